@@ -0,0 +1,871 @@
+/* fat16_bench.c - Host-built microbenchmark for the FAT16 filesystem and its sector I/O path
+ *
+ * Builds src/kernel/fat16.c (plus the VFS, tmpfs, CRC32C, LZ4, logfs, the copy-on-write
+ * overlay, the disk encryption layer and software RAID) for Linux on top of a
+ * RAM disk block device (default) or a file-backed disk and reports, per workload,
+ * ops/sec, sector reads and writes and disk commands per operation and
+ * latency percentiles.
+ *
+ * Usage: fat16_bench [-f disk.img] [-n ops]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fat16.h"
+#include "vfs.h"
+#include "tmpfs.h"
+#include "pcache.h"
+#include "crc32c.h"
+#include "lz4.h"
+#include "logfs.h"
+#include "cow.h"
+#include "aes.h"
+#include "crypt.h"
+#include "sha256.h"
+#include "raid.h"
+#include "ramdisk.h"
+
+/* ============================================================================
+   BACKING DISK
+   ============================================================================ */
+#define LOG_START TOTAL_SECTORS  // logfs region follows the FAT16 volume, as in the kernel
+#define LOG_SECTORS 1024
+#define COW_DELTA (LOG_START + LOG_SECTORS)  // Snapshot delta follows the log, as in the kernel
+
+#define CRYPT_HEADER (COW_DELTA + 1 + TOTAL_SECTORS)  // Encrypted volume header follows the delta, as in the kernel
+
+#define DISK_SECTORS (CRYPT_HEADER + 1)
+
+static uint8_t mem_disk[DISK_SECTORS * SECTOR_SIZE];  // RAM disk memory
+static ramdisk_t ram_disk;
+static int ram_dev = -1;                              // Block device id of the RAM disk
+static int disk_fd = -1;                              // File-backed disk if >= 0
+
+static uint64_t sectors_read = 0;     // Sector reads issued by the filesystem
+static uint64_t sectors_written = 0;  // Sector writes issued by the filesystem
+static uint64_t disk_commands = 0;    // Read/write/flush calls (one per multi-sector transfer)
+
+static int bench_disk_read_sectors(uint32_t lba, uint32_t count, void *buf) {
+    size_t bytes = (size_t)count * SECTOR_SIZE;
+    sectors_read += count;
+    disk_commands++;
+    if (disk_fd >= 0) {
+        return pread(disk_fd, buf, bytes, (off_t)lba * SECTOR_SIZE) == (ssize_t)bytes ? 0 : -1;
+    }
+    return blkdev_read(ram_dev, lba, count, buf);
+}
+
+static int bench_disk_write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+    size_t bytes = (size_t)count * SECTOR_SIZE;
+    sectors_written += count;
+    disk_commands++;
+    if (disk_fd >= 0) {
+        return pwrite(disk_fd, buf, bytes, (off_t)lba * SECTOR_SIZE) == (ssize_t)bytes ? 0 : -1;
+    }
+    return blkdev_write(ram_dev, lba, count, buf);
+}
+
+/* Discard: counted as a command; the RAM disk forgets the data like a thin image */
+static uint64_t sectors_discarded = 0;
+
+static int bench_disk_discard(uint32_t lba, uint32_t count) {
+    sectors_discarded += count;
+    disk_commands++;
+    return disk_fd < 0 ? blkdev_discard(ram_dev, lba, count) : 0;
+}
+
+static int bench_disk_read(uint32_t lba, void *buf) {
+    return bench_disk_read_sectors(lba, 1, buf);
+}
+
+static int bench_disk_write(uint32_t lba, const void *buf) {
+    return bench_disk_write_sectors(lba, 1, buf);
+}
+
+/* Cache flush: counted as a command (a real flush on the file-backed disk would dominate) */
+static int bench_disk_flush(void) {
+    disk_commands++;
+    return 0;
+}
+
+/* ============================================================================
+   TIMING AND REPORTING
+   ============================================================================ */
+#define MAX_OPS 4096
+
+static uint64_t lat_ns[MAX_OPS];  // Per-operation latency of the current workload
+static size_t lat_count = 0;
+static uint64_t run_start_ns, run_reads, run_writes, run_commands;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_begin(void) {
+    lat_count = 0;
+    run_reads = sectors_read;
+    run_writes = sectors_written;
+    run_commands = disk_commands;
+    run_start_ns = now_ns();
+}
+
+/* Time a single filesystem operation, returning its result. Sector counts include any
+   deferred cluster reclamation, which the kernel does in its idle loop */
+#define TIMED(expr) ({                                   \
+    uint64_t t0_ = now_ns();                             \
+    int r_ = (expr);                                     \
+    if (lat_count < MAX_OPS) lat_ns[lat_count++] = now_ns() - t0_; \
+    r_; })
+
+static uint64_t percentile(double p) {
+    size_t idx = (size_t)(p * (double)(lat_count - 1) + 0.5);
+    return lat_ns[idx];
+}
+
+static void run_end(const char *workload, size_t size, int fill_pct) {
+    uint64_t elapsed = now_ns() - run_start_ns;
+    if (lat_count == 0) {
+        printf("%-10s %7zu %4d%%  (no space for this workload)\n", workload, size, fill_pct);
+        return;
+    }
+    qsort(lat_ns, lat_count, sizeof(lat_ns[0]), cmp_u64);
+    double ops = (double)lat_count;
+    printf("%-10s %7zu %4d%% %6zu %11.0f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+           workload, size, fill_pct, lat_count,
+           ops / ((double)elapsed / 1e9),
+           (double)(sectors_read - run_reads) / ops,
+           (double)(sectors_written - run_writes) / ops,
+           (double)(disk_commands - run_commands) / ops,
+           (double)percentile(0.50) / 1e3,
+           (double)percentile(0.90) / 1e3,
+           (double)percentile(0.99) / 1e3);
+}
+
+/* Stop the run if a result is wrong: a fast cipher or checksum that gives the wrong answer is
+   not worth timing */
+static void expect(int ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "%s: wrong result\n", what);
+        exit(1);
+    }
+}
+
+/* ============================================================================
+   WORKLOADS
+   ============================================================================ */
+static uint8_t data[TOTAL_SECTORS * SECTOR_SIZE];    // Source data for writes
+static uint8_t readback[TOTAL_SECTORS * SECTOR_SIZE];  // Destination for reads
+
+static uint32_t clusters_for(size_t len) {
+    return (uint32_t)((len + SECTOR_SIZE - 1) / SECTOR_SIZE);
+}
+
+/* Format the disk and fill it to roughly fill_pct percent with 2KB filler files */
+static uint32_t prepare_volume(int fill_pct) {
+    fat16_init();
+    uint32_t total = fat16_data_clusters();
+    uint32_t target = total * (uint32_t)fill_pct / 100u;
+    uint32_t used = 0;
+    char name[20];  // Room for any int, so the name is never cut short
+    for (int i = 0; used + 4 <= target; ++i) {
+        snprintf(name, sizeof(name), "FILL%04d.DAT", i);
+        if (fat16_write_file(name, data, 4 * SECTOR_SIZE) != 0) break;
+        used += 4;
+    }
+    return total - used;  // Free clusters left for the workload
+}
+
+static void bench_size(size_t size, int fill_pct, size_t max_ops) {
+    char name[16];
+    uint32_t need = clusters_for(size);
+
+    /* create: write max_ops new files of this size */
+    uint32_t free_clusters = prepare_volume(fill_pct);
+    size_t n = need ? free_clusters / need : max_ops;
+    if (n > max_ops) n = max_ops;
+    run_begin();
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "B%07zu.DAT", i);
+        if (TIMED(fat16_write_file(name, data, size)) != 0) break;
+    }
+    run_end("create", size, fill_pct);
+
+    /* overwrite: rewrite the same file in place */
+    free_clusters = prepare_volume(fill_pct);
+    if (free_clusters >= 2 * need) {  // Old chain is only freed once the new one is written
+        fat16_write_file("OVER.DAT", data, size);
+        run_begin();
+        for (size_t i = 0; i < max_ops; ++i) {
+            TIMED(fat16_write_file("OVER.DAT", data, size));
+            fat16_sync();
+        }
+        run_end("overwrite", size, fill_pct);
+    } else {
+        run_begin();
+        run_end("overwrite", size, fill_pct);
+    }
+
+    /* append: grow a file by size bytes per operation through whole-file rewrites */
+    free_clusters = prepare_volume(fill_pct);
+    run_begin();
+    for (size_t len = size; len <= sizeof(data) && lat_count < max_ops; len += size) {
+        if (clusters_for(len) > free_clusters) break;
+        if (TIMED(fat16_write_file("APPEND.DAT", data, len)) != 0) break;
+        fat16_sync();
+    }
+    run_end("append", size, fill_pct);
+
+    /* delete: unlink files of this size (reclamation happens afterwards) */
+    free_clusters = prepare_volume(fill_pct);
+    n = need ? free_clusters / need : max_ops;
+    if (n > max_ops) n = max_ops;
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "D%07zu.DAT", i);
+        if (fat16_write_file(name, data, size) != 0) { n = i; break; }
+    }
+    run_begin();
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "D%07zu.DAT", i);
+        if (TIMED(fat16_unlink(name)) != 0) {
+            fprintf(stderr, "delete: unlink failed\n");
+            exit(1);
+        }
+        fat16_sync();
+    }
+    run_end("delete", size, fill_pct);
+
+    /* read-cold: read a file with an empty page cache (one command per run of clusters) */
+    free_clusters = prepare_volume(fill_pct);
+    if (free_clusters >= need) {
+        fat16_write_file("READ.DAT", data, size);
+        run_begin();
+        for (size_t i = 0; i < max_ops; ++i) {
+            pcache_init();
+            if (TIMED(fat16_read_file("READ.DAT", readback, sizeof(readback))) != (int)size) {
+                fprintf(stderr, "read-cold: short read\n");
+                exit(1);
+            }
+        }
+        run_end("read-cold", size, fill_pct);
+    }
+
+    /* read: read the same file back repeatedly (served from the page cache after the first) */
+    free_clusters = prepare_volume(fill_pct);
+    if (free_clusters >= need) {
+        fat16_write_file("READ.DAT", data, size);
+        run_begin();
+        for (size_t i = 0; i < max_ops; ++i) {
+            if (TIMED(fat16_read_file("READ.DAT", readback, sizeof(readback))) != (int)size) {
+                fprintf(stderr, "read: short read\n");
+                exit(1);
+            }
+        }
+        if (memcmp(readback, data, size) != 0) {
+            fprintf(stderr, "read: data mismatch\n");
+            exit(1);
+        }
+        run_end("read", size, fill_pct);
+    }
+}
+
+/* Same file rewritten in place and read back through the VFS: on FAT16 via the page
+   cache ("fat") or direct to disk ("dio"), or on tmpfs ("tmp"). Then the file must not be
+   deleted while it is open, and the descriptor must stop working when the volume is replaced */
+static void bench_vfs(const char *label, const char *path, int flags, size_t size, size_t max_ops) {
+    char workload[16];
+    prepare_volume(0);
+    tmpfs_init();
+    int fd = vfs_open(path, VFS_O_CREAT | flags);
+
+    snprintf(workload, sizeof(workload), "%s-write", label);
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        vfs_seek(fd, 0);
+        if (TIMED(vfs_write(fd, data, size)) != (int)size) break;
+        vfs_sync();  // Cached writes reach the disk here (counted, not timed)
+    }
+    run_end(workload, size, 0);
+
+    snprintf(workload, sizeof(workload), "%s-read", label);
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        vfs_seek(fd, 0);
+        if (TIMED(vfs_read(fd, readback, sizeof(readback))) != (int)size) {
+            fprintf(stderr, "%s: short read\n", workload);
+            exit(1);
+        }
+    }
+    if (memcmp(readback, data, size) != 0) {
+        fprintf(stderr, "%s: data mismatch\n", workload);
+        exit(1);
+    }
+    run_end(workload, size, 0);
+
+    // An open file keeps its inode: no unlink, and after the volume is replaced only close works
+    expect(vfs_unlink(path) != 0, "unlink of an open file");
+    vfs_invalidate(path);
+    expect(vfs_read(fd, readback, size) < 0 && vfs_close(fd) == 0 && vfs_unlink(path) == 0,
+           "stale descriptor");
+}
+
+/* Random single-sector direct reads across a large file fragmented into one-cluster
+   pieces (built by interleaving appends with a second file), so every read has to
+   translate a file offset deep into a long cluster chain */
+static void bench_seek(size_t max_ops) {
+    prepare_volume(0);
+    int fd = vfs_open("/SEEK.DAT", VFS_O_CREAT | VFS_O_DIRECT);
+    int gap = vfs_open("/GAP.DAT", VFS_O_CREAT | VFS_O_DIRECT);
+    uint32_t sectors = 0;
+    while (vfs_write(fd, data + (size_t)sectors * SECTOR_SIZE, SECTOR_SIZE) == SECTOR_SIZE &&
+           vfs_write(gap, data, SECTOR_SIZE) == SECTOR_SIZE) {
+        sectors++;
+    }
+    vfs_sync();
+
+    uint32_t seed = 1;
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t s = (seed >> 8) % sectors;
+        vfs_seek(fd, s * SECTOR_SIZE);
+        if (TIMED(vfs_read(fd, readback, SECTOR_SIZE)) != SECTOR_SIZE ||
+            memcmp(readback, data + (size_t)s * SECTOR_SIZE, SECTOR_SIZE) != 0) {
+            fprintf(stderr, "dio-seek: bad read\n");
+            exit(1);
+        }
+    }
+    run_end("dio-seek", (size_t)sectors * SECTOR_SIZE, 0);
+    vfs_close(gap);
+    vfs_close(fd);
+}
+
+/* Mounting a 90% full volume and verifying every metadata checksum */
+static void bench_mount(size_t max_ops) {
+    prepare_volume(90);
+    fat16_sync();  // Checksum table on disk
+    fat16_check_stats_t st;
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        if (TIMED(fat16_mount() == 0 ? fat16_check(&st) : -1) != 0) {
+            fprintf(stderr, "mount-check: volume not clean\n");
+            exit(1);
+        }
+    }
+    run_end("mount-chk", (size_t)st.checked * SECTOR_SIZE, 90);
+}
+
+/* Files created and deleted with no fat16_sync or idle writeback afterwards, as if the
+   machine went down, then the volume remounted: the table is still marked open, so the
+   mount takes the sectors written since and the check must find the volume clean. The
+   volume starts empty so no write runs out of space, which would sync on its own. Once the
+   volume is closed cleanly, a damaged directory sector must be caught again and refused */
+static void bench_unsynced(size_t max_ops) {
+    char name[16];
+    prepare_volume(0);
+    fat16_sync();
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        snprintf(name, sizeof(name), "U%07zu.DAT", i);
+        if (TIMED(fat16_write_file(name, data, 4096)) != 0) break;
+        if (i % 2) fat16_unlink(name);
+    }
+    fat16_check_stats_t st;
+    if (fat16_mount() != 0 || fat16_check(&st) != 0) {
+        fprintf(stderr, "unsynced: volume not clean after remount\n");
+        exit(1);
+    }
+    run_end("unsynced", 4096, 0);
+
+    uint8_t sec[SECTOR_SIZE];
+    fat16_sync();
+    for (uint32_t lba = 1; lba < 64; ++lba) {  // The root directory sector with the first file
+        bench_disk_read(lba, sec);
+        if (memcmp(sec, "U0000000DAT", 11) != 0) continue;
+        sec[0] ^= 0x20;
+        bench_disk_write(lba, sec);
+        break;
+    }
+    if (fat16_mount() != 0 || fat16_check(&st) == 0) {
+        fprintf(stderr, "unsynced: damaged directory not caught\n");
+        exit(1);
+    }
+    // Nothing may be looked up in or added next to the damaged sector: the name could be there
+    expect(fat16_lookup("U0000000.DAT") < 0 && fat16_write_file("U0000000.DAT", data, 4096) != 0 &&
+           fat16_create("NEW.DAT") < 0, "unsynced: damaged directory sector used");
+}
+
+/* Checksum throughput over 64 sectors per op, with the crc32 instruction and with the table,
+   after checking both against the standard check value and each other */
+static void bench_crc(size_t max_ops) {
+    static const size_t bytes = 64 * SECTOR_SIZE;
+    volatile uint32_t sink = 0;
+    expect(crc32c(0, "123456789", 9) == 0xE3069283 && crc32c_sw(0, "123456789", 9) == 0xE3069283,
+           "crc32c check value");
+    for (size_t len = 0; len < 64; ++len) {  // Every tail length and alignment the hardware path splits off
+        expect(crc32c(0, data + len, bytes - 2 * len) == crc32c_sw(0, data + len, bytes - 2 * len),
+               "crc32c hardware and software differ");
+    }
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) TIMED((sink += crc32c(0, data, bytes), 0));
+    run_end(crc32c_hw() ? "crc-hw" : "crc-none", bytes, 0);
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) TIMED((sink += crc32c_sw(0, data, bytes), 0));
+    run_end("crc-sw", bytes, 0);
+    (void)sink;
+}
+
+/* A 64KB text-like file saved and read back cold, stored plain ("raw") and with
+   compression ("lz4"): fewer sectors cross the bus for the same file. A hand-made block and
+   a round trip of the text check the codec first */
+static void bench_lz4(size_t max_ops) {
+    static const char *words[] = { "the ", "kernel ", "sector ", "cluster ", "file ", "of ", "and ",
+                                   "page ", "a ", "disk ", "to ", "is ", "write ", "read ", "\n" };
+    static uint8_t text[64 * 1024];
+    uint32_t seed = 7;
+    for (size_t i = 0; i < sizeof(text);) {
+        seed = seed * 1103515245u + 12345u;
+        for (const char *w = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))]; *w && i < sizeof(text); ++w) {
+            text[i++] = (uint8_t)*w;
+        }
+    }
+
+    // "abc", a 7-byte match 3 back, then the 5 literals every block has to end with
+    static const uint8_t block[] = { 0x33, 'a', 'b', 'c', 3, 0, 0x50, 'b', 'c', 'a', 'b', 'c' };
+    static uint8_t packed[LZ4_BOUND(LZ4_MAX_INPUT)];
+    expect(lz4_decompress(block, sizeof(block), readback, sizeof(readback)) == 15 &&
+           memcmp(readback, "abcabcabcabcabc", 15) == 0, "lz4 known block");
+    size_t n = lz4_compress(text, LZ4_MAX_INPUT, packed, sizeof(packed));
+    expect(n > 0 && lz4_decompress(packed, n, readback, sizeof(readback)) == LZ4_MAX_INPUT &&
+           memcmp(readback, text, LZ4_MAX_INPUT) == 0, "lz4 round trip");
+
+    for (int lz4 = 0; lz4 <= 1; ++lz4) {
+        char workload[16];
+        prepare_volume(0);
+        fat16_set_compression(lz4);
+
+        snprintf(workload, sizeof(workload), "save-%s", lz4 ? "lz4" : "raw");
+        run_begin();
+        for (size_t i = 0; i < max_ops; ++i) {
+            if (TIMED(fat16_write_file("TEXT.TXT", text, sizeof(text))) != 0) break;
+            fat16_sync();
+        }
+        run_end(workload, sizeof(text), 0);
+
+        snprintf(workload, sizeof(workload), "cold-%s", lz4 ? "lz4" : "raw");
+        run_begin();
+        for (size_t i = 0; i < max_ops; ++i) {
+            pcache_init();
+            if (TIMED(fat16_read_file("TEXT.TXT", readback, sizeof(readback))) != (int)sizeof(text) ||
+                memcmp(readback, text, sizeof(text)) != 0) {
+                fprintf(stderr, "%s: bad read\n", workload);
+                exit(1);
+            }
+        }
+        run_end(workload, sizeof(text), 0);
+    }
+    fat16_set_compression(0);
+}
+
+/* Format the log and fill it to roughly fill_pct percent of what it can hold with 8KB files */
+static void prepare_log(int fill_pct) {
+    char name[16];
+    int fit = 0;
+    logfs_format(LOG_START, LOG_SECTORS);
+    for (; fit < LOGFS_MAX_FILES - 1; ++fit) {
+        snprintf(name, sizeof(name), "fill%02d", fit);
+        if (logfs_vfs_ops.replace(NULL, name, data, 8192) != 0) break;
+    }
+    logfs_format(LOG_START, LOG_SECTORS);
+    for (int i = 0; i < fit * fill_pct / 100; ++i) {
+        snprintf(name, sizeof(name), "fill%02d", i);
+        logfs_vfs_ops.replace(NULL, name, data, 8192);
+    }
+    logfs_sync();
+}
+
+/* The same save as "overwrite" on the log-structured filesystem ("log-save"): one sequential
+   write per save, and once the log wraps, the cleaning needed to make room. Then mounting
+   from the checkpoint ("log-mount") */
+static void bench_logfs(size_t max_ops) {
+    static const size_t sizes[] = { 512, 4096, 16384 };
+    static const int fills[] = { 0, 50 };
+
+    for (size_t f = 0; f < sizeof(fills) / sizeof(fills[0]); ++f) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            prepare_log(fills[f]);
+            run_begin();
+            for (size_t i = 0; i < max_ops; ++i) {
+                if (TIMED(logfs_vfs_ops.replace(NULL, "save", data, sizes[s])) != 0) break;
+                logfs_sync();
+            }
+            run_end("log-save", sizes[s], fills[f]);
+        }
+    }
+
+    prepare_log(90);
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        pcache_init();
+        if (TIMED(logfs_mount(LOG_START, LOG_SECTORS)) != 0) {
+            fprintf(stderr, "log-mount: no checkpoint\n");
+            exit(1);
+        }
+    }
+    run_end("log-mount", (size_t)LOG_SECTORS * SECTOR_SIZE, 90);
+}
+
+/* The FAT16 volume through the copy-on-write overlay: taking a snapshot of a half-full
+   volume ("cow-snap", each followed by an empty rollback), the same overwrite as above with
+   a snapshot active ("cow-over"), and discarding everything that wrote ("cow-back") */
+static void bench_cow(const fat16_callbacks_t *direct, size_t max_ops) {
+    fat16_callbacks_t overlay = {
+        .disk_read = cow_read_sector,
+        .disk_write = cow_write_sector,
+        .disk_read_sectors = cow_read_sectors,
+        .disk_write_sectors = cow_write_sectors,
+        .disk_flush = cow_flush
+    };
+    cow_callbacks_t cb = {
+        .disk_read_sectors = bench_disk_read_sectors,
+        .disk_write_sectors = bench_disk_write_sectors,
+        .disk_flush = bench_disk_flush
+    };
+    cow_set_callbacks(&cb);
+    if (cow_init(0, TOTAL_SECTORS, COW_DELTA) != 0) {
+        fprintf(stderr, "cow: disk too small\n");
+        exit(1);
+    }
+    if (cow_active()) cow_rollback();  // Left over in a disk image from an earlier run
+    fat16_set_callbacks(&overlay);
+    prepare_volume(50);
+    fat16_write_file("OVER.DAT", data, 4096);
+    fat16_sync();
+
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        TIMED(cow_snapshot());
+        cow_rollback();
+    }
+    run_end("cow-snap", 0, 50);
+
+    cow_snapshot();
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        TIMED(fat16_write_file("OVER.DAT", data, 4096));
+        fat16_sync();
+    }
+    run_end("cow-over", 4096, 50);
+
+    size_t delta = (size_t)cow_delta_sectors() * SECTOR_SIZE;
+    run_begin();
+    if (TIMED(cow_rollback() == 0 ? fat16_mount() : -1) != 0) {
+        fprintf(stderr, "cow-back: volume lost\n");
+        exit(1);
+    }
+    run_end("cow-back", delta, 50);
+    fat16_set_callbacks(direct);
+}
+
+static int crypt_read_sector(uint32_t lba, void *buf) {
+    return crypt_read_sectors(lba, 1, buf);
+}
+
+static int crypt_write_sector(uint32_t lba, const void *buf) {
+    return crypt_write_sectors(lba, 1, buf);
+}
+
+/* Cipher throughput over one sector (32 blocks) per op, with AES-NI and in software, then
+   the 4KB overwrite from cow-over with every sector going through XTS ("crypt-over"). Both
+   ciphers are checked against the FIPS-197 and IEEE 1619 vectors and each other first, and
+   the passphrase KDF against RFC 7914 */
+static void bench_crypt(const fat16_callbacks_t *direct, size_t max_ops) {
+    static const uint8_t raw[CRYPT_KEY_BYTES] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                                  17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32 };
+    static uint8_t sector[SECTOR_SIZE], copy[SECTOR_SIZE];
+    aes128_key_t key;
+
+    // FIPS-197 appendix C.1
+    static const uint8_t fips_key[AES_BLOCK] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                                 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+    static const uint8_t fips_plain[AES_BLOCK] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                                                   0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    static const uint8_t fips_cipher[AES_BLOCK] = { 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+                                                    0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+    uint8_t block[AES_BLOCK];
+    aes128_set_key(&key, fips_key);
+    memcpy(block, fips_plain, AES_BLOCK);
+    aes128_encrypt_blocks(&key, block, 1);
+    expect(memcmp(block, fips_cipher, AES_BLOCK) == 0, "aes encrypt");
+    aes128_decrypt_blocks(&key, block, 1);
+    expect(memcmp(block, fips_plain, AES_BLOCK) == 0, "aes decrypt");
+    memcpy(block, fips_plain, AES_BLOCK);
+    aes128_encrypt_blocks_sw(&key, block, 1);
+    expect(memcmp(block, fips_cipher, AES_BLOCK) == 0, "aes-sw encrypt");
+    aes128_decrypt_blocks_sw(&key, block, 1);
+    expect(memcmp(block, fips_plain, AES_BLOCK) == 0, "aes-sw decrypt");
+
+    // Hardware and software on a whole sector: the hardware path works on several blocks at once
+    aes128_set_key(&key, raw);
+    memcpy(sector, data, SECTOR_SIZE);
+    memcpy(copy, data, SECTOR_SIZE);
+    aes128_encrypt_blocks(&key, sector, SECTOR_SIZE / AES_BLOCK);
+    aes128_encrypt_blocks_sw(&key, copy, SECTOR_SIZE / AES_BLOCK);
+    expect(memcmp(sector, copy, SECTOR_SIZE) == 0, "aes hardware and software encrypt differ");
+    aes128_decrypt_blocks(&key, sector, SECTOR_SIZE / AES_BLOCK);
+    aes128_decrypt_blocks_sw(&key, copy, SECTOR_SIZE / AES_BLOCK);
+    expect(memcmp(sector, data, SECTOR_SIZE) == 0 && memcmp(copy, data, SECTOR_SIZE) == 0,
+           "aes hardware and software decrypt differ");
+
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) TIMED((aes128_encrypt_blocks(&key, sector, SECTOR_SIZE / AES_BLOCK), 0));
+    run_end(aes_hw() ? "aes-hw" : "aes-none", SECTOR_SIZE, 0);
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) TIMED((aes128_encrypt_blocks_sw(&key, sector, SECTOR_SIZE / AES_BLOCK), 0));
+    run_end("aes-sw", SECTOR_SIZE, 0);
+
+    fat16_callbacks_t encrypted = {
+        .disk_read = crypt_read_sector,
+        .disk_write = crypt_write_sector,
+        .disk_read_sectors = crypt_read_sectors,
+        .disk_write_sectors = crypt_write_sectors,
+        .disk_flush = crypt_flush
+    };
+    crypt_callbacks_t cb = {
+        .disk_read_sectors = bench_disk_read_sectors,
+        .disk_write_sectors = bench_disk_write_sectors,
+        .disk_flush = bench_disk_flush
+    };
+    crypt_set_callbacks(&cb);
+
+    // IEEE 1619 XTS-AES-128 vector 1 (both keys zero, sector 0): blocks do not depend on
+    // each other, so the first 32 bytes of a zero sector are the vector's ciphertext
+    static const uint8_t xts_key[CRYPT_KEY_BYTES];
+    static const uint8_t xts_cipher[32] = { 0x91, 0x7c, 0xf6, 0x9e, 0xbd, 0x68, 0xb2, 0xec,
+                                            0x9b, 0x9f, 0xe9, 0xa3, 0xea, 0xdd, 0xa6, 0x92,
+                                            0xcd, 0x43, 0xd2, 0xf5, 0x95, 0x98, 0xed, 0x85,
+                                            0x8c, 0x02, 0xc2, 0x65, 0x2f, 0xbf, 0x92, 0x2e };
+    crypt_set_key(xts_key);
+    memset(sector, 0, SECTOR_SIZE);
+    expect(crypt_write_sectors(0, 1, sector) == 0 && bench_disk_read_sectors(0, 1, copy) == 0 &&
+           memcmp(copy, xts_cipher, sizeof(xts_cipher)) == 0, "xts encrypt");
+    expect(crypt_read_sectors(0, 1, copy) == 0 && memcmp(copy, sector, SECTOR_SIZE) == 0, "xts decrypt");
+
+    // RFC 7914 section 11, then a passphrase that makes a volume header, opens it again and
+    // refuses a wrong one
+    static const uint8_t pbkdf2_out[64] = {
+        0x55, 0xac, 0x04, 0x6e, 0x56, 0xe3, 0x08, 0x9f, 0xec, 0x16, 0x91, 0xc2, 0x25, 0x44, 0xb6, 0x05,
+        0xf9, 0x41, 0x85, 0x21, 0x6d, 0xde, 0x04, 0x65, 0xe6, 0x8b, 0x9d, 0x57, 0xc2, 0x0d, 0xac, 0xbc,
+        0x49, 0xca, 0x9c, 0xcc, 0xf1, 0x79, 0xb6, 0x45, 0x99, 0x16, 0x64, 0xb3, 0x9d, 0x77, 0xef, 0x31,
+        0x7c, 0x71, 0xb8, 0x45, 0xb1, 0xe3, 0x0b, 0xd5, 0x09, 0x11, 0x20, 0x41, 0xd3, 0xa1, 0x97, 0x83 };
+    uint8_t derived[sizeof(pbkdf2_out)];
+    pbkdf2_sha256("passwd", 6, "salt", 4, 1, derived, sizeof(derived));
+    expect(memcmp(derived, pbkdf2_out, sizeof(derived)) == 0, "pbkdf2-sha256");
+    static const uint8_t salt[CRYPT_SALT_BYTES] = { 0x5a };
+    memset(sector, 0, SECTOR_SIZE);
+    bench_disk_write_sectors(CRYPT_HEADER, 1, sector);
+    expect(crypt_set_passphrase("bench", CRYPT_HEADER, salt) == 0 &&
+           crypt_set_passphrase("bench", CRYPT_HEADER, salt) == 0 &&
+           crypt_set_passphrase("bench!", CRYPT_HEADER, salt) != 0, "passphrase check");
+
+    crypt_set_key(raw);
+    fat16_set_callbacks(&encrypted);
+    prepare_volume(50);
+    fat16_write_file("OVER.DAT", data, 4096);
+    fat16_sync();
+    run_begin();
+    for (size_t i = 0; i < max_ops; ++i) {
+        TIMED(fat16_write_file("OVER.DAT", data, 4096));
+        fat16_sync();
+    }
+    run_end("crypt-over", 4096, 50);
+    fat16_set_callbacks(direct);
+}
+
+/* RAID members are two halves of the backing disk; commands finish as they are submitted */
+#define RAID_MEMBER_SECTORS (DISK_SECTORS / 2)
+static int raid_result[2];
+static int raid_broken = -1;  // Member whose writes fail, -1 for none
+
+static int bench_raid_submit(int dev, int write, uint32_t lba, uint32_t count, void *buf) {
+    if (lba + count > RAID_MEMBER_SECTORS) return -1;
+    if (write && dev == raid_broken) {
+        raid_result[dev] = -1;
+        return 0;
+    }
+    uint32_t at = (uint32_t)dev * RAID_MEMBER_SECTORS + lba;
+    raid_result[dev] = write ? bench_disk_write_sectors(at, count, buf) : bench_disk_read_sectors(at, count, buf);
+    return 0;
+}
+
+static int bench_raid_complete(int dev) {
+    return raid_result[dev];
+}
+
+static int bench_raid_flush(int dev) {
+    return dev == 0 ? bench_disk_flush() : 0;  // One backing disk
+}
+
+static int raid_read_sector(uint32_t lba, void *buf) {
+    return raid_read_sectors(lba, 1, buf);
+}
+
+static int raid_write_sector(uint32_t lba, const void *buf) {
+    return raid_write_sectors(lba, 1, buf);
+}
+
+/* A 64KB file saved and read back cold on a two-disk RAID-0 (16-sector stripes) and
+   RAID-1: io/op counts commands across both members */
+static void bench_raid(const fat16_callbacks_t *direct, size_t max_ops) {
+    static const size_t size = 64 * 1024;
+    static const int devs[2] = { 0, 1 };
+    static const uint32_t sizes[2] = { RAID_MEMBER_SECTORS, RAID_MEMBER_SECTORS };
+    fat16_callbacks_t volume = {
+        .disk_read = raid_read_sector,
+        .disk_write = raid_write_sector,
+        .disk_read_sectors = raid_read_sectors,
+        .disk_write_sectors = raid_write_sectors,
+        .disk_flush = raid_flush
+    };
+    raid_callbacks_t cb = {
+        .submit = bench_raid_submit,
+        .complete = bench_raid_complete,
+        .flush = bench_raid_flush
+    };
+    raid_set_callbacks(&cb);
+    for (int level = 0; level <= 1; ++level) {
+        char workload[16];
+        raid_init(level, devs, sizes, 2, RAID_DEFAULT_STRIPE);
+        fat16_set_callbacks(&volume);
+        prepare_volume(0);
+
+        snprintf(workload, sizeof(workload), "raid%d-save", level);
+        run_begin();
+        for (size_t i = 0; i < max_ops; ++i) {
+            TIMED(fat16_write_file("RAID.DAT", data, size));
+            fat16_sync();
+        }
+        run_end(workload, size, 0);
+
+        snprintf(workload, sizeof(workload), "raid%d-cold", level);
+        run_begin();
+        for (size_t i = 0; i < max_ops; ++i) {
+            pcache_init();
+            if (TIMED(fat16_read_file("RAID.DAT", readback, sizeof(readback))) != (int)size ||
+                memcmp(readback, data, size) != 0) {
+                fprintf(stderr, "%s: bad read\n", workload);
+                exit(1);
+            }
+        }
+        run_end(workload, size, 0);
+    }
+
+    // A mirror whose writes fail is dropped; after reassembly ("reboot") it must stay out
+    // and reads must return the data written while it was gone, until it is resynced
+    raid_member_stats_t st;
+    raid_broken = 1;
+    fat16_write_file("RAID.DAT", data + SECTOR_SIZE, size);
+    fat16_sync();
+    raid_broken = -1;
+    raid_init(1, devs, sizes, 2, RAID_DEFAULT_STRIPE);
+    raid_member_stats(1, &st);
+    pcache_init();
+    if (!st.failed || fat16_read_file("RAID.DAT", readback, sizeof(readback)) != (int)size ||
+        memcmp(readback, data + SECTOR_SIZE, size) != 0) {
+        fprintf(stderr, "raid1: stale mirror used after reassembly\n");
+        exit(1);
+    }
+    int resynced = raid_resync() == 0 && raid_init(1, devs, sizes, 2, RAID_DEFAULT_STRIPE) == 0;
+    raid_member_stats(1, &st);
+    if (!resynced || st.failed) {
+        fprintf(stderr, "raid1: resync did not bring the mirror back\n");
+        exit(1);
+    }
+    fat16_set_callbacks(direct);
+}
+
+int main(int argc, char **argv) {
+    size_t max_ops = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+        if (opt == 'f') {
+            disk_fd = open(optarg, O_RDWR | O_CREAT, 0644);
+            if (disk_fd < 0 || ftruncate(disk_fd, (off_t)sizeof(mem_disk)) != 0) {
+                perror(optarg);
+                return 1;
+            }
+        } else if (opt == 'n') {
+            max_ops = (size_t)strtoul(optarg, NULL, 0);
+            if (max_ops == 0 || max_ops > MAX_OPS) max_ops = MAX_OPS;
+        } else {
+            fprintf(stderr, "usage: %s [-f disk.img] [-n ops]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(data); ++i) data[i] = (uint8_t)(i * 131u + (i >> 9));
+    ram_dev = ramdisk_create(&ram_disk, "ram0", mem_disk, DISK_SECTORS);
+    blkdev_set_timing(0);  // Two time stamp reads per request would be a large share of a RAM disk access
+
+    fat16_callbacks_t cb = {
+        .disk_read = bench_disk_read,
+        .disk_write = bench_disk_write,
+        .disk_read_sectors = bench_disk_read_sectors,
+        .disk_write_sectors = bench_disk_write_sectors,
+        .disk_flush = bench_disk_flush,
+        .disk_discard = bench_disk_discard
+    };
+    fat16_set_callbacks(&cb);
+    logfs_callbacks_t log_cb = {
+        .disk_read_sectors = bench_disk_read_sectors,
+        .disk_write_sectors = bench_disk_write_sectors,
+        .disk_flush = bench_disk_flush
+    };
+    logfs_set_callbacks(&log_cb);
+    vfs_mount("/", &fat16_vfs_ops, NULL, 0);
+    vfs_mount("/tmp", &tmpfs_vfs_ops, NULL, 0);
+
+    static const size_t sizes[] = { 512, 4096, 16384 };
+    static const int fills[] = { 0, 50, 90 };
+
+    printf("%s disk, %u sectors, up to %zu ops per workload\n",
+           disk_fd >= 0 ? "file-backed" : "RAM", TOTAL_SECTORS, max_ops);
+    printf("%-10s %7s %5s %6s %11s %9s %9s %9s %9s %9s %9s\n",
+           "workload", "bytes", "fill", "ops", "ops/sec", "rd/op", "wr/op", "io/op",
+           "p50(us)", "p90(us)", "p99(us)");
+    for (size_t f = 0; f < sizeof(fills) / sizeof(fills[0]); ++f) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            bench_size(sizes[s], fills[f], max_ops);
+        }
+    }
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        bench_vfs("fat", "/BENCH.DAT", 0, sizes[s], max_ops);
+        bench_vfs("dio", "/BENCH.DAT", VFS_O_DIRECT, sizes[s], max_ops);
+        bench_vfs("tmp", "/tmp/bench.dat", 0, sizes[s], max_ops);
+    }
+    bench_seek(max_ops);
+    bench_mount(max_ops);
+    bench_unsynced(max_ops);
+    bench_crc(max_ops);
+    bench_lz4(max_ops);
+    bench_logfs(max_ops);
+    bench_cow(&cb, max_ops);
+    bench_crypt(&cb, max_ops);
+    bench_raid(&cb, max_ops);
+
+    printf("%llu sectors discarded\n", (unsigned long long)sectors_discarded);
+    if (disk_fd >= 0) close(disk_fd);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/* acpi.c - ACPI table lookup
+ *
+ * The RSDP points at the root table: the RSDT with 32-bit table addresses, or
+ * on ACPI 2.0 and later the XSDT with 64-bit ones. Each entry is the physical
+ * address of a description table, found here by its signature. Tables are
+ * only read, and only after their checksum proves them whole.
+ */
+#include "acpi.h"
+
+#define BIOS_AREA_START 0xE0000   // The RSDP sits on a 16-byte boundary in the BIOS ROM area
+#define BIOS_AREA_END   0x100000
+
+typedef struct {
+    char signature[8];     // "RSD PTR "
+    uint8_t checksum;      // First 20 bytes add up to 0
+    char oem_id[6];
+    uint8_t revision;      // 0 for ACPI 1.0, 2 for 2.0 and later
+    uint32_t rsdt;
+    uint32_t length;       // From here on ACPI 2.0 only: whole structure
+    uint64_t xsdt;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+static acpi_callbacks_t callbacks;
+static const acpi_header_t *root = 0;  // RSDT or XSDT
+static int wide = 0;                   // Flag: root is the XSDT (8-byte entries)
+
+void acpi_set_callbacks(const acpi_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+static int checksum_ok(const void *p, size_t len) {
+    const uint8_t *b = (const uint8_t *)p;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; ++i) sum += b[i];
+    return sum == 0;
+}
+
+static int sig_equal(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+/* Map the table at phys, first its header and then all of it. NULL if it is not whole */
+static const acpi_header_t *map_table(uint64_t phys) {
+    if (!phys || !callbacks.map) return 0;
+    const acpi_header_t *h = (const acpi_header_t *)callbacks.map(phys, sizeof(acpi_header_t));
+    if (!h || h->length < sizeof(acpi_header_t)) return 0;
+    h = (const acpi_header_t *)callbacks.map(phys, h->length);
+    return h && checksum_ok(h, h->length) ? h : 0;
+}
+
+static const acpi_rsdp_t *find_rsdp(void) {
+    const uint8_t *area = callbacks.map ? (const uint8_t *)callbacks.map(BIOS_AREA_START, BIOS_AREA_END - BIOS_AREA_START) : 0;
+    if (!area) return 0;
+    for (size_t off = 0; off + 20 <= BIOS_AREA_END - BIOS_AREA_START; off += 16) {
+        if (sig_equal((const char *)area + off, "RSD PTR ", 8) && checksum_ok(area + off, 20)) {
+            return (const acpi_rsdp_t *)(area + off);
+        }
+    }
+    return 0;
+}
+
+int acpi_init(const void *rsdp_copy) {
+    const acpi_rsdp_t *rsdp = rsdp_copy ? (const acpi_rsdp_t *)rsdp_copy : find_rsdp();
+    root = 0;
+    if (!rsdp || !sig_equal(rsdp->signature, "RSD PTR ", 8) || !checksum_ok(rsdp, 20)) return -1;
+
+    if (rsdp->revision >= 2 && rsdp->xsdt && checksum_ok(rsdp, sizeof(acpi_rsdp_t))) {
+        root = map_table(rsdp->xsdt);
+        wide = 1;
+    }
+    if (!root) {
+        root = map_table(rsdp->rsdt);
+        wide = 0;
+    }
+    return root ? 0 : -1;
+}
+
+const acpi_header_t *acpi_find(const char *signature) {
+    if (!root) return 0;
+    size_t size = wide ? 8 : 4;
+    size_t n = (root->length - sizeof(acpi_header_t)) / size;
+    const uint8_t *entries = (const uint8_t *)root + sizeof(acpi_header_t);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t phys = 0;
+        for (size_t k = 0; k < size; ++k) phys |= (uint64_t)entries[i * size + k] << (8 * k);  // Entries are unaligned
+        const acpi_header_t *h = map_table(phys);
+        if (h && sig_equal(h->signature, signature, 4)) return h;
+    }
+    return 0;
+}
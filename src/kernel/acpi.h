@@ -0,0 +1,37 @@
+/* acpi.h - ACPI tables: find the firmware's description tables by signature */
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Header every description table starts with */
+typedef struct {
+    char signature[4];     // "SRAT", "SLIT", "APIC", ...
+    uint32_t length;       // Whole table, header included
+    uint8_t revision;
+    uint8_t checksum;      // All bytes of the table add up to 0
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+/* Callbacks - must be provided by kernel */
+typedef struct {
+    const void *(*map)(uint64_t phys, size_t len);  // Make firmware memory readable, NULL on failure
+} acpi_callbacks_t;
+
+/* Set the callbacks that the table lookup will use */
+void acpi_set_callbacks(const acpi_callbacks_t *callbacks);
+
+/* Read the root table from the RSDP (GRUB's copy, or NULL to search the BIOS area for it).
+   Returns 0, or -1 if there is no valid ACPI root */
+int acpi_init(const void *rsdp);
+
+/* First table with the given 4-character signature whose checksum is right, NULL if there
+   is none */
+const acpi_header_t *acpi_find(const char *signature);
+
+#endif
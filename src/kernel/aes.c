@@ -0,0 +1,307 @@
+/* aes.c - AES-128 block cipher
+ *
+ * With AES-NI each round is one aesenc/aesdec instruction. They take several
+ * cycles but can start every cycle, so four blocks go through the rounds
+ * side by side. Without it, the cipher runs in constant time: no table is
+ * indexed by data or key bytes. The S-box is computed as the GF(2^8) inverse
+ * (x^254) followed by the affine map, bitsliced over 64 bytes at once (four
+ * blocks): bit k of every byte goes into word k, and field multiplication
+ * becomes AND/XOR on whole words. MixColumns works on a column per 32-bit word.
+ */
+#include "aes.h"
+#include "kstring.h"
+
+/* ============================================================================
+   CPU SUPPORT
+   ============================================================================ */
+
+static int hw_state = -1;  // -1 until CPUID has been asked, then 0 or 1
+
+int aes_hw(void) {
+    if (hw_state < 0) {
+        uint32_t eax = 1, ebx, ecx, edx;
+        __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+        hw_state = (ecx >> 25) & 1;  // CPUID.1:ECX bit 25 = AES-NI
+    }
+    return hw_state;
+}
+
+/* ============================================================================
+   SOFTWARE AES (CONSTANT TIME)
+   ============================================================================ */
+
+#define SW_BATCH 4  // Blocks per bitsliced S-box pass (64 bytes: one bit of each in a word)
+
+/* Transpose an 8x8 bit matrix with one row per byte: bit c of byte r goes to bit r of byte c */
+static uint64_t transpose8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+/* Transpose an 8x8 byte matrix with one row per word: byte c of w[r] goes to byte r of w[c] */
+static void transpose_bytes(uint64_t w[8]) {
+    for (int i = 0; i < 4; ++i) {
+        uint64_t t = ((w[i] >> 32) ^ w[i + 4]) & 0x00000000FFFFFFFFull;
+        w[i] ^= t << 32;
+        w[i + 4] ^= t;
+    }
+    for (int i = 0; i < 8; i += (i & 1) ? 3 : 1) {  // 0, 1, 4, 5
+        uint64_t t = ((w[i] >> 16) ^ w[i + 2]) & 0x0000FFFF0000FFFFull;
+        w[i] ^= t << 16;
+        w[i + 2] ^= t;
+    }
+    for (int i = 0; i < 8; i += 2) {
+        uint64_t t = ((w[i] >> 8) ^ w[i + 1]) & 0x00FF00FF00FF00FFull;
+        w[i] ^= t << 8;
+        w[i + 1] ^= t;
+    }
+}
+
+/* Bitsliced GF(2^8) arithmetic: a[k] holds bit k of 64 field elements. Products are reduced
+   with x^8 = x^4 + x^3 + x + 1 */
+static void gf_reduce(uint64_t p[15], uint64_t r[8]) {
+    for (int k = 14; k >= 8; --k) {
+        p[k - 4] ^= p[k];
+        p[k - 5] ^= p[k];
+        p[k - 7] ^= p[k];
+        p[k - 8] ^= p[k];
+    }
+    for (int k = 0; k < 8; ++k) r[k] = p[k];
+}
+
+static void gf_mul(uint64_t r[8], const uint64_t a[8], const uint64_t b[8]) {
+    uint64_t p[15] = { 0 };
+    for (int i = 0; i < 8; ++i) {
+        for (int j = 0; j < 8; ++j) p[i + j] ^= a[i] & b[j];
+    }
+    gf_reduce(p, r);
+}
+
+static void gf_square(uint64_t r[8], const uint64_t a[8]) {
+    uint64_t p[15] = { 0 };
+    for (int i = 0; i < 8; ++i) p[2 * i] = a[i];  // Squaring is linear in GF(2^8)
+    gf_reduce(p, r);
+}
+
+/* x^254: the inverse of x, and 0 for 0 */
+static void gf_invert(uint64_t x[8]) {
+    uint64_t x2[8], x3[8], x12[8], x14[8], t[8];
+    gf_square(x2, x);
+    gf_mul(x3, x2, x);
+    gf_square(t, x3);        // x^6
+    gf_square(x12, t);
+    gf_mul(x14, x12, x2);
+    gf_mul(t, x12, x3);      // x^15
+    gf_square(t, t);         // x^30
+    gf_square(t, t);         // x^60
+    gf_square(t, t);         // x^120
+    gf_square(t, t);         // x^240
+    gf_mul(x, t, x14);
+}
+
+/* SubBytes (or InvSubBytes) on 64 bytes */
+static void sub_bytes64(uint8_t *b, int inverse) {
+    uint64_t w[8], a[8];
+    kmemcpy(w, b, sizeof(w));
+    for (int i = 0; i < 8; ++i) w[i] = transpose8(w[i]);
+    transpose_bytes(w);  // w[k] now holds bit k of every byte
+
+    if (!inverse) {
+        gf_invert(w);
+        for (int i = 0; i < 8; ++i) {
+            a[i] = w[i] ^ w[(i + 4) % 8] ^ w[(i + 5) % 8] ^ w[(i + 6) % 8] ^ w[(i + 7) % 8];
+            if ((0x63 >> i) & 1) a[i] = ~a[i];
+        }
+    } else {
+        for (int i = 0; i < 8; ++i) {
+            a[i] = w[(i + 2) % 8] ^ w[(i + 5) % 8] ^ w[(i + 7) % 8];
+            if ((0x05 >> i) & 1) a[i] = ~a[i];
+        }
+        gf_invert(a);
+    }
+
+    transpose_bytes(a);
+    for (int i = 0; i < 8; ++i) a[i] = transpose8(a[i]);
+    kmemcpy(b, a, sizeof(a));
+}
+
+/* Blocks are column-major: byte r + 4c is row r of column c */
+static void shift_rows(uint8_t *s, int inverse) {
+    uint8_t t[AES_BLOCK];
+    kmemcpy(t, s, AES_BLOCK);
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 1; r < 4; ++r) {
+            if (inverse) s[r + 4 * ((c + r) % 4)] = t[r + 4 * c];
+            else s[r + 4 * c] = t[r + 4 * ((c + r) % 4)];
+        }
+    }
+}
+
+/* Double every byte of a word in GF(2^8) */
+static uint32_t xtime4(uint32_t x) {
+    return ((x & 0x7F7F7F7Fu) << 1) ^ (((x >> 7) & 0x01010101u) * 0x1Bu);
+}
+
+static uint32_t rotr32(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+/* MixColumns (or InvMixColumns) on one block, a column per little-endian word */
+static void mix_columns(uint8_t *s, int inverse) {
+    for (int c = 0; c < 4; ++c) {
+        uint8_t *p = s + 4 * c;
+        uint32_t x = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        if (inverse) x ^= xtime4(xtime4(x ^ rotr32(x, 16)));  // InvMixColumns = this, then MixColumns
+        uint32_t r1 = rotr32(x, 8);  // Byte i holds byte i + 1 of the column
+        x = xtime4(x ^ r1) ^ r1 ^ rotr32(x, 16) ^ rotr32(x, 24);
+        p[0] = x & 0xFF;
+        p[1] = (x >> 8) & 0xFF;
+        p[2] = (x >> 16) & 0xFF;
+        p[3] = x >> 24;
+    }
+}
+
+static void add_round_key(uint8_t *s, const uint8_t *rk) {
+    for (int i = 0; i < AES_BLOCK; ++i) s[i] ^= rk[i];
+}
+
+/* Encrypt or decrypt SW_BATCH blocks */
+static void sw_crypt_batch(const uint8_t *rk, uint8_t *s, int decrypt) {
+    if (!decrypt) {
+        for (int b = 0; b < SW_BATCH; ++b) add_round_key(s + b * AES_BLOCK, rk);
+        for (int r = 1; r <= 10; ++r) {
+            sub_bytes64(s, 0);
+            for (int b = 0; b < SW_BATCH; ++b) {
+                shift_rows(s + b * AES_BLOCK, 0);
+                if (r < 10) mix_columns(s + b * AES_BLOCK, 0);
+                add_round_key(s + b * AES_BLOCK, rk + r * AES_BLOCK);
+            }
+        }
+    } else {
+        for (int b = 0; b < SW_BATCH; ++b) add_round_key(s + b * AES_BLOCK, rk + 10 * AES_BLOCK);
+        for (int r = 9; r >= 0; --r) {
+            for (int b = 0; b < SW_BATCH; ++b) shift_rows(s + b * AES_BLOCK, 1);
+            sub_bytes64(s, 1);
+            for (int b = 0; b < SW_BATCH; ++b) {
+                add_round_key(s + b * AES_BLOCK, rk + r * AES_BLOCK);
+                if (r > 0) mix_columns(s + b * AES_BLOCK, 1);
+            }
+        }
+    }
+}
+
+static void sw_crypt(const aes128_key_t *key, uint8_t *blocks, size_t n, int decrypt) {
+    size_t i = 0;
+    for (; i + SW_BATCH <= n; i += SW_BATCH) sw_crypt_batch(key->enc, blocks + i * AES_BLOCK, decrypt);
+    if (i < n) {
+        // Pad the last batch
+        uint8_t tail[SW_BATCH * AES_BLOCK];
+        kmemset(tail, 0, sizeof(tail));
+        kmemcpy(tail, blocks + i * AES_BLOCK, (n - i) * AES_BLOCK);
+        sw_crypt_batch(key->enc, tail, decrypt);
+        kmemcpy(blocks + i * AES_BLOCK, tail, (n - i) * AES_BLOCK);
+    }
+}
+
+void aes128_encrypt_blocks_sw(const aes128_key_t *key, uint8_t *blocks, size_t n) {
+    sw_crypt(key, blocks, n, 0);
+}
+
+void aes128_decrypt_blocks_sw(const aes128_key_t *key, uint8_t *blocks, size_t n) {
+    sw_crypt(key, blocks, n, 1);
+}
+
+void aes128_set_key(aes128_key_t *key, const uint8_t raw[16]) {
+    static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36 };
+    uint8_t *w = key->enc;
+    kmemcpy(w, raw, 16);
+    for (int i = 4; i < 44; ++i) {
+        uint8_t t[64];
+        kmemset(t, 0, sizeof(t));
+        kmemcpy(t, w + 4 * (i - 1), 4);
+        if (i % 4 == 0) {
+            uint8_t b0 = t[0];  // RotWord, SubWord, Rcon
+            t[0] = t[1];
+            t[1] = t[2];
+            t[2] = t[3];
+            t[3] = b0;
+            sub_bytes64(t, 0);
+            t[0] ^= rcon[i / 4 - 1];
+        }
+        for (int k = 0; k < 4; ++k) w[4 * i + k] = w[4 * (i - 4) + k] ^ t[k];
+    }
+
+    // AESDEC wants the round keys of the equivalent inverse cipher
+    kmemcpy(key->dec, key->enc + 10 * AES_BLOCK, AES_BLOCK);
+    for (int r = 1; r < 10; ++r) {
+        kmemcpy(key->dec + r * AES_BLOCK, key->enc + (10 - r) * AES_BLOCK, AES_BLOCK);
+        mix_columns(key->dec + r * AES_BLOCK, 1);
+    }
+    kmemcpy(key->dec + 10 * AES_BLOCK, key->enc, AES_BLOCK);
+}
+
+/* ============================================================================
+   AES-NI
+   ============================================================================ */
+
+typedef long long aes_xmm_t __attribute__((vector_size(16)));
+
+static aes_xmm_t xmm_load(const uint8_t *p) {
+    aes_xmm_t v;
+    __asm__ ("movdqu %1, %0" : "=x"(v) : "m"(*(const uint8_t (*)[AES_BLOCK])p));
+    return v;
+}
+
+static void xmm_store(uint8_t *p, aes_xmm_t v) {
+    __asm__ ("movdqu %1, %0" : "=m"(*(uint8_t (*)[AES_BLOCK])p) : "x"(v));
+}
+
+/* Four blocks at a time so each round's instructions overlap, then one at a time */
+#define HW_CRYPT(NAME, ROUND, LAST)                                                          \
+static void NAME(const uint8_t *rk, uint8_t *b, size_t n) {                                  \
+    size_t i = 0;                                                                            \
+    for (; i + 4 <= n; i += 4) {                                                             \
+        uint8_t *p = b + i * AES_BLOCK;                                                      \
+        aes_xmm_t k = xmm_load(rk);                                                          \
+        aes_xmm_t s0 = xmm_load(p) ^ k, s1 = xmm_load(p + 16) ^ k;                           \
+        aes_xmm_t s2 = xmm_load(p + 32) ^ k, s3 = xmm_load(p + 48) ^ k;                      \
+        for (int r = 1; r < 10; ++r) {                                                       \
+            k = xmm_load(rk + r * AES_BLOCK);                                                \
+            __asm__ (ROUND " %4, %0\n\t" ROUND " %4, %1\n\t" ROUND " %4, %2\n\t" ROUND " %4, %3" \
+                     : "+x"(s0), "+x"(s1), "+x"(s2), "+x"(s3) : "x"(k));                     \
+        }                                                                                    \
+        k = xmm_load(rk + 10 * AES_BLOCK);                                                   \
+        __asm__ (LAST " %4, %0\n\t" LAST " %4, %1\n\t" LAST " %4, %2\n\t" LAST " %4, %3"     \
+                 : "+x"(s0), "+x"(s1), "+x"(s2), "+x"(s3) : "x"(k));                         \
+        xmm_store(p, s0);                                                                    \
+        xmm_store(p + 16, s1);                                                               \
+        xmm_store(p + 32, s2);                                                               \
+        xmm_store(p + 48, s3);                                                               \
+    }                                                                                        \
+    for (; i < n; ++i) {                                                                     \
+        uint8_t *p = b + i * AES_BLOCK;                                                      \
+        aes_xmm_t s = xmm_load(p) ^ xmm_load(rk);                                            \
+        for (int r = 1; r < 10; ++r) __asm__ (ROUND " %1, %0" : "+x"(s) : "x"(xmm_load(rk + r * AES_BLOCK))); \
+        __asm__ (LAST " %1, %0" : "+x"(s) : "x"(xmm_load(rk + 10 * AES_BLOCK)));            \
+        xmm_store(p, s);                                                                     \
+    }                                                                                        \
+}
+
+HW_CRYPT(hw_encrypt, "aesenc", "aesenclast")
+HW_CRYPT(hw_decrypt, "aesdec", "aesdeclast")
+
+void aes128_encrypt_blocks(const aes128_key_t *key, uint8_t *blocks, size_t n) {
+    if (aes_hw()) hw_encrypt(key->enc, blocks, n);
+    else sw_crypt(key, blocks, n, 0);
+}
+
+void aes128_decrypt_blocks(const aes128_key_t *key, uint8_t *blocks, size_t n) {
+    if (aes_hw()) hw_decrypt(key->dec, blocks, n);
+    else sw_crypt(key, blocks, n, 1);
+}
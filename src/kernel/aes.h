@@ -0,0 +1,32 @@
+/* aes.h - AES-128 block cipher */
+#ifndef AES_H
+#define AES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AES_BLOCK 16
+
+/* Expanded key */
+typedef struct {
+    uint8_t enc[11 * AES_BLOCK];  // Round keys for encryption
+    uint8_t dec[11 * AES_BLOCK];  // Round keys for decryption, last first, with InvMixColumns applied
+} aes128_key_t;
+
+/* Check if the CPU has the AES-NI instructions (CPUID is asked once). Using them needs
+   SSE enabled in CR0/CR4 */
+int aes_hw(void);
+
+/* Expand a 16-byte key */
+void aes128_set_key(aes128_key_t *key, const uint8_t raw[16]);
+
+/* Encrypt or decrypt n independent 16-byte blocks in place (ECB), with AES-NI when the CPU
+   has it. Several blocks per call let both paths work on more than one block at a time */
+void aes128_encrypt_blocks(const aes128_key_t *key, uint8_t *blocks, size_t n);
+void aes128_decrypt_blocks(const aes128_key_t *key, uint8_t *blocks, size_t n);
+
+/* Same, always in software: constant time, no table lookups */
+void aes128_encrypt_blocks_sw(const aes128_key_t *key, uint8_t *blocks, size_t n);
+void aes128_decrypt_blocks_sw(const aes128_key_t *key, uint8_t *blocks, size_t n);
+
+#endif
@@ -0,0 +1,484 @@
+/* ata.c - ATA/IDE hard disk driver (PIO mode)
+ *
+ * Drives both legacy IDE channels (primary at 0x1F0/0x3F6, secondary at
+ * 0x170/0x376), each with a master and a slave. The CPU moves the data
+ * through the data port one sector per DRQ. Each channel keeps the command it
+ * has in flight in a small state machine that is stepped by polling that
+ * channel's status register, so with a command on each channel the CPU moves
+ * data for whichever drive is ready while the other one is still seeking.
+ * The drives' interrupts (IRQ 14/15) are switched off with nIEN: the status
+ * register tells the state machine everything the interrupt would.
+ *
+ * Sectors the filesystem no longer uses are collected per disk as TRIM ranges
+ * and sent with DATA SET MANAGEMENT, a block of up to 64 ranges per command,
+ * when the block fills up or at the next flush. That command only exists as
+ * a DMA transfer, so it goes through the controller's bus master registers.
+ */
+#include "ata.h"
+#include "io.h"
+
+/* Register offsets from a channel's command block base */
+#define REG_DATA     0  // Data register (16-bit)
+#define REG_ERROR    1  // Error register (read) / Features (write)
+#define REG_FEATURES 1
+#define REG_COUNT    2  // Sector count register
+#define REG_LBA_LOW  3  // LBA bits 0-7
+#define REG_LBA_MID  4  // LBA bits 8-15
+#define REG_LBA_HIGH 5  // LBA bits 16-23
+#define REG_DRIVE    6  // Drive/Head register (drive select bit 4, LBA bits 24-27)
+#define REG_STATUS   7  // Status register (read)
+#define REG_COMMAND  7  // Command register (write)
+
+/* Status register bits */
+#define SR_BSY 0x80  // Busy - drive is processing command
+#define SR_DF  0x20  // Drive Fault
+#define SR_DRQ 0x08  // Data Request - ready for data transfer
+#define SR_ERR 0x01  // Error - check error register for details
+
+#define CTRL_NIEN 0x02  // Device control: drive raises no interrupts
+
+#define CMD_DSM           0x06  // DATA SET MANAGEMENT (LBA48, DMA)
+#define CMD_READ_SECTORS  0x20
+#define CMD_WRITE_SECTORS 0x30
+#define CMD_CACHE_FLUSH   0xE7
+#define CMD_IDENTIFY      0xEC
+
+#define ATA_TIMEOUT 1000000  // Status polls without progress before a command is given up
+#define ATA_LBA28_MAX 0x0FFFFFFF
+
+/* Bus master IDE registers, from a channel's bus master base */
+#define BM_COMMAND 0  // Bit 0 starts the transfer, bit 3 set: device to memory
+#define BM_STATUS  2  // Bit 0 active, bit 1 error, bit 2 interrupt (bits 1-2 cleared by writing 1)
+#define BM_PRDT    4  // Physical address of the PRD table
+#define BM_START   0x01
+#define BM_ACTIVE  0x01
+#define BM_ERROR   0x02
+#define BM_IRQ     0x04
+
+#define DSM_TRIM 0x01           // DATA SET MANAGEMENT feature: TRIM
+#define TRIM_RANGES 64          // Range entries in one 512-byte block
+#define TRIM_RANGE_MAX 0xFFFF   // Sectors one range entry can cover
+
+typedef struct {
+    uint16_t base;   // Command block registers
+    uint16_t ctrl;   // Device control (write) / alternate status (read)
+    uint16_t bm;     // Bus master registers (0: no DMA)
+    int selected;    // Drive the registers currently address (-1: unknown)
+    int busy;        // Flag: a command is in flight
+    int dev;         // Device the command in flight is for
+    int write;       // Flag: the command in flight is a write
+    uint32_t left;   // Sectors still to transfer
+    uint16_t *buf;   // Where the next sector goes to or comes from
+} ata_channel_t;
+
+typedef struct {
+    int present;
+    uint32_t sectors;
+    char model[ATA_MODEL_MAX];
+    int result;    // Result of the disk's last finished command
+    int trim;      // Flag: DATA SET MANAGEMENT with TRIM is supported
+    int ranges;    // TRIM ranges collected in trim_block
+} ata_disk_t;
+
+/* Physical Region Descriptor: one buffer of a DMA transfer */
+typedef struct {
+    uint32_t addr;   // Physical address (identity mapped)
+    uint16_t bytes;  // Byte count (0 means 64KB)
+    uint16_t flags;  // Bit 15: last entry of the table
+} __attribute__((packed)) ata_prd_t;
+
+static ata_callbacks_t callbacks;
+static ata_channel_t channels[2] = {
+    { .base = 0x1F0, .ctrl = 0x3F6, .selected = -1 },  // Primary
+    { .base = 0x170, .ctrl = 0x376, .selected = -1 }   // Secondary
+};
+static ata_disk_t disks[ATA_MAX_DEVICES];
+static uint64_t trim_block[ATA_MAX_DEVICES][TRIM_RANGES] __attribute__((aligned(512)));  // 48-bit LBA, 16-bit count
+static ata_prd_t prd __attribute__((aligned(8)));
+
+static void trim_cancel(int dev, uint32_t lba, uint32_t count);  // Writes take their sectors out of queued TRIMs (see TRIM)
+
+void ata_set_callbacks(const ata_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+static void report(const char *msg) {
+    if (callbacks.print_message) callbacks.print_message(msg);
+}
+
+/* Small I/O wait: reading alternate status provides ~400ns delay */
+static void io_wait(const ata_channel_t *ch) {
+    (void)inb(ch->ctrl);  // Read alternate status 4 times
+    (void)inb(ch->ctrl);  // Each read takes ~100ns
+    (void)inb(ch->ctrl);
+    (void)inb(ch->ctrl);
+}
+
+/* Wait for the channel to be not busy. If want_drq is non-zero, also wait for DRQ */
+static int wait_ready(const ata_channel_t *ch, int want_drq) {
+    for (int i = 0; i < ATA_TIMEOUT; ++i) {
+        uint8_t st = inb(ch->base + REG_STATUS);
+        if (st & SR_BSY) continue;
+        if (st & (SR_ERR | SR_DF)) return -1;
+        if (!want_drq || (st & SR_DRQ)) return 0;
+    }
+    return -1;
+}
+
+/* Address drive (0 master, 1 slave) with the given LBA bits 24-27, waiting for the
+   selection to take effect if it changed */
+static void select_drive(ata_channel_t *ch, int drive, uint32_t lba_high) {
+    outb(ch->base + REG_DRIVE, (uint8_t)(0xE0 | (drive << 4) | (lba_high & 0x0F)));
+    if (ch->selected != drive) {
+        io_wait(ch);
+        io_wait(ch);
+        ch->selected = drive;
+    }
+    io_wait(ch);
+}
+
+/* Ask position dev who it is and fill in its disk entry */
+static void identify(int dev) {
+    ata_channel_t *ch = &channels[dev / 2];
+    ata_disk_t *d = &disks[dev];
+    d->present = 0;
+    d->sectors = 0;
+    d->model[0] = 0;
+
+    if (inb(ch->base + REG_STATUS) == 0xFF) return;  // Floating bus: nothing on this channel
+    select_drive(ch, dev & 1, 0);
+    outb(ch->base + REG_COUNT, 0);
+    outb(ch->base + REG_LBA_LOW, 0);
+    outb(ch->base + REG_LBA_MID, 0);
+    outb(ch->base + REG_LBA_HIGH, 0);
+    outb(ch->base + REG_COMMAND, CMD_IDENTIFY);
+    io_wait(ch);
+    if (inb(ch->base + REG_STATUS) == 0) return;  // No drive at this position
+
+    // Packet devices (CD-ROMs) abort IDENTIFY DEVICE and leave their signature in LBA mid/high
+    if (wait_ready(ch, 0) != 0) return;
+    if (inb(ch->base + REG_LBA_MID) || inb(ch->base + REG_LBA_HIGH)) return;
+    if (wait_ready(ch, 1) != 0) return;
+
+    uint16_t id[256];
+    for (int i = 0; i < 256; ++i) id[i] = inw(ch->base + REG_DATA);
+
+    // Words 60-61: sectors addressable with LBA28; words 27-46: model, two characters per word;
+    // word 169 bit 0: TRIM, word 83 bit 10: the LBA48 commands it comes with
+    d->sectors = (uint32_t)id[60] | ((uint32_t)id[61] << 16);
+    d->trim = (id[169] & 1) && (id[83] & (1u << 10));
+    d->ranges = 0;
+    int n = 0;
+    for (int w = 27; w <= 46; ++w) {
+        d->model[n++] = (char)(id[w] >> 8);
+        d->model[n++] = (char)(id[w] & 0xFF);
+    }
+    while (n > 0 && d->model[n - 1] == ' ') n--;  // Padded with spaces
+    d->model[n] = 0;
+    d->present = d->sectors != 0;
+}
+
+int ata_init(void) {
+    int found = 0;
+    for (int c = 0; c < 2; ++c) {
+        outb(channels[c].ctrl, CTRL_NIEN);
+        channels[c].selected = -1;
+        channels[c].busy = 0;
+    }
+    for (int dev = 0; dev < ATA_MAX_DEVICES; ++dev) {
+        identify(dev);
+        found += disks[dev].present;
+    }
+    return found;
+}
+
+int ata_present(int dev) {
+    return dev >= 0 && dev < ATA_MAX_DEVICES && disks[dev].present;
+}
+
+uint32_t ata_sectors(int dev) {
+    return ata_present(dev) ? disks[dev].sectors : 0;
+}
+
+const char *ata_model(int dev) {
+    return ata_present(dev) ? disks[dev].model : "";
+}
+
+/* ============================================================================
+   COMMAND STATE MACHINE
+   ============================================================================ */
+
+static void finish(ata_channel_t *ch, int result) {
+    ch->busy = 0;
+    disks[ch->dev].result = result;
+}
+
+/* Move the channel's command on by at most one sector. Returns 1 if it made progress */
+static int channel_step(ata_channel_t *ch) {
+    if (!ch->busy) return 0;
+
+    uint8_t st = inb(ch->base + REG_STATUS);
+    if (st & SR_BSY) return 0;
+    if (st & (SR_ERR | SR_DF)) {
+        report(ch->write ? "ATA: error during write\n" : "ATA: error during read\n");
+        finish(ch, -1);
+        return 1;
+    }
+    if (ch->left == 0) {
+        // Every sector moved and the drive is done with the last one
+        finish(ch, 0);
+        return 1;
+    }
+    if (!(st & SR_DRQ)) return 0;
+
+    // The drive raises DRQ once per sector: 256 words through the data port
+    if (ch->write) {
+        for (int i = 0; i < 256; ++i) outw(ch->base + REG_DATA, *ch->buf++);
+    } else {
+        for (int i = 0; i < 256; ++i) *ch->buf++ = inw(ch->base + REG_DATA);
+    }
+    ch->left--;
+    io_wait(ch);  // Status is not valid for 400ns after the transfer
+    return 1;
+}
+
+int ata_submit(int dev, int write, uint32_t lba, uint32_t count, void *buf) {
+    // LBA28 supports up to 2^28 sectors, and one command moves 1-256 of them
+    if (!ata_present(dev) || count == 0 || count > ATA_MAX_COUNT || lba + count - 1 > ATA_LBA28_MAX ||
+        lba + count > disks[dev].sectors) {
+        return -1;
+    }
+
+    if (write) trim_cancel(dev, lba, count);  // New data must not be trimmed away at the next flush
+
+    ata_channel_t *ch = &channels[dev / 2];
+    ata_complete(dev ^ 1);  // One command per channel: wait for the other drive's
+    ata_complete(dev);
+    if (wait_ready(ch, 0) != 0) {
+        report("ATA: busy wait failed before command\n");
+        return -1;
+    }
+
+    select_drive(ch, dev & 1, lba >> 24);
+    outb(ch->base + REG_COUNT, (uint8_t)count);  // 0 means 256
+    outb(ch->base + REG_LBA_LOW, (uint8_t)(lba & 0xFF));
+    outb(ch->base + REG_LBA_MID, (uint8_t)((lba >> 8) & 0xFF));
+    outb(ch->base + REG_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));
+    outb(ch->base + REG_COMMAND, write ? CMD_WRITE_SECTORS : CMD_READ_SECTORS);
+
+    ch->busy = 1;
+    ch->dev = dev;
+    ch->write = write;
+    ch->left = count;
+    ch->buf = (uint16_t *)buf;
+    disks[dev].result = 0;
+    io_wait(ch);
+    return 0;
+}
+
+int ata_poll(void) {
+    int busy = 0;
+    for (int c = 0; c < 2; ++c) {
+        channel_step(&channels[c]);
+        busy += channels[c].busy;
+    }
+    return busy;
+}
+
+int ata_complete(int dev) {
+    if (dev < 0 || dev >= ATA_MAX_DEVICES) return -1;
+    ata_channel_t *ch = &channels[dev / 2];
+    for (int idle = 0; ch->busy && ch->dev == dev;) {
+        // Keep the other channel's transfer moving while this one waits for its drive
+        int progress = channel_step(&channels[0]);
+        progress |= channel_step(&channels[1]);
+        if (progress) {
+            idle = 0;
+        } else if (++idle > ATA_TIMEOUT) {
+            report("ATA: poll timeout\n");
+            ch->selected = -1;
+            finish(ch, -1);
+        }
+    }
+    return disks[dev].result;
+}
+
+int ata_read_sectors(int dev, uint32_t lba, uint32_t count, void *buf) {
+    if (ata_submit(dev, 0, lba, count, buf) != 0) return -1;
+    return ata_complete(dev);
+}
+
+int ata_write_sectors(int dev, uint32_t lba, uint32_t count, const void *buf) {
+    // The state machine only reads from buf on writes
+    if (ata_submit(dev, 1, lba, count, (void *)(uintptr_t)buf) != 0) return -1;
+    return ata_complete(dev);
+}
+
+/* ============================================================================
+   TRIM
+   ============================================================================ */
+
+void ata_set_busmaster(uint16_t base) {
+    channels[0].bm = base;
+    channels[1].bm = base ? (uint16_t)(base + 8) : 0;
+}
+
+int ata_trim_supported(int dev) {
+    return ata_present(dev) && disks[dev].trim && channels[dev / 2].bm;
+}
+
+/* Send the collected TRIM ranges of dev with one DATA SET MANAGEMENT command */
+static int trim_send(int dev) {
+    ata_disk_t *d = &disks[dev];
+    if (d->ranges == 0) return 0;
+    ata_channel_t *ch = &channels[dev / 2];
+    ata_complete(dev ^ 1);
+    ata_complete(dev);
+    if (wait_ready(ch, 0) != 0) {
+        report("ATA: busy wait failed before TRIM\n");
+        return -1;
+    }
+    for (int i = d->ranges; i < TRIM_RANGES; ++i) trim_block[dev][i] = 0;  // Zero count: unused entry
+    d->ranges = 0;
+
+    // The bus master reads the block from memory (direction bit clear)
+    prd.addr = (uint32_t)(uintptr_t)trim_block[dev];
+    prd.bytes = sizeof(trim_block[dev]);
+    prd.flags = 0x8000;
+    outl(ch->bm + BM_PRDT, (uint32_t)(uintptr_t)&prd);
+    outb(ch->bm + BM_COMMAND, 0);
+    outb(ch->bm + BM_STATUS, BM_ERROR | BM_IRQ);
+
+    // LBA48 command: each register takes the high byte, then the low byte
+    outb(ch->base + REG_DRIVE, (uint8_t)(0x40 | ((dev & 1) << 4)));
+    ch->selected = -1;  // Leaves the LBA28 bits of the drive register behind
+    io_wait(ch);
+    outb(ch->base + REG_FEATURES, 0);
+    outb(ch->base + REG_FEATURES, DSM_TRIM);
+    outb(ch->base + REG_COUNT, 0);
+    outb(ch->base + REG_COUNT, 1);  // One 512-byte block of ranges
+    for (int reg = REG_LBA_LOW; reg <= REG_LBA_HIGH; ++reg) {
+        outb((uint16_t)(ch->base + reg), 0);
+        outb((uint16_t)(ch->base + reg), 0);
+    }
+    outb(ch->base + REG_COMMAND, CMD_DSM);
+    outb(ch->bm + BM_COMMAND, BM_START);
+    io_wait(ch);
+
+    int r = wait_ready(ch, 0);
+    for (int i = 0; r == 0 && (inb(ch->bm + BM_STATUS) & BM_ACTIVE); ++i) {
+        if (i == ATA_TIMEOUT) r = -1;
+    }
+    outb(ch->bm + BM_COMMAND, 0);
+    if (r != 0 || (inb(ch->bm + BM_STATUS) & BM_ERROR)) {
+        report("ATA: TRIM failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Take lba..lba+count-1 out of the queued ranges of dev: they are about to hold new data.
+   A range cut in two keeps both ends if there is a free entry, otherwise the tail is
+   simply not trimmed (TRIM is only a hint) */
+static void trim_cancel(int dev, uint32_t lba, uint32_t count) {
+    ata_disk_t *d = &disks[dev];
+    uint64_t end = (uint64_t)lba + count;
+    for (int i = 0; i < d->ranges;) {
+        uint64_t start = trim_block[dev][i] & 0xFFFFFFFFFFFFull;
+        uint64_t stop = start + (trim_block[dev][i] >> 48);
+        if (stop <= lba || start >= end) {
+            ++i;
+            continue;
+        }
+        int head = start < lba, tail = stop > end;
+        if (head) trim_block[dev][i] = start | ((lba - start) << 48);
+        if (tail) {
+            uint64_t entry = end | ((stop - end) << 48);
+            if (!head) trim_block[dev][i] = entry;
+            else if (d->ranges < TRIM_RANGES) trim_block[dev][d->ranges++] = entry;
+        }
+        if (head || tail) {
+            ++i;
+        } else {
+            trim_block[dev][i] = trim_block[dev][--d->ranges];  // Wholly overwritten: drop it
+        }
+    }
+}
+
+int ata_discard(int dev, uint32_t lba, uint32_t count) {
+    if (!ata_trim_supported(dev)) return 0;
+    if (count == 0 || lba + count > disks[dev].sectors) return -1;
+    ata_disk_t *d = &disks[dev];
+    int r = 0;
+    while (count > 0) {
+        // Extend the last range if this one follows on from it
+        uint64_t *last = d->ranges ? &trim_block[dev][d->ranges - 1] : 0;
+        if (last && (*last & 0xFFFFFFFFFFFFull) + (*last >> 48) == lba && (*last >> 48) < TRIM_RANGE_MAX) {
+            uint32_t add = TRIM_RANGE_MAX - (uint32_t)(*last >> 48);
+            if (add > count) add = count;
+            *last += (uint64_t)add << 48;
+            lba += add;
+            count -= add;
+            continue;
+        }
+        if (d->ranges == TRIM_RANGES && trim_send(dev) != 0) r = -1;
+        uint32_t n = count < TRIM_RANGE_MAX ? count : TRIM_RANGE_MAX;
+        trim_block[dev][d->ranges++] = (uint64_t)lba | ((uint64_t)n << 48);
+        lba += n;
+        count -= n;
+    }
+    return r;
+}
+
+/* Writes are not flushed one by one: the filesystems call this where order matters (FAT16
+   around its checksum table, logfs before its checkpoint) and at sync points. Collected
+   TRIM ranges go out first */
+int ata_flush(int dev) {
+    if (!ata_present(dev)) return -1;
+    ata_channel_t *ch = &channels[dev / 2];
+    int r = trim_send(dev);
+    ata_complete(dev ^ 1);
+    ata_complete(dev);
+    select_drive(ch, dev & 1, 0);
+    outb(ch->base + REG_COMMAND, CMD_CACHE_FLUSH);
+    io_wait(ch);
+    if (wait_ready(ch, 0) != 0) {
+        report("ATA: cache flush failed\n");
+        return -1;
+    }
+    return r;
+}
+
+/* ============================================================================
+   BLOCK DEVICE
+   ============================================================================ */
+// The device pointer is the device number
+
+static int blk_read(void *dev, uint32_t lba, uint32_t count, void *buf) {
+    return ata_read_sectors((int)(uintptr_t)dev, lba, count, buf);
+}
+
+static int blk_write(void *dev, uint32_t lba, uint32_t count, const void *buf) {
+    return ata_write_sectors((int)(uintptr_t)dev, lba, count, buf);
+}
+
+static int blk_flush(void *dev) {
+    return ata_flush((int)(uintptr_t)dev);
+}
+
+static int blk_discard(void *dev, uint32_t lba, uint32_t count) {
+    return ata_discard((int)(uintptr_t)dev, lba, count);
+}
+
+const blkdev_ops_t ata_blkdev_ops = {
+    .read_sectors = blk_read,
+    .write_sectors = blk_write,
+    .flush = blk_flush,
+    .discard = blk_discard
+};
+
+int ata_register(int dev, const char *name) {
+    if (!ata_present(dev)) return -1;
+    return blkdev_register(name, ata_model(dev), &ata_blkdev_ops, (void *)(uintptr_t)dev,
+                           ata_sectors(dev), ATA_MAX_COUNT, ata_trim_supported(dev) ? BLKDEV_DISCARD : 0);
+}
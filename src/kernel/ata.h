@@ -0,0 +1,83 @@
+/* ata.h - ATA/IDE hard disk driver (PIO mode) for both legacy channels */
+#ifndef ATA_H
+#define ATA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "blkdev.h"
+
+/* Device numbers: channel * 2 + drive */
+#define ATA_PRIMARY_MASTER   0
+#define ATA_PRIMARY_SLAVE    1
+#define ATA_SECONDARY_MASTER 2
+#define ATA_SECONDARY_SLAVE  3
+#define ATA_MAX_DEVICES      4
+
+#define ATA_MODEL_MAX 41  // Model string from IDENTIFY, with the terminating zero
+#define ATA_MAX_COUNT 256  // Most sectors one command transfers
+
+/* Callbacks - must be provided by kernel */
+typedef struct {
+    void (*print_message)(const char *msg);  // Optional (may be NULL): report driver errors
+} ata_callbacks_t;
+
+/* Set the callbacks that the driver will use */
+void ata_set_callbacks(const ata_callbacks_t *callbacks);
+
+/* Probe the four legacy positions with IDENTIFY DEVICE. Positions that are empty or hold
+   a packet (ATAPI) device are left out. Returns the number of ATA disks found */
+int ata_init(void);
+
+/* Check if there is an ATA disk at device number dev */
+int ata_present(int dev);
+
+/* Size of the disk in sectors (LBA28 addressable), 0 if there is none */
+uint32_t ata_sectors(int dev);
+
+/* Model string reported by the disk, "" if there is none */
+const char *ata_model(int dev);
+
+/* Read or write count (1-256) consecutive 512-byte sectors with one command and wait for
+   it. Returns 0 on success, -1 on error */
+int ata_read_sectors(int dev, uint32_t lba, uint32_t count, void *buf);
+int ata_write_sectors(int dev, uint32_t lba, uint32_t count, const void *buf);
+
+/* Make completed writes on dev durable (CACHE FLUSH), sending any collected TRIM ranges */
+int ata_flush(int dev);
+
+/* Tell the driver where the IDE controller's bus master registers are (BAR4 of the PCI
+   function, primary channel first), which TRIM needs. 0: no DMA */
+void ata_set_busmaster(uint16_t base);
+
+/* Check if dev takes TRIM (the disk advertises it and the bus master registers are known) */
+int ata_trim_supported(int dev);
+
+/* Tell dev that sectors lba..lba+count-1 no longer hold data. Ranges are collected (adjacent
+   ones merged) and sent with DATA SET MANAGEMENT when a block of 64 is full or at the next
+   ata_flush; a write to sectors still waiting takes them out of their range first. Does
+   nothing on disks without TRIM. Returns 0, or -1 on error */
+int ata_discard(int dev, uint32_t lba, uint32_t count);
+
+/* Overlapped I/O. Each channel has its own registers and runs one command at a time, so a
+   command submitted on one channel proceeds while the CPU moves data for the other.
+   ata_submit starts the command (first finishing any command already on dev's channel,
+   whichever drive it is for) and returns at once; buf must stay valid until ata_complete
+   returns. Returns 0 if the command was started, -1 if not */
+int ata_submit(int dev, int write, uint32_t lba, uint32_t count, void *buf);
+
+/* Move every channel's command on as far as it can go without waiting. Returns the number
+   of channels that still have a command in flight */
+int ata_poll(void);
+
+/* Wait for dev's last command, moving the other channel on meanwhile. Returns its result:
+   0 on success, -1 on error */
+int ata_complete(int dev);
+
+/* Operations to register a disk with (its device number, cast, as the device pointer) */
+extern const blkdev_ops_t ata_blkdev_ops;
+
+/* Register disk dev as a block device under name, taking TRIM if it supports it (so call
+   ata_set_busmaster first). Returns its id, or -1 if there is no such disk */
+int ata_register(int dev, const char *name);
+
+#endif
@@ -0,0 +1,190 @@
+/* blkdev.c - Block device table
+ *
+ * Drivers (the ATA disks, the RAID volume, RAM disks) register an operations
+ * table and a pointer of their own under a short name; everything above them
+ * asks for a device by name and calls blkdev_read/blkdev_write, which check
+ * the range against the device size and cut long requests to what the driver
+ * takes in one call. Each request is counted and timed with the time stamp
+ * counter on the way, into a log2 latency histogram per kind.
+ */
+#include "blkdev.h"
+
+typedef struct {
+    blkdev_info_t info;
+    const blkdev_ops_t *ops;
+    void *dev;
+    blkdev_stats_t stats;
+    uint32_t next_lba[2];  // Where the last read/write ended
+} blkdev_t;
+
+static blkdev_t devices[BLKDEV_MAX];
+static int ndevices = 0;
+static int timing = 1;  // Flag: time requests into the latency histograms
+
+static int name_equal(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return *a == *b;
+}
+
+int blkdev_register(const char *name, const char *model, const blkdev_ops_t *ops, void *dev,
+                    uint32_t sectors, uint32_t max_count, int flags) {
+    if (ndevices == BLKDEV_MAX || !ops || !ops->read_sectors || !ops->write_sectors) return -1;
+    if (blkdev_find(name) >= 0) return -1;
+
+    size_t len = 0;
+    while (name[len]) ++len;
+    if (len == 0 || len >= BLKDEV_NAME_MAX) return -1;
+
+    blkdev_t *d = &devices[ndevices];
+    for (size_t i = 0; i <= len; ++i) d->info.name[i] = name[i];
+    d->info.model = model ? model : "";
+    d->info.sectors = sectors;
+    d->info.max_count = max_count;
+    d->info.flags = flags;
+    d->ops = ops;
+    d->dev = dev;
+    blkdev_reset_stats(ndevices);
+    return ndevices++;
+}
+
+int blkdev_find(const char *name) {
+    for (int id = 0; id < ndevices; ++id) {
+        if (name_equal(devices[id].info.name, name)) return id;
+    }
+    return -1;
+}
+
+int blkdev_count(void) {
+    return ndevices;
+}
+
+int blkdev_info(int id, blkdev_info_t *info) {
+    if (id < 0 || id >= ndevices) return -1;
+    *info = devices[id].info;
+    return 0;
+}
+
+int blkdev_stats(int id, blkdev_stats_t *st) {
+    if (id < 0 || id >= ndevices) return -1;
+    *st = devices[id].stats;
+    return 0;
+}
+
+void blkdev_reset_stats(int id) {
+    if (id < 0 || id >= BLKDEV_MAX) return;
+    blkdev_t *d = &devices[id];
+    uint32_t active = d->stats.active;  // Calls under way still return
+    uint8_t *p = (uint8_t *)&d->stats;
+    for (size_t i = 0; i < sizeof(d->stats); ++i) p[i] = 0;
+    d->stats.active = active;
+    d->next_lba[0] = d->next_lba[1] = 0xFFFFFFFFu;
+}
+
+void blkdev_set_timing(int on) {
+    timing = on;
+}
+
+/* ============================================================================
+   ACCOUNTING
+   ============================================================================ */
+
+static uint64_t cycles(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* A request enters the driver: returns its start time */
+static uint64_t request_begin(blkdev_t *d) {
+    if (++d->stats.active > d->stats.max_active) d->stats.max_active = d->stats.active;
+    return timing ? cycles() : 0;
+}
+
+/* A request of the given kind that began at start has finished with result r */
+static int request_end(blkdev_t *d, int kind, uint64_t start, int r) {
+    d->stats.requests[kind]++;
+    d->stats.active--;
+    if (r != 0) d->stats.errors++;
+    if (timing) {
+        uint64_t t = cycles() - start;
+        int bucket = 63 - __builtin_clzll(t | 1);
+        if (bucket >= BLKDEV_BUCKETS) bucket = BLKDEV_BUCKETS - 1;
+        d->stats.timed[kind]++;
+        d->stats.cycles[kind] += t;
+        d->stats.histogram[kind][bucket]++;
+    }
+    return r;
+}
+
+/* Count a read or write of count sectors at lba */
+static void count_transfer(blkdev_t *d, int kind, uint32_t lba, uint32_t count) {
+    d->stats.sectors[kind] += count;
+    if (lba == d->next_lba[kind]) d->stats.sequential[kind]++;
+    d->next_lba[kind] = lba + count;
+    if (d->info.max_count && count > d->info.max_count) {
+        d->stats.splits += (count - 1) / d->info.max_count;
+    }
+}
+
+/* ============================================================================
+   SECTOR I/O
+   ============================================================================ */
+
+/* Device id if lba..lba+count-1 is on it, NULL otherwise */
+static blkdev_t *device_range(int id, uint32_t lba, uint32_t count) {
+    if (id < 0 || id >= ndevices || count == 0) return 0;
+    blkdev_t *d = &devices[id];
+    if (lba + count > d->info.sectors || lba + count < lba) return 0;
+    return d;
+}
+
+/* Call the driver for each piece of a long request */
+static int transfer(blkdev_t *d, int write, uint32_t lba, uint32_t count, uint8_t *p) {
+    while (count > 0) {
+        uint32_t n = d->info.max_count && count > d->info.max_count ? d->info.max_count : count;
+        int r = write ? d->ops->write_sectors(d->dev, lba, n, p) : d->ops->read_sectors(d->dev, lba, n, p);
+        if (r != 0) return -1;
+        lba += n;
+        count -= n;
+        p += (size_t)n * BLKDEV_SECTOR;
+    }
+    return 0;
+}
+
+int blkdev_read(int id, uint32_t lba, uint32_t count, void *buf) {
+    blkdev_t *d = device_range(id, lba, count);
+    if (!d) return -1;
+    count_transfer(d, BLKDEV_READ, lba, count);
+    uint64_t start = request_begin(d);
+    return request_end(d, BLKDEV_READ, start, transfer(d, 0, lba, count, (uint8_t *)buf));
+}
+
+int blkdev_write(int id, uint32_t lba, uint32_t count, const void *buf) {
+    blkdev_t *d = device_range(id, lba, count);
+    if (!d) return -1;
+    count_transfer(d, BLKDEV_WRITE, lba, count);
+    uint64_t start = request_begin(d);
+    // Drivers only read from buf on writes
+    return request_end(d, BLKDEV_WRITE, start, transfer(d, 1, lba, count, (uint8_t *)(uintptr_t)buf));
+}
+
+int blkdev_flush(int id) {
+    if (id < 0 || id >= ndevices) return -1;
+    blkdev_t *d = &devices[id];
+    uint64_t start = request_begin(d);
+    return request_end(d, BLKDEV_FLUSH, start, d->ops->flush ? d->ops->flush(d->dev) : 0);
+}
+
+int blkdev_discard(int id, uint32_t lba, uint32_t count) {
+    blkdev_t *d = device_range(id, lba, count);
+    if (!d) return -1;
+    if (!(d->info.flags & BLKDEV_DISCARD) || !d->ops->discard) return 0;
+    d->stats.discards++;
+    d->stats.sectors_discarded += count;
+    int r = d->ops->discard(d->dev, lba, count);
+    if (r != 0) d->stats.errors++;
+    return r;
+}
@@ -0,0 +1,98 @@
+/* blkdev.h - Block devices: one interface for every driver that stores sectors */
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLKDEV_SECTOR 512   // Bytes per sector on every device
+#define BLKDEV_MAX 8        // Registered devices
+#define BLKDEV_NAME_MAX 8   // Longest device name, including terminator
+
+#define BLKDEV_BUCKETS 40   // Latency histogram buckets: bucket i counts 2^i to 2^(i+1)-1 cycles
+
+/* Request kinds with a latency histogram */
+#define BLKDEV_READ  0
+#define BLKDEV_WRITE 1
+#define BLKDEV_FLUSH 2
+#define BLKDEV_KINDS 3
+
+/* Device flags */
+#define BLKDEV_DISCARD 0x01  // Discards reach the medium (TRIM), so they are worth sending
+
+/* Operations a driver provides. 'dev' is the pointer passed to blkdev_register, and lba and
+   count are already checked against the device size. Calls return 0 on success, -1 on error.
+   Entries a driver does not support may be NULL */
+typedef struct {
+    int (*read_sectors)(void *dev, uint32_t lba, uint32_t count, void *buf);
+    int (*write_sectors)(void *dev, uint32_t lba, uint32_t count, const void *buf);
+    int (*flush)(void *dev);                                  // Make completed writes durable
+    int (*discard)(void *dev, uint32_t lba, uint32_t count);  // Sectors no longer hold data
+} blkdev_ops_t;
+
+/* Geometry and identity of a registered device */
+typedef struct {
+    char name[BLKDEV_NAME_MAX];
+    const char *model;     // Description for listings
+    uint32_t sectors;      // Size in sectors
+    uint32_t max_count;    // Most sectors one read/write call may take, 0 for no limit
+    int flags;
+} blkdev_info_t;
+
+/* I/O counters of a device, gathered around every call into its driver. Latencies are in
+   CPU cycles (time stamp counter) */
+typedef struct {
+    uint64_t requests[BLKDEV_KINDS];  // Reads, writes, flushes
+    uint64_t sectors[2];              // Sectors read, written
+    uint64_t sequential[2];           // Reads/writes that began where the previous one ended.
+                                      // Nothing merges them: requests go to the driver as they come
+    uint64_t splits;                  // Extra driver calls for requests over max_count
+    uint64_t discards;
+    uint64_t sectors_discarded;
+    uint64_t errors;                  // Failed requests of any kind
+    uint32_t active;                  // Driver calls not returned yet: every call waits for its
+                                      // request, so this is 1 during a call and only goes higher
+                                      // when a call is made while another is under way
+    uint32_t max_active;              // Most calls under way at once
+    uint64_t timed[BLKDEV_KINDS];     // Requests timed (all of them unless timing was off)
+    uint64_t cycles[BLKDEV_KINDS];    // Total latency of the timed requests per kind
+    uint64_t histogram[BLKDEV_KINDS][BLKDEV_BUCKETS];
+} blkdev_stats_t;
+
+/* Add a device of the given size under name (for example "hd0"). max_count and flags as in
+   blkdev_info_t. Returns its id (>= 0), or -1 if the name is taken or the table is full */
+int blkdev_register(const char *name, const char *model, const blkdev_ops_t *ops, void *dev,
+                    uint32_t sectors, uint32_t max_count, int flags);
+
+/* Id of the device called name, -1 if there is none */
+int blkdev_find(const char *name);
+
+/* Number of registered devices; their ids are 0 to blkdev_count() - 1 */
+int blkdev_count(void);
+
+/* Copy device id's geometry to *info. Returns 0, or -1 if there is no such device */
+int blkdev_info(int id, blkdev_info_t *info);
+
+/* Copy device id's counters to *st. Returns 0, or -1 if there is no such device */
+int blkdev_stats(int id, blkdev_stats_t *st);
+
+/* Zero device id's counters */
+void blkdev_reset_stats(int id);
+
+/* Turn request timing on (the default) or off. Counters are kept either way; the two time
+   stamp reads per request only matter on devices as fast as a RAM disk */
+void blkdev_set_timing(int on);
+
+/* Sector I/O on device id. Requests past the end fail; long ones are cut into pieces the
+   driver takes. Returns 0 on success, -1 on error */
+int blkdev_read(int id, uint32_t lba, uint32_t count, void *buf);
+int blkdev_write(int id, uint32_t lba, uint32_t count, const void *buf);
+
+/* Make completed writes on device id durable (does nothing if the driver has no cache) */
+int blkdev_flush(int id);
+
+/* Tell device id that sectors lba..lba+count-1 no longer hold data. Does nothing on devices
+   that cannot use it */
+int blkdev_discard(int id, uint32_t lba, uint32_t count);
+
+#endif
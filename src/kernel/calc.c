@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "calc.h"
+#include "kstring.h"
 
 /* ============================================================================
    CALCULATOR CONFIGURATION
@@ -494,10 +495,7 @@ void calc_start(void) {
     shift_down = 0;  // Clear shift state
     ctrl_down = 0;   // Clear control state
 
-    // Clear input buffer
-    for (size_t i = 0; i < INPUT_MAX; i++) {
-        input_buffer[i] = '\0';
-    }
+    kmemset(input_buffer, 0, INPUT_MAX);  // Clear input buffer
 
     calc_redraw();  // Draw initial calculator screen
 }
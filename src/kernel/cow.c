@@ -0,0 +1,231 @@
+/* cow.c - Copy-on-write block overlay
+ *
+ * Sits between a filesystem and the disk. While a snapshot is active, writes
+ * to the covered range never touch it: each sector goes to its own slot in a
+ * delta area and a bitmap records which sectors now live there, so reads of
+ * those sectors are redirected. Taking a snapshot only starts a new, empty
+ * bitmap; rolling back throws it away; committing copies the delta slots back
+ * over the originals. The bitmap is kept in a header sector in front of the
+ * delta and written at flush points, after the data it describes is durable,
+ * so a snapshot survives reboots (including the boot-time format).
+ */
+#include "cow.h"
+#include "crc32c.h"
+#include "kstring.h"
+
+#define COW_SECTOR 512
+#define COW_BATCH 16  // Sectors copied per command when committing
+
+// Header sector: 0 "COWD", 4 active flag, 8 covered sectors, 12 CRC32C, 16 bitmap
+#define HDR_CRC 12
+#define HDR_BITMAP 16
+
+static const uint8_t hdr_magic[4] = { 'C', 'O', 'W', 'D' };
+
+static cow_callbacks_t callbacks;
+static uint32_t base_first = 0;      // First covered sector
+static uint32_t base_count = 0;      // Covered sectors (0: overlay unavailable)
+static uint32_t delta_start = 0;     // Header sector; slot of covered sector i is delta_start + 1 + i
+static int active = 0;               // Flag: a snapshot is active
+static int hdr_dirty = 0;            // Flag: the bitmap changed since the header was written
+static uint8_t bitmap[COW_MAX_SECTORS / 8];  // Bit i set: covered sector i is in the delta
+static uint8_t copy_buf[COW_BATCH * COW_SECTOR];
+
+void cow_set_callbacks(const cow_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+static int in_delta(uint32_t i) {
+    return (bitmap[i / 8] >> (i % 8)) & 1;
+}
+
+static void disk_flush(void) {
+    if (callbacks.disk_flush) callbacks.disk_flush();
+}
+
+static int header_write(void) {
+    uint8_t hdr[COW_SECTOR];
+    kmemset(hdr, 0, COW_SECTOR);
+    kmemcpy(hdr, hdr_magic, sizeof(hdr_magic));
+    hdr[4] = (uint8_t)active;
+    hdr[8] = base_count & 0xFF;
+    hdr[9] = (base_count >> 8) & 0xFF;
+    kmemcpy(hdr + HDR_BITMAP, bitmap, sizeof(bitmap));
+    uint32_t crc = crc32c(0, hdr, COW_SECTOR);
+    for (int k = 0; k < 4; ++k) hdr[HDR_CRC + k] = (crc >> (8 * k)) & 0xFF;
+    hdr_dirty = 0;
+    return callbacks.disk_write_sectors(delta_start, 1, hdr);
+}
+
+int cow_init(uint32_t first, uint32_t sectors, uint32_t delta_sector) {
+    base_count = 0;
+    active = 0;
+    hdr_dirty = 0;
+    kmemset(bitmap, 0, sizeof(bitmap));
+    if (sectors == 0 || sectors > COW_MAX_SECTORS) return -1;
+
+    // The delta needs a slot for every covered sector; probe the last one
+    uint8_t hdr[COW_SECTOR];
+    if (callbacks.disk_read_sectors(delta_sector + sectors, 1, hdr) != 0) return -1;
+    base_first = first;
+    base_count = sectors;
+    delta_start = delta_sector;
+
+    // A valid header for the same range carries an active snapshot over
+    if (callbacks.disk_read_sectors(delta_start, 1, hdr) != 0) return 0;
+    uint32_t crc = (uint32_t)hdr[HDR_CRC] | ((uint32_t)hdr[HDR_CRC + 1] << 8) |
+                   ((uint32_t)hdr[HDR_CRC + 2] << 16) | ((uint32_t)hdr[HDR_CRC + 3] << 24);
+    kmemset(hdr + HDR_CRC, 0, 4);
+    if (hdr[0] != hdr_magic[0] || hdr[1] != hdr_magic[1] || hdr[2] != hdr_magic[2] || hdr[3] != hdr_magic[3] ||
+        crc32c(0, hdr, COW_SECTOR) != crc || (uint32_t)(hdr[8] | (hdr[9] << 8)) != sectors || !hdr[4]) {
+        return 0;
+    }
+    active = 1;
+    kmemcpy(bitmap, hdr + HDR_BITMAP, sizeof(bitmap));
+    return 0;
+}
+
+int cow_snapshot(void) {
+    if (!base_count || active) return -1;
+    disk_flush();  // The snapshot is what is on disk now
+    kmemset(bitmap, 0, sizeof(bitmap));
+    active = 1;
+    int r = header_write();
+    disk_flush();
+    return r;
+}
+
+int cow_rollback(void) {
+    if (!active) return -1;
+    kmemset(bitmap, 0, sizeof(bitmap));
+    active = 0;
+    int r = header_write();
+    disk_flush();
+    return r;
+}
+
+int cow_commit(void) {
+    if (!active) return -1;
+
+    // Until the header says otherwise, reads keep coming from the delta, so a commit cut
+    // short by a crash is simply done again
+    disk_flush();
+    for (uint32_t i = 0; i < base_count;) {
+        if (!in_delta(i)) {
+            i++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (run < COW_BATCH && i + run < base_count && in_delta(i + run)) run++;
+        if (callbacks.disk_read_sectors(delta_start + 1 + i, run, copy_buf) != 0 ||
+            callbacks.disk_write_sectors(base_first + i, run, copy_buf) != 0) {
+            return -1;
+        }
+        i += run;
+    }
+    disk_flush();
+
+    kmemset(bitmap, 0, sizeof(bitmap));
+    active = 0;
+    int r = header_write();
+    disk_flush();
+    return r;
+}
+
+int cow_active(void) {
+    return active;
+}
+
+uint32_t cow_delta_sectors(void) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < base_count; ++i) n += (uint32_t)in_delta(i);
+    return n;
+}
+
+/* ============================================================================
+   SECTOR I/O
+   ============================================================================ */
+
+/* Split a request at the edges of the covered range: *before and *after are the sector
+   counts outside it, the rest is covered */
+static void split(uint32_t lba, uint32_t count, uint32_t *before, uint32_t *after) {
+    uint32_t end = lba + count, base_end = base_first + base_count;
+    *before = *after = 0;
+    if (!active || end <= base_first || lba >= base_end) {
+        *before = count;  // Nothing redirected
+        return;
+    }
+    if (lba < base_first) *before = base_first - lba;
+    if (end > base_end) *after = end - base_end;
+}
+
+int cow_read_sectors(uint32_t lba, uint32_t count, void *buf) {
+    uint32_t before, after;
+    split(lba, count, &before, &after);
+    uint8_t *p = (uint8_t *)buf;
+    if (before && callbacks.disk_read_sectors(lba, before, p) != 0) return -1;
+    if (before == count) return 0;
+
+    // One command per run of sectors that are all in the delta or all in the snapshot
+    uint32_t i = lba + before - base_first, end = lba + count - after - base_first;
+    while (i < end) {
+        int d = in_delta(i);
+        uint32_t run = 1;
+        while (i + run < end && in_delta(i + run) == d) run++;
+        uint32_t at = d ? delta_start + 1 + i : base_first + i;
+        if (callbacks.disk_read_sectors(at, run, p + (size_t)(base_first + i - lba) * COW_SECTOR) != 0) return -1;
+        i += run;
+    }
+
+    if (after) return callbacks.disk_read_sectors(lba + count - after, after, p + (size_t)(count - after) * COW_SECTOR);
+    return 0;
+}
+
+int cow_write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+    uint32_t before, after;
+    split(lba, count, &before, &after);
+    const uint8_t *p = (const uint8_t *)buf;
+    if (before && callbacks.disk_write_sectors(lba, before, p) != 0) return -1;
+    if (before == count) return 0;
+
+    // Slots are laid out like the covered range, so the covered part is still one command
+    uint32_t i = lba + before - base_first, n = count - before - after;
+    if (callbacks.disk_write_sectors(delta_start + 1 + i, n, p + (size_t)before * COW_SECTOR) != 0) return -1;
+    for (uint32_t k = i; k < i + n; ++k) {
+        if (!in_delta(k)) {
+            bitmap[k / 8] |= (uint8_t)(1u << (k % 8));
+            hdr_dirty = 1;
+        }
+    }
+
+    if (after) return callbacks.disk_write_sectors(lba + count - after, after, p + (size_t)(count - after) * COW_SECTOR);
+    return 0;
+}
+
+int cow_read_sector(uint32_t lba, void *buf) {
+    return cow_read_sectors(lba, 1, buf);
+}
+
+int cow_write_sector(uint32_t lba, const void *buf) {
+    return cow_write_sectors(lba, 1, buf);
+}
+
+int cow_discard(uint32_t lba, uint32_t count) {
+    if (!callbacks.disk_discard) return 0;
+    uint32_t before, after;
+    split(lba, count, &before, &after);
+    int r = 0;
+    if (before && callbacks.disk_discard(lba, before) != 0) r = -1;
+    if (before < count && after && callbacks.disk_discard(lba + count - after, after) != 0) r = -1;
+    return r;
+}
+
+int cow_flush(void) {
+    int r = callbacks.disk_flush ? callbacks.disk_flush() : 0;
+    if (!hdr_dirty) return r;
+
+    // The sectors the bitmap points at are durable now; record them
+    if (header_write() != 0) r = -1;
+    if (callbacks.disk_flush && callbacks.disk_flush() != 0) r = -1;
+    return r;
+}
@@ -0,0 +1,57 @@
+/* cow.h - Copy-on-write block overlay for volume snapshots */
+#ifndef COW_H
+#define COW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define COW_MAX_SECTORS 2048  // Largest range the overlay can cover (bitmap in one header sector)
+
+/* Sector I/O callbacks of the disk underneath - must be provided by kernel (or a host harness) */
+typedef struct {
+    int (*disk_read_sectors)(uint32_t lba, uint32_t count, void *buf);         // Return 0 on success
+    int (*disk_write_sectors)(uint32_t lba, uint32_t count, const void *buf);  // Return 0 on success
+    int (*disk_flush)(void);  // Optional (may be NULL): make every completed write durable
+    int (*disk_discard)(uint32_t lba, uint32_t count);  // Optional (may be NULL): sectors no longer hold data
+} cow_callbacks_t;
+
+/* Set the callbacks that the overlay will use */
+void cow_set_callbacks(const cow_callbacks_t *callbacks);
+
+/* Cover disk sectors first..first+sectors-1, keeping the delta (a header sector, then one
+   sector per covered sector) from delta_sector on. Picks up a snapshot left active by an
+   earlier boot. Returns 0, or -1 if the disk is too small (sectors then pass straight through) */
+int cow_init(uint32_t first, uint32_t sectors, uint32_t delta_sector);
+
+/* Freeze the covered sectors as they are on disk now: later writes go to the delta.
+   Returns 0, or -1 if the overlay is unavailable or a snapshot is already active */
+int cow_snapshot(void);
+
+/* Throw the delta away, going back to the snapshot. Returns 0, or -1 if no snapshot is active */
+int cow_rollback(void);
+
+/* Copy the delta onto the snapshot and end it, keeping the current contents.
+   Returns 0, or -1 if no snapshot is active or a disk command failed */
+int cow_commit(void);
+
+/* Check if a snapshot is active */
+int cow_active(void);
+
+/* Covered sectors written since the snapshot was taken */
+uint32_t cow_delta_sectors(void);
+
+/* Sector I/O through the overlay, same contract as the disk callbacks. Sectors outside the
+   covered range pass straight through */
+int cow_read_sectors(uint32_t lba, uint32_t count, void *buf);
+int cow_write_sectors(uint32_t lba, uint32_t count, const void *buf);
+int cow_read_sector(uint32_t lba, void *buf);
+int cow_write_sector(uint32_t lba, const void *buf);
+
+/* Pass a discard down, except for covered sectors while a snapshot is active: the snapshot
+   still needs them */
+int cow_discard(uint32_t lba, uint32_t count);
+
+/* Flush the disk, recording which sectors are in the delta first */
+int cow_flush(void);
+
+#endif
@@ -0,0 +1,104 @@
+/* crc32c.c - CRC32C (Castagnoli) checksums
+ *
+ * SSE4.2 added a crc32 instruction for this polynomial. It has a latency of
+ * three cycles but can start a new one every cycle, so the hardware path runs
+ * three independent streams over adjacent parts of the buffer and merges them
+ * with a table that advances a CRC over a fixed run of zero bytes. CPUs
+ * without the instruction fall back to a 256-entry byte table. Tables are
+ * built on first use.
+ */
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78u  // Castagnoli polynomial, bit-reversed
+#define STREAM_BYTES 168         // Bytes per stream per block: 3 * 168 + 8 = one 512-byte sector
+
+static uint32_t crc_table[256];         // CRC register after one byte
+static uint32_t shift_table[4][256];    // CRC register after STREAM_BYTES zero bytes, per input byte
+static int tables_ready = 0;
+static int hw_state = -1;  // -1 until CPUID has been asked, then 0 or 1
+
+static void crc_tables_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc_table[i] = c;
+    }
+
+    // Advancing over zeros is linear: work out where each register bit ends up,
+    // then combine those for every byte value
+    uint32_t bit_shift[32];
+    for (int b = 0; b < 32; ++b) {
+        uint32_t c = 1u << b;
+        for (int n = 0; n < STREAM_BYTES; ++n) c = crc_table[c & 0xFF] ^ (c >> 8);
+        bit_shift[b] = c;
+    }
+    for (int k = 0; k < 4; ++k) {
+        for (uint32_t v = 0; v < 256; ++v) {
+            uint32_t c = 0;
+            for (int j = 0; j < 8; ++j) {
+                if (v & (1u << j)) c ^= bit_shift[k * 8 + j];
+            }
+            shift_table[k][v] = c;
+        }
+    }
+    tables_ready = 1;
+}
+
+/* CRC register c advanced over STREAM_BYTES zero bytes */
+static uint32_t crc_shift(uint32_t c) {
+    return shift_table[0][c & 0xFF] ^ shift_table[1][(c >> 8) & 0xFF] ^
+           shift_table[2][(c >> 16) & 0xFF] ^ shift_table[3][c >> 24];
+}
+
+int crc32c_hw(void) {
+    if (hw_state < 0) {
+        uint32_t eax = 1, ebx, ecx, edx;
+        __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+        hw_state = (ecx >> 20) & 1;  // CPUID.1:ECX bit 20 = SSE4.2
+    }
+    return hw_state;
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len) {
+    if (!tables_ready) crc_tables_init();
+    const uint8_t *p = (const uint8_t *)buf;
+    crc = ~crc;
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    if (!crc32c_hw()) return crc32c_sw(crc, buf, len);
+    if (!tables_ready) crc_tables_init();
+
+    const uint8_t *p = (const uint8_t *)buf;
+    uint64_t c0 = (uint32_t)~crc;
+
+    // Bytes up to an 8-byte boundary
+    for (; len && ((uintptr_t)p & 7); --len, ++p) {
+        __asm__ ("crc32b %1, %k0" : "+r"(c0) : "rm"(*p));
+    }
+
+    // Three streams at a time; c1 and c2 start from zero and are merged in afterwards
+    while (len >= 3 * STREAM_BYTES) {
+        uint64_t c1 = 0, c2 = 0;
+        const uint64_t *q = (const uint64_t *)p;
+        for (int i = 0; i < STREAM_BYTES / 8; ++i) {
+            __asm__ ("crc32q %1, %0" : "+r"(c0) : "rm"(q[i]));
+            __asm__ ("crc32q %1, %0" : "+r"(c1) : "rm"(q[i + STREAM_BYTES / 8]));
+            __asm__ ("crc32q %1, %0" : "+r"(c2) : "rm"(q[i + 2 * STREAM_BYTES / 8]));
+        }
+        c0 = crc_shift(crc_shift((uint32_t)c0) ^ (uint32_t)c1) ^ (uint32_t)c2;
+        p += 3 * STREAM_BYTES;
+        len -= 3 * STREAM_BYTES;
+    }
+
+    // Remaining quadwords, then the tail
+    for (; len >= 8; len -= 8, p += 8) {
+        __asm__ ("crc32q %1, %0" : "+r"(c0) : "rm"(*(const uint64_t *)p));
+    }
+    for (; len; --len, ++p) {
+        __asm__ ("crc32b %1, %k0" : "+r"(c0) : "rm"(*p));
+    }
+    return ~(uint32_t)c0;
+}
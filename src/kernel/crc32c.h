@@ -0,0 +1,18 @@
+/* crc32c.h - CRC32C (Castagnoli) checksums */
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Extend crc over len bytes of buf (start with crc = 0). Uses the SSE4.2 crc32
+   instruction when the CPU has it, otherwise crc32c_sw */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* Same result computed with a lookup table, one byte at a time */
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len);
+
+/* Check if crc32c uses the hardware instruction */
+int crc32c_hw(void);
+
+#endif
@@ -0,0 +1,148 @@
+/* crypt.c - Encrypted block device layer
+ *
+ * XTS-AES-128 (IEEE 1619) with one data unit per 512-byte sector: the sector
+ * number encrypted with the tweak key gives the first block's tweak, each
+ * later tweak is the previous one times x in GF(2^128), and every block is
+ * encrypted as AES(P ^ T) ^ T with the data key. Tweaks for a whole sector
+ * are worked out first, so the 32 blocks go through AES in one call and the
+ * AES-NI path keeps several in flight. Writes are encrypted into a bounce
+ * buffer, so a long write becomes one command per CRYPT_BATCH sectors.
+ *
+ * The key comes from the passphrase through PBKDF2-HMAC-SHA256 with a random
+ * per-volume salt, kept with the iteration count in a header sector, so the
+ * same passphrase gives different keys on different volumes and every guess
+ * costs an attacker as many HMACs as it costs the kernel at boot.
+ */
+#include "crypt.h"
+#include "aes.h"
+#include "sha256.h"
+#include "kstring.h"
+
+#define CRYPT_SECTOR 512
+#define CRYPT_BLOCKS (CRYPT_SECTOR / AES_BLOCK)
+#define CRYPT_BATCH 32                // Sectors encrypted per write command
+#define CRYPT_MAGIC 0x31535458u       // Volume header, "XTS1"
+#define CRYPT_KDF_ITERATIONS 100000u  // PBKDF2 iterations for new volumes
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+
+/* Volume header: the only sector of the volume kept in the clear */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t iterations;              // PBKDF2 iterations the key is derived with
+    uint8_t salt[CRYPT_SALT_BYTES];   // Chosen when the header is written
+    uint8_t check[16];                // Start of the SHA-256 of the key
+} crypt_header_t;
+
+static crypt_callbacks_t callbacks;
+static int enabled = 0;
+static aes128_key_t data_key, tweak_key;
+static uint8_t bounce[CRYPT_BATCH * CRYPT_SECTOR];
+
+void crypt_set_callbacks(const crypt_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+void crypt_set_key(const uint8_t key[CRYPT_KEY_BYTES]) {
+    aes128_set_key(&data_key, key);
+    aes128_set_key(&tweak_key, key + 16);
+    enabled = 1;
+}
+
+/* PBKDF2-HMAC-SHA256 over the passphrase with the volume's salt and iteration count. A
+   volume without a header gets one here, written in the clear before any sector is
+   encrypted. The header keeps the start of the key's SHA-256, so a wrong passphrase is
+   refused instead of decrypting the disk into noise */
+int crypt_set_passphrase(const char *passphrase, uint32_t header_lba, const uint8_t salt[CRYPT_SALT_BYTES]) {
+    static uint8_t sector[CRYPT_SECTOR];
+    crypt_header_t *hdr = (crypt_header_t *)sector;
+    size_t len = 0;
+    while (passphrase[len]) len++;
+
+    if (callbacks.disk_read_sectors(header_lba, 1, sector) != 0) return -1;
+    int fresh = hdr->magic != CRYPT_MAGIC;
+    if (fresh) {
+        kmemset(sector, 0, CRYPT_SECTOR);
+        hdr->magic = CRYPT_MAGIC;
+        hdr->iterations = CRYPT_KDF_ITERATIONS;
+        kmemcpy(hdr->salt, salt, CRYPT_SALT_BYTES);
+    } else if (hdr->iterations == 0) {
+        return -1;
+    }
+
+    uint8_t key[CRYPT_KEY_BYTES], check[SHA256_DIGEST];
+    sha256_t hash;
+    pbkdf2_sha256(passphrase, len, hdr->salt, CRYPT_SALT_BYTES, hdr->iterations, key, sizeof(key));
+    sha256_init(&hash);
+    sha256_update(&hash, key, sizeof(key));
+    sha256_final(&hash, check);
+
+    int r = 0;
+    if (fresh) {
+        kmemcpy(hdr->check, check, sizeof(hdr->check));
+        if (callbacks.disk_write_sectors(header_lba, 1, sector) != 0 || crypt_flush() != 0) r = -1;
+    } else {
+        uint8_t diff = 0;
+        for (size_t i = 0; i < sizeof(hdr->check); ++i) diff |= hdr->check[i] ^ check[i];
+        if (diff) r = -1;
+    }
+    if (r == 0) crypt_set_key(key);
+    kmemset(key, 0, sizeof(key));
+    kmemset(check, 0, sizeof(check));
+    return r;
+}
+
+int crypt_enabled(void) {
+    return enabled;
+}
+
+/* Encrypt or decrypt one sector in place */
+static void xts_sector(uint32_t lba, uint8_t *sec, int decrypt) {
+    uint64_t tweaks[CRYPT_SECTOR / 8];
+    tweaks[0] = lba;  // Sector number, little-endian
+    tweaks[1] = 0;
+    aes128_encrypt_blocks(&tweak_key, (uint8_t *)tweaks, 1);
+
+    // Next tweak = previous times x: a 128-bit little-endian shift, folding the carry back in
+    for (int j = 2; j < CRYPT_SECTOR / 8; j += 2) {
+        uint64_t lo = tweaks[j - 2], hi = tweaks[j - 1];
+        tweaks[j] = (lo << 1) ^ (0x87 & -(hi >> 63));
+        tweaks[j + 1] = (hi << 1) | (lo >> 63);
+    }
+
+    unaligned_u64 *w = (unaligned_u64 *)sec;
+    for (int i = 0; i < CRYPT_SECTOR / 8; ++i) w[i] ^= tweaks[i];
+    if (decrypt) aes128_decrypt_blocks(&data_key, sec, CRYPT_BLOCKS);
+    else aes128_encrypt_blocks(&data_key, sec, CRYPT_BLOCKS);
+    for (int i = 0; i < CRYPT_SECTOR / 8; ++i) w[i] ^= tweaks[i];
+}
+
+int crypt_read_sectors(uint32_t lba, uint32_t count, void *buf) {
+    if (callbacks.disk_read_sectors(lba, count, buf) != 0) return -1;
+    if (!enabled) return 0;
+    for (uint32_t s = 0; s < count; ++s) xts_sector(lba + s, (uint8_t *)buf + (size_t)s * CRYPT_SECTOR, 1);
+    return 0;
+}
+
+int crypt_write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+    if (!enabled) return callbacks.disk_write_sectors(lba, count, buf);
+    const uint8_t *src = (const uint8_t *)buf;
+    while (count > 0) {
+        uint32_t n = count < CRYPT_BATCH ? count : CRYPT_BATCH;
+        kmemcpy(bounce, src, (size_t)n * CRYPT_SECTOR);
+        for (uint32_t s = 0; s < n; ++s) xts_sector(lba + s, bounce + (size_t)s * CRYPT_SECTOR, 0);
+        if (callbacks.disk_write_sectors(lba, n, bounce) != 0) return -1;
+        lba += n;
+        src += (size_t)n * CRYPT_SECTOR;
+        count -= n;
+    }
+    return 0;
+}
+
+int crypt_flush(void) {
+    return callbacks.disk_flush ? callbacks.disk_flush() : 0;
+}
+
+int crypt_discard(uint32_t lba, uint32_t count) {
+    return callbacks.disk_discard ? callbacks.disk_discard(lba, count) : 0;
+}
@@ -0,0 +1,46 @@
+/* crypt.h - Encrypted block device layer (AES-XTS per sector) */
+#ifndef CRYPT_H
+#define CRYPT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CRYPT_KEY_BYTES 32       // XTS-AES-128: data key, then tweak key
+#define CRYPT_PASSPHRASE_MAX 128  // Longest passphrase the kernel takes from the command line, with the zero
+#define CRYPT_SALT_BYTES 16       // Per-volume salt for the passphrase KDF
+
+/* Sector I/O callbacks of the disk underneath - must be provided by kernel (or a host harness) */
+typedef struct {
+    int (*disk_read_sectors)(uint32_t lba, uint32_t count, void *buf);         // Return 0 on success
+    int (*disk_write_sectors)(uint32_t lba, uint32_t count, const void *buf);  // Return 0 on success
+    int (*disk_flush)(void);  // Optional (may be NULL): make every completed write durable
+    int (*disk_discard)(uint32_t lba, uint32_t count);  // Optional (may be NULL): sectors no longer hold data
+} crypt_callbacks_t;
+
+/* Set the callbacks that the layer will use */
+void crypt_set_callbacks(const crypt_callbacks_t *callbacks);
+
+/* Encrypt everything from now on with this key. Until a key is set, sectors pass through */
+void crypt_set_key(const uint8_t key[CRYPT_KEY_BYTES]);
+
+/* Derive the key from a passphrase with PBKDF2-HMAC-SHA256 and the salt in the volume header
+   at header_lba (kept in the clear, outside the sectors being encrypted), and set it. A disk
+   without a header gets one with the given salt, which should be random. Returns 0, or -1
+   if the passphrase does not match the header or the header could not be read or written;
+   no key is set then */
+int crypt_set_passphrase(const char *passphrase, uint32_t header_lba, const uint8_t salt[CRYPT_SALT_BYTES]);
+
+/* Check if a key is set */
+int crypt_enabled(void);
+
+/* Sector I/O through the layer, same contract as the disk callbacks. Each sector is
+   encrypted on its own with its LBA as the tweak; the caller's buffer is left untouched
+   on writes and decrypted in place on reads */
+int crypt_read_sectors(uint32_t lba, uint32_t count, void *buf);
+int crypt_write_sectors(uint32_t lba, uint32_t count, const void *buf);
+int crypt_flush(void);
+
+/* Pass a discard straight down: discarded sectors read back as whatever the disk returns */
+int crypt_discard(uint32_t lba, uint32_t count);
+
+#endif
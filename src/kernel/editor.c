@@ -76,21 +76,35 @@ typedef struct {
     char ch;              // Character that was inserted or deleted
 } action_t;
 
-#define UNDO_STACK_SIZE 512   // Maximum number of undo operations to remember
+#define UNDO_STACK_INITIAL 64  // Actions the undo/redo stacks hold before they first grow
 
-static action_t undo_stack[UNDO_STACK_SIZE];  // Stack of actions that can be undone
+// Both stacks live on the kernel heap and double whenever they fill up, so the history is as
+// long as the editing session needs
+static action_t *undo_stack = 0;               // Stack of actions that can be undone
 static int undo_top = 0;                       // Index of next free slot in undo stack
+static int undo_cap = 0;                       // Actions the undo stack has room for
 
-static action_t redo_stack[UNDO_STACK_SIZE];  // Stack of actions that can be redone
+static action_t *redo_stack = 0;               // Stack of actions that can be redone
 static int redo_top = 0;                       // Index of next free slot in redo stack
+static int redo_cap = 0;                       // Actions the redo stack has room for
 
 /* ============================================================================
    UNDO/REDO STACK OPERATIONS
    ============================================================================ */
 
+// Double a stack's room through the kernel heap. Returns 1 if successful, 0 if out of memory
+static int stack_grow(action_t **stack, int *cap) {
+    int n = *cap ? *cap * 2 : UNDO_STACK_INITIAL;
+    action_t *p = (action_t *)callbacks.mem_realloc(*stack, (size_t)n * sizeof(action_t));
+    if (!p) return 0;                     // Keep the old stack; the action is not recorded
+    *stack = p;
+    *cap = n;
+    return 1;
+}
+
 // Push an action onto the undo stack
 static void undo_push(action_t a) {
-    if (undo_top < UNDO_STACK_SIZE)       // Check if there's space in the stack
+    if (undo_top < undo_cap || stack_grow(&undo_stack, &undo_cap)) // Make room if it's full
         undo_stack[undo_top++] = a;       // Store action and increment top pointer
 }
 
@@ -103,7 +117,7 @@ static int undo_pop(action_t *out) {
 
 // Push an action onto the redo stack
 static void redo_push(action_t a) {
-    if (redo_top < UNDO_STACK_SIZE)       // Check if there's space in the stack
+    if (redo_top < redo_cap || stack_grow(&redo_stack, &redo_cap)) // Make room if it's full
         redo_stack[redo_top++] = a;       // Store action and increment top pointer
 }
 
@@ -566,18 +580,18 @@ static void finish_prompt(void) {
 
     if (prompt_mode == PROMPT_SAVE) {     // Save operation
         // Write buffer to file using callback
-        int r = callbacks.fat_write(prompt_buf,
-                                    (const uint8_t*)edit_buf,
-                                    edit_len);
+        int r = callbacks.file_write(prompt_buf,
+                                     (const uint8_t*)edit_buf,
+                                     edit_len);
 
         // Display result message
         callbacks.print_message(r == 0 ? "File saved.\n" : "Save failed.\n");
 
     } else if (prompt_mode == PROMPT_OPEN) {  // Open operation
         // Read file into buffer using callback
-        int r = callbacks.fat_read(prompt_buf,
-                                   (uint8_t*)edit_buf,
-                                   EDIT_BUF_SIZE);
+        int r = callbacks.file_read(prompt_buf,
+                                    (uint8_t*)edit_buf,
+                                    EDIT_BUF_SIZE);
 
         if (r >= 0) {                     // Read successful
             edit_len = r;                 // Update buffer length
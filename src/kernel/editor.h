@@ -21,9 +21,10 @@ int editor_is_active(void);
 typedef struct {
     void (*clear_screen)(void);
     void (*draw_char)(size_t row, size_t col, char ch, uint8_t attr);
-    int (*fat_write)(const char *name, const uint8_t *data, size_t len);
-    int (*fat_read)(const char *name, uint8_t *buf, size_t maxlen);
+    int (*file_write)(const char *path, const uint8_t *data, size_t len);
+    int (*file_read)(const char *path, uint8_t *buf, size_t maxlen);
     void (*print_message)(const char *msg);
+    void *(*mem_realloc)(void *p, size_t size);  // Resize a heap block (NULL p allocates), NULL if out of memory
 } editor_callbacks_t;
 
 /* Set the callbacks that editor will use */
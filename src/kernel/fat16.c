@@ -0,0 +1,1980 @@
+/* fat16.c - FAT16 filesystem on top of kernel-provided sector I/O */
+#include "fat16.h"
+#include "pcache.h"
+#include "kstring.h"
+#include "crc32c.h"
+#include "lz4.h"
+
+static fat16_callbacks_t callbacks;  // Sector read/write functions supplied by the kernel
+
+/* Chains of clusters waiting to be freed (see fat16_reclaim_step) */
+#define RECLAIM_QUEUE_SIZE 64   // Chains that can be waiting to be freed
+
+static uint16_t reclaim_queue[RECLAIM_QUEUE_SIZE];  // First cluster of each queued chain
+static size_t reclaim_head = 0;                     // Index of the oldest queued chain
+static size_t reclaim_count = 0;                    // Number of queued chains
+
+static uint32_t meta_generation = 0;  // Bumped on every FAT or directory write (see fat16_defrag_step)
+
+static const pcache_ops_t fat16_pcache_ops;  // File data goes through the page cache (see FILE PAGES)
+static void extent_map_invalidate(int ino);        // Cluster lookups are cached per file (see EXTENT MAPS)
+static void discard_note(uint16_t cluster, int freed);  // Freed clusters are discarded later (see DISCARDS)
+static void discard_forget(void);
+
+/* Set callback functions for sector I/O */
+void fat16_set_callbacks(const fat16_callbacks_t *cb) {
+    callbacks = *cb;  // Copy callback structure
+}
+
+/* ============================================================================
+   FAT16 FILESYSTEM IMPLEMENTATION
+   ============================================================================ */
+ // FAT16 filesystem for persistent storage
+ // Layout: Boot sector | FAT tables | Root directory | Data area
+
+/* Filesystem Parameters (SECTOR_SIZE and TOTAL_SECTORS are in fat16.h) */
+#define BYTES_PER_SECTOR 512      // Bytes per sector
+#define SECTORS_PER_CLUSTER 1     // Cluster size = 512 bytes
+#define RESERVED_SECTORS 3        // Boot sector, two copies of the metadata checksum table
+#define NUM_FATS 2                // Two FAT copies for redundancy
+#define ROOT_DIR_ENTRIES 512      // Max files in root directory
+#define SECTORS_PER_FAT 4         // Size of each FAT table
+
+/* Calculate number of sectors occupied by root directory */
+static uint32_t root_dir_sectors(void) {
+    // Each directory entry is 32 bytes
+    return ((ROOT_DIR_ENTRIES * 32) + (BYTES_PER_SECTOR - 1)) / BYTES_PER_SECTOR;
+}
+
+/* Calculate first sector of data area (where file contents are stored) */
+static uint32_t first_data_sector(void) {
+    return RESERVED_SECTORS + (NUM_FATS * SECTORS_PER_FAT) + root_dir_sectors();
+}
+
+/* Calculate first sector of FAT table */
+static uint32_t first_fat_sector(void) {
+    return RESERVED_SECTORS;
+}
+
+/* ============================================================================
+   METADATA CHECKSUMS
+   ============================================================================ */
+// Every FAT and root directory sector has a CRC32C in a side table. Sectors
+// are stamped as they are written and verified as they are read, so a torn or
+// corrupted sector is caught before the filesystem acts on it. A bad FAT
+// sector whose twin in the other FAT copy still matches is repaired from it.
+//
+// The table is kept in memory and stored by fat16_sync and the idle loop, in
+// two reserved sectors of its own used in turn, each with a sequence number
+// and a CRC of its own: a torn table write leaves the previous copy. Before the
+// first metadata write after a store, the copy on disk is marked open, so a
+// mount can tell sectors written since the last store (stale CRCs are expected
+// there) from damage on a volume that was closed cleanly.
+//
+// Verified sectors are kept in a small write-through cache, so walking a chain
+// (one FAT entry at a time) checks each FAT sector once instead of on every link.
+
+#define META_SECTORS (RESERVED_SECTORS + NUM_FATS * SECTORS_PER_FAT + (ROOT_DIR_ENTRIES * 32) / BYTES_PER_SECTOR)
+#define CRC_TABLE_SECTOR 1  // The two table copies follow the boot sector
+#define CRC_TABLE_HEADER 12  // Table layout: magic, sequence, open flag, one CRC per sector, own CRC
+#define CRC_TABLE_BYTES (CRC_TABLE_HEADER + META_SECTORS * 4)  // Bytes covered by the table's own CRC
+static const uint8_t crc_magic[4] = { 'C', 'R', 'C', '2' };
+
+static int meta_checksums = 1;           // Format new volumes with a checksum table
+static int meta_crc_on = 0;              // Flag: 1 when the mounted volume has a checksum table
+static int meta_crc_dirty = 0;           // Flag: 1 when the table on disk is out of date
+static int meta_open = 0;                // Flag: 1 when the table on disk is marked open
+static int meta_formatting = 0;          // Flag: fat16_init is writing, the table goes out once at the end
+static uint32_t meta_seq = 0;            // Sequence number of the newest table copy on disk
+static uint32_t meta_crc[META_SECTORS];  // Expected CRC32C of each metadata sector (boot and table entries unused)
+static fat16_check_stats_t meta_stats;   // Errors found since the volume was mounted
+static uint32_t meta_refused = 0;        // Bumped on every metadata read that failed or did not verify
+
+#define META_CACHE_SLOTS 8  // Cached metadata sectors (direct-mapped by sector number)
+
+typedef struct {
+    uint32_t sec;     // Sector held by this slot (0 when empty, sector 0 is never cached)
+    uint8_t data[SECTOR_SIZE];
+} meta_cache_slot_t;
+
+static meta_cache_slot_t meta_cache[META_CACHE_SLOTS];
+
+static int is_meta_sector(uint32_t sec) {
+    return sec >= RESERVED_SECTORS && sec < META_SECTORS;
+}
+
+/* Copy a metadata sector into the cache, replacing whatever shared its slot */
+static void meta_cache_put(uint32_t sec, const void *buf) {
+    meta_cache_slot_t *slot = &meta_cache[sec % META_CACHE_SLOTS];
+    slot->sec = sec;
+    kmemcpy(slot->data, buf, SECTOR_SIZE);
+}
+
+static void meta_cache_clear(void) {
+    for (int i = 0; i < META_CACHE_SLOTS; ++i) meta_cache[i].sec = 0;
+}
+
+/* Record the checksum of a metadata sector that is being written */
+static void meta_stamp(uint32_t sec, const void *buf) {
+    if (!meta_crc_on || !is_meta_sector(sec)) return;
+    meta_crc[sec] = crc32c(0, buf, SECTOR_SIZE);
+    meta_crc_dirty = 1;
+}
+
+/* Check a metadata sector that was just read into buf, repairing FAT sectors from the
+   other copy when possible. Returns 0 if buf now holds good data */
+static int meta_verify(uint32_t sec, uint8_t *buf) {
+    if (!meta_crc_on || !is_meta_sector(sec)) return 0;
+    meta_stats.checked++;
+    if (crc32c(0, buf, SECTOR_SIZE) == meta_crc[sec]) return 0;
+    meta_stats.bad++;
+
+    uint32_t fat_end = RESERVED_SECTORS + NUM_FATS * SECTORS_PER_FAT;
+    if (sec < fat_end) {
+        // Both FAT copies hold the same data: take the twin if it still matches
+        uint32_t twin = sec < RESERVED_SECTORS + SECTORS_PER_FAT ? sec + SECTORS_PER_FAT : sec - SECTORS_PER_FAT;
+        uint8_t copy[SECTOR_SIZE];
+        if (callbacks.disk_read(twin, copy) == 0 && crc32c(0, copy, SECTOR_SIZE) == meta_crc[sec]) {
+            kmemcpy(buf, copy, SECTOR_SIZE);
+            callbacks.disk_write(sec, copy);  // Same contents the table expects, no restamp needed
+            meta_stats.repaired++;
+            return 0;
+        }
+    }
+    return -1;  // Directory sector, or both FAT copies damaged
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Write the next table copy, over the older of the two */
+static void meta_table_write(int open) {
+    uint8_t sec[SECTOR_SIZE];
+    kmemset(sec, 0, SECTOR_SIZE);
+    kmemcpy(sec, crc_magic, sizeof(crc_magic));
+    put32(sec + 4, ++meta_seq);
+    put32(sec + 8, (uint32_t)open);
+    for (uint32_t i = 0; i < META_SECTORS; ++i) put32(sec + CRC_TABLE_HEADER + i * 4, meta_crc[i]);
+    put32(sec + CRC_TABLE_BYTES, crc32c(0, sec, CRC_TABLE_BYTES));
+    callbacks.disk_write(CRC_TABLE_SECTOR + meta_seq % 2, sec);
+}
+
+/* Check if the table on disk needs storing */
+static int meta_table_pending(void) {
+    return meta_crc_on && (meta_crc_dirty || meta_open);
+}
+
+/* Store the checksum table if it changed (sync and idle loop): the metadata it vouches for
+   reaches the medium first, and the table is durable on return. Returns 1 if it was stored
+   (the disk has been flushed), 0 if there was nothing to store */
+static int meta_table_store(void) {
+    if (!meta_table_pending()) return 0;
+    if (callbacks.disk_flush) callbacks.disk_flush();
+    meta_table_write(0);
+    if (callbacks.disk_flush) callbacks.disk_flush();
+    meta_crc_dirty = 0;
+    meta_open = 0;
+    return 1;
+}
+
+/* Called before a metadata sector is written: the first write after a store marks the table
+   on disk open, durably, before the sector can reach the medium */
+static void meta_mark_open(void) {
+    if (!meta_crc_on || meta_open || meta_formatting) return;
+    meta_table_write(1);
+    if (callbacks.disk_flush) callbacks.disk_flush();
+    meta_open = 1;
+}
+
+/* Load the newest intact table copy of the volume on disk. Returns 1 if it is marked open,
+   0 if not (or if the volume has no table) */
+static int meta_table_load(void) {
+    uint8_t sec[SECTOR_SIZE];
+    int found = 0, open = 0;
+    meta_crc_on = 0;
+    for (uint32_t copy = 0; copy < 2; ++copy) {
+        if (callbacks.disk_read(CRC_TABLE_SECTOR + copy, sec) != 0) continue;
+        int ok = crc32c(0, sec, CRC_TABLE_BYTES) == get32(sec + CRC_TABLE_BYTES);
+        for (size_t i = 0; i < sizeof(crc_magic); ++i) {
+            if (sec[i] != crc_magic[i]) ok = 0;
+        }
+        uint32_t seq = get32(sec + 4);
+        if (!ok || (found && (int32_t)(seq - meta_seq) <= 0)) continue;
+        found = 1;
+        meta_seq = seq;
+        open = get32(sec + 8) != 0;
+        for (uint32_t i = 0; i < META_SECTORS; ++i) meta_crc[i] = get32(sec + CRC_TABLE_HEADER + i * 4);
+    }
+    meta_crc_on = found;
+    meta_crc_dirty = 0;
+    meta_open = found && open;
+    return meta_open;
+}
+
+/* After an unclean shutdown, take the metadata sectors written since the last store as they
+   are: a FAT sector whose twin holds the same bytes, or any directory sector (which has no
+   twin). Other bad FAT sectors go through meta_verify as usual. Then store a clean table */
+static void meta_recover(void) {
+    uint32_t fat_end = RESERVED_SECTORS + NUM_FATS * SECTORS_PER_FAT;
+    uint8_t buf[SECTOR_SIZE], twin[SECTOR_SIZE];
+    for (uint32_t sec = RESERVED_SECTORS; sec < META_SECTORS; ++sec) {
+        if (callbacks.disk_read(sec, buf) != 0 || crc32c(0, buf, SECTOR_SIZE) == meta_crc[sec]) continue;
+        int take = 1;
+        if (sec < fat_end) {
+            uint32_t other = sec < RESERVED_SECTORS + SECTORS_PER_FAT ? sec + SECTORS_PER_FAT : sec - SECTORS_PER_FAT;
+            take = callbacks.disk_read(other, twin) == 0;
+            for (size_t i = 0; take && i < SECTOR_SIZE; ++i) take = buf[i] == twin[i];
+        }
+        if (!take) {
+            meta_verify(sec, buf);  // Repaired from the twin if that still matches
+            continue;
+        }
+        meta_crc[sec] = crc32c(0, buf, SECTOR_SIZE);
+        meta_crc_dirty = 1;
+    }
+    meta_table_store();
+}
+
+void fat16_set_checksums(int enabled) {
+    meta_checksums = enabled;
+}
+
+/* Verified contents of a metadata sector, read from the disk only if it is not cached.
+   Returns NULL (and bumps meta_refused) if the sector cannot be read or fails its
+   checksum. The pointer stays valid until the next metadata access */
+static const uint8_t *meta_read(uint32_t sec) {
+    meta_cache_slot_t *slot = &meta_cache[sec % META_CACHE_SLOTS];
+    if (slot->sec == sec) return slot->data;
+
+    slot->sec = 0;
+    // Bad sectors are counted in meta_stats and not cached, so every read reports them
+    if (callbacks.disk_read(sec, slot->data) != 0 || meta_verify(sec, slot->data) != 0) {
+        meta_refused++;
+        return NULL;
+    }
+    slot->sec = sec;
+    return slot->data;
+}
+
+/* Read a sector with bounds checking. Returns 0, or -1 with buf zeroed if the sector is
+   out of bounds, unreadable or (for metadata) fails its checksum */
+static int read_sector(uint32_t sec, void *buf) {
+    if (is_meta_sector(sec)) {
+        const uint8_t *data = meta_read(sec);
+        if (!data) {
+            kmemset(buf, 0, SECTOR_SIZE);
+            return -1;
+        }
+        kmemcpy(buf, data, SECTOR_SIZE);
+        return 0;
+    }
+    if (sec >= TOTAL_SECTORS || callbacks.disk_read(sec, buf) != 0) {
+        kmemset(buf, 0, SECTOR_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+/* Write a sector with bounds checking */
+static void write_sector(uint32_t sec, const void *buf) {
+    if (sec >= TOTAL_SECTORS) return;  // Ignore out-of-bounds writes
+    if (sec < first_data_sector()) meta_generation++;  // FAT or directory changed
+    if (is_meta_sector(sec)) {
+        meta_mark_open();
+        meta_stamp(sec, buf);
+        meta_cache_put(sec, buf);
+    }
+    callbacks.disk_write(sec, buf);
+}
+
+/* Read count consecutive sectors, with a single command if the kernel provides one */
+static void read_sectors(uint32_t sec, uint32_t count, void *buf) {
+    uint8_t *dst = (uint8_t *)buf;
+    if (!callbacks.disk_read_sectors || sec + count > TOTAL_SECTORS) {
+        for (uint32_t i = 0; i < count; ++i) read_sector(sec + i, dst + (size_t)i * SECTOR_SIZE);
+        return;
+    }
+    if (callbacks.disk_read_sectors(sec, count, buf) != 0) kmemset(buf, 0, (size_t)count * SECTOR_SIZE);
+}
+
+/* Write count consecutive sectors, with a single command if the kernel provides one */
+static void write_sectors(uint32_t sec, uint32_t count, const void *buf) {
+    const uint8_t *src = (const uint8_t *)buf;
+    if (!callbacks.disk_write_sectors || sec + count > TOTAL_SECTORS) {
+        for (uint32_t i = 0; i < count; ++i) write_sector(sec + i, src + (size_t)i * SECTOR_SIZE);
+        return;
+    }
+    if (sec < first_data_sector()) meta_generation++;  // FAT or directory changed
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!is_meta_sector(sec + i)) continue;
+        meta_mark_open();
+        meta_stamp(sec + i, src + (size_t)i * SECTOR_SIZE);
+        meta_cache_put(sec + i, src + (size_t)i * SECTOR_SIZE);
+    }
+    callbacks.disk_write_sectors(sec, count, buf);
+}
+
+/* Forget everything cached about the previous volume */
+static void volume_reset(void) {
+    reclaim_head = 0;
+    reclaim_count = 0;
+    discard_forget();
+    pcache_invalidate(&fat16_pcache_ops, 0, -1, 0);
+    extent_map_invalidate(-1);
+    meta_cache_clear();
+    meta_stats.checked = meta_stats.bad = meta_stats.repaired = 0;
+}
+
+/* Initialise FAT16 filesystem by creating boot sector and FAT tables */
+void fat16_init(void) {
+    /* Nothing from a previous volume is left to reclaim */
+    volume_reset();
+    meta_crc_on = meta_checksums;  // Stamp every sector written below
+    meta_formatting = 1;
+    meta_open = 0;
+    meta_seq = 0;
+
+    /* Zero out all sectors on disk */
+    uint8_t zero[SECTOR_SIZE];
+    kmemset(zero, 0, SECTOR_SIZE);
+    for (uint32_t s = 0; s < TOTAL_SECTORS; ++s) {
+        write_sector(s, zero);
+    }
+
+    /* Create Boot Parameter Block (BPB) in sector 0 */
+    uint8_t bpb[SECTOR_SIZE];
+    kmemset(bpb, 0, SECTOR_SIZE);
+
+    // Jump instruction and NOP
+    bpb[0] = 0xEB; bpb[1] = 0x3C; bpb[2] = 0x90;
+
+    // OEM identifier (8 bytes)
+    const char *oem = "ATAFAT16";
+    for (size_t i = 0; i < 8; ++i) bpb[3+i] = (i < 8) ? oem[i] : ' ';
+
+    // Bytes per sector (little-endian format, stores the least-significant byte at the smallest address)
+    bpb[11] = (BYTES_PER_SECTOR & 0xFF);
+    bpb[12] = (BYTES_PER_SECTOR >> 8) & 0xFF;
+
+    // Sectors per cluster
+    bpb[13] = SECTORS_PER_CLUSTER;
+
+    // Reserved sectors (little-endian)
+    bpb[14] = (RESERVED_SECTORS & 0xFF);
+    bpb[15] = (RESERVED_SECTORS >> 8) & 0xFF;
+
+    // Root directory entries (little-endian)
+    bpb[16] = ROOT_DIR_ENTRIES & 0xFF;
+    bpb[17] = (ROOT_DIR_ENTRIES >> 8) & 0xFF;
+
+    // Total sectors (16-bit, little-endian)
+    uint16_t totsec16 = (TOTAL_SECTORS <= 0xFFFF) ? (uint16_t)TOTAL_SECTORS : 0;
+    bpb[19] = (totsec16 & 0xFF);
+    bpb[20] = (totsec16 >> 8) & 0xFF;
+
+    // Media descriptor (0xF8 = fixed disk)
+    bpb[21] = 0xF8;
+
+    // Sectors per FAT (little-endian)
+    bpb[22] = SECTORS_PER_FAT & 0xFF;
+    bpb[23] = (SECTORS_PER_FAT >> 8) & 0xFF;
+
+    // Sectors per track, heads, hidden sectors (zeros for simplicity)
+    bpb[24] = 0; bpb[25] = 0;
+    bpb[26] = 0; bpb[27] = 0;
+    bpb[28] = 0; bpb[29] = 0; bpb[30] = 0; bpb[31] = 0;
+
+    // Extended boot signature
+    bpb[38] = 0x29;
+
+    // Volume label (11 bytes, space-padded)
+    const char *label = "ATADISK    ";
+    for (size_t i = 0; i < 11; ++i) bpb[43 + i] = label[i];
+
+    // Filesystem type (8 bytes, space-padded)
+    const char *fs = "FAT16   ";
+    for (size_t i = 0; i < 8; ++i) bpb[54 + i] = fs[i];
+
+    // Write boot sector
+    write_sector(0, bpb);
+
+    /* Initialise both FAT tables */
+    uint8_t fatsec[SECTOR_SIZE];
+    for (size_t s = 0; s < SECTORS_PER_FAT; ++s) {
+        // Zero out FAT sector
+        kmemset(fatsec, 0, SECTOR_SIZE);
+
+        // First FAT sector has special media descriptor entries
+        if (s == 0) {
+            fatsec[0] = 0xF8; fatsec[1] = 0xFF;  // Media descriptor
+            fatsec[2] = 0xFF; fatsec[3] = 0xFF;  // End of chain marker
+        }
+
+        // Write to both FAT copies
+        write_sector(first_fat_sector() + s, fatsec);
+        write_sector(first_fat_sector() + s + SECTORS_PER_FAT, fatsec);
+    }
+
+    // Checksums of the fresh metadata go into the first table copy
+    meta_formatting = 0;
+    meta_table_store();
+}
+
+int fat16_mount(void) {
+    volume_reset();
+    uint8_t boot[SECTOR_SIZE];
+    if (callbacks.disk_read(0, boot) != 0) return -1;
+
+    // Only volumes laid out the way fat16_init formats them are accepted
+    const char *fs = "FAT16   ";
+    for (size_t i = 0; i < 8; ++i) {
+        if (boot[54 + i] != (uint8_t)fs[i]) return -1;
+    }
+    if ((boot[11] | (boot[12] << 8)) != BYTES_PER_SECTOR || boot[13] != SECTORS_PER_CLUSTER ||
+        (boot[14] | (boot[15] << 8)) != RESERVED_SECTORS || (boot[16] | (boot[17] << 8)) != ROOT_DIR_ENTRIES ||
+        (boot[22] | (boot[23] << 8)) != SECTORS_PER_FAT) {
+        return -1;
+    }
+
+    if (meta_table_load()) meta_recover();  // Not closed cleanly
+    return 0;
+}
+
+int fat16_check(fat16_check_stats_t *stats) {
+    fat16_check_stats_t before = meta_stats;
+    uint8_t buf[SECTOR_SIZE];
+    for (uint32_t sec = RESERVED_SECTORS; sec < META_SECTORS; ++sec) {
+        // Straight from the disk: the cache only holds sectors that were good when read
+        if (callbacks.disk_read(sec, buf) != 0) {
+            meta_stats.checked++;
+            meta_stats.bad++;
+        } else if (meta_verify(sec, buf) == 0) {
+            meta_cache_put(sec, buf);
+        }
+    }
+
+    stats->checked = meta_stats.checked - before.checked;
+    stats->bad = meta_stats.bad - before.bad;
+    stats->repaired = meta_stats.repaired - before.repaired;
+    return (int)(stats->bad - stats->repaired);
+}
+
+void fat16_check_stats(fat16_check_stats_t *stats) {
+    *stats = meta_stats;
+}
+
+/* Read a FAT entry (cluster chain link) */
+static uint16_t fat_get_entry(uint16_t cluster) {
+    // Each FAT16 entry is 2 bytes
+    uint32_t fat_offset = (uint32_t)cluster * 2u;
+
+    // Determine which FAT sector contains this entry
+    uint32_t sec = first_fat_sector() + (fat_offset / SECTOR_SIZE);
+    uint32_t off = fat_offset % SECTOR_SIZE;
+
+    // Read the entry in place from the (verified) metadata cache. A sector that cannot be
+    // trusted reads as end-of-chain; callers notice through meta_refused
+    const uint8_t *secbuf = meta_read(sec);
+    if (!secbuf) return 0xFFFF;
+
+    // Handle case where entry spans two sectors
+    if (off == SECTOR_SIZE - 1) {
+        uint8_t lo = secbuf[off];
+        const uint8_t *nextsecbuf = meta_read(sec + 1);
+        if (!nextsecbuf) return 0xFFFF;
+        return (uint16_t)(lo | (nextsecbuf[0] << 8)); //return next cluster in chain
+    } else {
+        // Entry is within single sector
+        uint16_t val = secbuf[off] | (secbuf[off+1] << 8);
+        return val; //return 0xFFFF for end-of-chain
+    }
+}
+
+/* Write a FAT entry (update cluster chain link). Returns -1, writing nothing, if either
+   FAT copy of the sector fails its checksum: writing it back would bless the damage */
+static int fat_set_entry(uint16_t cluster, uint16_t val) {
+    // Calculate FAT entry location
+    uint32_t fat_offset = (uint32_t)cluster * 2u;
+    uint32_t sec = first_fat_sector() + (fat_offset / SECTOR_SIZE);
+    uint32_t off = fat_offset % SECTOR_SIZE;
+
+    uint8_t copies[NUM_FATS][SECTOR_SIZE];
+    for (int copy = 0; copy < NUM_FATS; ++copy) {
+        if (read_sector(sec + copy * SECTORS_PER_FAT, copies[copy]) != 0) return -1;
+    }
+
+    // Update both FAT copies
+    for (int copy = 0; copy < NUM_FATS; ++copy) {
+        uint8_t *secbuf = copies[copy];
+
+        // Write low byte
+        secbuf[off] = val & 0xFF; //val: Value to write (next cluster or end-of-chain marker)
+
+        // Handle entry spanning two sectors
+        if (off == SECTOR_SIZE - 1) {
+            write_sector(sec + copy * SECTORS_PER_FAT, secbuf);
+            uint8_t nextsecbuf[SECTOR_SIZE];
+            if (read_sector(sec + 1 + copy * SECTORS_PER_FAT, nextsecbuf) != 0) return -1;
+            nextsecbuf[0] = (val >> 8) & 0xFF;
+            write_sector(sec + 1 + copy * SECTORS_PER_FAT, nextsecbuf);
+        } else {
+            // Write high byte
+            secbuf[off+1] = (val >> 8) & 0xFF;
+            write_sector(sec + copy * SECTORS_PER_FAT, secbuf);
+        }
+    }
+    discard_note(cluster, val == 0x0000);
+    return 0;
+}
+
+/* Convert cluster number to disk sector number */
+static uint32_t cluster_to_sector(uint16_t cluster) {
+    // Cluster 2 is the first data cluster
+    return first_data_sector() + (cluster - 2) * SECTORS_PER_CLUSTER;
+}
+
+/* Number of clusters available in the data area */
+uint32_t fat16_data_clusters(void) {
+    uint32_t data_sectors = TOTAL_SECTORS - first_data_sector();
+    return data_sectors / SECTORS_PER_CLUSTER;
+}
+
+/* Find an unused cluster in the FAT memory */
+static int16_t fat_find_free_cluster(void) {
+    // Calculate how many data clusters are available
+    uint32_t max_clusters = fat16_data_clusters();
+
+    // Scan FAT for free entry (value 0x0000)
+    for (uint16_t c = 2; c < 2 + max_clusters; ++c) {
+        uint16_t v = fat_get_entry(c);
+        if (v == 0x0000) return (int16_t)c;
+    }
+    return -1;  // No free clusters, disk full
+}
+
+/* Convert filename to DOS 8.3 format (space-padded) */
+static void make_dos_name(const char *in, uint8_t out[11]) {
+    // Initialise with spaces
+    for (int i = 0; i < 11; ++i) out[i] = ' ';
+
+    // Copy filename part (up to 8 characters)
+    int j = 0;
+    while (*in && *in != '.' && j < 8) {
+        char c = *in++;
+        if (c >= 'a' && c <= 'z') c -= 32;  // Convert to uppercase
+        out[j++] = c;
+    }
+
+    // Skip dot if present
+    if (*in == '.') in++;
+
+    // Copy extension part (up to 3 characters)
+    j = 8;
+    while (*in && j < 11) {
+        char c = *in++;
+        if (c >= 'a' && c <= 'z') c -= 32;  // Convert to uppercase
+        out[j++] = c;
+    }
+}
+
+/* ============================================================================
+   EXTENT MAPS
+   ============================================================================ */
+// Reaching cluster n of a file through the FAT means n link reads. Instead each
+// recently used file keeps its chain compressed into extents (file cluster,
+// disk cluster, run length), sorted by file cluster, so a position is found
+// with a binary search. Maps are filled lazily, only as far as someone has
+// looked, and dropped whenever the file's chain is rewritten.
+
+#define EXTENT_MAPS 8           // Files with a cached extent map
+#define EXTENTS_PER_MAP 256     // Extents remembered per file (further clusters are walked)
+
+typedef struct {
+    uint32_t file_cluster;  // Position of the extent within the file, in clusters
+    uint16_t cluster;       // First disk cluster
+    uint16_t length;        // Consecutive clusters
+} fat_extent_t;
+
+typedef struct {
+    int ino;                 // Inode this map describes (-1 when the slot is unused)
+    uint16_t start_cluster;  // First cluster of the chain when the map was started
+    uint16_t count;          // Extents filled in
+    uint32_t mapped;         // File clusters covered by the extents (always a prefix of the file)
+    int complete;            // Flag: 1 once the end of the chain has been reached
+    uint32_t last_used;      // Value of extent_clock at the last use
+    fat_extent_t ext[EXTENTS_PER_MAP];
+    int lz4_loaded;                  // Flag: 1 once lz4_header holds the chain's first sector
+    uint8_t lz4_header[SECTOR_SIZE]; // Group table of a compressed file (see COMPRESSED FILES)
+} fat_extent_map_t;
+
+static fat_extent_map_t extent_maps[EXTENT_MAPS];
+static uint32_t extent_clock = 0;
+
+static void extent_map_reset(fat_extent_map_t *m, int ino, uint16_t start_cluster) {
+    m->ino = ino;
+    m->start_cluster = start_cluster;
+    m->count = 0;
+    m->mapped = 0;
+    m->complete = 0;
+    m->lz4_loaded = 0;
+}
+
+/* Get the map of file ino whose chain starts at start_cluster, taking over the least
+   recently used map if it has none */
+static fat_extent_map_t *extent_map_get(int ino, uint16_t start_cluster) {
+    fat_extent_map_t *victim = &extent_maps[0];
+    extent_clock++;
+    for (int i = 0; i < EXTENT_MAPS; ++i) {
+        fat_extent_map_t *m = &extent_maps[i];
+        if (m->ino == ino) {
+            if (m->start_cluster != start_cluster) extent_map_reset(m, ino, start_cluster);
+            m->last_used = extent_clock;
+            return m;
+        }
+        if (extent_clock - m->last_used > extent_clock - victim->last_used) victim = m;
+    }
+    extent_map_reset(victim, ino, start_cluster);
+    victim->last_used = extent_clock;
+    return victim;
+}
+
+/* Forget the map of file ino (ino < 0: every map) because its chain changed */
+static void extent_map_invalidate(int ino) {
+    for (int i = 0; i < EXTENT_MAPS; ++i) {
+        if (ino < 0 || extent_maps[i].ino == ino) extent_map_reset(&extent_maps[i], -1, 0);
+    }
+}
+
+/* Clusters were appended to the chain of file ino: the recorded extents still hold, only
+   the end of the chain moved */
+static void extent_map_grown(int ino) {
+    for (int i = 0; i < EXTENT_MAPS; ++i) {
+        if (extent_maps[i].ino == ino) extent_maps[i].complete = 0;
+    }
+}
+
+/* Follow the chain until the map covers 'upto' clusters, the chain ends, or the map is full */
+static void extent_fill(fat_extent_map_t *m, uint32_t upto) {
+    while (!m->complete && m->mapped < upto) {
+        fat_extent_t *last = m->count ? &m->ext[m->count - 1] : 0;
+        uint32_t refused = meta_refused;
+        uint16_t c = last ? fat_get_entry((uint16_t)(last->cluster + last->length - 1)) : m->start_cluster;
+        if (meta_refused != refused) break;  // Damaged FAT sector: not the end, just unknown
+        if (c < 2 || c >= 0xFFF8) {
+            m->complete = 1;  // End of chain
+            break;
+        }
+
+        if (last && last->cluster + last->length == c && last->length < 0xFFFF) {
+            last->length++;  // Chain continues on the next disk cluster
+        } else if (m->count < EXTENTS_PER_MAP) {
+            m->ext[m->count].file_cluster = m->mapped;
+            m->ext[m->count].cluster = c;
+            m->ext[m->count].length = 1;
+            m->count++;
+        } else {
+            break;  // Map full, extent_lookup walks the rest
+        }
+        m->mapped++;
+    }
+}
+
+/* Disk cluster holding cluster n of the file, or 0 if the chain is shorter. *run gets the
+   number of consecutive disk clusters from there (at most want, at least 1) */
+static uint16_t extent_lookup(fat_extent_map_t *m, uint32_t n, uint32_t want, uint32_t *run) {
+    extent_fill(m, n + (want ? want : 1));
+
+    if (n < m->mapped) {
+        // Last extent starting at or before n
+        uint32_t lo = 0, hi = m->count - 1u;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi + 1) / 2;
+            if (m->ext[mid].file_cluster <= n) lo = mid;
+            else hi = mid - 1;
+        }
+        const fat_extent_t *e = &m->ext[lo];
+        *run = e->file_cluster + e->length - n;
+        if (want && *run > want) *run = want;
+        return (uint16_t)(e->cluster + (n - e->file_cluster));
+    }
+    if (m->complete || m->count == 0) return 0;
+
+    // Past what the map can hold: walk on from its last cluster
+    const fat_extent_t *e = &m->ext[m->count - 1];
+    uint16_t c = (uint16_t)(e->cluster + e->length - 1);
+    for (uint32_t i = m->mapped - 1; i < n && c >= 2 && c < 0xFFF8; ++i) c = fat_get_entry(c);
+    if (c < 2 || c >= 0xFFF8) return 0;
+    *run = 1;
+    return c;
+}
+
+/* ============================================================================
+   DIRECT SECTOR SPANS
+   ============================================================================ */
+// File data moves straight between the caller's buffer and the disk: whole
+// sectors on consecutive clusters go out as one multi-sector transfer, and only
+// a partial first or last sector is staged through a bounce buffer.
+
+#define SPAN_MAX_SECTORS 128  // Longest single transfer (ATA allows 256)
+
+#define SPAN_READ 0    // Disk to buffer
+#define SPAN_WRITE 1   // Buffer to disk, partial sectors keep the bytes around the span
+#define SPAN_FILL 2    // Buffer to new clusters, partial sectors are zero-padded (NULL buffer: zeros)
+
+/* Transfer len bytes at byte offset pos of the chain described by extent map m. buf is only
+   read when writing. Returns the number of bytes transferred, less than len if the chain ends early */
+static size_t span_io_map(fat_extent_map_t *m, uint32_t pos, uint8_t *buf, size_t len, int mode) {
+    size_t done = 0;
+    while (done < len) {
+        uint32_t at = pos + (uint32_t)done;
+        uint32_t skip = at % SECTOR_SIZE;  // Offset into the sector (one sector per cluster)
+        size_t whole = (len - done) / SECTOR_SIZE;
+        uint32_t run;
+
+        if (skip == 0 && whole > 0 && buf) {
+            // Aligned whole sectors: no staging, one command per run of consecutive clusters
+            uint32_t want = whole < SPAN_MAX_SECTORS ? (uint32_t)whole : SPAN_MAX_SECTORS;
+            uint16_t c = extent_lookup(m, at / SECTOR_SIZE, want, &run);
+            if (!c) break;  // Chain ended early
+            if (mode == SPAN_READ) read_sectors(cluster_to_sector(c), run, buf + done);
+            else write_sectors(cluster_to_sector(c), run, buf + done);
+            done += (size_t)run * SECTOR_SIZE;
+            continue;
+        }
+
+        // Partial sector: stage it in a bounce buffer
+        uint16_t c = extent_lookup(m, at / SECTOR_SIZE, 1, &run);
+        if (!c) break;
+        uint8_t secbuf[SECTOR_SIZE];
+        size_t copy = SECTOR_SIZE - skip;
+        if (copy > len - done) copy = len - done;
+        if (mode == SPAN_READ) {
+            read_sector(cluster_to_sector(c), secbuf);
+            kmemcpy(buf + done, secbuf + skip, copy);
+        } else {
+            if (mode == SPAN_WRITE && copy < SECTOR_SIZE) read_sector(cluster_to_sector(c), secbuf);
+            else kmemset(secbuf, 0, SECTOR_SIZE);
+            if (buf) kmemcpy(secbuf + skip, buf + done, copy);
+            write_sector(cluster_to_sector(c), secbuf);
+        }
+        done += copy;
+    }
+    return done;
+}
+
+/* Same for file ino, whose chain starts at start_cluster (ino < 0: a chain that is not a
+   file yet, mapped just for this call) */
+static size_t span_io(int ino, uint16_t start_cluster, uint32_t pos, uint8_t *buf, size_t len, int mode) {
+    fat_extent_map_t scratch;
+    fat_extent_map_t *m = &scratch;
+    if (ino >= 0) m = extent_map_get(ino, start_cluster);
+    else extent_map_reset(m, -1, start_cluster);
+    return span_io_map(m, pos, buf, len, mode);
+}
+
+/* ============================================================================
+   CLUSTER CHAIN ALLOCATION AND DEFERRED RECLAMATION
+   ============================================================================ */
+// Dropping a file only updates its directory entry; the clusters it owned stay
+// marked in the FAT (so nothing can allocate them) until the chain is freed by
+// fat16_reclaim_step() in the background or by fat16_sync().
+
+/* Free a whole cluster chain immediately */
+static void fat_free_chain(uint16_t c) {
+    while (c >= 2 && c < 0xFFF8) {
+        uint16_t next = fat_get_entry(c);
+        if (fat_set_entry(c, 0x0000) != 0) return;  // Damaged FAT sector: leave the rest allocated
+        c = next;
+    }
+}
+
+/* Queue a cluster chain to be freed later (frees it now if the queue is full) */
+static void fat_queue_chain(uint16_t c) {
+    if (c < 2 || c >= 0xFFF8) return;  // Empty file, nothing to free
+    if (reclaim_count == RECLAIM_QUEUE_SIZE) {
+        fat_free_chain(c);
+        return;
+    }
+    reclaim_queue[(reclaim_head + reclaim_count) % RECLAIM_QUEUE_SIZE] = c;
+    reclaim_count++;
+}
+
+/* Allocate a new chain of the given number of clusters without writing them. On failure
+   the partial chain is freed */
+static int fat_build_chain(uint32_t clusters, uint16_t *first_out) {
+    uint16_t first_cluster = 0, prev_cluster = 0;  // Track first and previous cluster numbers
+
+    // One cluster per iteration
+    for (uint32_t i = 0; i < clusters; ++i) {
+        // Find an available cluster in the FAT
+        int16_t c = fat_find_free_cluster();
+        if (c < 0) {
+            fat_free_chain(first_cluster);  // No free clusters available: undo what was allocated
+            return -1;
+        }
+
+        // Claim the cluster as end-of-chain straight away so the next search skips it
+        if (fat_set_entry((uint16_t)c, 0xFFFF) != 0) {
+            fat_free_chain(first_cluster);  // Damaged FAT sector
+            return -1;
+        }
+
+        // If this is the first cluster, remember it for the directory entry
+        if (!first_cluster) first_cluster = (uint16_t)c;
+
+        // Link previous cluster to this one (building the cluster chain)
+        if (prev_cluster && fat_set_entry(prev_cluster, (uint16_t)c) != 0) {
+            fat_set_entry((uint16_t)c, 0x0000);
+            fat_free_chain(first_cluster);
+            return -1;
+        }
+        prev_cluster = (uint16_t)c;  // Update previous cluster tracker
+    }
+
+    *first_out = first_cluster;
+    return 0;
+}
+
+/* Allocate a new chain holding len bytes of data (zeros if data is NULL). On failure the partial chain is freed */
+static int fat_alloc_chain(const uint8_t *data, size_t len, uint16_t *first_out) {
+    uint32_t cluster_bytes = SECTORS_PER_CLUSTER * SECTOR_SIZE;
+    if (fat_build_chain((uint32_t)((len + cluster_bytes - 1) / cluster_bytes), first_out) != 0) return -1;
+
+    // Write the data straight from the caller's buffer, zero-padding the last sector
+    span_io(-1, *first_out, 0, (uint8_t *)data, len, SPAN_FILL);
+    return 0;
+}
+
+/* Number of chains still waiting to be freed */
+size_t fat16_reclaim_pending(void) {
+    return reclaim_count;
+}
+
+/* Free up to max_clusters clusters from the queued chains */
+void fat16_reclaim_step(size_t max_clusters) {
+    while (reclaim_count > 0 && max_clusters > 0) {
+        uint16_t c = reclaim_queue[reclaim_head];
+        uint16_t next = fat_get_entry(c);
+        if (fat_set_entry(c, 0x0000) != 0) next = 0xFFFF;  // Damaged FAT sector: leave the rest allocated
+        max_clusters--;
+
+        if (next >= 2 && next < 0xFFF8) {
+            reclaim_queue[reclaim_head] = next;  // Rest of the chain stays queued
+        } else {
+            reclaim_head = (reclaim_head + 1) % RECLAIM_QUEUE_SIZE;  // Chain fully freed
+            reclaim_count--;
+        }
+    }
+}
+
+/* ============================================================================
+   DISCARDS
+   ============================================================================ */
+// Freed clusters are remembered in a bitmap and reported to the disk once the FAT that
+// frees them is durable, one discard per run of consecutive clusters. A cluster that is
+// allocated again before then drops out of the bitmap, so a discard never hits live data.
+
+#define DISCARD_CLUSTERS (TOTAL_SECTORS / SECTORS_PER_CLUSTER + 2)  // Cluster numbers start at 2
+
+static uint8_t discard_map[(DISCARD_CLUSTERS + 7) / 8];  // Bit c set: cluster c freed, not discarded yet
+static int discard_waiting = 0;                         // Flag: some bit is set
+
+static void discard_note(uint16_t cluster, int freed) {
+    if (!callbacks.disk_discard || cluster >= DISCARD_CLUSTERS) return;
+    if (freed) {
+        discard_map[cluster / 8] |= (uint8_t)(1u << (cluster % 8));
+        discard_waiting = 1;
+    } else {
+        discard_map[cluster / 8] &= (uint8_t)~(1u << (cluster % 8));
+    }
+}
+
+static void discard_forget(void) {
+    kmemset(discard_map, 0, sizeof(discard_map));
+    discard_waiting = 0;
+}
+
+/* Discard every cluster freed since the last call. The FAT must be durable already */
+static void discard_issue(void) {
+    if (!discard_waiting) return;
+    discard_waiting = 0;
+    for (uint32_t c = 2; c < DISCARD_CLUSTERS;) {
+        if (!discard_map[c / 8]) {
+            c = (c / 8 + 1) * 8;  // Skip a byte of clusters still in use
+            continue;
+        }
+        uint32_t run = 0;
+        while (c + run < DISCARD_CLUSTERS && (discard_map[(c + run) / 8] >> ((c + run) % 8)) & 1) {
+            discard_map[(c + run) / 8] &= (uint8_t)~(1u << ((c + run) % 8));
+            run++;
+        }
+        if (run) callbacks.disk_discard(cluster_to_sector((uint16_t)c), run * SECTORS_PER_CLUSTER);
+        c += run ? run : 1;
+    }
+    if (callbacks.disk_flush) callbacks.disk_flush();  // Disk drivers send collected ranges at a flush
+}
+
+/* Write back dirty file pages, then free every queued chain */
+void fat16_sync(void) {
+    pcache_flush(&fat16_pcache_ops, 0, -1, SIZE_MAX);
+    while (reclaim_count > 0) {
+        fat16_reclaim_step(SIZE_MAX);
+    }
+    if (!meta_table_store() && callbacks.disk_flush) callbacks.disk_flush();  // A store flushes already
+    discard_issue();
+}
+
+/* ============================================================================
+   DIRECTORY ENTRY HELPERS
+   ============================================================================ */
+
+/* First sector of the root directory */
+static uint32_t root_dir_start(void) {
+    return RESERVED_SECTORS + (NUM_FATS * SECTORS_PER_FAT);
+}
+
+/* Find a file's directory entry. Returns its byte offset in the root directory (with
+   its sector loaded into dirsec), -1 if not found, or -2 if a directory sector that
+   could hold it fails its checksum */
+static int dir_find(const uint8_t dosname[11], uint8_t *dirsec) {
+    for (uint32_t s = 0; s < root_dir_sectors(); ++s) {
+        if (read_sector(root_dir_start() + s, dirsec) != 0) return -2;
+
+        for (uint32_t off = 0; off < SECTOR_SIZE; off += 32) {
+            if (dirsec[off] == 0x00) return -1;  // End of directory
+            if (dirsec[off] == 0xE5) continue;   // Deleted entry, skip
+
+            int match = 1;
+            for (int k = 0; k < 11; ++k) {
+                if (dirsec[off+k] != dosname[k]) { match = 0; break; }
+            }
+            if (match) return (int)((s * SECTOR_SIZE) + off);
+        }
+    }
+    return -1;
+}
+
+/* Get starting cluster from a directory entry */
+static uint16_t dirent_start_cluster(const uint8_t *ent) {
+    return (uint16_t)(ent[26] | (ent[27] << 8));
+}
+
+/* Get file size from a directory entry */
+static uint32_t dirent_size(const uint8_t *ent) {
+    return (uint32_t)ent[28] | ((uint32_t)ent[29] << 8) |
+           ((uint32_t)ent[30] << 16) | ((uint32_t)ent[31] << 24);
+}
+
+/* Convert a space-padded 8.3 directory name to "NAME.EXT" */
+static void format_dos_name(const uint8_t *ent, char out[13]) {
+    int j = 0;
+    for (int k = 0; k < 8 && ent[k] != ' '; ++k) out[j++] = (char)ent[k];
+    if (ent[8] != ' ') {
+        out[j++] = '.';
+        for (int k = 8; k < 11 && ent[k] != ' '; ++k) out[j++] = (char)ent[k];
+    }
+    out[j] = 0;
+}
+
+/* Set starting cluster and file size in a directory entry */
+static void dirent_set_data(uint8_t *ent, uint16_t start_cluster, uint32_t size) {
+    ent[26] = start_cluster & 0xFF;
+    ent[27] = (start_cluster >> 8) & 0xFF;
+    ent[28] = (uint8_t)(size & 0xFF);
+    ent[29] = (uint8_t)((size >> 8) & 0xFF);
+    ent[30] = (uint8_t)((size >> 16) & 0xFF);
+    ent[31] = (uint8_t)((size >> 24) & 0xFF);
+}
+
+/* ============================================================================
+   COMPRESSED FILES
+   ============================================================================ */
+// With compression on, fat16_write_file stores file data as LZ4 blocks of one
+// page each, so any page can be brought in on its own. The directory entry
+// keeps the original size and marks the file in its reserved byte; the chain
+// starts with a header sector listing where each group starts and how many
+// bytes it stores. A group that would not save at least one sector is stored
+// as is, and a file that would not get shorter is not compressed at all.
+// Compressed files are never written in place: the first write or truncate
+// expands the file back into a plain chain.
+
+#define DIRENT_LZ4 0x01                          // Directory entry byte 12: data is compressed
+#define LZ4_GROUP PCACHE_PAGE_SIZE               // File bytes per compressed group
+#define LZ4_HDR_GROUPS ((SECTOR_SIZE - 12) / 4)  // Groups one header sector can describe
+#define LZ4_RAW 0x8000                           // Stored length flag: group kept uncompressed
+
+static const uint8_t lz4_magic[4] = { 'L', 'Z', '4', 'G' };
+
+static int lz4_enabled = 0;
+static uint8_t lz4_buf[LZ4_GROUP];      // One compressed group
+static fat_extent_map_t lz4_new_chain;  // Map of the chain being written by lz4_store/lz4_expand
+
+void fat16_set_compression(int enabled) {
+    lz4_enabled = enabled;
+}
+
+/* Check if a directory entry describes a compressed file */
+static int dirent_compressed(const uint8_t *ent) {
+    return (ent[12] & DIRENT_LZ4) != 0;
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void put16(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+/* Compress group g of a len-byte file into lz4_buf. Returns the stored length, with
+   LZ4_RAW set if the group is kept as is */
+static uint32_t lz4_pack_group(const uint8_t *data, size_t len, uint32_t g) {
+    size_t n = len - (size_t)g * LZ4_GROUP;
+    if (n > LZ4_GROUP) n = LZ4_GROUP;
+    size_t sectors = (n + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    if (sectors > 1) {
+        size_t packed = lz4_compress(data + (size_t)g * LZ4_GROUP, n, lz4_buf, (sectors - 1) * SECTOR_SIZE);
+        if (packed) return (uint32_t)packed;
+    }
+    return (uint32_t)n | LZ4_RAW;
+}
+
+/* Sectors taken by a group with the given stored length */
+static uint32_t lz4_group_sectors(uint32_t stored) {
+    return ((stored & ~LZ4_RAW) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+/* Write len bytes of data to a new compressed chain. Returns 0, or -1 if compression does
+   not save any sectors or the disk is full (nothing is allocated then) */
+static int lz4_store(const uint8_t *data, size_t len, uint16_t *first_out) {
+    uint32_t groups = (uint32_t)((len + LZ4_GROUP - 1) / LZ4_GROUP);
+    if (groups == 0 || groups > LZ4_HDR_GROUPS) return -1;
+
+    // First pass only sizes the groups, so nothing is allocated unless it pays off
+    uint8_t header[SECTOR_SIZE];
+    kmemset(header, 0, SECTOR_SIZE);
+    kmemcpy(header, lz4_magic, sizeof(lz4_magic));
+    header[4] = (uint8_t)(len & 0xFF);
+    header[5] = (uint8_t)((len >> 8) & 0xFF);
+    header[6] = (uint8_t)((len >> 16) & 0xFF);
+    header[7] = (uint8_t)((len >> 24) & 0xFF);
+    put16(header + 8, groups);
+
+    uint32_t sectors = 1;  // The header
+    for (uint32_t g = 0; g < groups; ++g) {
+        uint32_t stored = lz4_pack_group(data, len, g);
+        put16(header + 12 + g * 4, sectors);
+        put16(header + 14 + g * 4, stored);
+        sectors += lz4_group_sectors(stored);
+    }
+    if (sectors >= (len + SECTOR_SIZE - 1) / SECTOR_SIZE) return -1;
+
+    // Second pass compresses each group again and writes it out
+    if (fat_build_chain(sectors, first_out) != 0) return -1;
+    extent_map_reset(&lz4_new_chain, -1, *first_out);
+    span_io_map(&lz4_new_chain, 0, header, SECTOR_SIZE, SPAN_FILL);
+    for (uint32_t g = 0; g < groups; ++g) {
+        uint32_t stored = lz4_pack_group(data, len, g);
+        const uint8_t *src = (stored & LZ4_RAW) ? data + (size_t)g * LZ4_GROUP : lz4_buf;
+        span_io_map(&lz4_new_chain, get16(header + 12 + g * 4) * SECTOR_SIZE, (uint8_t *)src,
+                    stored & ~LZ4_RAW, SPAN_FILL);
+    }
+    return 0;
+}
+
+/* Header sector of the compressed file described by extent map m, kept with the map.
+   Returns NULL if it is damaged */
+static const uint8_t *lz4_header(fat_extent_map_t *m) {
+    if (!m->lz4_loaded) {
+        if (span_io_map(m, 0, m->lz4_header, SECTOR_SIZE, SPAN_READ) != SECTOR_SIZE) return 0;
+        for (size_t i = 0; i < sizeof(lz4_magic); ++i) {
+            if (m->lz4_header[i] != lz4_magic[i]) return 0;
+        }
+        if (get16(m->lz4_header + 8) > LZ4_HDR_GROUPS) return 0;
+        m->lz4_loaded = 1;
+    }
+    return m->lz4_header;
+}
+
+/* Read group 'index' of compressed file ino into page, which must come to exactly bytes
+   bytes. Returns 0, or -1 if the file is damaged */
+static int lz4_read_group(int ino, uint16_t start_cluster, uint32_t index, uint8_t *page, uint32_t bytes) {
+    fat_extent_map_t *m = extent_map_get(ino, start_cluster);
+    const uint8_t *header = lz4_header(m);
+    if (!header || index >= get16(header + 8)) return -1;
+
+    uint32_t first = get16(header + 12 + index * 4);
+    uint32_t stored = get16(header + 14 + index * 4);
+    uint32_t n = stored & ~LZ4_RAW;
+    size_t span = (size_t)lz4_group_sectors(stored) * SECTOR_SIZE;
+    if (span > LZ4_GROUP) return -1;
+
+    if (stored & LZ4_RAW) {
+        if (n != bytes) return -1;
+        return span_io_map(m, first * SECTOR_SIZE, page, span, SPAN_READ) == span ? 0 : -1;
+    }
+    if (span_io_map(m, first * SECTOR_SIZE, lz4_buf, span, SPAN_READ) != span) return -1;
+    return lz4_decompress(lz4_buf, n, page, PCACHE_PAGE_SIZE) == (int)bytes ? 0 : -1;
+}
+
+/* Rewrite compressed file ino (entry at byte offset 'found' of the root directory, sector
+   in dirsec) as a plain chain so it can be changed in place. Returns 0, or -1 if the disk
+   is full or the file is damaged */
+static int lz4_expand(int ino, uint8_t *dirsec, int found) {
+    uint32_t off = found % SECTOR_SIZE;
+    uint32_t size = dirent_size(&dirsec[off]);
+    uint32_t clusters = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+    uint16_t first = 0;
+    if (fat_build_chain(clusters, &first) != 0) {
+        fat16_sync();  // Disk full: reclaim queued chains and try again
+        if (fat_build_chain(clusters, &first) != 0) return -1;
+    }
+
+    // Pages come through the cache (decompressing as needed) and stay valid afterwards
+    extent_map_reset(&lz4_new_chain, -1, first);
+    for (uint32_t pos = 0; pos < size; pos += PCACHE_PAGE_SIZE) {
+        const uint8_t *page = pcache_get(&fat16_pcache_ops, 0, ino, pos / PCACHE_PAGE_SIZE, 0);
+        if (!page) {
+            fat_free_chain(first);
+            return -1;
+        }
+        size_t bytes = size - pos < PCACHE_PAGE_SIZE ? size - pos : PCACHE_PAGE_SIZE;
+        span_io_map(&lz4_new_chain, pos, (uint8_t *)page, bytes, SPAN_FILL);
+    }
+
+    uint16_t old = dirent_start_cluster(&dirsec[off]);
+    dirsec[off + 12] &= (uint8_t)~DIRENT_LZ4;
+    dirent_set_data(&dirsec[off], first, size);
+    write_sector(root_dir_start() + found / SECTOR_SIZE, dirsec);
+
+    fat_queue_chain(old);
+    extent_map_invalidate(ino);
+    return 0;
+}
+
+/* ============================================================================
+   FAT16 FILE WRITING
+   ============================================================================ */
+int fat16_write_file(const char *name, const uint8_t *data, size_t len) {
+    // Convert filename to DOS 8.3 format
+    uint8_t dosname[11];
+    make_dos_name(name, dosname);
+
+    /* Search root directory for existing file or free entry */
+    uint8_t dirsec[SECTOR_SIZE];
+    uint32_t root_start = RESERVED_SECTORS + (NUM_FATS * SECTORS_PER_FAT);
+    uint32_t root_sectors = root_dir_sectors();
+    int found_offset = -1;  // Directory entry location
+    uint16_t existing_start_cluster = 0;
+
+    // Scan root directory
+    for (uint32_t s = 0; s < root_sectors; ++s) {
+        if (read_sector(root_start + s, dirsec) != 0) return -1;  // Damaged sector: the name may be in it
+
+        // Each directory entry is 32 bytes
+        for (uint32_t off = 0; off < SECTOR_SIZE; off += 32) {
+            if (dirsec[off] == 0x00) {
+                // Empty entry (end of directory)
+                if (found_offset < 0) found_offset = (int)((s * SECTOR_SIZE) + off);
+                break;
+            } else if (dirsec[off] == 0xE5) {
+                // Deleted entry (can be reused)
+                if (found_offset < 0) found_offset = (int)((s * SECTOR_SIZE) + off);
+                continue;
+            } else {
+                // Check if this entry matches our filename
+                int match = 1;
+                for (int k = 0; k < 11; ++k) {
+                    if (dirsec[off+k] != dosname[k]) { match = 0; break; }
+                }
+                if (match) {
+                    // Found existing file - will overwrite
+                    found_offset = (int)((s * SECTOR_SIZE) + off);
+                    existing_start_cluster = (uint16_t)(dirsec[off+26] | (dirsec[off+27] << 8));
+                    s = root_sectors;  // Exit outer loop
+                    break;
+                }
+            }
+        }
+    }
+
+    if (found_offset < 0) return -1;  // Root directory is full
+
+    /* Allocate clusters and write file data before the old chain is released */
+    uint16_t first_cluster = 0;
+    int compressed = lz4_enabled && lz4_store(data, len, &first_cluster) == 0;
+    if (!compressed && fat_alloc_chain(data, len, &first_cluster) != 0) {
+        // Disk full: reclaim any queued chains, then reuse the old file's clusters as a last resort.
+        // The entry is emptied first, so if the retry fails too it is left as an empty file
+        // rather than pointing at freed clusters
+        fat16_sync();
+        if (existing_start_cluster >= 2) {
+            uint32_t off = found_offset % SECTOR_SIZE;
+            if (read_sector(root_start + found_offset / SECTOR_SIZE, dirsec) != 0) return -1;
+            dirsec[off + 12] &= (uint8_t)~DIRENT_LZ4;
+            dirent_set_data(&dirsec[off], 0, 0);
+            write_sector(root_start + found_offset / SECTOR_SIZE, dirsec);
+            pcache_invalidate(&fat16_pcache_ops, 0, found_offset / 32, 0);
+            extent_map_invalidate(found_offset / 32);
+            fat_free_chain(existing_start_cluster);
+            existing_start_cluster = 0;
+        }
+        compressed = lz4_enabled && lz4_store(data, len, &first_cluster) == 0;
+        if (!compressed && fat_alloc_chain(data, len, &first_cluster) != 0) return -1;
+    }
+
+    /* Update the directory entry with file metadata */
+    // Calculate which sector and offset within sector the directory entry is at
+    uint32_t sidx = found_offset / SECTOR_SIZE;    // Sector index
+    uint32_t off = found_offset % SECTOR_SIZE;     // Offset within sector
+
+    // Read the directory sector into buffer
+    if (read_sector(root_start + sidx, dirsec) != 0) {
+        fat_free_chain(first_cluster);  // Never referenced
+        return -1;
+    }
+
+    // Write the 8.3 filename (11 bytes)
+    for (int k = 0; k < 11; ++k) dirsec[off + k] = dosname[k];
+
+    // Set file attributes and reserved bytes
+    dirsec[off + 11] = 0x20;  // Attribute: Archive bit set (normal file)
+    dirsec[off + 12] = compressed ? DIRENT_LZ4 : 0;  // Reserved for Windows NT, holds our flags
+    dirsec[off + 13] = 0;     // Creation time tenth of second
+    dirsec[off + 14] = 0; dirsec[off + 15] = 0;  // Creation time
+    dirsec[off + 16] = 0; dirsec[off + 17] = 0;  // Creation date
+
+    // Write starting cluster number (little-endian, 16-bit)
+    dirsec[off + 26] = first_cluster & 0xFF;           // Low byte
+    dirsec[off + 27] = (first_cluster >> 8) & 0xFF;    // High byte
+
+    // Write file size (little-endian, 32-bit)
+    dirsec[off + 28] = (uint8_t)(len & 0xFF);          // Byte 0 (LSB)
+    dirsec[off + 29] = (uint8_t)((len >> 8) & 0xFF);   // Byte 1
+    dirsec[off + 30] = (uint8_t)((len >> 16) & 0xFF);  // Byte 2
+    dirsec[off + 31] = (uint8_t)((len >> 24) & 0xFF);  // Byte 3 (MSB)
+
+    // Write the updated directory sector back to disk
+    write_sector(root_start + sidx, dirsec);
+
+    /* The old contents are no longer referenced: free them later */
+    fat_queue_chain(existing_start_cluster);
+    pcache_invalidate(&fat16_pcache_ops, 0, found_offset / 32, 0);  // Cached pages hold the old contents
+    extent_map_invalidate(found_offset / 32);
+
+    return 0;  // Success
+}
+
+/* ============================================================================
+   FAT16 FILE READING
+   ============================================================================ */
+int fat16_read_file(const char *name, uint8_t *out, size_t maxlen) {
+    // Look the file up, then read it through the page cache so repeated reads stay in memory
+    int ino = fat16_lookup(name);
+    if (ino < 0) return -1;  // File not found
+    return fat16_read(ino, 0, out, maxlen);
+}
+
+/* ============================================================================
+   FAT16 DELETE, RENAME AND TRUNCATE
+   ============================================================================ */
+// Each operation rewrites a single directory sector; any clusters that are no
+// longer referenced are queued for reclamation instead of being freed here.
+
+int fat16_unlink(const char *name) {
+    uint8_t dosname[11];
+    make_dos_name(name, dosname);
+
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_find(dosname, dirsec);
+    if (found < 0) return -1;  // File not found
+
+    uint32_t off = found % SECTOR_SIZE;
+    uint16_t start_cluster = dirent_start_cluster(&dirsec[off]);
+
+    dirsec[off] = 0xE5;  // Mark entry as deleted
+    write_sector(root_dir_start() + found / SECTOR_SIZE, dirsec);
+
+    pcache_invalidate(&fat16_pcache_ops, 0, found / 32, 0);
+    extent_map_invalidate(found / 32);
+    fat_queue_chain(start_cluster);
+    return 0;
+}
+
+int fat16_rename(const char *old_name, const char *new_name) {
+    uint8_t old_dos[11], new_dos[11];
+    make_dos_name(old_name, old_dos);
+    make_dos_name(new_name, new_dos);
+
+    uint8_t dirsec[SECTOR_SIZE];
+    if (dir_find(new_dos, dirsec) != -1) return -1;  // Target name already in use (or can't tell)
+
+    int found = dir_find(old_dos, dirsec);
+    if (found < 0) return -1;  // File not found
+
+    uint32_t off = found % SECTOR_SIZE;
+    for (int k = 0; k < 11; ++k) dirsec[off + k] = new_dos[k];
+    write_sector(root_dir_start() + found / SECTOR_SIZE, dirsec);
+    return 0;
+}
+
+/* Shrink the file whose entry is at byte offset 'found' of the root directory (sector in dirsec) */
+static int dir_truncate(uint8_t *dirsec, int found, size_t len) {
+    uint32_t off = found % SECTOR_SIZE;
+    uint16_t start_cluster = dirent_start_cluster(&dirsec[off]);
+    uint32_t size = dirent_size(&dirsec[off]);
+    if (len > size) return -1;   // Only shrinking is supported
+    if (len == size) return 0;   // Nothing to do
+
+    // A compressed file emptied completely just drops its chain, otherwise it is expanded first
+    if (dirent_compressed(&dirsec[off])) {
+        if (len == 0) dirsec[off + 12] &= (uint8_t)~DIRENT_LZ4;
+        else if (lz4_expand(found / 32, dirsec, found) != 0) return -1;
+        start_cluster = dirent_start_cluster(&dirsec[off]);
+    }
+
+    uint32_t cluster_bytes = SECTORS_PER_CLUSTER * SECTOR_SIZE;
+    uint32_t keep = (uint32_t)((len + cluster_bytes - 1) / cluster_bytes);  // Clusters still needed
+    uint16_t tail = 0;  // First cluster to release
+
+    if (keep == 0) {
+        tail = start_cluster;
+        start_cluster = 0;
+    } else {
+        // Find the last cluster that is kept and cut the chain there
+        uint32_t run, refused = meta_refused;
+        uint16_t last = extent_lookup(extent_map_get(found / 32, start_cluster), keep - 1, 1, &run);
+        if (last) tail = fat_get_entry(last);
+        if (meta_refused != refused) return -1;  // Chain runs through a damaged FAT sector
+        if (tail >= 2 && tail < 0xFFF8 && fat_set_entry(last, 0xFFFF) != 0) return -1;
+    }
+    extent_map_invalidate(found / 32);
+
+    dirent_set_data(&dirsec[off], start_cluster, (uint32_t)len);
+    write_sector(root_dir_start() + found / SECTOR_SIZE, dirsec);
+
+    pcache_truncate(&fat16_pcache_ops, 0, found / 32, (uint32_t)len);
+    fat_queue_chain(tail);
+    return 0;
+}
+
+int fat16_truncate(const char *name, size_t len) {
+    uint8_t dosname[11];
+    make_dos_name(name, dosname);
+
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_find(dosname, dirsec);
+    if (found < 0) return -1;  // File not found
+
+    return dir_truncate(dirsec, found, len);
+}
+
+/* ============================================================================
+   FAT16 INODE INTERFACE
+   ============================================================================ */
+// Used by the VFS. A file's inode number is the index of its entry in the root
+// directory, so it stays valid across renames but not after the file is deleted.
+
+#define DIR_ENTRIES_PER_SECTOR (SECTOR_SIZE / 32)
+
+/* Load the directory sector holding inode ino. Returns the entry's byte offset in the
+   root directory, or -1 if ino is not a live file or its sector fails its checksum */
+static int dir_load_inode(int ino, uint8_t *dirsec) {
+    if (ino < 0 || ino >= ROOT_DIR_ENTRIES) return -1;
+    if (read_sector(root_dir_start() + (uint32_t)ino / DIR_ENTRIES_PER_SECTOR, dirsec) != 0) return -1;
+    uint32_t off = ((uint32_t)ino % DIR_ENTRIES_PER_SECTOR) * 32;
+    if (dirsec[off] == 0x00 || dirsec[off] == 0xE5) return -1;
+    return ino * 32;
+}
+
+int fat16_lookup(const char *name) {
+    uint8_t dosname[11];
+    make_dos_name(name, dosname);
+
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_find(dosname, dirsec);
+    return found < 0 ? -1 : found / 32;
+}
+
+int fat16_create(const char *name) {
+    uint8_t dosname[11];
+    make_dos_name(name, dosname);
+
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_find(dosname, dirsec);
+    if (found >= 0) return found / 32;  // Already exists
+    if (found != -1) return -1;         // Damaged directory: it may exist
+
+    // Use the first deleted or never-used entry
+    for (uint32_t s = 0; s < root_dir_sectors(); ++s) {
+        if (read_sector(root_dir_start() + s, dirsec) != 0) continue;  // Damaged sector: leave its entries alone
+        for (uint32_t off = 0; off < SECTOR_SIZE; off += 32) {
+            if (dirsec[off] != 0x00 && dirsec[off] != 0xE5) continue;
+
+            for (int k = 0; k < 32; ++k) dirsec[off + k] = 0;
+            for (int k = 0; k < 11; ++k) dirsec[off + k] = dosname[k];
+            dirsec[off + 11] = 0x20;  // Attribute: Archive bit set (normal file)
+            write_sector(root_dir_start() + s, dirsec);
+            pcache_invalidate(&fat16_pcache_ops, 0, (int)((s * SECTOR_SIZE + off) / 32), 0);
+            extent_map_invalidate((int)((s * SECTOR_SIZE + off) / 32));
+            return (int)((s * SECTOR_SIZE + off) / 32);
+        }
+    }
+    return -1;  // Root directory is full
+}
+
+int fat16_file_size(int ino) {
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_load_inode(ino, dirsec);
+    if (found < 0) return -1;
+    return (int)dirent_size(&dirsec[found % SECTOR_SIZE]);
+}
+
+int fat16_read(int ino, uint32_t pos, uint8_t *buf, size_t len) {
+    uint32_t refused = meta_refused;
+    size_t got = 0;
+    while (got < len) {
+        size_t avail;
+        const uint8_t *src = fat16_map(ino, pos + (uint32_t)got, &avail);
+        if (!src) break;  // End of file (or not a file)
+        if (avail > len - got) avail = len - got;
+        kmemcpy(buf + got, src, avail);
+        got += avail;
+    }
+    if (meta_refused != refused) return -1;  // Stopped at a damaged sector, not at the end
+    if (got == 0 && fat16_file_size(ino) < 0) return -1;
+    return (int)got;
+}
+
+const uint8_t *fat16_map(int ino, uint32_t pos, size_t *len) {
+    int size = fat16_file_size(ino);
+    if (size < 0 || pos >= (uint32_t)size) return 0;
+
+    const uint8_t *page = pcache_get(&fat16_pcache_ops, 0, ino, pos / PCACHE_PAGE_SIZE, 0);
+    if (!page) return 0;
+
+    uint32_t off = pos % PCACHE_PAGE_SIZE;
+    *len = PCACHE_PAGE_SIZE - off;
+    if (*len > (uint32_t)size - pos) *len = (uint32_t)size - pos;
+    return page + off;
+}
+
+/* Make the chain starting at *start_cluster (holding size bytes) long enough for end bytes,
+   for a write of [pos, end). The new clusters are linked without writing them, then every
+   sector of them that the write does not cover whole is zeroed. Returns 0 on success, -1 if
+   the disk is full or the chain is damaged */
+static int chain_extend(int ino, uint16_t *start_cluster, uint32_t size, uint32_t pos, uint32_t end) {
+    uint32_t cluster_bytes = SECTORS_PER_CLUSTER * SECTOR_SIZE;
+    uint32_t have = (size + cluster_bytes - 1) / cluster_bytes;
+    uint32_t need = (end + cluster_bytes - 1) / cluster_bytes;
+    if (need <= have) return 0;
+
+    uint16_t last = 0;
+    if (have > 0) {
+        uint32_t run;
+        last = extent_lookup(extent_map_get(ino, *start_cluster), have - 1, 1, &run);
+        if (!last) return -1;  // Chain shorter than the file, or runs through a damaged FAT sector
+    }
+    uint16_t more = 0;
+    if (fat_build_chain(need - have, &more) != 0) {
+        fat16_sync();  // Disk full: reclaim queued chains and try again
+        if (fat_build_chain(need - have, &more) != 0) return -1;
+    }
+
+    // Zero the new sectors before and after the whole sectors the write will fill
+    uint32_t base = have * cluster_bytes, limit = need * cluster_bytes;
+    uint32_t lo = (pos + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE, hi = end / SECTOR_SIZE * SECTOR_SIZE;
+    if (lo < base) lo = base;
+    if (hi < lo) hi = lo;  // No whole sector written: zero everything
+    if (lo > base) span_io(-1, more, 0, NULL, lo - base, SPAN_FILL);
+    if (hi < limit) span_io(-1, more, hi - base, NULL, limit - hi, SPAN_FILL);
+    if (last && fat_set_entry(last, more) != 0) {
+        fat_free_chain(more);
+        return -1;
+    }
+    if (!last) *start_cluster = more;
+    extent_map_grown(ino);
+    return 0;
+}
+
+int fat16_write(int ino, uint32_t pos, const uint8_t *data, size_t len) {
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_load_inode(ino, dirsec);
+    if (found < 0) return -1;
+    if (len == 0) return 0;
+    if (dirent_compressed(&dirsec[found % SECTOR_SIZE]) && lz4_expand(ino, dirsec, found) != 0) return -1;
+
+    uint32_t off = found % SECTOR_SIZE;
+    uint32_t size = dirent_size(&dirsec[off]);
+    uint16_t start_cluster = dirent_start_cluster(&dirsec[off]);
+    uint32_t end = pos + (uint32_t)len;
+
+    /* Grow the chain if the write goes past the last cluster */
+    if (chain_extend(ino, &start_cluster, size, pos, end) != 0) return -1;
+
+    /* The last sector may hold stale bytes past the old end of file (left by a truncate).
+       Bring its page in while the old size still applies, which zeros them, and mark it
+       dirty so the zeros reach the disk */
+    if (end > size && size % SECTOR_SIZE) {
+        uint8_t *page = pcache_get(&fat16_pcache_ops, 0, ino, size / PCACHE_PAGE_SIZE, PCACHE_DIRTY);
+        if (!page) return -1;
+        kmemset(page + size % PCACHE_PAGE_SIZE, 0, PCACHE_PAGE_SIZE - size % PCACHE_PAGE_SIZE);
+    }
+
+    /* Record the new size and first cluster before any page is written back */
+    if (end > size || dirent_start_cluster(&dirsec[off]) != start_cluster) {
+        dirent_set_data(&dirsec[off], start_cluster, end > size ? end : size);
+        write_sector(root_dir_start() + found / SECTOR_SIZE, dirsec);
+    }
+
+    /* Copy the data into cached pages; they reach the disk on writeback */
+    size_t done = 0;
+    while (done < len) {
+        uint32_t at = pos + (uint32_t)done;
+        uint32_t skip = at % PCACHE_PAGE_SIZE;  // Offset into the page
+        size_t copy = PCACHE_PAGE_SIZE - skip;
+        if (copy > len - done) copy = len - done;
+
+        // A page that is overwritten completely does not need to be read first
+        int flags = PCACHE_DIRTY | (copy == PCACHE_PAGE_SIZE ? PCACHE_NOFILL : 0);
+        uint8_t *page = pcache_get(&fat16_pcache_ops, 0, ino, at / PCACHE_PAGE_SIZE, flags);
+        if (!page) break;
+        kmemcpy(page + skip, data + done, copy);
+        done += copy;
+    }
+    return done ? (int)done : -1;
+}
+
+int fat16_read_direct(int ino, uint32_t pos, uint8_t *buf, size_t len) {
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_load_inode(ino, dirsec);
+    if (found < 0) return -1;
+
+    if (dirent_compressed(&dirsec[found % SECTOR_SIZE])) return fat16_read(ino, pos, buf, len);  // Only pages hold plain data
+
+    uint32_t size = dirent_size(&dirsec[found % SECTOR_SIZE]);
+    if (pos >= size) return 0;
+    if (len > size - pos) len = size - pos;
+
+    pcache_flush(&fat16_pcache_ops, 0, ino, SIZE_MAX);  // The disk must hold any cached writes
+    uint32_t refused = meta_refused;
+    size_t got = span_io(ino, dirent_start_cluster(&dirsec[found % SECTOR_SIZE]), pos, buf, len, SPAN_READ);
+    return meta_refused != refused ? -1 : (int)got;  // Stopped at a damaged FAT sector
+}
+
+int fat16_write_direct(int ino, uint32_t pos, const uint8_t *data, size_t len) {
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_load_inode(ino, dirsec);
+    if (found < 0) return -1;
+    if (len == 0) return 0;
+    if (dirent_compressed(&dirsec[found % SECTOR_SIZE]) && lz4_expand(ino, dirsec, found) != 0) return -1;
+
+    pcache_flush(&fat16_pcache_ops, 0, ino, SIZE_MAX);  // Cached writes must not land on top of this one
+
+    uint32_t off = found % SECTOR_SIZE;
+    uint32_t size = dirent_size(&dirsec[off]);
+    uint16_t start_cluster = dirent_start_cluster(&dirsec[off]);
+    uint32_t end = pos + (uint32_t)len;
+    if (chain_extend(ino, &start_cluster, size, pos, end) != 0) return -1;
+
+    /* Stale bytes past the old end of file in its last sector (left by a truncate) must read back as zeros */
+    if (end > size && size % SECTOR_SIZE) {
+        uint8_t zero[SECTOR_SIZE];
+        kmemset(zero, 0, SECTOR_SIZE);
+        span_io(ino, start_cluster, size, zero, SECTOR_SIZE - size % SECTOR_SIZE, SPAN_WRITE);
+    }
+
+    if (end > size || dirent_start_cluster(&dirsec[off]) != start_cluster) {
+        dirent_set_data(&dirsec[off], start_cluster, end > size ? end : size);
+        write_sector(root_dir_start() + found / SECTOR_SIZE, dirsec);
+    }
+
+    size_t done = span_io(ino, start_cluster, pos, (uint8_t *)data, len, SPAN_WRITE);
+    pcache_invalidate(&fat16_pcache_ops, 0, ino, pos / PCACHE_PAGE_SIZE);  // Clean, but now out of date
+    return done ? (int)done : -1;
+}
+
+int fat16_truncate_inode(int ino, size_t len) {
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_load_inode(ino, dirsec);
+    if (found < 0) return -1;
+    return dir_truncate(dirsec, found, len);
+}
+
+int fat16_readdir(uint32_t *cursor, char *name, uint32_t *size) {
+    uint8_t dirsec[SECTOR_SIZE];
+    while (*cursor < ROOT_DIR_ENTRIES) {
+        uint32_t ino = (*cursor)++;
+        uint32_t off = (ino % DIR_ENTRIES_PER_SECTOR) * 32;
+        if (read_sector(root_dir_start() + ino / DIR_ENTRIES_PER_SECTOR, dirsec) != 0) {
+            *cursor = (ino / DIR_ENTRIES_PER_SECTOR + 1) * DIR_ENTRIES_PER_SECTOR;  // Damaged sector: skip its entries
+            continue;
+        }
+        if (dirsec[off] == 0x00) break;   // End of directory
+        if (dirsec[off] == 0xE5) continue;
+        format_dos_name(&dirsec[off], name);
+        *size = dirent_size(&dirsec[off]);
+        return 0;
+    }
+    *cursor = ROOT_DIR_ENTRIES;
+    return -1;
+}
+
+/* ============================================================================
+   FILE PAGES
+   ============================================================================ */
+// File data is cached in PCACHE_PAGE_SIZE pages keyed by (inode, page index).
+// A page is read or written with one multi-sector transfer per run of
+// consecutive clusters, so an unfragmented page costs a single disk command.
+
+/* Read (write = 0) or write the sectors of page 'index' of a file that lie inside the file.
+   Returns the number of file bytes in the page, or -1 if ino is not a file or its chain
+   runs through a damaged FAT sector */
+static int page_io(int ino, uint32_t index, uint8_t *page, int write) {
+    uint8_t dirsec[SECTOR_SIZE];
+    int found = dir_load_inode(ino, dirsec);
+    if (found < 0) return -1;
+
+    uint32_t size = dirent_size(&dirsec[found % SECTOR_SIZE]);
+    uint32_t start = index * PCACHE_PAGE_SIZE;
+    if (start >= size) return 0;
+    uint32_t bytes = size - start < PCACHE_PAGE_SIZE ? size - start : PCACHE_PAGE_SIZE;
+    uint32_t count = (bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+    // A compressed file is expanded before any write, so its pages are never dirty
+    if (dirent_compressed(&dirsec[found % SECTOR_SIZE])) {
+        if (write) return (int)bytes;
+        return lz4_read_group(ino, dirent_start_cluster(&dirsec[found % SECTOR_SIZE]), index, page, bytes) == 0 ? (int)bytes : -1;
+    }
+
+    uint32_t refused = meta_refused;
+    span_io(ino, dirent_start_cluster(&dirsec[found % SECTOR_SIZE]), start, page,
+            (size_t)count * SECTOR_SIZE, write ? SPAN_WRITE : SPAN_READ);
+    return meta_refused != refused ? -1 : (int)bytes;
+}
+
+static int fat16_page_fill(void *fs, int ino, uint32_t index, uint8_t *page) {
+    (void)fs;
+    kmemset(page, 0, PCACHE_PAGE_SIZE);
+    int bytes = page_io(ino, index, page, 0);
+    if (bytes < 0) return -1;
+    kmemset(page + bytes, 0, PCACHE_PAGE_SIZE - (size_t)bytes);  // Past end of file
+    return 0;
+}
+
+static int fat16_page_writeback(void *fs, int ino, uint32_t index, const uint8_t *page) {
+    (void)fs;
+    page_io(ino, index, (uint8_t *)page, 1);  // A deleted file has nothing left to write
+    return 0;
+}
+
+static const pcache_ops_t fat16_pcache_ops = {
+    .fill = fat16_page_fill,
+    .writeback = fat16_page_writeback
+};
+
+size_t fat16_writeback_pending(void) {
+    return pcache_dirty_count(&fat16_pcache_ops, 0) + (size_t)discard_waiting + (size_t)meta_table_pending();
+}
+
+void fat16_writeback_step(size_t max_pages) {
+    // File pages first: freed clusters are discarded once everything has settled
+    pcache_flush(&fat16_pcache_ops, 0, -1, max_pages);
+    if (pcache_dirty_count(&fat16_pcache_ops, 0) != 0) return;
+    // Then the checksum table, and the discards once the FAT that freed them is durable
+    if (!meta_table_store() && discard_waiting && callbacks.disk_flush) callbacks.disk_flush();
+    discard_issue();
+}
+
+/* VFS adapters: FAT16 has a single volume, so the fs pointer is unused */
+static int fat16_vfs_lookup(void *fs, const char *name) { (void)fs; return fat16_lookup(name); }
+static int fat16_vfs_create(void *fs, const char *name) { (void)fs; return fat16_create(name); }
+static int fat16_vfs_size(void *fs, int ino) { (void)fs; return fat16_file_size(ino); }
+static int fat16_vfs_read(void *fs, int ino, uint32_t pos, uint8_t *buf, size_t len) { (void)fs; return fat16_read(ino, pos, buf, len); }
+static int fat16_vfs_write(void *fs, int ino, uint32_t pos, const uint8_t *data, size_t len) { (void)fs; return fat16_write(ino, pos, data, len); }
+static int fat16_vfs_truncate(void *fs, int ino, uint32_t len) { (void)fs; return fat16_truncate_inode(ino, len); }
+static int fat16_vfs_replace(void *fs, const char *name, const uint8_t *data, size_t len) { (void)fs; return fat16_write_file(name, data, len); }
+static int fat16_vfs_unlink(void *fs, const char *name) { (void)fs; return fat16_unlink(name); }
+static int fat16_vfs_rename(void *fs, const char *old_name, const char *new_name) { (void)fs; return fat16_rename(old_name, new_name); }
+static int fat16_vfs_readdir(void *fs, uint32_t *cursor, char *name, uint32_t *size) { (void)fs; return fat16_readdir(cursor, name, size); }
+static void fat16_vfs_sync(void *fs) { (void)fs; fat16_sync(); }
+static int fat16_vfs_read_direct(void *fs, int ino, uint32_t pos, uint8_t *buf, size_t len) { (void)fs; return fat16_read_direct(ino, pos, buf, len); }
+static int fat16_vfs_write_direct(void *fs, int ino, uint32_t pos, const uint8_t *data, size_t len) { (void)fs; return fat16_write_direct(ino, pos, data, len); }
+static const uint8_t *fat16_vfs_map(void *fs, int ino, uint32_t pos, size_t *len) { (void)fs; return fat16_map(ino, pos, len); }
+
+const vfs_ops_t fat16_vfs_ops = {
+    .lookup = fat16_vfs_lookup,
+    .create = fat16_vfs_create,
+    .size = fat16_vfs_size,
+    .read = fat16_vfs_read,
+    .write = fat16_vfs_write,
+    .truncate = fat16_vfs_truncate,
+    .replace = fat16_vfs_replace,
+    .unlink = fat16_vfs_unlink,
+    .rename = fat16_vfs_rename,
+    .readdir = fat16_vfs_readdir,
+    .sync = fat16_vfs_sync,
+    .map = fat16_vfs_map,
+    .read_direct = fat16_vfs_read_direct,
+    .write_direct = fat16_vfs_write_direct
+};
+
+/* ============================================================================
+   FRAGMENTATION REPORT
+   ============================================================================ */
+
+/* Bucket index for a free extent of len clusters (1, 2-3, 4-7, ...) */
+static uint32_t extent_bucket(uint32_t len) {
+    uint32_t b = 0;
+    while (len > 1 && b < FAT16_FREE_EXTENT_BUCKETS - 1) { len >>= 1; b++; }
+    return b;
+}
+
+void fat16_frag_report(fat16_frag_stats_t *stats, fat16_frag_file_fn per_file) {
+    for (size_t i = 0; i < sizeof(*stats); ++i) ((uint8_t *)stats)[i] = 0;
+
+    /* Per-file fragment counts: a new fragment starts wherever the chain is not contiguous */
+    uint8_t dirsec[SECTOR_SIZE];
+    for (uint32_t s = 0; s < root_dir_sectors(); ++s) {
+        if (read_sector(root_dir_start() + s, dirsec) != 0) continue;  // Damaged sector, fat16_check reports it
+
+        for (uint32_t off = 0; off < SECTOR_SIZE; off += 32) {
+            if (dirsec[off] == 0x00) { s = root_dir_sectors(); break; }  // End of directory
+            if (dirsec[off] == 0xE5) continue;                             // Deleted entry, skip
+
+            uint32_t fragments = 0;
+            uint16_t c = dirent_start_cluster(&dirsec[off]);
+            uint16_t prev = 0;
+            while (c >= 2 && c < 0xFFF8) {
+                if (c != prev + 1) fragments++;
+                prev = c;
+                c = fat_get_entry(c);
+            }
+
+            stats->files++;
+            stats->total_fragments += fragments;
+            if (fragments > 1) stats->fragmented_files++;
+
+            if (per_file) {
+                char name[13];
+                format_dos_name(&dirsec[off], name);
+                per_file(name, dirent_size(&dirsec[off]), fragments);
+            }
+        }
+    }
+
+    /* Free space extents: runs of consecutive free clusters */
+    uint32_t run = 0;
+    uint32_t max_clusters = fat16_data_clusters();
+    for (uint32_t c = 2; c < 2 + max_clusters + 1; ++c) {
+        if (c < 2 + max_clusters && fat_get_entry((uint16_t)c) == 0x0000) {
+            run++;
+            continue;
+        }
+        if (run > 0) {
+            stats->free_clusters += run;
+            stats->free_extents++;
+            stats->free_extent_hist[extent_bucket(run)]++;
+            if (run > stats->largest_free_extent) stats->largest_free_extent = run;
+            run = 0;
+        }
+    }
+}
+
+/* ============================================================================
+   ONLINE DEFRAGMENTER
+   ============================================================================ */
+// Files are packed, in directory order, into consecutive clusters from the
+// start of the data area, which also leaves all free space in one extent at
+// the end. Work is done in small steps so the caller can rate-limit it; any
+// FAT or directory write by someone else restarts the pass from the top.
+//
+// Each cluster move copies the data first, then points the new cluster at the
+// rest of the chain, then switches the single reference to it (the previous
+// FAT entry or the directory entry), and only then frees the old cluster.
+
+static int defrag_active = 0;          // Flag: 1 while a pass is in progress
+static uint32_t defrag_generation;     // meta_generation when the saved position was valid
+static uint32_t defrag_sector;         // Root directory sector of the file being packed
+static uint32_t defrag_offset;         // Offset of its entry within that sector
+static uint16_t defrag_prev;           // Cluster before the current one (0 = directory entry)
+static uint16_t defrag_cluster;        // Current cluster of the file being packed
+static uint16_t defrag_target;         // Where the current cluster should end up
+
+/* Start a defragmentation pass from the first file */
+static void defrag_restart(void) {
+    defrag_sector = 0;
+    defrag_offset = 0;
+    defrag_prev = 0;
+    defrag_cluster = 0;
+    defrag_target = 2;
+    defrag_generation = meta_generation;
+}
+
+/* Move on to the next directory entry */
+static void defrag_next_entry(void) {
+    defrag_cluster = 0;
+    defrag_offset += 32;
+    if (defrag_offset == SECTOR_SIZE) {
+        defrag_offset = 0;
+        defrag_sector++;
+    }
+}
+
+void fat16_defrag_start(void) {
+    defrag_active = 1;
+    defrag_restart();
+}
+
+int fat16_defrag_active(void) {
+    return defrag_active;
+}
+
+/* Point whatever references cluster 'from' (FAT entry prev, or the directory entry of the
+   file at dir sector/offset when prev is 0) at cluster 'to'. Returns -1 if that sector is damaged */
+static int defrag_relink(uint16_t prev, uint32_t dir_sector, uint32_t dir_offset, uint16_t to) {
+    if (prev) return fat_set_entry(prev, to);
+
+    uint8_t dirsec[SECTOR_SIZE];
+    if (read_sector(root_dir_start() + dir_sector, dirsec) != 0) return -1;
+    dirent_set_data(&dirsec[dir_offset], to, dirent_size(&dirsec[dir_offset]));
+    write_sector(root_dir_start() + dir_sector, dirsec);
+    return 0;
+}
+
+/* Move the contents of cluster 'from' (referenced as described for defrag_relink) to free cluster 'to'.
+   Returns -1, leaving 'from' in use, if a sector involved cannot be read or trusted */
+static int defrag_move(uint16_t from, uint16_t to, uint16_t prev, uint32_t dir_sector, uint32_t dir_offset) {
+    uint8_t secbuf[SECTOR_SIZE];
+    uint32_t refused = meta_refused;
+    uint16_t next = fat_get_entry(from);
+    if (meta_refused != refused || read_sector(cluster_to_sector(from), secbuf) != 0) return -1;
+    write_sector(cluster_to_sector(to), secbuf);          // 1. Copy data
+    if (fat_set_entry(to, next) != 0) return -1;          // 2. New cluster continues the chain
+    if (defrag_relink(prev, dir_sector, dir_offset, to) != 0) {
+        fat_set_entry(to, 0x0000);                        // 3. Switch the reference (or give 'to' back)
+        return -1;
+    }
+    fat_set_entry(from, 0x0000);                          // 4. Free the old cluster
+    extent_map_invalidate(-1);  // 'from' may belong to any file (evictions), drop every map
+    return 0;
+}
+
+/* Find who references cluster c: a FAT entry (returned in *prev) or a directory entry.
+   Returns 0 if found, -1 if the cluster is not referenced */
+static int defrag_find_owner(uint16_t c, uint16_t *prev, uint32_t *dir_sector, uint32_t *dir_offset) {
+    uint8_t secbuf[SECTOR_SIZE];
+    uint32_t max_clusters = fat16_data_clusters();
+
+    // Look for a FAT entry pointing at c, one FAT sector at a time
+    for (uint32_t s = 0; s < SECTORS_PER_FAT; ++s) {
+        if (read_sector(first_fat_sector() + s, secbuf) != 0) return -1;  // Can't tell, leave c alone
+        for (uint32_t i = 0; i < SECTOR_SIZE / 2; ++i) {
+            uint32_t entry = s * (SECTOR_SIZE / 2) + i;
+            if (entry < 2 || entry >= 2 + max_clusters) continue;
+            if ((uint16_t)(secbuf[i*2] | (secbuf[i*2+1] << 8)) == c) {
+                *prev = (uint16_t)entry;
+                return 0;
+            }
+        }
+    }
+
+    // Otherwise it must be the first cluster of a file
+    for (uint32_t s = 0; s < root_dir_sectors(); ++s) {
+        if (read_sector(root_dir_start() + s, secbuf) != 0) return -1;
+        for (uint32_t off = 0; off < SECTOR_SIZE; off += 32) {
+            if (secbuf[off] == 0x00) return -1;
+            if (secbuf[off] == 0xE5) continue;
+            if (dirent_start_cluster(&secbuf[off]) == c) {
+                *prev = 0;
+                *dir_sector = s;
+                *dir_offset = off;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Find the highest-numbered free cluster above 'above', or -1 */
+static int32_t defrag_find_free_high(uint16_t above) {
+    uint32_t max_clusters = fat16_data_clusters();
+    for (uint32_t c = 2 + max_clusters - 1; c > above; --c) {
+        if (fat_get_entry((uint16_t)c) == 0x0000) return (int32_t)c;
+    }
+    return -1;
+}
+
+int fat16_defrag_step(size_t max_clusters) {
+    if (!defrag_active) return 0;
+
+    // Chains waiting to be reclaimed are not referenced by anything, free them first
+    if (reclaim_count > 0) {
+        fat16_sync();
+        defrag_restart();
+        return 1;
+    }
+
+    // Someone else changed the FAT or directory since the last step: start again
+    if (defrag_generation != meta_generation) defrag_restart();
+
+    uint8_t dirsec[SECTOR_SIZE];
+    uint32_t refused = meta_refused;
+    while (max_clusters > 0 && meta_refused == refused) {
+        /* Pick up the next file when the current one is done */
+        if (defrag_cluster < 2 || defrag_cluster >= 0xFFF8) {
+            if (defrag_sector >= root_dir_sectors()) break;  // No more files
+            if (read_sector(root_dir_start() + defrag_sector, dirsec) != 0) break;  // Damaged directory
+            if (dirsec[defrag_offset] == 0x00) break;        // End of directory
+
+            uint16_t start = dirent_start_cluster(&dirsec[defrag_offset]);
+            if (dirsec[defrag_offset] == 0xE5 || start < 2) {
+                defrag_next_entry();  // Deleted or empty file, nothing to pack
+                continue;
+            }
+            defrag_prev = 0;
+            defrag_cluster = start;
+        }
+
+        max_clusters--;
+        uint16_t c = defrag_cluster;
+        uint16_t d = defrag_target;
+
+        if (c != d) {
+            if (fat_get_entry(d) != 0x0000) {
+                /* Target is used by another chain (or a later part of this one): evict it */
+                uint16_t owner_prev = 0;
+                uint32_t owner_sector = 0, owner_offset = 0;
+                int32_t f = defrag_find_free_high(d);
+                if (f < 0 || defrag_find_owner(d, &owner_prev, &owner_sector, &owner_offset) != 0) break;  // Disk full or orphan
+                if (defrag_move(d, (uint16_t)f, owner_prev, owner_sector, owner_offset) != 0) break;
+                continue;  // Target is free now, move the current cluster on the next pass
+            }
+            /* Target is free: move the current cluster there */
+            if (defrag_move(c, d, defrag_prev, defrag_sector, defrag_offset) != 0) break;
+            c = d;
+        }
+
+        // Current cluster is in place, continue along the chain
+        defrag_prev = c;
+        defrag_cluster = fat_get_entry(c);
+        defrag_target++;
+        if (defrag_cluster < 2 || defrag_cluster >= 0xFFF8) {
+            defrag_next_entry();  // File finished
+        }
+    }
+
+    defrag_generation = meta_generation;  // Our own writes don't invalidate the position
+    if (max_clusters > 0 || meta_refused != refused) defrag_active = 0;  // Stopped early: pass finished
+    return defrag_active;
+}
@@ -0,0 +1,148 @@
+/* fat16.h - FAT16 filesystem interface */
+#ifndef FAT16_H
+#define FAT16_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vfs.h"
+
+/* Filesystem Parameters */
+#define SECTOR_SIZE 512           // Standard sector size
+#define TOTAL_SECTORS 512         // Total disk size: 256KB
+
+/* Sector I/O callbacks that the filesystem needs - must be provided by kernel (or a host harness) */
+typedef struct {
+    int (*disk_read)(uint32_t lba, void *buf);          // Read one sector, return 0 on success
+    int (*disk_write)(uint32_t lba, const void *buf);   // Write one sector, return 0 on success
+    /* Optional (may be NULL): transfer count consecutive sectors with a single command */
+    int (*disk_read_sectors)(uint32_t lba, uint32_t count, void *buf);
+    int (*disk_write_sectors)(uint32_t lba, uint32_t count, const void *buf);
+    /* Optional (may be NULL): make every completed write durable */
+    int (*disk_flush)(void);
+    /* Optional (may be NULL): tell the disk that count sectors from lba no longer hold data */
+    int (*disk_discard)(uint32_t lba, uint32_t count);
+} fat16_callbacks_t;
+
+/* Set the callbacks that the filesystem will use */
+void fat16_set_callbacks(const fat16_callbacks_t *callbacks);
+
+/* Format the disk with an empty FAT16 filesystem */
+void fat16_init(void);
+
+/* Use the FAT16 volume already on the disk instead of formatting it. Returns 0, or -1 if the
+   disk does not hold a volume in this layout */
+int fat16_mount(void);
+
+/* Write a whole file, replacing any existing file with the same name. Returns 0 on success, -1 on failure */
+int fat16_write_file(const char *name, const uint8_t *data, size_t len);
+
+/* Read up to maxlen bytes of a file. Returns number of bytes read, or -1 if not found */
+int fat16_read_file(const char *name, uint8_t *out, size_t maxlen);
+
+/* Delete a file. Its clusters are queued for reclamation. Returns 0 on success, -1 if not found */
+int fat16_unlink(const char *name);
+
+/* Rename a file. Fails (-1) if the new name is already in use */
+int fat16_rename(const char *old_name, const char *new_name);
+
+/* Shrink a file to len bytes. Released clusters are queued for reclamation. Returns 0 on success, -1 on failure */
+int fat16_truncate(const char *name, size_t len);
+
+/* Inode interface used by the VFS (inode number = root directory entry index) */
+int fat16_lookup(const char *name);                                   // Returns inode or -1
+int fat16_create(const char *name);                                   // Returns inode (existing or new) or -1
+int fat16_file_size(int ino);                                         // Returns size in bytes or -1
+int fat16_read(int ino, uint32_t pos, uint8_t *buf, size_t len);       // Returns bytes read or -1
+int fat16_write(int ino, uint32_t pos, const uint8_t *data, size_t len); // Returns bytes written or -1, grows the file
+int fat16_truncate_inode(int ino, size_t len);                        // Shrink, returns 0 or -1
+int fat16_readdir(uint32_t *cursor, char *name, uint32_t *size);      // Next file from *cursor, -1 at end
+
+/* Read or write bypassing the page cache: whole sectors move directly between the caller's
+   buffer and the disk, only a partial first or last sector is staged. Same results as
+   fat16_read/fat16_write, but the data reaches the disk before the call returns */
+int fat16_read_direct(int ino, uint32_t pos, uint8_t *buf, size_t len);
+int fat16_write_direct(int ino, uint32_t pos, const uint8_t *data, size_t len);
+
+/* Map file data at pos without copying: returns a pointer into the page cache and sets *len to
+   the bytes available there (up to the end of the page or file). Valid until the next FAT16 call.
+   Returns NULL at end of file or on failure */
+const uint8_t *fat16_map(int ino, uint32_t pos, size_t *len);
+
+/* FAT16 as a VFS backend */
+extern const vfs_ops_t fat16_vfs_ops;
+
+/* Number of cluster chains still waiting to be freed */
+size_t fat16_reclaim_pending(void);
+
+/* Free up to max_clusters queued clusters (called from the idle loop) */
+void fat16_reclaim_step(size_t max_clusters);
+
+/* Number of cached file pages not yet written to disk (plus 1 while freed clusters wait to be
+   discarded, and 1 while the metadata checksum table on disk is out of date) */
+size_t fat16_writeback_pending(void);
+
+/* Write up to max_pages dirty file pages to disk (called from the idle loop) */
+void fat16_writeback_step(size_t max_pages);
+
+/* Write back every dirty file page, free every queued cluster chain and store the
+   metadata checksums, then flush the disk cache */
+void fat16_sync(void);
+
+/* Fragmentation statistics for the whole volume */
+#define FAT16_FREE_EXTENT_BUCKETS 10  // Free extents of 1, 2-3, 4-7, ... 512+ clusters
+
+typedef struct {
+    uint32_t files;                  // Files in the root directory
+    uint32_t fragmented_files;       // Files stored in more than one fragment
+    uint32_t total_fragments;        // Fragments across all files
+    uint32_t free_clusters;          // Free clusters in the data area
+    uint32_t free_extents;           // Runs of consecutive free clusters
+    uint32_t largest_free_extent;    // Longest run of free clusters
+    uint32_t free_extent_hist[FAT16_FREE_EXTENT_BUCKETS];  // Free extents by log2 length
+} fat16_frag_stats_t;
+
+/* Called once per file by fat16_frag_report */
+typedef void (*fat16_frag_file_fn)(const char *name, uint32_t size, uint32_t fragments);
+
+/* Fill in fragmentation statistics, calling per_file (if not NULL) for every file */
+void fat16_frag_report(fat16_frag_stats_t *stats, fat16_frag_file_fn per_file);
+
+/* Start an online defragmentation pass (files packed in directory order, free space at the end) */
+void fat16_defrag_start(void);
+
+/* Check if a defragmentation pass is in progress */
+int fat16_defrag_active(void);
+
+/* Move up to max_clusters clusters. Returns 1 while the pass has more work, 0 when finished */
+int fat16_defrag_step(size_t max_clusters);
+
+/* Metadata checksums: every FAT and root directory sector has a CRC32C that is checked when
+   the sector is read. A bad FAT sector is repaired from the other FAT copy when that still matches;
+   a sector that can't be repaired is never used, and operations that need it fail with -1.
+   The table is stored at sync and from the idle loop; mounting a volume that was not closed
+   cleanly takes the sectors written since as they are (FAT sectors only if both copies agree) */
+typedef struct {
+    uint32_t checked;    // Metadata sector reads verified
+    uint32_t bad;        // Reads that did not match their checksum
+    uint32_t repaired;   // Bad FAT sectors restored from the other copy
+} fat16_check_stats_t;
+
+/* Format volumes with (1, the default) or without (0) checksums from the next fat16_init on */
+void fat16_set_checksums(int enabled);
+
+/* Verify every metadata sector of the volume, repairing what can be repaired. Fills in the
+   results of this scan and returns the number of bad sectors left (0 if the volume is clean) */
+int fat16_check(fat16_check_stats_t *stats);
+
+/* Totals since the volume was formatted or mounted (including checks on normal reads) */
+void fat16_check_stats(fat16_check_stats_t *stats);
+
+/* Store files written with fat16_write_file LZ4-compressed (1) or plain (0, the default).
+   Compressed files read back transparently; writing into one or truncating it first
+   rewrites it uncompressed */
+void fat16_set_compression(int enabled);
+
+/* Number of clusters in the data area (used to size workloads) */
+uint32_t fat16_data_clusters(void);
+
+#endif
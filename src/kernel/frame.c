@@ -0,0 +1,503 @@
+/* frame.c - Buddy allocator for physical page frames
+ *
+ * Free memory is kept as blocks of 2^order frames, each aligned to its own
+ * size, on one list per order. An allocation takes the smallest block that is
+ * big enough and splits off halves (buddies) onto the lower lists until it has
+ * the size asked for; a free merges the block with its buddy for as long as
+ * the buddy is free too. Both walk at most FRAME_ORDERS lists, and merging
+ * keeps large blocks available however memory was carved up.
+ *
+ * The list links live in the free blocks themselves, which the identity map
+ * makes addressable. One state byte per frame below the limit says whether a
+ * frame starts a free or an allocated block, and of which order; that table
+ * is carved out of the first range of RAM added that has room for it.
+ *
+ * On a NUMA machine every node has its own set of lists. No block crosses a
+ * node boundary and buddies on different nodes never merge, so a block is
+ * always on its node's lists. An allocation is served from the node of the
+ * CPU asking, and only when that node is out of blocks big enough from the
+ * others, nearest first.
+ *
+ * Pages that have to start out zeroed come from a pool per node, filled in
+ * the idle loop with non-temporal stores so that clearing them neither
+ * waits on nor evicts cache lines. Taking one is a pop off the pool.
+ */
+#include "frame.h"
+#include "kstring.h"
+
+/* Frame state: flag plus block order in the low bits, 0 inside a block or for unmanaged frames */
+#define STATE_FREE 0x80   // First frame of a free block
+#define STATE_USED 0x40   // First frame of an allocated block
+#define STATE_ORDER 0x0F
+
+typedef struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+} free_block_t;
+
+typedef struct {
+    uint64_t start;   // First byte, rounded down to a frame
+    uint64_t end;     // Byte past the last, rounded up to a frame
+} range_t;
+
+typedef struct {
+    uint64_t start;   // First frame
+    uint64_t end;     // Frame past the last
+    int node;
+} node_range_t;
+
+static frame_callbacks_t callbacks;
+static uint8_t *state = 0;       // One byte per frame, 0 until frame_add places it
+static uint64_t nframes = 0;     // Frames below the limit
+static uint64_t top_frame = 0;   // Frame past the highest one added
+static free_block_t *free_lists[FRAME_MAX_NODES][FRAME_ORDERS];
+static uint64_t free_blocks[FRAME_MAX_NODES][FRAME_ORDERS];
+static frame_node_stats_t node_stats[FRAME_MAX_NODES];
+static uint64_t total_frames = 0;
+static uint64_t free_frames = 0;
+
+static range_t reserved[FRAME_MAX_RESERVED + 1];  // The last one for the state table
+static int nreserved = 0;
+
+static uint64_t zero_pool[FRAME_MAX_NODES][FRAME_ZERO_POOL];  // Zeroed frames, allocated
+static unsigned zero_count[FRAME_MAX_NODES];
+
+static node_range_t node_ranges[FRAME_MAX_NODE_RANGES];
+static int nnode_ranges = 0;
+static int nnodes = 1;
+static int fallback[FRAME_MAX_NODES][FRAME_MAX_NODES];  // Nodes to try, nearest first
+static int nfallback[FRAME_MAX_NODES];
+
+void frame_set_callbacks(const frame_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+void frame_init(uint64_t limit) {
+    if (limit > FRAME_MAX_MEMORY) limit = FRAME_MAX_MEMORY;
+    nframes = (limit + FRAME_SIZE - 1) / FRAME_SIZE;
+    top_frame = 0;
+    state = 0;
+    for (int n = 0; n < FRAME_MAX_NODES; ++n) {
+        for (int k = 0; k < FRAME_ORDERS; ++k) {
+            free_lists[n][k] = 0;
+            free_blocks[n][k] = 0;
+        }
+        node_stats[n].frames = node_stats[n].free = 0;
+        node_stats[n].allocs = node_stats[n].frees = node_stats[n].fallbacks = 0;
+        node_stats[n].zeroed = node_stats[n].zero_hits = node_stats[n].zero_misses = 0;
+        zero_count[n] = 0;
+        nfallback[n] = 0;
+    }
+    total_frames = free_frames = 0;
+    nreserved = 0;
+    nnode_ranges = 0;
+    nnodes = 1;
+}
+
+int frame_reserve(uint64_t base, uint64_t len) {
+    if (len == 0) return 0;
+    if (nreserved >= FRAME_MAX_RESERVED) return -1;  // The spare slot is only for the state table
+    uint64_t end = base + len < base ? ~0ull : base + len;
+    reserved[nreserved].start = base & ~(uint64_t)(FRAME_SIZE - 1);
+    reserved[nreserved].end = end > ~0ull - FRAME_SIZE ? ~0ull : (end + FRAME_SIZE - 1) & ~(uint64_t)(FRAME_SIZE - 1);
+    nreserved++;
+    return 0;
+}
+
+/* ============================================================================
+   FREE LISTS
+   ============================================================================ */
+
+static free_block_t *block_at(uint64_t frame) {
+    return (free_block_t *)(uintptr_t)(frame * FRAME_SIZE);
+}
+
+/* Node of a frame: from the ranges frame_set_node was given, 0 outside them */
+static int node_of(uint64_t frame) {
+    for (int i = 0; i < nnode_ranges; ++i) {
+        if (frame >= node_ranges[i].start && frame < node_ranges[i].end) return node_ranges[i].node;
+    }
+    return 0;
+}
+
+/* Check if a node range starts or ends inside frames start..end-1 */
+static int node_split(uint64_t start, uint64_t end) {
+    for (int i = 0; i < nnode_ranges; ++i) {
+        if ((node_ranges[i].start > start && node_ranges[i].start < end) ||
+            (node_ranges[i].end > start && node_ranges[i].end < end)) return 1;
+    }
+    return 0;
+}
+
+static void push_block(uint64_t frame, unsigned order, int node) {
+    free_block_t *b = block_at(frame);
+    b->prev = 0;
+    b->next = free_lists[node][order];
+    if (b->next) b->next->prev = b;
+    free_lists[node][order] = b;
+    free_blocks[node][order]++;
+    state[frame] = (uint8_t)(STATE_FREE | order);
+}
+
+static void unlink_block(uint64_t frame, unsigned order, int node) {
+    free_block_t *b = block_at(frame);
+    if (b->prev) b->prev->next = b->next;
+    else free_lists[node][order] = b->next;
+    if (b->next) b->next->prev = b->prev;
+    free_blocks[node][order]--;
+    state[frame] = 0;
+}
+
+/* Put a free block on its node's list, first merging it with its buddy as far as possible */
+static void release_block(uint64_t frame, unsigned order, int node) {
+    while (order + 1 < FRAME_ORDERS) {
+        uint64_t buddy = frame ^ (1ull << order);
+        if (buddy >= nframes || state[buddy] != (STATE_FREE | order)) break;
+        if (nnode_ranges && node_of(buddy) != node) break;
+        unlink_block(buddy, order, node);
+        frame &= ~(1ull << order);
+        order++;
+    }
+    push_block(frame, order, node);
+}
+
+/* ============================================================================
+   ADDING MEMORY
+   ============================================================================ */
+
+/* End of the reserved range holding addr, 0 if it is not reserved */
+static uint64_t reserved_end(uint64_t addr) {
+    for (int i = 0; i < nreserved; ++i) {
+        if (addr >= reserved[i].start && addr < reserved[i].end) return reserved[i].end;
+    }
+    return 0;
+}
+
+/* Check if start..end-1 touches a reserved range */
+static int reserved_overlap(uint64_t start, uint64_t end) {
+    for (int i = 0; i < nreserved; ++i) {
+        if (start < reserved[i].end && reserved[i].start < end) return 1;
+    }
+    return 0;
+}
+
+/* Put the state table in the first place in addr..end-1 clear of the reserved ranges, and
+   reserve it. Returns 0, or -1 if it does not fit */
+static int place_state(uint64_t addr, uint64_t end) {
+    if (nreserved > FRAME_MAX_RESERVED) return -1;  // Spare slot already used
+    uint64_t size = (nframes + FRAME_SIZE - 1) & ~(uint64_t)(FRAME_SIZE - 1);
+    while (addr + size <= end) {
+        uint64_t skip = 0;
+        for (int i = 0; i < nreserved; ++i) {
+            if (addr < reserved[i].end && reserved[i].start < addr + size && reserved[i].end > skip) skip = reserved[i].end;
+        }
+        if (!skip) {
+            state = (uint8_t *)(uintptr_t)addr;
+            for (uint64_t i = 0; i < nframes; ++i) state[i] = 0;
+            reserved[nreserved].start = addr;
+            reserved[nreserved].end = addr + size;
+            nreserved++;
+            return 0;
+        }
+        addr = skip;
+    }
+    return -1;
+}
+
+/* Free addr..end-1 (frame aligned) with the largest aligned blocks that fit around the
+   reserved ranges and inside one node. Returns the number of frames */
+static uint64_t cover(uint64_t addr, uint64_t end) {
+    uint64_t frames = 0;
+    while (addr < end) {
+        uint64_t skip = reserved_end(addr);
+        if (skip) {
+            addr = skip;
+            continue;
+        }
+        unsigned order = 0;
+        while (order + 1 < FRAME_ORDERS) {
+            uint64_t size = (uint64_t)FRAME_SIZE << (order + 1);
+            if ((addr & (size - 1)) || addr + size > end || reserved_overlap(addr, addr + size) ||
+                node_split(addr / FRAME_SIZE, (addr + size) / FRAME_SIZE)) break;
+            order++;
+        }
+        int node = node_of(addr / FRAME_SIZE);
+        release_block(addr / FRAME_SIZE, order, node);
+        node_stats[node].frames += 1ull << order;
+        node_stats[node].free += 1ull << order;
+        frames += 1ull << order;
+        addr += (uint64_t)FRAME_SIZE << order;
+    }
+    return frames;
+}
+
+int frame_add(uint64_t base, uint64_t len) {
+    uint64_t limit = nframes * FRAME_SIZE;
+    uint64_t end = base + len < base || base + len > limit ? limit : base + len;
+    uint64_t addr = (base + FRAME_SIZE - 1) & ~(uint64_t)(FRAME_SIZE - 1);
+    end &= ~(uint64_t)(FRAME_SIZE - 1);
+    if (addr < FRAME_SIZE) addr = FRAME_SIZE;  // Address 0 means out of memory
+    if (addr >= end) return 0;
+    if (!state && place_state(addr, end) != 0) return -1;
+
+    uint64_t frames = cover(addr, end);
+    total_frames += frames;
+    free_frames += frames;
+    if (end / FRAME_SIZE > top_frame) top_frame = end / FRAME_SIZE;
+    return 0;
+}
+
+/* ============================================================================
+   NODES
+   ============================================================================ */
+
+int frame_set_node(uint64_t base, uint64_t len, int node) {
+    if (node < 0 || node >= FRAME_MAX_NODES || nnode_ranges == FRAME_MAX_NODE_RANGES) return -1;
+    if (len == 0) return 0;
+    uint64_t end = base + len < base ? ~0ull : base + len;
+    node_ranges[nnode_ranges].start = base / FRAME_SIZE;
+    node_ranges[nnode_ranges].end = end / FRAME_SIZE + (end % FRAME_SIZE != 0);
+    node_ranges[nnode_ranges].node = node;
+    nnode_ranges++;
+    if (node >= nnodes) nnodes = node + 1;
+    return 0;
+}
+
+int frame_set_fallback(int node, const int *nodes, int n) {
+    if (node < 0 || node >= FRAME_MAX_NODES || n < 0 || n > FRAME_MAX_NODES) return -1;
+    for (int i = 0; i < n; ++i) {
+        if (nodes[i] < 0 || nodes[i] >= FRAME_MAX_NODES) return -1;
+    }
+    for (int i = 0; i < n; ++i) fallback[node][i] = nodes[i];
+    nfallback[node] = n;
+    return 0;
+}
+
+void frame_regroup(void) {
+    if (!state) return;
+
+    // Take every free block off the lists, chained through next, with its state cleared so
+    // that nothing merges with it before its turn
+    free_block_t *chain = 0;
+    for (int n = 0; n < FRAME_MAX_NODES; ++n) {
+        for (int k = 0; k < FRAME_ORDERS; ++k) {
+            while (free_lists[n][k]) {
+                free_block_t *b = free_lists[n][k];
+                uint64_t frame = (uint64_t)(uintptr_t)b / FRAME_SIZE;
+                unlink_block(frame, (unsigned)k, n);
+                b->prev = (free_block_t *)(uintptr_t)k;  // Order, for the second pass
+                b->next = chain;
+                chain = b;
+            }
+        }
+        node_stats[n].frames = node_stats[n].free = 0;
+    }
+
+    // Free them again, now split along the node ranges
+    while (chain) {
+        free_block_t *b = chain;
+        chain = b->next;
+        uint64_t addr = (uint64_t)(uintptr_t)b;
+        cover(addr, addr + ((uint64_t)FRAME_SIZE << (uintptr_t)b->prev));
+    }
+
+    // Blocks in use count toward their node's frames
+    for (uint64_t f = 0; f < top_frame; ++f) {
+        if (state[f] & STATE_USED) node_stats[node_of(f)].frames += 1ull << (state[f] & STATE_ORDER);
+    }
+}
+
+int frame_nodes(void) {
+    return nnodes;
+}
+
+int frame_node_stats(int node, frame_node_stats_t *st) {
+    if (node < 0 || node >= nnodes) return -1;
+    *st = node_stats[node];
+    return 0;
+}
+
+/* ============================================================================
+   ALLOCATION
+   ============================================================================ */
+
+/* Take a block of 2^order frames from node's lists. Returns the frame, 0 if it has none */
+static uint64_t take_block(unsigned order, int node) {
+    unsigned k = order;
+    while (k < FRAME_ORDERS && !free_lists[node][k]) k++;
+    if (k == FRAME_ORDERS) return 0;
+
+    uint64_t frame = (uint64_t)(uintptr_t)free_lists[node][k] / FRAME_SIZE;
+    unlink_block(frame, k, node);
+    while (k > order) {  // Return the upper halves to the lower lists
+        k--;
+        push_block(frame + (1ull << k), k, node);
+    }
+    state[frame] = (uint8_t)(STATE_USED | order);
+    free_frames -= 1ull << order;
+    node_stats[node].free -= 1ull << order;
+    return frame;
+}
+
+/* Take a frame from node's zeroed pool. Returns the frame, 0 if the pool is empty */
+static uint64_t take_zeroed(int node) {
+    if (!zero_count[node]) return 0;
+    node_stats[node].zeroed--;
+    node_stats[node].free--;
+    free_frames--;
+    return zero_pool[node][--zero_count[node]];
+}
+
+static unsigned zero_drain(void);  // Pooled frames go back to the lists (see ZEROED FRAMES)
+
+/* Take a block from node's lists, or failing that from the other nodes'. Returns the frame, 0 if
+   none has one */
+static uint64_t alloc_block(unsigned order, int node) {
+    uint64_t frame = take_block(order, node);
+    if (!frame && order == 0) frame = take_zeroed(node);  // Zeroed frames do for any use
+    if (frame) {
+        node_stats[node].allocs++;
+        return frame;
+    }
+
+    // Fall back to the other nodes, nearest first, or in order if no list was set
+    int n = nfallback[node] ? nfallback[node] : nnodes;
+    for (int i = 0; i < n; ++i) {
+        int other = nfallback[node] ? fallback[node][i] : i;
+        if (other == node || other >= nnodes) continue;
+        frame = take_block(order, other);
+        if (!frame && order == 0) frame = take_zeroed(other);
+        if (frame) {
+            node_stats[other].allocs++;
+            node_stats[node].fallbacks++;
+            return frame;
+        }
+    }
+    return 0;
+}
+
+uint64_t frame_alloc_node(unsigned order, int node) {
+    if (order >= FRAME_ORDERS) return 0;
+    if (node < 0 || node >= nnodes) node = 0;
+    uint64_t frame = alloc_block(order, node);
+    // Pooled frames count as free, so a larger block they would merge back into must not fail
+    if (!frame && order > 0 && zero_drain()) frame = alloc_block(order, node);
+    return frame * FRAME_SIZE;
+}
+
+uint64_t frame_alloc(unsigned order) {
+    return frame_alloc_node(order, callbacks.node ? callbacks.node() : 0);
+}
+
+int frame_free(uint64_t addr) {
+    if ((addr & (FRAME_SIZE - 1)) || addr / FRAME_SIZE >= nframes || !state) return -1;
+    uint64_t frame = addr / FRAME_SIZE;
+    if (!(state[frame] & STATE_USED)) return -1;
+    unsigned order = state[frame] & STATE_ORDER;
+    int node = node_of(frame);
+    state[frame] = 0;
+    free_frames += 1ull << order;
+    node_stats[node].free += 1ull << order;
+    node_stats[node].frees++;
+    release_block(frame, order, node);
+    return 0;
+}
+
+/* ============================================================================
+   ZEROED FRAMES
+   ============================================================================ */
+
+/* Clear a frame with non-temporal stores, which go to memory through write-combining
+   buffers instead of reading each line into the cache first and evicting something else */
+static void zero_frame(uint64_t frame) {
+    uint64_t *p = (uint64_t *)(uintptr_t)(frame * FRAME_SIZE);
+    for (unsigned i = 0; i < FRAME_SIZE / 8; i += 8) {
+        __asm__ volatile ("movnti %1, 0(%0)\n\tmovnti %1, 8(%0)\n\t"
+                          "movnti %1, 16(%0)\n\tmovnti %1, 24(%0)\n\t"
+                          "movnti %1, 32(%0)\n\tmovnti %1, 40(%0)\n\t"
+                          "movnti %1, 48(%0)\n\tmovnti %1, 56(%0)"
+                          : : "r"(p + i), "r"(0ull) : "memory");
+    }
+}
+
+static int caller_node(void) {
+    int node = callbacks.node ? callbacks.node() : 0;
+    return node < 0 || node >= nnodes ? 0 : node;
+}
+
+uint64_t frame_alloc_zeroed(void) {
+    int node = caller_node();
+    uint64_t frame = take_zeroed(node);
+    if (frame) {
+        node_stats[node].allocs++;
+        node_stats[node].zero_hits++;
+        return frame * FRAME_SIZE;
+    }
+    // Pool empty: clear one now, with ordinary stores since the caller is about to use it
+    uint64_t addr = frame_alloc_node(0, node);
+    if (!addr) return 0;
+    node_stats[node].zero_misses++;
+    kmemset((void *)(uintptr_t)addr, 0, FRAME_SIZE);
+    return addr;
+}
+
+/* Hand every pooled frame back to its node's lists, where it can merge with its buddies
+   again. The frames stay free, they are just no longer known to be zero. Returns how many */
+static unsigned zero_drain(void) {
+    unsigned drained = 0;
+    for (int node = 0; node < nnodes; ++node) {
+        while (zero_count[node]) {
+            uint64_t frame = zero_pool[node][--zero_count[node]];
+            node_stats[node].zeroed--;
+            state[frame] = 0;
+            release_block(frame, 0, node);
+            drained++;
+        }
+    }
+    return drained;
+}
+
+int frame_zero_pending(void) {
+    int node = caller_node();
+    if (zero_count[node] == FRAME_ZERO_POOL || !state) return 0;
+    for (unsigned k = 0; k < FRAME_ORDERS; ++k) {
+        if (free_lists[node][k]) return 1;
+    }
+    return 0;
+}
+
+unsigned frame_zero_step(unsigned max) {
+    int node = caller_node();
+    unsigned done = 0;
+    while (done < max && zero_count[node] < FRAME_ZERO_POOL) {
+        uint64_t frame = take_block(0, node);  // Only the node's own memory is worth clearing ahead
+        if (!frame) break;
+        zero_frame(frame);
+        free_frames++;  // Pooled frames still count as free
+        node_stats[node].free++;
+        node_stats[node].zeroed++;
+        zero_pool[node][zero_count[node]++] = frame;
+        done++;
+    }
+    if (done) __asm__ volatile ("sfence" : : : "memory");  // Drain the write-combining buffers
+    return done;
+}
+
+/* ============================================================================
+   STATISTICS
+   ============================================================================ */
+
+uint64_t frame_total(void) {
+    return total_frames;
+}
+
+uint64_t frame_free_count(void) {
+    return free_frames;
+}
+
+uint64_t frame_free_blocks(unsigned order) {
+    if (order >= FRAME_ORDERS) return 0;
+    uint64_t blocks = 0;
+    for (int n = 0; n < FRAME_MAX_NODES; ++n) blocks += free_blocks[n][order];
+    return blocks;
+}
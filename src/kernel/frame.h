@@ -0,0 +1,99 @@
+/* frame.h - Physical memory: buddy allocator for 4KB page frames */
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAME_SIZE 4096                   // Bytes per frame
+#define FRAME_ORDERS 11                   // Block sizes: 2^0 to 2^10 frames (4KB to 4MB)
+#define FRAME_MAX_MEMORY 0x8000000000ull  // Most physical memory managed (512GB)
+#define FRAME_MAX_RESERVED 16             // Ranges frame_reserve can hold
+#define FRAME_MAX_NODES 8                 // NUMA nodes with lists of their own
+#define FRAME_MAX_NODE_RANGES 32          // Ranges frame_set_node can hold
+#define FRAME_ZERO_POOL 256               // Zeroed frames kept ready per node (1MB)
+
+/* Callbacks - optional, set by kernel */
+typedef struct {
+    int (*node)(void);    // NUMA node of the calling CPU, where frame_alloc looks first
+} frame_callbacks_t;
+
+/* Usage of one node's memory */
+typedef struct {
+    uint64_t frames;      // Frames handed to the allocator on this node
+    uint64_t free;
+    uint64_t allocs;      // Blocks allocated from this node
+    uint64_t frees;       // Blocks freed back to it
+    uint64_t fallbacks;   // Requests from this node's CPUs served by another node
+    uint64_t zeroed;      // Free frames already cleared, in the pool
+    uint64_t zero_hits;   // frame_alloc_zeroed calls the pool served
+    uint64_t zero_misses; // frame_alloc_zeroed calls that found the pool empty and cleared a frame
+} frame_node_stats_t;
+
+/* Set the callbacks that the frame allocator will use */
+void frame_set_callbacks(const frame_callbacks_t *callbacks);
+
+/* Start over with no memory, for RAM below limit (capped to FRAME_MAX_MEMORY). Reserve ranges
+   first, then add the usable ones */
+void frame_init(uint64_t limit);
+
+/* Keep base..base+len-1 out of every range frame_add is given later (the kernel image, boot
+   modules, firmware tables). Returns 0, or -1 if the table of ranges is full */
+int frame_reserve(uint64_t base, uint64_t len);
+
+/* Hand usable RAM at base..base+len-1 to the allocator, less the reserved ranges. Partial
+   frames at either end and anything past the limit are left out. Ranges must not overlap ones
+   added before, and must be mapped at their physical address. The first range with room
+   also holds the allocator's table, one byte per frame below the limit. Returns 0, or -1 if
+   the range was left out because the table has no place yet */
+int frame_add(uint64_t base, uint64_t len);
+
+/* Put RAM at base..base+len-1 on NUMA node (below FRAME_MAX_NODES); memory outside every
+   such range is on node 0. Ranges given before frame_add apply right away, later ones once
+   frame_regroup runs. Returns 0, or -1 if the node is out of range or the table is full */
+int frame_set_node(uint64_t base, uint64_t len, int node);
+
+/* Nodes for frame_alloc_node to try after node, nearest first (by default all of them in
+   order). Returns 0, or -1 if a node is out of range */
+int frame_set_fallback(int node, const int *nodes, int n);
+
+/* Move the free blocks onto the lists of the nodes frame_set_node has since put them on */
+void frame_regroup(void);
+
+/* Allocate 2^order contiguous frames, aligned to their size, from the calling CPU's node (the
+   node callback, 0 without one), falling back to the others and then to the zeroed pools.
+   Returns the physical address
+   (which is also the address to use, memory being identity mapped), 0 if none are free */
+uint64_t frame_alloc(unsigned order);
+
+/* Same, preferring node's memory */
+uint64_t frame_alloc_node(unsigned order, int node);
+
+/* Allocate one frame filled with zeros, from the calling CPU's pool of frames cleared ahead
+   of time, or cleared now if the pool is empty. Returns the address, 0 if none are free */
+uint64_t frame_alloc_zeroed(void);
+
+/* Check if the calling CPU's zeroed pool has room and its node free frames to fill it */
+int frame_zero_pending(void);
+
+/* Clear up to max free frames of the calling CPU's node into its pool, with non-temporal
+   stores that leave the cache alone. Meant for idle time. Returns how many */
+unsigned frame_zero_step(unsigned max);
+
+/* Give back a block from frame_alloc. Returns 0, or -1 if addr is not an allocated block */
+int frame_free(uint64_t addr);
+
+/* Frames handed to the allocator, and how many of them are free (zeroed pools included) */
+uint64_t frame_total(void);
+uint64_t frame_free_count(void);
+
+/* Free blocks of 2^order frames on all nodes (the rest are split or merged into other orders) */
+uint64_t frame_free_blocks(unsigned order);
+
+/* Number of nodes frame_set_node has seen, at least 1 */
+int frame_nodes(void);
+
+/* Usage of node's memory. Returns 0, or -1 if there is no such node */
+int frame_node_stats(int node, frame_node_stats_t *st);
+
+#endif
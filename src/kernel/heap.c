@@ -0,0 +1,331 @@
+/* heap.c - Kernel heap
+ *
+ * Small requests are rounded up to a power-of-two size class, 16 to 1024
+ * bytes, each served by a cache of slabs: single pages that start with a
+ * header and are cut into objects of that size, the free ones linked through
+ * themselves. Larger requests get a block of whole pages with a short header.
+ * Either way the header sits at the start of the page the pointer is in, so
+ * kfree finds it by rounding down.
+ *
+ * In front of each cache every CPU has a magazine, a small stack of free
+ * objects only that CPU touches: kmalloc pops from it and kfree pushes onto
+ * it without taking a lock. Only when the magazine runs empty (or full) does
+ * the CPU lock the cache and move half a magazine of objects from (or back
+ * to) the slabs in one go.
+ */
+#include "heap.h"
+#include "kstring.h"
+
+#define SLAB_MAGIC 0x42414C53u   // "SLAB"
+#define LARGE_MAGIC 0x4547524Cu  // "LRGE"
+#define SLAB_HEADER 64           // Objects start this far into a slab page
+#define LARGE_HEADER 16          // Large blocks start this far into their first page
+#define PAGE_ORDERS 11           // Largest block page_alloc is asked for: 2^10 pages
+
+/* Start of every page a block is handed out from */
+typedef struct {
+    uint32_t magic;
+    uint32_t order;        // Large blocks: size of the page block, 2^order pages
+} page_head_t;
+
+struct cache;
+
+typedef struct slab {
+    page_head_t head;      // SLAB_MAGIC
+    struct cache *cache;
+    struct slab *next;     // On the cache's partial list (slabs with free objects)
+    struct slab *prev;
+    void *free;            // First free object
+    uint32_t in_use;       // Objects handed out (to callers or magazines)
+} slab_t;
+
+typedef struct {
+    void *objs[HEAP_MAGAZINE];
+    uint32_t count;
+    uint64_t allocs, frees, fast_allocs, fast_frees;
+} magazine_t;
+
+typedef struct cache {
+    size_t size;
+    uint32_t per_slab;
+    volatile int lock;
+    slab_t *partial;       // Slabs with free objects, not counting spare
+    slab_t *spare;         // One empty slab kept back, so a cache near a page boundary doesn't thrash
+    uint64_t refills, drains, failures, slabs;
+    magazine_t mags[HEAP_MAX_CPUS];
+} cache_t;
+
+static heap_callbacks_t callbacks;
+static cache_t caches[HEAP_CACHES];
+static int ncpus = 1;
+
+/* Large blocks */
+static volatile int large_lock;
+static uint64_t large_allocs, large_frees, large_failures, large_pages;
+
+void heap_set_callbacks(const heap_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+void heap_init(int cpus) {
+    ncpus = cpus < 1 ? 1 : cpus > HEAP_MAX_CPUS ? HEAP_MAX_CPUS : cpus;
+    for (int i = 0; i < HEAP_CACHES; ++i) {
+        cache_t *c = &caches[i];
+        kmemset(c, 0, sizeof(*c));
+        c->size = (size_t)HEAP_MIN_SIZE << i;
+        c->per_slab = (uint32_t)((HEAP_PAGE - SLAB_HEADER) / c->size);
+    }
+    large_lock = 0;
+    large_allocs = large_frees = large_failures = large_pages = 0;
+}
+
+static void lock(volatile int *l) {
+    while (__atomic_test_and_set(l, __ATOMIC_ACQUIRE)) {
+        __asm__ volatile ("pause");
+    }
+}
+
+static void unlock(volatile int *l) {
+    __atomic_clear(l, __ATOMIC_RELEASE);
+}
+
+/* The calling CPU's magazine in cache c */
+static magazine_t *magazine(cache_t *c) {
+    int cpu = callbacks.cpu ? callbacks.cpu() : 0;
+    return &c->mags[(cpu < 0 ? 0 : cpu) % ncpus];
+}
+
+static page_head_t *page_of(const void *p) {
+    return (page_head_t *)((uintptr_t)p & ~(uintptr_t)(HEAP_PAGE - 1));
+}
+
+/* ============================================================================
+   SLABS (called with the cache locked)
+   ============================================================================ */
+
+static void partial_add(cache_t *c, slab_t *s) {
+    s->prev = 0;
+    s->next = c->partial;
+    if (s->next) s->next->prev = s;
+    c->partial = s;
+}
+
+static void partial_remove(cache_t *c, slab_t *s) {
+    if (s->prev) s->prev->next = s->next;
+    else c->partial = s->next;
+    if (s->next) s->next->prev = s->prev;
+}
+
+/* A slab with a free object: a partial one, the spare, or a new page. NULL if out of memory */
+static slab_t *slab_with_room(cache_t *c) {
+    if (c->partial) return c->partial;
+    slab_t *s = c->spare;
+    if (s) {
+        c->spare = 0;
+    } else {
+        s = (slab_t *)callbacks.page_alloc(0);
+        if (!s) return 0;
+        s->head.magic = SLAB_MAGIC;
+        s->head.order = 0;
+        s->cache = c;
+        s->in_use = 0;
+        s->free = 0;
+        uint8_t *obj = (uint8_t *)s + SLAB_HEADER;
+        for (uint32_t i = 0; i < c->per_slab; ++i) {
+            uint8_t *o = obj + (size_t)(c->per_slab - 1 - i) * c->size;  // Lowest address first out
+            *(void **)o = s->free;
+            s->free = o;
+        }
+        c->slabs++;
+    }
+    partial_add(c, s);
+    return s;
+}
+
+static void *slab_get(cache_t *c) {
+    slab_t *s = slab_with_room(c);
+    if (!s) return 0;
+    void *obj = s->free;
+    s->free = *(void **)obj;
+    if (++s->in_use == c->per_slab) partial_remove(c, s);  // Full slabs are on no list
+    return obj;
+}
+
+static void slab_put(cache_t *c, void *obj) {
+    slab_t *s = (slab_t *)page_of(obj);
+    if (s->in_use == c->per_slab) partial_add(c, s);
+    *(void **)obj = s->free;
+    s->free = obj;
+    if (--s->in_use > 0) return;
+
+    // Empty: keep it as the spare, or give the page back
+    partial_remove(c, s);
+    if (!c->spare) {
+        c->spare = s;
+    } else {
+        s->head.magic = 0;
+        callbacks.page_free(s);
+        c->slabs--;
+    }
+}
+
+/* ============================================================================
+   MAGAZINES
+   ============================================================================ */
+
+static void *cache_alloc(cache_t *c) {
+    magazine_t *m = magazine(c);
+    if (m->count == 0) {
+        // Empty: take half a magazine from the slabs at once
+        lock(&c->lock);
+        while (m->count < HEAP_MAGAZINE / 2) {
+            void *obj = slab_get(c);
+            if (!obj) break;
+            m->objs[m->count++] = obj;
+        }
+        if (m->count) c->refills++;
+        else c->failures++;
+        unlock(&c->lock);
+        if (m->count == 0) return 0;
+    } else {
+        m->fast_allocs++;
+    }
+    m->allocs++;
+    return m->objs[--m->count];
+}
+
+static void cache_free(cache_t *c, void *obj) {
+    magazine_t *m = magazine(c);
+    if (m->count == HEAP_MAGAZINE) {
+        // Full: return the older half to the slabs
+        lock(&c->lock);
+        for (uint32_t i = 0; i < HEAP_MAGAZINE / 2; ++i) slab_put(c, m->objs[i]);
+        c->drains++;
+        unlock(&c->lock);
+        for (uint32_t i = HEAP_MAGAZINE / 2; i < HEAP_MAGAZINE; ++i) m->objs[i - HEAP_MAGAZINE / 2] = m->objs[i];
+        m->count = HEAP_MAGAZINE / 2;
+    } else {
+        m->fast_frees++;
+    }
+    m->frees++;
+    m->objs[m->count++] = obj;
+}
+
+/* ============================================================================
+   ALLOCATION
+   ============================================================================ */
+
+/* Cache for a request of size bytes, -1 if it needs a large block */
+static int size_class(size_t size) {
+    int i = 0;
+    while (i < HEAP_CACHES && caches[i].size < size) i++;
+    return i < HEAP_CACHES ? i : -1;
+}
+
+static void *large_alloc(size_t size) {
+    unsigned order = 0;
+    while (order < PAGE_ORDERS && ((size_t)HEAP_PAGE << order) - LARGE_HEADER < size) order++;
+    page_head_t *h = order < PAGE_ORDERS ? (page_head_t *)callbacks.page_alloc(order) : 0;
+    lock(&large_lock);
+    if (h) {
+        large_allocs++;
+        large_pages += 1ull << order;
+    } else {
+        large_failures++;
+    }
+    unlock(&large_lock);
+    if (!h) return 0;
+    h->magic = LARGE_MAGIC;
+    h->order = order;
+    return (uint8_t *)h + LARGE_HEADER;
+}
+
+void *kmalloc(size_t size) {
+    if (size == 0 || !callbacks.page_alloc) return 0;
+    int i = size_class(size);
+    return i >= 0 ? cache_alloc(&caches[i]) : large_alloc(size);
+}
+
+void *kzalloc(size_t size) {
+    void *p = kmalloc(size);
+    if (p) kmemset(p, 0, size);
+    return p;
+}
+
+void kfree(void *p) {
+    if (!p) return;
+    page_head_t *h = page_of(p);
+    if (h->magic == SLAB_MAGIC) {
+        cache_free(((slab_t *)h)->cache, p);
+    } else if (h->magic == LARGE_MAGIC && (uint8_t *)p == (uint8_t *)h + LARGE_HEADER) {
+        unsigned order = h->order;
+        h->magic = 0;  // A second kfree finds no header
+        callbacks.page_free(h);
+        lock(&large_lock);
+        large_frees++;
+        large_pages -= 1ull << order;
+        unlock(&large_lock);
+    }
+}
+
+size_t ksize(const void *p) {
+    if (!p) return 0;
+    const page_head_t *h = page_of(p);
+    if (h->magic == SLAB_MAGIC) return ((const slab_t *)h)->cache->size;
+    if (h->magic == LARGE_MAGIC) return ((size_t)HEAP_PAGE << h->order) - LARGE_HEADER;
+    return 0;
+}
+
+void *krealloc(void *p, size_t size) {
+    if (!p) return kmalloc(size);
+    if (size == 0) {
+        kfree(p);
+        return 0;
+    }
+    size_t old = ksize(p);
+    if (size <= old) return p;
+    void *q = kmalloc(size);
+    if (!q) return 0;
+    kmemcpy(q, p, old);
+    kfree(p);
+    return q;
+}
+
+/* ============================================================================
+   STATISTICS
+   ============================================================================ */
+
+int heap_stats(int cache, heap_stats_t *st) {
+    if (cache < 0 || cache > HEAP_CACHES) return -1;
+    kmemset(st, 0, sizeof(*st));
+    if (cache == HEAP_CACHES) {
+        lock(&large_lock);
+        st->allocs = large_allocs;
+        st->frees = large_frees;
+        st->failures = large_failures;
+        st->slabs = large_pages;
+        unlock(&large_lock);
+        st->in_use = st->allocs - st->frees;
+        return 0;
+    }
+
+    cache_t *c = &caches[cache];
+    st->size = c->size;
+    st->per_slab = c->per_slab;
+    for (int cpu = 0; cpu < ncpus; ++cpu) {
+        const magazine_t *m = &c->mags[cpu];
+        st->allocs += m->allocs;
+        st->frees += m->frees;
+        st->fast_allocs += m->fast_allocs;
+        st->fast_frees += m->fast_frees;
+        st->cached += m->count;
+    }
+    lock(&c->lock);
+    st->refills = c->refills;
+    st->drains = c->drains;
+    st->failures = c->failures;
+    st->slabs = c->slabs;
+    unlock(&c->lock);
+    st->in_use = st->allocs - st->frees;
+    return 0;
+}
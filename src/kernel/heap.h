@@ -0,0 +1,65 @@
+/* heap.h - Kernel heap: size-class slab caches with per-CPU magazines, pages for large blocks */
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HEAP_MAX_CPUS 4       // CPUs with a magazine of their own (others share them)
+#define HEAP_MAGAZINE 32      // Objects a CPU keeps per cache before going to the slabs
+#define HEAP_CACHES 7         // Size classes: 16, 32, 64, ..., 1024 bytes
+#define HEAP_MIN_SIZE 16      // Smallest size class, and the alignment of every block
+#define HEAP_PAGE 4096        // Slab size; larger requests get whole 2^order page blocks
+
+/* Callbacks - must be provided by kernel */
+typedef struct {
+    void *(*page_alloc)(unsigned order);  // 2^order contiguous pages, aligned to their size, NULL if none
+    void (*page_free)(void *p);           // Give back a block from page_alloc
+    int (*cpu)(void);                     // Optional (may be NULL): number of the CPU running the caller
+} heap_callbacks_t;
+
+/* Allocation counters of one cache (HEAP_CACHES for the large blocks) */
+typedef struct {
+    size_t size;          // Object size, 0 for the large blocks
+    uint32_t per_slab;    // Objects per slab page
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t fast_allocs; // Taken from the CPU's magazine without touching the slabs
+    uint64_t fast_frees;  // Put in the CPU's magazine
+    uint64_t refills;     // Magazines refilled from the slabs
+    uint64_t drains;      // Magazines emptied half way back into the slabs
+    uint64_t failures;    // Allocations that found no memory
+    uint64_t slabs;       // Slab pages held (pages for the large blocks)
+    uint64_t in_use;      // Objects allocated and not freed
+    uint64_t cached;      // Free objects sitting in magazines
+} heap_stats_t;
+
+/* Set the callbacks that the heap will use */
+void heap_set_callbacks(const heap_callbacks_t *callbacks);
+
+/* Start with empty caches and one magazine per CPU for cpus CPUs */
+void heap_init(int cpus);
+
+/* Allocate size bytes, aligned to HEAP_MIN_SIZE. Returns NULL if size is 0 or there is no
+   memory. Callers must not be interrupted by another allocation on the same CPU (the kernel
+   allocates with interrupts off or from the keyboard handler only) */
+void *kmalloc(size_t size);
+
+/* kmalloc, with the block zeroed */
+void *kzalloc(size_t size);
+
+/* Resize a block, moving it if it has to grow past its size class. NULL p allocates; size 0
+   frees and returns NULL. On failure p is left as it was and NULL is returned */
+void *krealloc(void *p, size_t size);
+
+/* Free a block from kmalloc. NULL is ignored */
+void kfree(void *p);
+
+/* Bytes usable in a block from kmalloc (at least what was asked for) */
+size_t ksize(const void *p);
+
+/* Copy cache's counters to *st, cache 0 to HEAP_CACHES - 1 for the size classes and
+   HEAP_CACHES for the large blocks. Returns 0, or -1 if there is no such cache */
+int heap_stats(int cache, heap_stats_t *st);
+
+#endif
@@ -0,0 +1,159 @@
+/* initrd.c - Read-only filesystem over a tar archive loaded by the bootloader
+ *
+ * GRUB loads the archive into memory as a multiboot2 module. At mount time the
+ * headers are walked once to build a small index of names, sizes and data
+ * pointers into the archive; file contents are never copied until read.
+ */
+#include "initrd.h"
+#include "kstring.h"
+
+#define TAR_BLOCK 512
+
+/* ustar header (only the fields used here) */
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];      // File size, octal text
+    char mtime[12];
+    char chksum[8];     // Sum of the header bytes with this field read as spaces, octal text
+    char typeflag;      // '0' or 0 for regular files
+    char linkname[100];
+    char magic[6];      // "ustar"
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];   // Leading path components of long names
+} tar_header_t;
+
+typedef struct {
+    const char *name;     // Points into the archive header
+    const uint8_t *data;  // Points into the archive
+    uint32_t size;
+} initrd_file_t;
+
+static initrd_file_t files[INITRD_MAX_FILES];
+static int file_count = 0;
+
+/* Parse an octal text field, stopping at a space or NUL */
+static uint32_t tar_octal(const char *s, size_t n) {
+    uint32_t v = 0;
+    for (size_t i = 0; i < n && s[i] >= '0' && s[i] <= '7'; ++i) v = v * 8 + (uint32_t)(s[i] - '0');
+    return v;
+}
+
+static int tar_checksum_ok(const uint8_t *block) {
+    const tar_header_t *h = (const tar_header_t *)block;
+    size_t ck = (size_t)(h->chksum - h->name);  // Offset of the checksum field
+    uint32_t sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK; ++i) {
+        sum += (i >= ck && i < ck + sizeof(h->chksum)) ? ' ' : block[i];
+    }
+    return sum == tar_octal(h->chksum, sizeof(h->chksum));
+}
+
+static int initrd_streq(const char *a, const char *b) {
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
+int initrd_init(const uint8_t *archive, size_t len) {
+    file_count = 0;
+
+    size_t off = 0;
+    while (off + TAR_BLOCK <= len) {
+        const tar_header_t *h = (const tar_header_t *)(archive + off);
+        if (h->name[0] == 0) break;  // Zero block marks the end of the archive
+        if (!(h->magic[0] == 'u' && h->magic[1] == 's' && h->magic[2] == 't' &&
+              h->magic[3] == 'a' && h->magic[4] == 'r') || !tar_checksum_ok(archive + off)) {
+            return file_count ? file_count : -1;
+        }
+
+        uint32_t size = tar_octal(h->size, sizeof(h->size));
+        const uint8_t *data = archive + off + TAR_BLOCK;
+        if ((uint64_t)off + TAR_BLOCK + size > len) break;  // Truncated archive
+        off += TAR_BLOCK + ((size + TAR_BLOCK - 1) / TAR_BLOCK) * TAR_BLOCK;
+
+        // Only regular files in the top directory whose names fit a VFS name
+        if (h->typeflag != '0' && h->typeflag != 0) continue;
+        if (h->prefix[0]) continue;
+        const char *name = h->name;
+        if (name[0] == '.' && name[1] == '/') name += 2;
+        const char *limit = h->name + sizeof(h->name);  // Names of exactly 100 bytes have no terminator
+        size_t k = 0;
+        while (name + k < limit && name[k] && name[k] != '/') k++;
+        if (k == 0 || k >= VFS_NAME_MAX || name + k == limit || name[k] != 0) continue;
+
+        if (file_count == INITRD_MAX_FILES) break;
+        files[file_count].name = name;
+        files[file_count].data = data;
+        files[file_count].size = size;
+        file_count++;
+    }
+    return file_count;
+}
+
+/* ============================================================================
+   VFS OPERATIONS
+   ============================================================================ */
+
+static int initrd_lookup(void *fs, const char *name) {
+    (void)fs;
+    for (int i = 0; i < file_count; ++i) {
+        if (initrd_streq(files[i].name, name)) return i;
+    }
+    return -1;
+}
+
+static int initrd_size(void *fs, int ino) {
+    (void)fs;
+    if (ino < 0 || ino >= file_count) return -1;
+    return (int)files[ino].size;
+}
+
+static int initrd_read(void *fs, int ino, uint32_t pos, uint8_t *buf, size_t len) {
+    (void)fs;
+    if (ino < 0 || ino >= file_count) return -1;
+    const initrd_file_t *f = &files[ino];
+    if (pos >= f->size) return 0;
+    if (len > f->size - pos) len = f->size - pos;
+    kmemcpy(buf, f->data + pos, len);
+    return (int)len;
+}
+
+/* Files are contiguous in the archive, so the whole rest of the file maps at once */
+static const uint8_t *initrd_map(void *fs, int ino, uint32_t pos, size_t *len) {
+    (void)fs;
+    if (ino < 0 || ino >= file_count || pos >= files[ino].size) return 0;
+    *len = files[ino].size - pos;
+    return files[ino].data + pos;
+}
+
+static int initrd_readdir(void *fs, uint32_t *cursor, char *name, uint32_t *size) {
+    (void)fs;
+    if (*cursor >= (uint32_t)file_count) return -1;
+    const initrd_file_t *f = &files[(*cursor)++];
+    size_t k = 0;
+    for (; f->name[k]; ++k) name[k] = f->name[k];
+    name[k] = 0;
+    *size = f->size;
+    return 0;
+}
+
+const vfs_ops_t initrd_vfs_ops = {
+    .lookup = initrd_lookup,
+    .create = 0,
+    .size = initrd_size,
+    .read = initrd_read,
+    .write = 0,
+    .truncate = 0,
+    .replace = 0,
+    .unlink = 0,
+    .rename = 0,
+    .readdir = initrd_readdir,
+    .sync = 0,
+    .map = initrd_map
+};
@@ -0,0 +1,18 @@
+/* initrd.h - Read-only filesystem over a tar archive loaded by the bootloader */
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vfs.h"
+
+#define INITRD_MAX_FILES 64    // Files indexed from the archive
+
+/* Index the regular files of a ustar archive. The archive is used in place and must stay
+   in memory. Returns the number of files found, or -1 if it is not a tar archive */
+int initrd_init(const uint8_t *archive, size_t len);
+
+/* The initrd as a VFS backend (single instance, the fs pointer is unused). Mount it VFS_RDONLY */
+extern const vfs_ops_t initrd_vfs_ops;
+
+#endif
@@ -4,6 +4,30 @@
 #include <stddef.h>
 #include "editor.h"
 #include "calc.h"
+#include "fat16.h"
+#include "vfs.h"
+#include "tmpfs.h"
+#include "multiboot.h"
+#include "initrd.h"
+#include "pcache.h"
+#include "logfs.h"
+#include "cow.h"
+#include "crypt.h"
+#include "aes.h"
+#include "kstring.h"
+#include "io.h"
+#include "ata.h"
+#include "raid.h"
+#include "pci.h"
+#include "nvme.h"
+#include "serial.h"
+#include "blkdev.h"
+#include "ramdisk.h"
+#include "frame.h"
+#include "heap.h"
+#include "paging.h"
+#include "acpi.h"
+#include "numa.h"
 
 /* ============================================================================
    VGA TEXT MODE DEFINITIONS
@@ -17,11 +41,14 @@
    EXTERNAL ASSEMBLY FUNCTIONS
    ============================================================================ */
 extern void init_idt64(void);  // Initialise the Interrupt Descriptor Table (64-bit)
+extern void disk_isr64(void);  // Disk controller interrupt entry (saves registers, calls handle_disk_irq)
+extern char kernel_end[];      // Linker script: first byte past the kernel image (its .bss holds the boot page tables)
 
 /* ============================================================================
    INTERRUPT HANDLERS
    ============================================================================ */
 void handle_scancode(uint8_t scancode); //Called from assembly ISR wrapper when keyboard interrupt
+void handle_disk_irq(void); //Called from assembly ISR wrapper when a disk controller interrupts
 
 /* ============================================================================
    VGA OUTPUT STATE
@@ -93,658 +120,53 @@ static void kprints(const char *s) {
     }
 }
 
-/* ============================================================================
-   I/O PORT ACCESS FUNCTIONS
-   ============================================================================ */
-// Low-level functions to read/write CPU I/O ports
-
-/* Read a byte from an I/O port */
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    asm volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
-
-/* Write a byte to an I/O port */
-static inline void outb(uint16_t port, uint8_t val) {
-    asm volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
-}
-
-/* Read a word (16 bits) from an I/O port */
-static inline uint16_t inw(uint16_t port) {
-    uint16_t ret;
-    asm volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
-
-/* Write a word (16 bits) to an I/O port */
-static inline void outw(uint16_t port, uint16_t val) {
-    asm volatile ("outw %0, %1" : : "a"(val), "Nd"(port));
+/* Print an unsigned number in decimal */
+static void kprint_dec(uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + (v % 10));
+        v /= 10;
+    } while (v);
+    while (n > 0) kputchar(digits[--n]);
 }
 
 /* ============================================================================
-   ATA/IDE HARD DISK DRIVER (PIO MODE)
-   ============================================================================
-// Allows non-volatile permanent storage (vs RAM storage which is volatile)
-
-/* ATA I/O Port Definitions */
-#define ATA_DATA_PORT      0x1F0  // Data register (16-bit)
-#define ATA_ERROR_PORT     0x1F1  // Error register (read) / Features (write)
-#define ATA_SECT_COUNT     0x1F2  // Sector count register
-#define ATA_LBA_LOW        0x1F3  // LBA bits 0-7
-#define ATA_LBA_MID        0x1F4  // LBA bits 8-15
-#define ATA_LBA_HIGH       0x1F5  // LBA bits 16-23
-#define ATA_DRIVE_HEAD     0x1F6  // Drive/Head register (contains LBA bits 24-27)
-#define ATA_STATUS         0x1F7  // Status register (read)
-#define ATA_COMMAND        0x1F7  // Command register (write)
-#define ATA_CONTROL        0x3F6  // Device control / Alternate status
-
-/* ATA Status Register Bits */
-#define ATA_SR_BSY  0x80  // Busy - drive is processing command
-#define ATA_SR_DRDY 0x40  // Drive Ready
-#define ATA_SR_DF   0x20  // Drive Fault
-#define ATA_SR_DRQ  0x08  // Data Request - ready for data transfer
-#define ATA_SR_ERR  0x01  // Error - check error register for details
-
-/* Small I/O wait: reading alternate status provides ~400ns delay */
-static inline void io_wait(void) {
-    (void)inb(ATA_CONTROL);  // Read alternate status 4 times
-    (void)inb(ATA_CONTROL);  // Each read takes ~100ns
-    (void)inb(ATA_CONTROL);
-    (void)inb(ATA_CONTROL);
-}
-
-/* Wait for ATA drive to be ready. If non-zero, also wait for DRQ (data request) flag */
-static int ata_wait(uint32_t want_drq) {
-    /* Poll status register with timeout */
-    for (int i = 0; i < 1000000; ++i) {
-        uint8_t st = inb(ATA_STATUS);  // Read status register
-
-        // Check for error condition
-        if (st & ATA_SR_ERR) {
-            kprints("ATA: status ERR during poll\n");
-            return -1; //-1 on error
-        }
-
-        // If busy, continue waiting
-        if (st & ATA_SR_BSY) continue;
-
-        // If not busy anymore
-        if (want_drq) {
-            // If DRQ needed, check if it's set
-            if (st & ATA_SR_DRQ) return 0;
-            else continue;
-        } else {
-            // Just needed not-busy
-            return 0; //return 0 on success
-        }
-    }
-    kprints("ATA: poll timeout\n");
-    return -1; //-1 on timeout
-}
-
-/* Select ATA drive (master=0, slave=1) with proper delays */
-static inline void ata_select_drive(uint8_t drive) {
-    // Set LBA mode (bit 7) and drive select bit (bit 4)
-    uint8_t val = 0xE0 | ((drive & 1) << 4);
-    outb(ATA_DRIVE_HEAD, val);
-
-    // Wait 400ns for drive selection to take effect
-    io_wait();
-    io_wait();
-    (void)inb(ATA_CONTROL);  // Final alternate status read to flush
-}
-
-/* Read one 512-byte sector from disk using LBA28 (Logical Blcok Address) */
-static int ata_read_sector(uint32_t lba, void *buf) {
-    // LBA28 supports up to 2^28 sectors
-    if (lba > 0x0FFFFFFF) return -1;
-
-    /* Wait for drive to be ready */
-    (void)inb(ATA_STATUS);  // Dummy read to flush any pending status
-    if (ata_wait(0) != 0) {
-        kprints("ATA: busy wait failed before read\n");
-        return -1;
-    }
-
-    /* Set drive and upper 4 bits of LBA (bits 24-27) */
-    outb(ATA_DRIVE_HEAD, 0xE0 | ((lba >> 24) & 0x0F));
-    io_wait();
-    (void)inb(ATA_STATUS);  // Give device time to process
-
-    /* Set sector count to 1 */
-    outb(ATA_SECT_COUNT, 1);
-
-    /* Set LBA low, middle, and high bytes (bits 0-23) */
-    outb(ATA_LBA_LOW, (uint8_t)(lba & 0xFF));           // LBA bits 0-7
-    outb(ATA_LBA_MID, (uint8_t)((lba >> 8) & 0xFF));    // LBA bits 8-15
-    outb(ATA_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));  // LBA bits 16-23
-    io_wait();  // Small delay after register writes
-
-    /* Issue READ SECTORS command (0x20) */
-    outb(ATA_COMMAND, 0x20);
-
-    /* Wait for DRQ (data request) to be set */
-    io_wait();
-    if (ata_wait(1) != 0) {
-        kprints("ATA: DRQ not set after READ command\n");
-        return -1;
-    }
-
-    /* Read 256 words (512 bytes) from data port */
-    uint16_t *dst = (uint16_t *)buf;
-    for (int i = 0; i < 256; ++i) {
-        dst[i] = inw(ATA_DATA_PORT);
-    }
-
-    /* Wait for BSY to clear after data transfer */
-    if (ata_wait(0) != 0) {
-        kprints("ATA: final BSY wait failed after data read\n");
-        return -1;
-    }
-
-    return 0; //return 0 on success
-}
-
-/* Write one 512-byte sector to disk using LBA28 ((Logical Block Addressing) */
-static int ata_write_sector(uint32_t lba, const void *buf) {
-    // Validate LBA is within LBA28 range
-    if (lba > 0x0FFFFFFF) return -1;
-
-    /* Wait for drive to be ready */
-    (void)inb(ATA_STATUS);
-    if (ata_wait(0) != 0) {
-        kprints("ATA: busy wait failed before write\n");
-        return -1;
-    }
-
-    /* Set drive and upper 4 bits of LBA */
-    outb(ATA_DRIVE_HEAD, 0xE0 | ((lba >> 24) & 0x0F));
-    io_wait();
-    (void)inb(ATA_STATUS);
-
-    /* Set sector count and LBA */
-    outb(ATA_SECT_COUNT, 1);  // Write one sector
-    outb(ATA_LBA_LOW, (uint8_t)(lba & 0xFF));           // Extract bits 0-7
-    outb(ATA_LBA_MID, (uint8_t)((lba >> 8) & 0xFF));    // Extract bits 8-15
-    outb(ATA_LBA_HIGH, (uint8_t)((lba >> 16) & 0xFF));  // Extract bits 16-23
-    io_wait();
-
-    /* Issue WRITE SECTORS command (0x30) */
-    outb(ATA_COMMAND, 0x30);
-
-    /* Wait for DRQ to indicate drive is ready for data */
-    if (ata_wait(1) != 0) {
-        kprints("ATA: DRQ not set after WRITE command\n");
-        return -1;
-    }
-
-    /* Write 256 words (512 bytes) to data port */
-    const uint16_t *src = (const uint16_t *)buf; //buffer containing 512 bytes to write
-    for (int i = 0; i < 256; ++i) {
-        outw(ATA_DATA_PORT, src[i]);
-    }
-
-    /* Wait for write to complete */
-    if (ata_wait(0) != 0) {
-        kprints("ATA: final BSY wait failed after data write\n");
-        return -1;
-    }
-
-    /* Flush disk cache with CACHE FLUSH command (0xE7) */
-    outb(ATA_COMMAND, 0xE7);
-    if (ata_wait(0) != 0) {
-        kprints("ATA: cache flush failed\n");
-        return -1;
-    }
-
-    return 0; //return 0 on success
-}
-
-/* ============================================================================
-   FAT16 FILESYSTEM IMPLEMENTATION
+   BOOT DISK
    ============================================================================ */
- // FAT16 filesystem for persistent storage
- // Layout: Boot sector | FAT tables | Root directory | Data area
+// The filesystems live on one block device: the device named by root= on the boot command
+// line, otherwise a RAID volume made of every ATA disk, otherwise the first ATA disk (normally
+// the primary master), otherwise an NVMe SSD. root=ram0 puts them on a RAM disk instead,
+// blank at every boot
 
-/* Filesystem Parameters */
-#define SECTOR_SIZE 512           // Standard sector size
-#define TOTAL_SECTORS 512         // Total disk size: 256KB
+#define LOGFS_START TOTAL_SECTORS  // The log-structured filesystem follows the FAT16 volume on disk
+#define LOGFS_SECTORS 1024         // 512KB
 
-#define BYTES_PER_SECTOR 512      // Bytes per sector
-#define SECTORS_PER_CLUSTER 1     // Cluster size = 512 bytes
-#define RESERVED_SECTORS 1        // Boot sector
-#define NUM_FATS 2                // Two FAT copies for redundancy
-#define ROOT_DIR_ENTRIES 512      // Max files in root directory
-#define SECTORS_PER_FAT 4         // Size of each FAT table
+#define COW_DELTA_START (LOGFS_START + LOGFS_SECTORS)  // Snapshot delta: a header, then a slot per FAT16 sector
 
-/* Calculate number of sectors occupied by root directory */
-static uint32_t root_dir_sectors(void) {
-    // Each directory entry is 32 bytes
-    return ((ROOT_DIR_ENTRIES * 32) + (BYTES_PER_SECTOR - 1)) / BYTES_PER_SECTOR;
-}
+#define CRYPT_HEADER_LBA (COW_DELTA_START + 1 + TOTAL_SECTORS)  // Passphrase salt, after the delta
 
-/* Calculate first sector of data area (where file contents are stored) */
-static uint32_t first_data_sector(void) {
-    return RESERVED_SECTORS + (NUM_FATS * SECTORS_PER_FAT) + root_dir_sectors();
-}
+#define RAMDISK_SECTORS (CRYPT_HEADER_LBA + 1)  // Room for everything above, ~1MB
 
-/* Calculate first sector of FAT table */
-static uint32_t first_fat_sector(void) {
-    return RESERVED_SECTORS;
-}
+static int root_dev = -1;  // Block device id, -1 if there is none
 
-/* Read a sector with bounds checking */
-static void read_sector(uint32_t sec, void *buf) {
-    // Return 0 if sector is out of bounds
-    if (sec >= TOTAL_SECTORS) {
-        uint8_t *dst = (uint8_t *)buf;
-        for (size_t i = 0; i < SECTOR_SIZE; ++i) dst[i] = 0;
-        return;
-    }
-    // Attempt to read, return 0 on failure
-    if (ata_read_sector(sec, buf) != 0) {
-        uint8_t *dst = (uint8_t *)buf;
-        for (size_t i = 0; i < SECTOR_SIZE; ++i) dst[i] = 0;
-    }
-}
+static ramdisk_t ram0;
+static uint8_t ram0_mem[RAMDISK_SECTORS * BLKDEV_SECTOR];
 
-/* Write a sector with bounds checking */
-static void write_sector(uint32_t sec, const void *buf) {
-    if (sec >= TOTAL_SECTORS) return;  // Ignore out-of-bounds writes
-    ata_write_sector(sec, buf);
+static int disk_read_sectors(uint32_t lba, uint32_t count, void *buf) {
+    return blkdev_read(root_dev, lba, count, buf);
 }
 
-/* Initialise FAT16 filesystem by creating boot sector and FAT tables */
-static void fat16_init(void) {
-    /* Zero out all sectors on disk */
-    uint8_t zero[SECTOR_SIZE];
-    for (size_t i = 0; i < SECTOR_SIZE; ++i) zero[i] = 0;
-    for (uint32_t s = 0; s < TOTAL_SECTORS; ++s) {
-        write_sector(s, zero);
-    }
-
-    /* Create Boot Parameter Block (BPB) in sector 0 */
-    uint8_t bpb[SECTOR_SIZE];
-    for (size_t i = 0; i < SECTOR_SIZE; ++i) bpb[i] = 0;
-
-    // Jump instruction and NOP
-    bpb[0] = 0xEB; bpb[1] = 0x3C; bpb[2] = 0x90;
-
-    // OEM identifier (8 bytes)
-    const char *oem = "ATAFAT16";
-    for (size_t i = 0; i < 8; ++i) bpb[3+i] = (i < 8) ? oem[i] : ' ';
-
-    // Bytes per sector (little-endian format, stores the least-significant byte at the smallest address)
-    bpb[11] = (BYTES_PER_SECTOR & 0xFF);
-    bpb[12] = (BYTES_PER_SECTOR >> 8) & 0xFF;
-
-    // Sectors per cluster
-    bpb[13] = SECTORS_PER_CLUSTER;
-
-    // Reserved sectors (little-endian)
-    bpb[14] = (RESERVED_SECTORS & 0xFF);
-    bpb[15] = (RESERVED_SECTORS >> 8) & 0xFF;
-
-    // Root directory entries (little-endian)
-    bpb[16] = ROOT_DIR_ENTRIES & 0xFF;
-    bpb[17] = (ROOT_DIR_ENTRIES >> 8) & 0xFF;
-
-    // Total sectors (16-bit, little-endian)
-    uint16_t totsec16 = (TOTAL_SECTORS <= 0xFFFF) ? (uint16_t)TOTAL_SECTORS : 0;
-    bpb[19] = (totsec16 & 0xFF);
-    bpb[20] = (totsec16 >> 8) & 0xFF;
-
-    // Media descriptor (0xF8 = fixed disk)
-    bpb[21] = 0xF8;
-
-    // Sectors per FAT (little-endian)
-    bpb[22] = SECTORS_PER_FAT & 0xFF;
-    bpb[23] = (SECTORS_PER_FAT >> 8) & 0xFF;
-
-    // Sectors per track, heads, hidden sectors (zeros for simplicity)
-    bpb[24] = 0; bpb[25] = 0;
-    bpb[26] = 0; bpb[27] = 0;
-    bpb[28] = 0; bpb[29] = 0; bpb[30] = 0; bpb[31] = 0;
-
-    // Extended boot signature
-    bpb[38] = 0x29;
-
-    // Volume label (11 bytes, space-padded)
-    const char *label = "ATADISK    ";
-    for (size_t i = 0; i < 11; ++i) bpb[43 + i] = label[i];
-
-    // Filesystem type (8 bytes, space-padded)
-    const char *fs = "FAT16   ";
-    for (size_t i = 0; i < 8; ++i) bpb[54 + i] = fs[i];
-
-    // Write boot sector
-    write_sector(0, bpb);
-
-    /* Initialise both FAT tables */
-    uint8_t fatsec[SECTOR_SIZE];
-    for (size_t s = 0; s < SECTORS_PER_FAT; ++s) {
-        // Zero out FAT sector
-        for (size_t i = 0; i < SECTOR_SIZE; ++i) fatsec[i] = 0;
-
-        // First FAT sector has special media descriptor entries
-        if (s == 0) {
-            fatsec[0] = 0xF8; fatsec[1] = 0xFF;  // Media descriptor
-            fatsec[2] = 0xFF; fatsec[3] = 0xFF;  // End of chain marker
-        }
-
-        // Write to both FAT copies
-        write_sector(first_fat_sector() + s, fatsec);
-        write_sector(first_fat_sector() + s + SECTORS_PER_FAT, fatsec);
-    }
+static int disk_write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+    return blkdev_write(root_dev, lba, count, buf);
 }
 
-/* Read a FAT entry (cluster chain link) */
-static uint16_t fat_get_entry(uint16_t cluster) {
-    // Each FAT16 entry is 2 bytes
-    uint32_t fat_offset = (uint32_t)cluster * 2u;
-
-    // Determine which FAT sector contains this entry
-    uint32_t sec = first_fat_sector() + (fat_offset / SECTOR_SIZE);
-    uint32_t off = fat_offset % SECTOR_SIZE;
-
-    uint8_t secbuf[SECTOR_SIZE];
-    read_sector(sec, secbuf);
-
-    // Handle case where entry spans two sectors
-    if (off == SECTOR_SIZE - 1) {
-        uint8_t nextsecbuf[SECTOR_SIZE];
-        read_sector(sec + 1, nextsecbuf);
-        return (uint16_t)(secbuf[off] | (nextsecbuf[0] << 8)); //return next cluster in chain
-    } else {
-        // Entry is within single sector
-        uint16_t val = secbuf[off] | (secbuf[off+1] << 8);
-        return val; //return 0xFFFF for end-of-chain
-    }
-}
-
-/* Write a FAT entry (update cluster chain link) */
-static void fat_set_entry(uint16_t cluster, uint16_t val) {
-    // Calculate FAT entry location
-    uint32_t fat_offset = (uint32_t)cluster * 2u;
-    uint32_t sec = first_fat_sector() + (fat_offset / SECTOR_SIZE);
-    uint32_t off = fat_offset % SECTOR_SIZE;
-
-    // Update both FAT copies
-    for (int copy = 0; copy < NUM_FATS; ++copy) {
-        uint8_t secbuf[SECTOR_SIZE];
-        read_sector(sec + copy * SECTORS_PER_FAT, secbuf);
-
-        // Write low byte
-        secbuf[off] = val & 0xFF; //val: Value to write (next cluster or end-of-chain marker)
-
-        // Handle entry spanning two sectors
-        if (off == SECTOR_SIZE - 1) {
-            write_sector(sec + copy * SECTORS_PER_FAT, secbuf);
-            uint8_t nextsecbuf[SECTOR_SIZE];
-            read_sector(sec + 1 + copy * SECTORS_PER_FAT, nextsecbuf);
-            nextsecbuf[0] = (val >> 8) & 0xFF;
-            write_sector(sec + 1 + copy * SECTORS_PER_FAT, nextsecbuf);
-        } else {
-            // Write high byte
-            secbuf[off+1] = (val >> 8) & 0xFF;
-            write_sector(sec + copy * SECTORS_PER_FAT, secbuf);
-        }
-    }
-}
-
-/* Convert cluster number to disk sector number */
-static uint32_t cluster_to_sector(uint16_t cluster) {
-    // Cluster 2 is the first data cluster
-    return first_data_sector() + (cluster - 2) * SECTORS_PER_CLUSTER;
-}
-
-/* Find an unused cluster in the FAT memory */
-static int16_t fat_find_free_cluster(void) {
-    // Calculate how many data clusters are available
-    uint32_t data_sectors = TOTAL_SECTORS - first_data_sector();
-    uint32_t max_clusters = data_sectors / SECTORS_PER_CLUSTER;
-
-    // Scan FAT for free entry (value 0x0000)
-    for (uint16_t c = 2; c < 2 + max_clusters; ++c) {
-        uint16_t v = fat_get_entry(c);
-        if (v == 0x0000) return (int16_t)c;
-    }
-    return -1;  // No free clusters, disk full
-}
-
-/* Convert filename to DOS 8.3 format (space-padded) */
-static void make_dos_name(const char *in, uint8_t out[11]) {
-    // Initialise with spaces
-    for (int i = 0; i < 11; ++i) out[i] = ' ';
-
-    // Copy filename part (up to 8 characters)
-    int i = 0, j = 0;
-    while (*in && *in != '.' && j < 8) {
-        char c = *in++;
-        if (c >= 'a' && c <= 'z') c -= 32;  // Convert to uppercase
-        out[j++] = c;
-    }
-
-    // Skip dot if present
-    if (*in == '.') in++;
-
-    // Copy extension part (up to 3 characters)
-    j = 8;
-    while (*in && j < 11) {
-        char c = *in++;
-        if (c >= 'a' && c <= 'z') c -= 32;  // Convert to uppercase
-        out[j++] = c;
-    }
-}
-
-/* ============================================================================
-   FAT16 FILE WRITING
-   ============================================================================ */
-static int fat16_write_file(const char *name, const uint8_t *data, size_t len) {
-    // Convert filename to DOS 8.3 format
-    uint8_t dosname[11];
-    make_dos_name(name, dosname);
-
-    /* Search root directory for existing file or free entry */
-    uint8_t dirsec[SECTOR_SIZE];
-    uint32_t root_start = RESERVED_SECTORS + (NUM_FATS * SECTORS_PER_FAT);
-    uint32_t root_sectors = root_dir_sectors();
-    int found_offset = -1;  // Directory entry location
-    uint16_t existing_start_cluster = 0;
-
-    // Scan root directory
-    for (uint32_t s = 0; s < root_sectors; ++s) {
-        read_sector(root_start + s, dirsec);
-
-        // Each directory entry is 32 bytes
-        for (uint32_t off = 0; off < SECTOR_SIZE; off += 32) {
-            if (dirsec[off] == 0x00) {
-                // Empty entry (end of directory)
-                if (found_offset < 0) found_offset = (int)((s * SECTOR_SIZE) + off);
-                break;
-            } else if (dirsec[off] == 0xE5) {
-                // Deleted entry (can be reused)
-                if (found_offset < 0) found_offset = (int)((s * SECTOR_SIZE) + off);
-                continue;
-            } else {
-                // Check if this entry matches our filename
-                int match = 1;
-                for (int k = 0; k < 11; ++k) {
-                    if (dirsec[off+k] != dosname[k]) { match = 0; break; }
-                }
-                if (match) {
-                    // Found existing file - will overwrite
-                    found_offset = (int)((s * SECTOR_SIZE) + off);
-                    existing_start_cluster = (uint16_t)(dirsec[off+26] | (dirsec[off+27] << 8));
-                    s = root_sectors;  // Exit outer loop
-                    break;
-                }
-            }
-        }
-    }
-
-    /* Free existing clusters if file already exists */
-    if (existing_start_cluster >= 2) {
-        uint16_t c = existing_start_cluster;
-        while (c >= 2 && c < 0xFFF8) {
-            uint16_t next = fat_get_entry(c);
-            fat_set_entry(c, 0x0000);  // Mark cluster as free
-            if (next >= 0xFFF8) break;  // End of chain
-            c = next;
-        }
-    }
-
-    /* Allocate clusters and write file data */
-    uint16_t first_cluster = 0, prev_cluster = 0;  // Track first and previous cluster numbers
-    size_t remaining = len;                         // Bytes remaining to write
-    const uint8_t *ptr = data;                      // Pointer to current position in data buffer
-
-    if (len > 0) {
-        // Loop through data, allocating one cluster per iteration
-        while (remaining > 0) {
-            // Find an available cluster in the FAT
-            int16_t c = fat_find_free_cluster();
-            if (c < 0) return -1;  // Fails if no free clusters available
-
-            // If this is the first cluster, remember it for the directory entry
-            if (!first_cluster) first_cluster = (uint16_t)c;
-
-            // Link previous cluster to this one (building the cluster chain)
-            if (prev_cluster) fat_set_entry(prev_cluster, (uint16_t)c);
-            prev_cluster = (uint16_t)c;  // Update previous cluster tracker
-
-            // Create a sector buffer and initialise to zero
-            uint8_t secbuf[SECTOR_SIZE];
-            for (size_t i = 0; i < SECTOR_SIZE; ++i) secbuf[i] = 0;
-
-            // Calculate how many bytes to copy (one sector or remaining, whichever is smaller)
-            size_t tocopy = remaining > SECTOR_SIZE ? SECTOR_SIZE : remaining;
-
-            // Copy data from input buffer to sector buffer
-            for (size_t i = 0; i < tocopy; ++i) secbuf[i] = *ptr++;
-            remaining -= tocopy;  // Update remaining byte count
-
-            // Write the sector to disk at this cluster's location
-            write_sector(cluster_to_sector((uint16_t)c), secbuf);
-        }
-
-        // Mark the last cluster with end-of-file marker (0xFFFF)
-        if (prev_cluster) fat_set_entry(prev_cluster, 0xFFFF);
-    }
-
-    /* Update the directory entry with file metadata */
-    if (found_offset < 0) return -1;  // Safety check
-
-    // Calculate which sector and offset within sector the directory entry is at
-    uint32_t sidx = found_offset / SECTOR_SIZE;    // Sector index
-    uint32_t off = found_offset % SECTOR_SIZE;     // Offset within sector
-
-    // Read the directory sector into buffer
-    read_sector(root_start + sidx, dirsec);
-
-    // Write the 8.3 filename (11 bytes)
-    for (int k = 0; k < 11; ++k) dirsec[off + k] = dosname[k];
-
-    // Set file attributes and reserved bytes
-    dirsec[off + 11] = 0x20;  // Attribute: Archive bit set (normal file)
-    dirsec[off + 12] = 0;     // Reserved for Windows NT
-    dirsec[off + 13] = 0;     // Creation time tenth of second
-    dirsec[off + 14] = 0; dirsec[off + 15] = 0;  // Creation time
-    dirsec[off + 16] = 0; dirsec[off + 17] = 0;  // Creation date
-
-    // Write starting cluster number (little-endian, 16-bit)
-    dirsec[off + 26] = first_cluster & 0xFF;           // Low byte
-    dirsec[off + 27] = (first_cluster >> 8) & 0xFF;    // High byte
-
-    // Write file size (little-endian, 32-bit)
-    dirsec[off + 28] = (uint8_t)(len & 0xFF);          // Byte 0 (LSB)
-    dirsec[off + 29] = (uint8_t)((len >> 8) & 0xFF);   // Byte 1
-    dirsec[off + 30] = (uint8_t)((len >> 16) & 0xFF);  // Byte 2
-    dirsec[off + 31] = (uint8_t)((len >> 24) & 0xFF);  // Byte 3 (MSB)
-
-    // Write the updated directory sector back to disk
-    write_sector(root_start + sidx, dirsec);
-
-    return 0;  // Success
+static int disk_flush(void) {
+    return blkdev_flush(root_dev);
 }
 
-/* ============================================================================
-   FAT16 FILE READING
-   ============================================================================ */
-static int fat16_read_file(const char *name, uint8_t *out, size_t maxlen) {
-    // Convert filename to DOS 8.3 format
-    uint8_t dosname[11];
-    make_dos_name(name, dosname);
-
-    uint8_t dirsec[SECTOR_SIZE];  // Buffer for reading directory sectors
-
-    // Calculate root directory location
-    uint32_t root_start = RESERVED_SECTORS + (NUM_FATS * SECTORS_PER_FAT);
-    uint32_t root_sectors = root_dir_sectors();
-
-    // Search through root directory for matching filename
-    for (uint32_t s = 0; s < root_sectors; ++s) {
-        read_sector(root_start + s, dirsec);  // Read one directory sector
-
-        // Each directory entry is 32 bytes; scan through sector
-        for (uint32_t off = 0; off < SECTOR_SIZE; off += 32) {
-            if (dirsec[off] == 0x00) continue;  // Empty entry (end of directory)
-            if (dirsec[off] == 0xE5) continue;  // Deleted entry, skip
-
-            // Compare filename with this entry
-            int match = 1;
-            for (int k = 0; k < 11; ++k) {
-                if (dirsec[off+k] != dosname[k]) {
-                    match = 0;
-                    break;
-                }
-            }
-
-            if (match) { // if file found, extract metadata from directory entry
-
-                // Get starting cluster (little-endian, 16-bit at offset 26-27)
-                uint16_t start_cluster = (uint16_t)(dirsec[off+26] | (dirsec[off+27] << 8));
-
-                // Get file size (little-endian, 32-bit at offset 28-31)
-                uint32_t file_size = (uint32_t)dirsec[off+28] |
-                ((uint32_t)dirsec[off+29] << 8) |
-                ((uint32_t)dirsec[off+30] << 16) |
-                ((uint32_t)dirsec[off+31] << 24);
-
-                // Determine how many bytes to read (file size or buffer limit)
-                size_t toread = file_size < maxlen ? file_size : maxlen;
-                size_t got = 0;  // Track bytes read so far
-                uint16_t c = start_cluster;  // Current cluster in chain
-
-                if (file_size == 0) return 0;  // If empty file
-
-                // Follow the cluster chain and read data
-                while (c >= 2 && got < toread) {  // Cluster 0 and 1 are reserved
-                    uint8_t secbuf[SECTOR_SIZE];
-
-                    // Read this cluster's data
-                    read_sector(cluster_to_sector(c), secbuf);
-
-                    // Calculate how many bytes to copy from this cluster
-                    size_t copy = (toread - got > SECTOR_SIZE) ? SECTOR_SIZE : (toread - got);
-
-                    // Copy data to output buffer
-                    for (size_t i = 0; i < copy; ++i) out[got + i] = secbuf[i];
-                    got += copy;
-
-                    // Get next cluster in chain from FAT
-                    uint16_t next = fat_get_entry(c);
-                    if (next >= 0xFFF8) break;  // End-of-file marker
-                    c = next;
-                }
-
-                return (int)got;  // Return number of bytes read
-            }
-        }
-    }
-
-    return -1;  // File not found
+static int disk_discard(uint32_t lba, uint32_t count) {
+    return blkdev_discard(root_dev, lba, count);
 }
 
 /* ============================================================================
@@ -822,6 +244,421 @@ static void scancode_map_init(void) {
     normal_map[0x0E] = '\b';  // Backspace
 }
 
+/* ============================================================================
+   CONSOLE COMMANDS
+   ============================================================================ */
+// Text typed at the kernel prompt is collected into a line; Enter runs it as a command
+
+#define CMD_MAX 64       // Longest command line
+#define CMD_MAX_ARGS 4   // Command name plus up to three arguments
+
+static char cmd_buf[CMD_MAX];  // Current command line
+static size_t cmd_len = 0;     // Characters in the command line
+
+/* Compare two null-terminated strings, returns 1 if equal */
+static int kstreq(const char *a, const char *b) {
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
+/* Parse a decimal number, returns 0 on success */
+static int kparse_dec(const char *s, uint64_t *out) {
+    uint64_t v = 0;
+    if (!*s) return -1;
+    for (; *s; ++s) {
+        if (*s < '0' || *s > '9') return -1;
+        v = v * 10 + (uint64_t)(*s - '0');
+    }
+    *out = v;
+    return 0;
+}
+
+/* Print the result of a filesystem command */
+static void console_result(int r, const char *ok) {
+    kprints(r == 0 ? ok : "Failed.\n");
+}
+
+/* Print one file's line of a directory listing */
+static void ls_print_file(const char *name, uint32_t size) {
+    kprints("  ");
+    kprints(name);
+    kprints(" ");
+    kprint_dec(size);
+    kprints("\n");
+}
+
+/* Print one file's line of the fragmentation report */
+static void frag_print_file(const char *name, uint32_t size, uint32_t fragments) {
+    kprints("  ");
+    kprints(name);
+    kprints(": ");
+    kprint_dec(size);
+    kprints(" bytes, ");
+    kprint_dec(fragments);
+    kprints(fragments == 1 ? " fragment\n" : " fragments\n");
+}
+
+/* Print the fragmentation report for the FAT16 volume */
+static void frag_report(void) {
+    fat16_frag_stats_t st;
+    fat16_frag_report(&st, frag_print_file);
+
+    kprint_dec(st.files); kprints(" files, ");
+    kprint_dec(st.fragmented_files); kprints(" fragmented, ");
+    kprint_dec(st.total_fragments); kprints(" fragments\n");
+
+    kprint_dec(st.free_clusters); kprints(" free clusters in ");
+    kprint_dec(st.free_extents); kprints(" extents, largest ");
+    kprint_dec(st.largest_free_extent); kprints("\n");
+
+    // Free extent distribution by log2 length
+    kprints("Free extents by length:");
+    for (uint32_t b = 0; b < FAT16_FREE_EXTENT_BUCKETS; ++b) {
+        if (!st.free_extent_hist[b]) continue;
+        kprints(" ");
+        kprint_dec((uint64_t)1 << b);
+        kprints("+:");
+        kprint_dec(st.free_extent_hist[b]);
+    }
+    kprints("\n");
+}
+
+/* Verify the FAT16 metadata checksums and report what was found */
+static void check_volume(void) {
+    fat16_check_stats_t st;
+    int left = fat16_check(&st);
+    kprint_dec(st.checked); kprints(" metadata sectors checked, ");
+    kprint_dec(st.bad); kprints(" bad, ");
+    kprint_dec(st.repaired); kprints(" repaired from the other FAT\n");
+    if (left > 0) { kprint_dec((uint64_t)left); kprints(" sectors could not be repaired.\n"); }
+}
+
+/* Print a text file to the console */
+static void cat_file(const char *path) {
+    int fd = vfs_open(path, 0);
+    if (fd < 0) { kprints("Failed.\n"); return; }
+
+    // Print straight from the filesystem's memory (page cache, tmpfs page or initrd archive)
+    const uint8_t *p;
+    size_t len;
+    while ((p = vfs_map(fd, &len)) != 0) {
+        for (size_t i = 0; i < len; ++i) kputchar((char)p[i]);
+    }
+    vfs_close(fd);
+}
+
+/* Freeze the FAT16 volume as it is now; later changes go to the overlay's delta */
+static void take_snapshot(void) {
+    if (cow_active()) {
+        kprints("A snapshot is already active (");
+        kprint_dec(cow_delta_sectors());
+        kprints(" sectors changed since).\n");
+        return;
+    }
+    fat16_sync();  // Cached pages and deferred frees belong in the snapshot
+    console_result(cow_snapshot(), "Snapshot taken.\n");
+}
+
+/* Go back to the snapshot and remount it, dropping everything cached from the discarded state */
+static void rollback_snapshot(void) {
+    if (cow_rollback() != 0) {
+        kprints("No snapshot is active.\n");
+        return;
+    }
+    if (fat16_mount() != 0) fat16_init();
+    vfs_invalidate("/");  // Inode numbers held by open files refer to the discarded state
+    kprints("Rolled back to the snapshot.\n");
+}
+
+/* List the block devices: the ATA disks found on both channels, the RAID volume and the
+   RAM disk */
+static void list_disks(void) {
+    for (int id = 0; id < blkdev_count(); ++id) {
+        blkdev_info_t info;
+        blkdev_info(id, &info);
+        kprints("  ");
+        kprints(info.name);
+        kprints(": ");
+        kprints(info.model);
+        kprints(", ");
+        kprint_dec(info.sectors / 2);
+        kprints("KB");
+        if (info.flags & BLKDEV_DISCARD) kprints(", discard");
+        kprints(id == root_dev ? ", filesystems\n" : "\n");
+    }
+}
+
+/* Show the RAID volume and how its members' I/O is spread */
+static void raid_report(void) {
+    if (raid_level() < 0) {
+        kprints("No RAID volume (boot with raid=0 or raid=1).\n");
+        return;
+    }
+    kprints(raid_level() == 0 ? "RAID-0, " : "RAID-1, ");
+    kprint_dec(raid_sectors() / 2);
+    kprints("KB, stripe ");
+    kprint_dec(raid_stripe());
+    kprints(" sectors\n");
+    for (int i = 0; i < raid_members(); ++i) {
+        raid_member_stats_t st;
+        raid_member_stats(i, &st);
+        kprints("  hd");
+        kprint_dec((uint64_t)st.dev);
+        kprints(": ");
+        kprint_dec(st.reads); kprints(" reads (");
+        kprint_dec(st.sectors_read); kprints(" sectors), ");
+        kprint_dec(st.writes); kprints(" writes (");
+        kprint_dec(st.sectors_written); kprints(" sectors)");
+        kprints(st.failed ? ", out of sync\n" : "\n");
+    }
+}
+
+/* raid [resync]: show the volume, or copy it onto the mirrors left out and take them back */
+static void raid_command(int argc, char **argv) {
+    if (argc == 1) {
+        raid_report();
+    } else if (kstreq(argv[1], "resync")) {
+        if (raid_level() != 1) {
+            kprints("Only RAID-1 volumes have mirrors to resync.\n");
+            return;
+        }
+        kprints(raid_resync() == 0 ? "Mirrors in sync.\n" : "Resync failed, the mirror stays out.\n");
+    } else {
+        kprints("Usage: raid [resync]\n");
+    }
+}
+
+/* Print an unsigned number in decimal through out (the screen or the serial port) */
+static void print_dec(void (*out)(const char *s), uint64_t v) {
+    char digits[21];
+    int n = 20;
+    digits[n] = 0;
+    do {
+        digits[--n] = (char)('0' + (v % 10));
+        v /= 10;
+    } while (v);
+    out(&digits[n]);
+}
+
+/* Print each block device's counters and latency histograms through out */
+static void iostat_report(void (*out)(const char *s)) {
+    static const char *kinds[BLKDEV_KINDS] = { "  read ", "  write", "  flush" };
+    int shown = 0;
+    for (int id = 0; id < blkdev_count(); ++id) {
+        blkdev_info_t info;
+        blkdev_stats_t st;
+        blkdev_info(id, &info);
+        blkdev_stats(id, &st);
+        if (!st.requests[BLKDEV_READ] && !st.requests[BLKDEV_WRITE] && !st.requests[BLKDEV_FLUSH] && !st.discards) continue;
+        shown = 1;
+
+        out(info.name);
+        out(": ");
+        print_dec(out, st.requests[BLKDEV_READ]); out(" reads (");
+        print_dec(out, st.sectors[BLKDEV_READ]); out(" sectors, ");
+        print_dec(out, st.sequential[BLKDEV_READ]); out(" sequential), ");
+        print_dec(out, st.requests[BLKDEV_WRITE]); out(" writes (");
+        print_dec(out, st.sectors[BLKDEV_WRITE]); out(" sectors, ");
+        print_dec(out, st.sequential[BLKDEV_WRITE]); out(" sequential)\n  ");
+        print_dec(out, st.requests[BLKDEV_FLUSH]); out(" flushes, ");
+        print_dec(out, st.discards); out(" discards (");
+        print_dec(out, st.sectors_discarded); out(" sectors), ");
+        print_dec(out, st.splits); out(" splits, ");
+        print_dec(out, st.errors); out(" errors, active ");
+        print_dec(out, st.active); out(" (peak ");
+        print_dec(out, st.max_active); out(")\n");
+
+        // Latency: average, then the non-empty log2 buckets as "2^N:count" (N: cycles)
+        for (int k = 0; k < BLKDEV_KINDS; ++k) {
+            if (!st.timed[k]) continue;
+            out(kinds[k]);
+            out(" avg ");
+            print_dec(out, st.cycles[k] / st.timed[k]);
+            out(" cycles:");
+            for (int b = 0; b < BLKDEV_BUCKETS; ++b) {
+                if (!st.histogram[k][b]) continue;
+                out(" 2^");
+                print_dec(out, (uint64_t)b);
+                out(":");
+                print_dec(out, st.histogram[k][b]);
+            }
+            out("\n");
+        }
+    }
+    if (!shown) out("No disk I/O yet.\n");
+}
+
+/* iostat [serial|reset]: show the counters, send them to COM1, or start them again */
+static void iostat(int argc, char **argv) {
+    if (argc == 1) {
+        iostat_report(kprints);
+    } else if (kstreq(argv[1], "serial")) {
+        if (!serial_present()) {
+            kprints("No serial port.\n");
+            return;
+        }
+        iostat_report(serial_write);
+        kprints("Sent to COM1.\n");
+    } else if (kstreq(argv[1], "reset")) {
+        for (int id = 0; id < blkdev_count(); ++id) blkdev_reset_stats(id);
+        kprints("I/O counters reset.\n");
+    } else {
+        kprints("Usage: iostat [serial|reset]\n");
+    }
+}
+
+/* Show how much physical memory is free, in which block sizes, how it is spread over NUMA
+   nodes, how much of it is zeroed ahead, and how many pages of each size map it */
+static void mem_report(void) {
+    kprint_dec(frame_free_count() * (FRAME_SIZE / 1024));
+    kprints("KB free of ");
+    kprint_dec(frame_total() * (FRAME_SIZE / 1024));
+    kprints("KB\n ");
+    for (unsigned order = 0; order < FRAME_ORDERS; ++order) {
+        kprints(" ");
+        kprint_dec((uint64_t)(FRAME_SIZE / 1024) << order);
+        kprints("KB:");
+        kprint_dec(frame_free_blocks(order));
+    }
+    for (int node = 0; frame_nodes() > 1 && node < frame_nodes(); ++node) {
+        frame_node_stats_t ns;
+        frame_node_stats(node, &ns);
+        kprints("\nNode "); kprint_dec(node); kprints(": ");
+        kprint_dec(ns.free * (FRAME_SIZE / 1024)); kprints("KB free of ");
+        kprint_dec(ns.frames * (FRAME_SIZE / 1024)); kprints("KB, ");
+        kprint_dec(numa_cpus(node)); kprints(" CPUs, ");
+        kprint_dec(ns.allocs); kprints(" allocs, ");
+        kprint_dec(ns.frees); kprints(" frees, ");
+        kprint_dec(ns.fallbacks); kprints(" served remotely, distances");
+        for (int other = 0; other < frame_nodes(); ++other) {
+            kprints(" ");
+            kprint_dec(numa_distance(node, other));
+        }
+    }
+    uint64_t zeroed = 0, hits = 0, misses = 0;
+    for (int node = 0; node < frame_nodes(); ++node) {
+        frame_node_stats_t ns;
+        frame_node_stats(node, &ns);
+        zeroed += ns.zeroed;
+        hits += ns.zero_hits;
+        misses += ns.zero_misses;
+    }
+    kprints("\nZeroed: ");
+    kprint_dec(zeroed * (FRAME_SIZE / 1024)); kprints("KB ready, ");
+    kprint_dec(hits); kprints(" requests served from the pool, ");
+    kprint_dec(misses); kprints(" cleared on demand");
+    paging_stats_t st;
+    paging_stats(&st);
+    kprints("\nMapped: ");
+    kprint_dec(st.pages_1g); kprints(" 1GB pages, ");
+    kprint_dec(st.pages_2m); kprints(" 2MB pages, ");
+    kprint_dec(st.pages_4k); kprints(" 4KB pages (");
+    kprint_dec(st.global); kprints(" global) in ");
+    kprint_dec(st.tables); kprints(paging_pcid() ? " tables, PCIDs on\n" : " tables\n");
+}
+
+/* Show each heap cache: object size, slabs, objects in use and how often the per-CPU
+   magazines served allocations and frees without going to the slabs */
+static void heap_report(void) {
+    for (int i = 0; i <= HEAP_CACHES; ++i) {
+        heap_stats_t st;
+        heap_stats(i, &st);
+        if (!st.allocs && !st.failures) continue;
+        kprints("  ");
+        if (st.size) {
+            kprint_dec(st.size);
+            kprints(" bytes: ");
+            kprint_dec(st.slabs); kprints(" slabs, ");
+        } else {
+            kprints("large: ");
+            kprint_dec(st.slabs); kprints(" pages, ");
+        }
+        kprint_dec(st.in_use); kprints(" in use, ");
+        kprint_dec(st.allocs); kprints(" allocs (");
+        kprint_dec(st.fast_allocs); kprints(" fast), ");
+        kprint_dec(st.frees); kprints(" frees (");
+        kprint_dec(st.fast_frees); kprints(" fast), ");
+        kprint_dec(st.failures); kprints(" failed\n");
+    }
+}
+
+/* Split the command line into arguments and run it */
+static void console_run(char *line) {
+    char *argv[CMD_MAX_ARGS];
+    int argc = 0;
+
+    // Split on spaces in place
+    while (*line && argc < CMD_MAX_ARGS) {
+        while (*line == ' ') *line++ = 0;
+        if (!*line) break;
+        argv[argc++] = line;
+        while (*line && *line != ' ') line++;
+    }
+    while (*line == ' ') *line++ = 0;
+    if (argc == 0) return;
+
+    if (kstreq(argv[0], "help")) {
+        kprints("Commands: ls [/MOUNT], cat FILE, rm FILE, mv OLD NEW, truncate FILE LEN, sync, frag, defrag, check, compress on|off, snapshot, rollback, commit, disks, raid [resync], iostat [serial|reset], mem, heap\n");
+    } else if (kstreq(argv[0], "ls") && argc <= 2) {
+        if (vfs_list(argc == 2 ? argv[1] : "/", ls_print_file) != 0) kprints("Failed.\n");
+    } else if (kstreq(argv[0], "cat") && argc == 2) {
+        cat_file(argv[1]);
+    } else if (kstreq(argv[0], "rm") && argc == 2) {
+        console_result(vfs_unlink(argv[1]), "Deleted.\n");
+    } else if (kstreq(argv[0], "mv") && argc == 3) {
+        console_result(vfs_rename(argv[1], argv[2]), "Renamed.\n");
+    } else if (kstreq(argv[0], "truncate") && argc == 3) {
+        uint64_t len;
+        if (kparse_dec(argv[2], &len) != 0) { kprints("Bad length.\n"); return; }
+        console_result(vfs_truncate(argv[1], (uint32_t)len), "Truncated.\n");
+    } else if (kstreq(argv[0], "sync") && argc == 1) {
+        vfs_sync();
+        kprints("Synced.\n");
+    } else if (kstreq(argv[0], "frag") && argc == 1) {
+        frag_report();
+    } else if (kstreq(argv[0], "defrag") && argc == 1) {
+        fat16_defrag_start();
+        kprints("Defragmenting in the background.\n");
+    } else if (kstreq(argv[0], "check") && argc == 1) {
+        check_volume();
+    } else if (kstreq(argv[0], "compress") && argc == 2 && (kstreq(argv[1], "on") || kstreq(argv[1], "off"))) {
+        fat16_set_compression(kstreq(argv[1], "on"));
+        kprints(kstreq(argv[1], "on") ? "Files will be saved compressed.\n" : "Files will be saved uncompressed.\n");
+    } else if (kstreq(argv[0], "snapshot") && argc == 1) {
+        take_snapshot();
+    } else if (kstreq(argv[0], "rollback") && argc == 1) {
+        rollback_snapshot();
+    } else if (kstreq(argv[0], "commit") && argc == 1) {
+        fat16_sync();
+        console_result(cow_commit(), "Snapshot committed.\n");
+    } else if (kstreq(argv[0], "disks") && argc == 1) {
+        list_disks();
+    } else if (kstreq(argv[0], "raid") && argc <= 2) {
+        raid_command(argc, argv);
+    } else if (kstreq(argv[0], "iostat") && argc <= 2) {
+        iostat(argc, argv);
+    } else if (kstreq(argv[0], "mem") && argc == 1) {
+        mem_report();
+    } else if (kstreq(argv[0], "heap") && argc == 1) {
+        heap_report();
+    } else {
+        kprints("Unknown command. Type help for a list.\n");
+    }
+}
+
+/* Add a typed character to the command line, running it on Enter */
+static void console_input(char c) {
+    if (c == '\n') {
+        cmd_buf[cmd_len] = 0;
+        console_run(cmd_buf);
+        cmd_len = 0;
+    } else if (c == '\b') {
+        if (cmd_len > 0) cmd_len--;
+    } else if (cmd_len < CMD_MAX - 1) {
+        cmd_buf[cmd_len++] = c;
+    }
+}
+
 /* ============================================================================
     KEYBOARD INPUT HANDLING
    ============================================================================ */
@@ -880,9 +717,10 @@ void handle_scancode(uint8_t scancode) {
     /* Don't output control characters */
     if (ctrl_down) return;
 
-    /* Normal output: display the character if valid */
+    /* Normal output: display the character if valid and add it to the command line */
     if (c) {
         kputchar(c);
+        console_input(c);
     }
 }
 
@@ -895,38 +733,493 @@ static inline void disable_smi(void) {
     outb(0xB2, 0x00);
 }
 
+static inline void enable_sse(void) {
+    // main.asm only turns on paging; AES-NI works on XMM registers, which fault until the OS
+    // says it handles them: clear CR0.EM, set CR0.MP, then CR4.OSFXSR and CR4.OSXMMEXCPT
+    uint64_t cr;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr));
+    cr = (cr & ~(1ull << 2)) | (1ull << 1);
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr));
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr));
+    cr |= (1ull << 9) | (1ull << 10);
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(cr));
+}
+
+/* Number of the CPU running the caller (its NVMe queue pair and heap magazines). Only the
+   boot CPU runs the kernel so far */
+static int cpu_number(void) {
+    return 0;
+}
+
+/* ============================================================================
+   PHYSICAL MEMORY
+   ============================================================================ */
+
+#define BOOT_MAPPED 0x40000000ull  // main.asm identity maps the first 1GB
+
+static uint64_t page_table_alloc(void) {
+    return frame_alloc_zeroed();
+}
+
+static void page_table_free(uint64_t phys) {
+    frame_free(phys);  // Fails harmlessly for main.asm's tables, which are part of the image
+}
+
+/* Hand the available RAM the memory map lists between lo and hi to the frame allocator.
+   Returns how many ranges were added */
+static int add_memory(uint64_t multiboot_info, uint64_t lo, uint64_t hi) {
+    uint64_t base, len;
+    uint32_t type;
+    int added = 0;
+    for (int i = 0; multiboot_memory_region(multiboot_info, i, &base, &len, &type) == 0; ++i) {
+        if (type != MULTIBOOT_MEMORY_AVAILABLE) continue;
+        uint64_t start = base < lo ? lo : base;
+        uint64_t end = base + len < base || base + len > hi ? hi : base + len;
+        if (start < end && frame_add(start, end - start) == 0) added++;
+    }
+    return added;
+}
+
+/* Make firmware memory at phys..phys+len-1 readable: the direct map covers RAM, tables
+   outside it get mapped where they are. Returns phys as a pointer, NULL if it could not be
+   mapped */
+static const void *map_firmware(uint64_t phys, size_t len) {
+    uint64_t start = phys & ~(PAGE_SIZE - 1);
+    uint64_t end = (phys + (len ? len : 1) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint64_t mapped;
+    if (end > PAGING_USER_BASE) return 0;
+    // Every page: mapped ends say nothing about the middle, which can cross a hole in RAM
+    for (uint64_t page = start; page < end; page += PAGE_SIZE) {
+        if (paging_translate(page, &mapped) == 0 && mapped == page) continue;
+        if (paging_map(page, page, PAGE_SIZE, PAGE_GLOBAL) != 0) return 0;
+    }
+    return (const void *)(uintptr_t)phys;
+}
+
+/* NUMA node of the calling CPU, by its initial local APIC id */
+static int cpu_node(void) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return numa_node_of_cpu(ebx >> 24);
+}
+
+/* Read the memory topology from the ACPI SRAT and SLIT, put each node's RAM on its own free
+   lists and let allocations go to the asking CPU's node first, then to the nearest others.
+   Memory already added (the first 1GB) is moved to the lists of its node */
+static void numa_setup(uint64_t multiboot_info) {
+    acpi_callbacks_t acpi_callbacks = {
+        .map = map_firmware  // Function to reach the tables, which may lie outside RAM
+    };
+    acpi_set_callbacks(&acpi_callbacks);
+    if (acpi_init(multiboot_acpi_rsdp(multiboot_info)) != 0) {
+        numa_init(0, 0);
+        return;
+    }
+    numa_init(acpi_find("SRAT"), acpi_find("SLIT"));
+    if (numa_nodes() == 1) return;
+
+    uint64_t base, len;
+    int node, nodes[NUMA_MAX_NODES];
+    for (int i = 0; numa_range(i, &base, &len, &node) == 0; ++i) {
+        if (frame_set_node(base, len, node) != 0) kprints("mem: too many NUMA ranges, the rest counted as node 0\n");
+    }
+    for (node = 0; node < numa_nodes(); ++node) {
+        int n = numa_fallback(node, nodes);
+        frame_set_fallback(node, nodes, n);
+    }
+    frame_regroup();
+    frame_callbacks_t frame_callbacks = {
+        .node = cpu_node  // Function to pick the node an allocation comes from first
+    };
+    frame_set_callbacks(&frame_callbacks);
+}
+
+/* Build the frame allocator from the firmware's memory map, keeping out the first 1MB, the
+   kernel image, the boot modules and the boot information (read again later for options).
+   RAM inside the boot identity map goes in first; the page tables for a direct map of all RAM
+   come from it, then the NUMA topology is read through that map, and then the RAM above 1GB
+   is added too */
+static void memory_setup(uint64_t multiboot_info) {
+    uint64_t base, len, top = 0;
+    uint32_t type;
+    for (int i = 0; multiboot_memory_region(multiboot_info, i, &base, &len, &type) == 0; ++i) {
+        if (type == MULTIBOOT_MEMORY_AVAILABLE && base + len > top) top = base + len;
+    }
+    if (top > FRAME_MAX_MEMORY) top = FRAME_MAX_MEMORY;
+
+    frame_init(top);
+    frame_reserve(0, (uint64_t)(uintptr_t)kernel_end);  // The kernel is loaded at 1MB, above BIOS data and VGA
+    frame_reserve(multiboot_info, multiboot_info_size(multiboot_info));
+    int modules = 0;
+    uint64_t lowest = ~0ull, highest = 0;
+    for (; multiboot_module_region(multiboot_info, modules, &base, &len) == 0; ++modules) {
+        if (base < lowest) lowest = base;
+        if (base + len > highest) highest = base + len;
+    }
+    if (modules > FRAME_MAX_RESERVED - 2) {
+        // More modules than reserved ranges are left: keep out everything from the lowest to
+        // the highest, gaps included, rather than let any of them be handed out
+        frame_reserve(lowest, highest - lowest);
+    } else {
+        for (int i = 0; multiboot_module_region(multiboot_info, i, &base, &len) == 0; ++i) frame_reserve(base, len);
+    }
+
+    paging_callbacks_t paging_callbacks = {
+        .table_alloc = page_table_alloc,  // Function to get pages for new tables
+        .table_free = page_table_free     // Function to give back tables a large page replaced
+    };
+    paging_set_callbacks(&paging_callbacks);
+    paging_init();
+
+    if (add_memory(multiboot_info, 0, BOOT_MAPPED) == 0) {
+        kprints("mem: no memory map from the boot loader, no memory to allocate\n");
+        return;
+    }
+    // Identity map all RAM (at least the 1GB main.asm did) with the largest pages there are,
+    // global so that they stay in the TLB across address space switches
+    uint64_t direct = top < BOOT_MAPPED ? BOOT_MAPPED : (top + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
+    if (paging_map(0, 0, direct, PAGE_WRITE | PAGE_GLOBAL) != 0) {
+        kprints("mem: out of memory for page tables, RAM above 1GB left unused\n");
+        return;
+    }
+    numa_setup(multiboot_info);
+    add_memory(multiboot_info, BOOT_MAPPED, ~0ull);
+}
+
+static void *heap_page_alloc(unsigned order) {
+    return (void *)(uintptr_t)frame_alloc(order);
+}
+
+static void heap_page_free(void *p) {
+    frame_free((uint64_t)(uintptr_t)p);
+}
+
+/* Put the kernel heap on top of the frame allocator, with a magazine per CPU */
+static void heap_setup(void) {
+    heap_callbacks_t heap_callbacks = {
+        .page_alloc = heap_page_alloc,  // Function to get slab pages and large blocks
+        .page_free = heap_page_free,    // Function to give them back
+        .cpu = cpu_number               // Function to pick the caller's magazines
+    };
+    heap_set_callbacks(&heap_callbacks);
+    heap_init(1);
+}
+
+/* ============================================================================
+   DEVICE MEMORY AND DISK INTERRUPTS
+   ============================================================================ */
+
+#define PIC_MASTER 0x20     // Command port; data (mask) port is one above
+#define PIC_SLAVE  0xA0
+#define PIC_EOI    0x20
+
+static int disk_irq = -1;  // IRQ the NVMe controller interrupts on, -1 if none is installed
+
+/* Map device registers at phys..phys+len-1 at the same address, uncached. Controllers'
+   registers normally sit just below 4GB, outside RAM or in a large page of the direct map,
+   which is split down to 4KB pages around them. Returns phys as a pointer, NULL if no page
+   table could be allocated */
+static void *map_mmio(uint64_t phys, size_t len) {
+    uint64_t start = phys & ~(PAGE_SIZE - 1);
+    uint64_t end = (phys + (len ? len : 1) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (end > PAGING_USER_BASE) return 0;  // Only the kernel's range is shared by every address space
+    if (paging_map(start, start, end - start, PAGE_WRITE | PAGE_WRITETHROUGH | PAGE_NOCACHE | PAGE_GLOBAL) != 0) return 0;
+    return (void *)(uintptr_t)phys;
+}
+
+/* Point vector at handler with a 64-bit interrupt gate in the table init_idt64 loaded */
+static void idt_set_gate(uint8_t vector, void (*handler)(void)) {
+    struct {
+        uint16_t limit;
+        uint64_t base;
+    } __attribute__((packed)) idtr;
+    __asm__ volatile ("sidt %0" : "=m"(idtr));
+    uint8_t *gate = (uint8_t *)(uintptr_t)idtr.base + (size_t)vector * 16;
+    uint64_t addr = (uint64_t)(uintptr_t)handler;
+    *(uint16_t *)(gate + 0) = (uint16_t)addr;          // Handler bits 0-15
+    *(uint16_t *)(gate + 2) = 0x0008;                  // Kernel code selector
+    gate[4] = 0;                                       // No Interrupt Stack Table
+    gate[5] = 0x8E;                                    // Present 64-bit interrupt gate
+    *(uint16_t *)(gate + 6) = (uint16_t)(addr >> 16);  // Handler bits 16-31
+    *(uint32_t *)(gate + 8) = (uint32_t)(addr >> 32);  // Handler bits 32-63
+    *(uint32_t *)(gate + 12) = 0;
+}
+
+void handle_disk_irq(void) {
+    nvme_interrupt();  // Mask it at the controller, so the level-triggered line drops
+    if (disk_irq >= 8) outb(PIC_SLAVE, PIC_EOI);
+    outb(PIC_MASTER, PIC_EOI);
+}
+
+/* Sleep until the disk IRQ comes in, letting only it through: the keyboard handler would
+   otherwise run console commands in the middle of the filesystem's disk access. Refused
+   while an interrupt is being handled, since the PIC holds back lower-priority IRQs until
+   its end of interrupt (console commands run in the keyboard handler) */
+static int disk_wait_irq(int irq) {
+    if (irq != disk_irq) return -1;
+    outb(PIC_MASTER, 0x0B);  // OCW3: the next read returns the in-service register
+    if (inb(PIC_MASTER)) return -1;
+
+    uint64_t flags;
+    __asm__ volatile ("pushfq; pop %0" : "=r"(flags));
+    uint8_t master = inb(PIC_MASTER + 1), slave = inb(PIC_SLAVE + 1);
+    if (irq < 8) {
+        outb(PIC_MASTER + 1, (uint8_t)~(1u << irq));
+    } else {
+        outb(PIC_MASTER + 1, (uint8_t)~(1u << 2));  // Cascade from the slave
+        outb(PIC_SLAVE + 1, (uint8_t)~(1u << (irq - 8)));
+    }
+    __asm__ volatile ("sti; hlt; cli");  // sti takes effect after hlt starts, so a pending IRQ wakes it
+    outb(PIC_MASTER + 1, master);
+    outb(PIC_SLAVE + 1, slave);
+    if (flags & 0x200) __asm__ volatile ("sti");
+    return 0;
+}
+
+/* Bring up an NVMe controller if there is one, with a queue pair per CPU, and install its
+   interrupt for the driver to sleep on when a command takes long */
+static void nvme_setup(void) {
+    nvme_callbacks_t nvme_callbacks = {
+        .print_message = kprints,     // Function to report driver errors
+        .map_mmio = map_mmio,         // Function to map the controller's registers
+        .cpu = cpu_number,            // Function to pick the caller's queue pair
+        .wait_irq = disk_wait_irq     // Function to sleep on the controller's interrupt
+    };
+    nvme_set_callbacks(&nvme_callbacks);
+    if (nvme_init(1) != 0) return;
+    int irq = nvme_irq();
+    if (irq > 2) {  // IRQ 0-2 are the timer, the keyboard and the cascade
+        idt_set_gate((uint8_t)(0x20 + irq), disk_isr64);
+        disk_irq = irq;
+    }
+}
+
+/* Find the IDE controller on PCI and give the ATA driver its bus master registers (BAR4),
+   which TRIM needs */
+static void ide_busmaster_setup(void) {
+    pci_addr_t ide;
+    if (pci_find_class(0x01, 0x01, 0, &ide) != 0) return;  // Mass storage, IDE
+    uint32_t bar = pci_bar(ide, 4);
+    if (!bar || bar > 0xFFFF) return;
+    pci_enable(ide, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    ata_set_busmaster((uint16_t)bar);
+}
+
+/* With raid=0 or raid=1 (and optionally stripe=SECTORS) on the boot command line, put
+   every ATA disk found into one volume */
+static void raid_setup(uint64_t multiboot_info) {
+    char opt[16];
+    if (multiboot_option(multiboot_info, "raid", opt, sizeof(opt)) != 0) return;
+
+    uint64_t lvl, stripe = RAID_DEFAULT_STRIPE;
+    if (kparse_dec(opt, &lvl) != 0 ||
+        (multiboot_option(multiboot_info, "stripe", opt, sizeof(opt)) == 0 && kparse_dec(opt, &stripe) != 0)) {
+        kprints("raid: bad option\n");
+        return;
+    }
+    int devs[RAID_MAX_MEMBERS];
+    uint32_t sizes[RAID_MAX_MEMBERS];
+    int n = 0;
+    for (int dev = 0; dev < ATA_MAX_DEVICES; ++dev) {
+        if (!ata_present(dev)) continue;
+        devs[n] = dev;
+        sizes[n++] = ata_sectors(dev);
+    }
+    raid_callbacks_t raid_callbacks = {
+        .submit = ata_submit,      // Function to start a command on a member
+        .complete = ata_complete,  // Function to wait for it
+        .flush = ata_flush,        // Cache flush at sync points
+        .discard = ata_discard     // TRIM for freed sectors
+    };
+    raid_set_callbacks(&raid_callbacks);
+    if (stripe > RAID_MAX_STRIPE || raid_init((int)lvl, devs, sizes, n, (uint32_t)stripe) != 0) {
+        kprints("raid: needs level 0 or 1, at least two disks and one usable mirror, using one disk\n");
+        return;
+    }
+    raid_register("md0");
+    kprints(lvl == 0 ? "RAID-0 over " : "RAID-1 over ");
+    kprint_dec((uint64_t)n);
+    kprints(" disks.\n");
+    for (int i = 0; i < n; ++i) {
+        raid_member_stats_t st;
+        raid_member_stats(i, &st);
+        if (!st.failed) continue;
+        kprints("raid: hd");
+        kprint_dec((uint64_t)st.dev);
+        kprints(" missed writes and is left out until 'raid resync'\n");
+    }
+}
+
+/* Register every disk, the NVMe namespace, the RAID volume and the RAM disk as block devices,
+   then pick the one the filesystems live on */
+static void root_setup(uint64_t multiboot_info) {
+    static const char *names[ATA_MAX_DEVICES] = { "hd0", "hd1", "hd2", "hd3" };
+    for (int dev = 0; dev < ATA_MAX_DEVICES; ++dev) ata_register(dev, names[dev]);
+    nvme_register("nvme0");
+    raid_setup(multiboot_info);
+    ramdisk_create(&ram0, "ram0", ram0_mem, RAMDISK_SECTORS);
+
+    char opt[16];
+    if (multiboot_option(multiboot_info, "root", opt, sizeof(opt)) == 0) {
+        root_dev = blkdev_find(opt);
+        if (root_dev < 0) kprints("root: no such device, using the default\n");
+    }
+    if (root_dev < 0) root_dev = blkdev_find("md0");
+    for (int dev = 0; dev < ATA_MAX_DEVICES && root_dev < 0; ++dev) root_dev = blkdev_find(names[dev]);
+    if (root_dev < 0) root_dev = blkdev_find("nvme0");
+    if (root_dev < 0) root_dev = blkdev_find("ram0");  // No disk at all: run from memory
+    if (root_dev == blkdev_find("ram0")) kprints("Filesystems on the RAM disk: nothing is kept across boots.\n");
+}
+
+/* Fill buf with a salt for a new encrypted volume: RDRAND when the CPU has it, otherwise
+   time stamp counter readings. A salt only has to differ between volumes, not stay secret */
+static void salt_fill(uint8_t *buf, size_t len) {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile ("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    int rdrand = (ecx >> 30) & 1;
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t v = 0;
+        uint8_t ok = 0;
+        for (int tries = 0; rdrand && !ok && tries < 10; ++tries) {
+            __asm__ volatile ("rdrand %0; setc %1" : "=r"(v), "=qm"(ok));
+        }
+        if (!ok) {
+            uint32_t lo, hi;
+            __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+            v = (((uint64_t)hi << 32) | lo) * 0x9E3779B97F4A7C15ull;  // Spread the changing low bits
+        }
+        for (size_t k = 0; k < 8 && i + k < len; ++k) buf[i + k] = (uint8_t)(v >> (8 * k));
+    }
+}
+
 /* ============================================================================
    KERNEL ENTRY POINT
    ============================================================================ */
 
-void kernel_main(void) {
+#define RECLAIM_BATCH 8    // Clusters freed per pass of the idle loop
+#define DEFRAG_BATCH 1     // Clusters moved per pass of the idle loop
+#define WRITEBACK_BATCH 1  // Dirty file pages written per pass of the idle loop
+#define ZERO_BATCH 8       // Free frames cleared per pass of the idle loop
+
+void kernel_main(uint64_t multiboot_info) {
     // Initialise keyboard scancode mapping tables
     scancode_map_init();
 
     // Disable System Management Interrupts
     disable_smi();
 
+    // Let the CPU run SSE instructions (the disk encryption uses AES-NI)
+    enable_sse();
+
     // Initialise 64-bit Interrupt Descriptor Table
     init_idt64();
 
+    // Serial port for reports too long for the screen
+    serial_init();
+
+    // Build the physical frame allocator from the memory map GRUB passed, and the heap on it
+    memory_setup(multiboot_info);
+    heap_setup();
+
     // Print welcome messages
     kprints("Kernel started. If you type on the keyboard, characters will appear below!\n");
-    kprints("Press Ctrl-E to enter editor or Ctrl-C to enter calculator.\n");
+    kprints("Press Ctrl-E to enter editor or Ctrl-C to enter calculator. Type help for commands.\n");
 
-    // Select ATA drive 0 (primary master)
-    ata_select_drive(0);
+    // Find the disks on both IDE channels and an NVMe controller, and choose where the filesystems go
+    ata_callbacks_t ata_callbacks = {
+        .print_message = kprints  // Function to report driver errors
+    };
+    ata_set_callbacks(&ata_callbacks);
+    ata_init();
+    ide_busmaster_setup();
+    nvme_setup();
+    root_setup(multiboot_info);
+
+    // Encrypt everything on the disk if a key was given on the boot command line
+    // (multiboot2 /boot/kernel.bin cryptkey=...), otherwise sectors pass straight through
+    crypt_callbacks_t crypt_callbacks = {
+        .disk_read_sectors = disk_read_sectors,
+        .disk_write_sectors = disk_write_sectors,
+        .disk_flush = disk_flush,
+        .disk_discard = disk_discard
+    };
+    crypt_set_callbacks(&crypt_callbacks);
+    char passphrase[CRYPT_PASSPHRASE_MAX];
+    if (multiboot_option(multiboot_info, "cryptkey", passphrase, sizeof(passphrase)) == 0) {
+        uint8_t salt[CRYPT_SALT_BYTES];  // Used if the disk has no volume header yet
+        salt_fill(salt, sizeof(salt));
+        if (crypt_set_passphrase(passphrase, CRYPT_HEADER_LBA, salt) == 0) {
+            kprints(aes_hw() ? "Disk encrypted (XTS-AES-128, AES-NI).\n" : "Disk encrypted (XTS-AES-128, software AES).\n");
+        } else {
+            // Leave the disk alone rather than write over what the right passphrase would open
+            root_dev = blkdev_find("ram0");
+            kprints("crypt: wrong passphrase or no room for the volume header, filesystems on the RAM disk\n");
+        }
+        kmemset(passphrase, 0, sizeof(passphrase));
+    }
+
+    // Put the copy-on-write overlay between FAT16 and the disk, so the volume can be snapshotted
+    cow_callbacks_t cow_callbacks = {
+        .disk_read_sectors = crypt_read_sectors,
+        .disk_write_sectors = crypt_write_sectors,
+        .disk_flush = crypt_flush,
+        .disk_discard = crypt_discard
+    };
+    cow_set_callbacks(&cow_callbacks);
+    if (cow_init(0, TOTAL_SECTORS, COW_DELTA_START) != 0) {
+        kprints("cow: disk too small, snapshots unavailable\n");
+    } else if (cow_active()) {
+        kprints("Snapshot active: rollback brings back the volume from before this boot.\n");
+    }
 
-    // Initialise FAT16 filesystem
+    // Initialise FAT16 filesystem on the root device
+    fat16_callbacks_t fat16_callbacks = {
+        .disk_read = cow_read_sector,    // Function to read a sector
+        .disk_write = cow_write_sector,  // Function to write a sector
+        .disk_read_sectors = cow_read_sectors,   // Multi-sector read (one command per run)
+        .disk_write_sectors = cow_write_sectors, // Multi-sector write (one command)
+        .disk_flush = cow_flush,                 // Cache flush at sync points
+        .disk_discard = cow_discard              // Freed clusters, sent after the FAT is durable
+    };
+    fat16_set_callbacks(&fat16_callbacks);
+    pcache_init();
     fat16_init();
 
+    // Mount FAT16 as the root filesystem and a RAM-backed tmpfs for scratch files
+    tmpfs_init();
+    vfs_mount("/", &fat16_vfs_ops, 0, 0);
+    vfs_mount("/tmp", &tmpfs_vfs_ops, 0, 0);
+
+    // Mount the log-structured filesystem at /log, creating it on first boot
+    logfs_callbacks_t logfs_callbacks = {
+        .disk_read_sectors = crypt_read_sectors,
+        .disk_write_sectors = crypt_write_sectors,
+        .disk_flush = crypt_flush
+    };
+    logfs_set_callbacks(&logfs_callbacks);
+    if (logfs_mount(LOGFS_START, LOGFS_SECTORS) == 0 || logfs_format(LOGFS_START, LOGFS_SECTORS) == 0) {
+        vfs_mount("/log", &logfs_vfs_ops, 0, 0);
+    } else {
+        kprints("logfs: disk too small, /log not mounted\n");
+    }
+
+    // Mount the archive GRUB loaded as the "initrd" module, read-only and in place
+    const uint8_t *initrd;
+    size_t initrd_len;
+    if (multiboot_find_module(multiboot_info, "initrd", &initrd, &initrd_len) == 0 &&
+        initrd_init(initrd, initrd_len) >= 0) {
+        vfs_mount("/initrd", &initrd_vfs_ops, 0, VFS_RDONLY);
+    }
+
     /* Initialise editor subsystem and set callbacks */
     editor_init();
     editor_callbacks_t editor_callbacks = {
         .clear_screen = kclear,          // Function to clear the screen
         .draw_char = kdraw_char,         // Function to draw a character
-        .fat_write = fat16_write_file,   // Function to write files
-        .fat_read = fat16_read_file,     // Function to read files
-        .print_message = kprints         // Function to print messages
+        .file_write = vfs_write_file,    // Function to write files
+        .file_read = vfs_read_file,      // Function to read files
+        .print_message = kprints,        // Function to print messages
+        .mem_realloc = krealloc          // Function to grow the undo history
     };
     editor_set_callbacks(&editor_callbacks);
 
@@ -938,8 +1231,35 @@ void kernel_main(void) {
     };
     calc_set_callbacks(&calc_callbacks);
 
-    // Main kernel loop: halt CPU and wait for interrupts
+    // Main kernel loop: do background work, otherwise halt CPU and wait for interrupts
     for (;;) {
-        __asm__ volatile ("hlt");  // Halt instruction - CPU sleeps until next interrupt
+        __asm__ volatile ("cli");  // Keyboard handlers also use the filesystem, keep them out while working
+        if (fat16_reclaim_pending()) {
+            // Free a small batch of deleted clusters, then let pending keystrokes in
+            fat16_reclaim_step(RECLAIM_BATCH);
+            __asm__ volatile ("sti");
+        } else if (fat16_writeback_pending()) {
+            // Write cached file data back to disk a page at a time
+            fat16_writeback_step(WRITEBACK_BATCH);
+            __asm__ volatile ("sti");
+        } else if (logfs_writeback_pending()) {
+            // Stage cached pages into the log, then write it as one partial segment
+            logfs_writeback_step(WRITEBACK_BATCH);
+            __asm__ volatile ("sti");
+        } else if (logfs_clean_pending()) {
+            // Clean one log segment so saves always find free segments
+            logfs_clean_step();
+            __asm__ volatile ("sti");
+        } else if (fat16_defrag_active()) {
+            // Move one cluster at a time so typing and saving stay responsive
+            if (!fat16_defrag_step(DEFRAG_BATCH)) kprints("Defragmentation finished.\n");
+            __asm__ volatile ("sti");
+        } else if (frame_zero_pending()) {
+            // Clear free frames ahead of time so zeroed allocations are a pop off the pool
+            frame_zero_step(ZERO_BATCH);
+            __asm__ volatile ("sti");
+        } else {
+            __asm__ volatile ("sti; hlt");  // Halt instruction - CPU sleeps until next interrupt
+        }
     }
 }
@@ -1,6 +1,8 @@
 #ifndef KENREL_H
 #define KENREL_H
 
-void kernel_main();
+#include <stdint.h>
+
+void kernel_main(uint64_t multiboot_info);  // Physical address of the multiboot2 boot information
 
 #endif
@@ -0,0 +1,947 @@
+/* logfs.c - Log-structured filesystem
+ *
+ * Nothing is updated in place. File data, inodes and deletions are appended
+ * to the head of a log as partial segments: a summary sector followed by the
+ * sectors it describes, written with a single multi-sector command, so saving
+ * a file is one sequential write. The inode map (where the latest copy of each
+ * inode is) and the number of live sectors in each segment are kept in memory
+ * and stored in one of two checkpoint sectors every few partial segments and
+ * on sync. Mounting reads the newer checkpoint and replays only the partial
+ * segments logged after it. A cleaner copies the live sectors out of mostly
+ * dead segments to the head of the log, so whole segments become free again.
+ */
+#include "logfs.h"
+#include "pcache.h"
+#include "crc32c.h"
+#include "kstring.h"
+
+static logfs_callbacks_t callbacks;
+static const pcache_ops_t logfs_pcache_ops;  // File data goes through the page cache (see FILE PAGES)
+
+void logfs_set_callbacks(const logfs_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+/* ============================================================================
+   ON-DISK FORMAT
+   ============================================================================ */
+// Addresses are sector numbers within the region (segment * LOGFS_SEG_SECTORS +
+// offset). Segment 0 only holds the checkpoint slots, so address 0 never holds
+// file data and means "none": a hole in a file, or an inode not on disk.
+//
+// Checkpoint (region sector 0 or 1, the valid one with the higher number wins):
+//   0 "LCKP", 4 volume id, 8 checkpoint number, 12 sequence of the next partial
+//   segment, 16 segments, 18 head segment, 20 head offset, 22 next segment,
+//   24 CRC32C, 28 inode map (u16 per inode), then live sectors (u16 per segment)
+// Partial segment summary:
+//   0 "LSUM", 4 volume id, 8 sequence, 12 sectors that follow, 14 next segment,
+//   16 CRC32C of the whole partial segment, 20 one entry per following sector:
+//   u16 inode, u16 file sector (ENTRY_INODE: the inode itself)
+// Inode:
+//   0 "LINO", 4 inode number, 6 live flag (0: deleted), 8 size, 12 name,
+//   44 address of each file sector
+
+#define LOG_SECTOR 512
+#define SEG ((uint32_t)LOGFS_SEG_SECTORS)
+#define NO_SEG 0xFFFF
+#define ENTRY_INODE 0xFFFF
+#define ADDR_PROMISED 0xFFFF  // Block written into a cached page, no address until writeback
+
+#define CP_CRC 24
+#define CP_IMAP 28
+#define CP_LIVE (CP_IMAP + 2 * LOGFS_MAX_FILES)
+#define SUM_CRC 16
+#define SUM_ENTRIES 20
+#define INO_NAME 12
+#define INO_BLOCKS 44
+
+#define CP_INTERVAL 8       // Partial segments between periodic checkpoints
+#define CLEAN_TARGET 4      // The background cleaner keeps this many segments clean
+#define CLEAN_MAX_LIVE (SEG * 3 / 4)  // ...but only cleans segments at most this full
+#define RESERVE_SEGS 3      // Segments kept out of the file capacity so the cleaner can always run
+
+static const uint8_t cp_magic[4] = { 'L', 'C', 'K', 'P' };
+static const uint8_t sum_magic[4] = { 'L', 'S', 'U', 'M' };
+static const uint8_t ino_magic[4] = { 'L', 'I', 'N', 'O' };
+
+static uint32_t get16(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put16(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+static int magic_ok(const uint8_t *sec, const uint8_t magic[4]) {
+    return sec[0] == magic[0] && sec[1] == magic[1] && sec[2] == magic[2] && sec[3] == magic[3];
+}
+
+/* ============================================================================
+   VOLUME STATE
+   ============================================================================ */
+
+typedef struct {
+    int live;       // Flag: 1 if the file exists
+    int loaded;     // Flag: 1 once the fields below are read in (files not on disk yet always are)
+    int dirty;      // Flag: 1 if the inode must be appended to the log (a deleted one as a tombstone)
+    char name[VFS_NAME_MAX];
+    uint32_t size;                        // File size in bytes
+    uint16_t blocks[LOGFS_FILE_SECTORS];  // Address of each file sector (0: hole, or ADDR_PROMISED)
+} logfs_inode_t;
+
+static logfs_inode_t inodes[LOGFS_MAX_FILES];  // Inode number = index in this table
+static uint16_t imap[LOGFS_MAX_FILES];         // Inode map: address of each inode's latest copy (0: none)
+static uint16_t seg_live[LOGFS_MAX_SEGS];      // Live sectors (file data and current inodes) per segment
+static uint8_t seg_pending[LOGFS_MAX_SEGS];    // Flag: the checkpoint on disk may still need this segment
+static uint32_t promised = 0;                  // Blocks set to ADDR_PROMISED
+
+static uint32_t region_start = 0;   // First disk sector of the region
+static uint32_t nsegs = 0;          // Segments in the region (0: nothing mounted)
+static uint32_t vol_id = 0;         // Tells this filesystem's log apart from older ones in the same region
+static uint32_t log_seq = 0;        // Sequence number of the next partial segment
+static uint16_t head_seg, head_off; // Where the next partial segment goes
+static uint16_t next_seg;           // Clean segment the log continues in when head_seg fills (NO_SEG: none)
+static uint32_t cp_count = 0;       // Checkpoints written (the low bit picks the slot)
+static uint32_t partials_since_cp = 0;
+
+static uint8_t part_buf[SEG * LOG_SECTOR];   // Partial segment being assembled: summary, then staged sectors
+static uint32_t part_count = 0;              // Sectors staged after the summary
+static uint8_t clean_buf[SEG * LOG_SECTOR];  // Segment being cleaned
+
+static int disk_read(uint32_t addr, uint32_t count, void *buf) {
+    return callbacks.disk_read_sectors(region_start + addr, count, buf);
+}
+
+static int disk_write(uint32_t addr, uint32_t count, const void *buf) {
+    return callbacks.disk_write_sectors(region_start + addr, count, buf);
+}
+
+static void disk_flush(void) {
+    if (callbacks.disk_flush) callbacks.disk_flush();
+}
+
+static uint32_t seg_of(uint32_t addr) {
+    return addr / SEG;
+}
+
+/* Address of the summary of the partial segment being assembled */
+static uint32_t part_base(void) {
+    return (uint32_t)head_seg * SEG + head_off;
+}
+
+/* Check if addr is staged in part_buf (assigned, but not on disk yet) */
+static int addr_staged(uint32_t addr) {
+    return addr > part_base() && addr <= part_base() + part_count;
+}
+
+/* The sector at addr is no longer referenced */
+static void sector_dead(uint32_t addr) {
+    if (addr == ADDR_PROMISED) promised--;
+    if (!addr || addr == ADDR_PROMISED) return;
+    uint32_t s = seg_of(addr);
+    if (seg_live[s] && --seg_live[s] == 0) seg_pending[s] = 1;  // Reusable after the next checkpoint
+}
+
+/* A segment can be written over: nothing live, and not needed by the checkpoint on disk */
+static int seg_clean(uint32_t s) {
+    return s != 0 && s != head_seg && s != next_seg && seg_live[s] == 0 && !seg_pending[s];
+}
+
+static uint32_t clean_count(void) {
+    uint32_t n = 0;
+    for (uint32_t s = 1; s < nsegs; ++s) n += (uint32_t)seg_clean(s);
+    return n;
+}
+
+/* Segments that only wait for a checkpoint to become clean */
+static uint32_t freeable_count(void) {
+    uint32_t n = 0;
+    for (uint32_t s = 1; s < nsegs; ++s) {
+        if (s != head_seg && s != next_seg && seg_live[s] == 0 && seg_pending[s]) n++;
+    }
+    return n;
+}
+
+/* First clean segment after the head, so the log keeps moving forward across the disk */
+static uint16_t pick_clean(void) {
+    for (uint32_t i = 1; i < nsegs; ++i) {
+        uint32_t s = (head_seg + i) % nsegs;
+        if (seg_clean(s)) return (uint16_t)s;
+    }
+    return NO_SEG;
+}
+
+static uint32_t live_total(void) {
+    uint32_t n = 0;
+    for (uint32_t s = 1; s < nsegs; ++s) n += seg_live[s];
+    return n;
+}
+
+/* Sectors the files may take (written or promised): segments stay a quarter empty on
+   average, so the cleaner always finds one worth cleaning */
+static uint32_t log_capacity(void) {
+    return (nsegs - 1 - RESERVE_SEGS) * SEG * 3 / 4;
+}
+
+static uint32_t dirty_count(void) {
+    uint32_t n = 0;
+    for (int i = 0; i < LOGFS_MAX_FILES; ++i) n += (uint32_t)(inodes[i].dirty != 0);
+    return n;
+}
+
+/* ============================================================================
+   INODES
+   ============================================================================ */
+
+static void inode_encode(int ino, uint8_t *sec) {
+    const logfs_inode_t *n = &inodes[ino];
+    kmemset(sec, 0, LOG_SECTOR);
+    kmemcpy(sec, ino_magic, sizeof(ino_magic));
+    put16(sec + 4, (uint32_t)ino);
+    sec[6] = (uint8_t)n->live;
+    if (!n->live) return;  // Tombstone
+    put32(sec + 8, n->size);
+    kmemcpy(sec + INO_NAME, n->name, VFS_NAME_MAX);
+    for (int i = 0; i < LOGFS_FILE_SECTORS; ++i) {
+        put16(sec + INO_BLOCKS + 2 * i, n->blocks[i] == ADDR_PROMISED ? 0 : n->blocks[i]);
+    }
+}
+
+static int inode_decode(int ino, const uint8_t *sec) {
+    if (!magic_ok(sec, ino_magic) || get16(sec + 4) != (uint32_t)ino) return -1;
+    logfs_inode_t *n = &inodes[ino];
+    n->live = sec[6] != 0;
+    n->size = get32(sec + 8);
+    kmemcpy(n->name, sec + INO_NAME, VFS_NAME_MAX);
+    n->name[VFS_NAME_MAX - 1] = 0;
+    for (int i = 0; i < LOGFS_FILE_SECTORS; ++i) n->blocks[i] = get16(sec + INO_BLOCKS + 2 * i);
+    if (n->size > LOGFS_FILE_SECTORS * LOG_SECTOR) return -1;
+    return 0;
+}
+
+/* Look up a live inode, reading it from the log on first use */
+static logfs_inode_t *inode_get(int ino) {
+    if (!nsegs || ino < 0 || ino >= LOGFS_MAX_FILES) return 0;
+    logfs_inode_t *n = &inodes[ino];
+    if (!n->loaded) {
+        uint8_t sec[LOG_SECTOR];
+        if (disk_read(imap[ino], 1, sec) != 0 || inode_decode(ino, sec) != 0) return 0;
+        n->loaded = 1;
+    }
+    return n->live ? n : 0;
+}
+
+/* Forget every inode; the ones in the inode map are read in again when used */
+static void inodes_reset(void) {
+    for (int i = 0; i < LOGFS_MAX_FILES; ++i) {
+        inodes[i].live = imap[i] != 0;
+        inodes[i].loaded = !inodes[i].live;
+        inodes[i].dirty = 0;
+        inodes[i].name[0] = 0;
+        inodes[i].size = 0;
+    }
+}
+
+/* ============================================================================
+   LOG WRITING
+   ============================================================================ */
+// Sectors are staged in part_buf at the address they will have on disk, so
+// readers find them there until the partial segment is written. Writing it
+// appends every dirty inode, so each partial segment carries the inodes that
+// point at its data.
+
+static int checkpoint(void);
+
+/* Move the head to the reserved next segment. Returns 0, or -1 if there is no clean segment */
+static int head_advance(void) {
+    int late = next_seg == NO_SEG;
+    if (late) next_seg = pick_clean();
+    if (next_seg == NO_SEG) return -1;
+
+    seg_pending[head_seg] = 1;  // Holds log written since the checkpoint until the next one
+    head_seg = next_seg;
+    head_off = 0;
+    next_seg = pick_clean();
+
+    // No summary names a segment picked this late, so only a checkpoint leads a mount to it
+    return late ? checkpoint() : 0;
+}
+
+/* Append the dirty inodes to the staged sectors and write it all as one partial segment,
+   moving the head on once the segment is (nearly) full. Returns 0, or -1 on failure */
+static int part_flush(void) {
+    if (part_count == 0 && dirty_count() == 0) return 0;
+
+    for (int ino = 0; ino < LOGFS_MAX_FILES; ++ino) {
+        logfs_inode_t *n = &inodes[ino];
+        if (!n->dirty) continue;
+        inode_encode(ino, part_buf + (1 + part_count) * LOG_SECTOR);
+        put16(part_buf + SUM_ENTRIES + part_count * 4, (uint32_t)ino);
+        put16(part_buf + SUM_ENTRIES + part_count * 4 + 2, ENTRY_INODE);
+        part_count++;
+        if (n->live) {
+            sector_dead(imap[ino]);
+            imap[ino] = (uint16_t)(part_base() + part_count);
+            seg_live[head_seg]++;
+        }
+        n->dirty = 0;
+    }
+
+    uint8_t *sum = part_buf;
+    kmemcpy(sum, sum_magic, sizeof(sum_magic));
+    put32(sum + 4, vol_id);
+    put32(sum + 8, log_seq);
+    put16(sum + 12, part_count);
+    put16(sum + 14, next_seg);
+    put32(sum + SUM_CRC, 0);
+    kmemset(sum + SUM_ENTRIES + part_count * 4, 0, LOG_SECTOR - SUM_ENTRIES - part_count * 4);
+    put32(sum + SUM_CRC, crc32c(0, part_buf, (1 + part_count) * LOG_SECTOR));
+
+    int r = disk_write(part_base(), 1 + part_count, part_buf);
+    log_seq++;
+    head_off = (uint16_t)(head_off + 1 + part_count);
+    part_count = 0;
+    partials_since_cp++;
+
+    // Not even a summary, one sector and its inode fit any more
+    if (SEG - head_off < 3 && head_advance() != 0) r = -1;
+    return r;
+}
+
+/* Make room in the partial segment for 'sectors' more sectors of inode ino and the inode
+   itself. Returns 0, or -1 if the log has no clean segment to continue in */
+static int part_reserve(int ino, uint32_t sectors) {
+    uint32_t need = sectors + (inodes[ino].dirty ? 0 : 1);
+    if (1 + part_count + dirty_count() + need <= SEG - head_off) return 0;
+    if (part_flush() != 0) return -1;
+    if (1 + dirty_count() + need <= SEG - head_off) return 0;
+    if (head_advance() != 0) return -1;
+    return 1 + dirty_count() + need <= SEG - head_off ? 0 : -1;
+}
+
+/* Mark an inode to be written with the next partial segment */
+static int inode_touch(int ino) {
+    if (inodes[ino].dirty) return 0;
+    if (part_reserve(ino, 0) != 0) return -1;
+    inodes[ino].dirty = 1;
+    return 0;
+}
+
+/* Store file sector idx of inode ino: overwritten in place if it is still staged, otherwise
+   staged at the head of the log. Returns 0, or -1 if the log is full */
+static int file_set_sector(int ino, uint32_t idx, const uint8_t *data) {
+    logfs_inode_t *n = &inodes[ino];
+    uint16_t old = n->blocks[idx];
+    if (old && addr_staged(old)) {
+        kmemcpy(part_buf + (old - part_base()) * LOG_SECTOR, data, LOG_SECTOR);
+        return 0;
+    }
+
+    if (part_reserve(ino, 1) != 0) return -1;
+    kmemcpy(part_buf + (1 + part_count) * LOG_SECTOR, data, LOG_SECTOR);
+    put16(part_buf + SUM_ENTRIES + part_count * 4, (uint32_t)ino);
+    put16(part_buf + SUM_ENTRIES + part_count * 4 + 2, idx);
+    part_count++;
+    seg_live[head_seg]++;
+    n->dirty = 1;
+
+    sector_dead(old);
+    n->blocks[idx] = (uint16_t)(part_base() + part_count);
+    return 0;
+}
+
+/* Read count file sectors of n from file sector idx on, one command per run of sectors
+   that are consecutive on disk */
+static int file_read_sectors(const logfs_inode_t *n, uint32_t idx, uint32_t count, uint8_t *buf) {
+    for (uint32_t i = 0; i < count;) {
+        uint32_t a = n->blocks[idx + i];
+        uint8_t *dst = buf + (size_t)i * LOG_SECTOR;
+        if (!a || a == ADDR_PROMISED) {
+            kmemset(dst, 0, LOG_SECTOR);  // Hole (a promised sector is still in its dirty page)
+            i++;
+        } else if (addr_staged(a)) {
+            kmemcpy(dst, part_buf + (a - part_base()) * LOG_SECTOR, LOG_SECTOR);
+            i++;
+        } else {
+            uint32_t run = 1;
+            while (i + run < count && n->blocks[idx + i + run] == a + run && !addr_staged(a + run)) run++;
+            if (disk_read(a, run, dst) != 0) return -1;
+            i += run;
+        }
+    }
+    return 0;
+}
+
+/* ============================================================================
+   CHECKPOINTS AND RECOVERY
+   ============================================================================ */
+
+/* Write out the partial segment, then store the inode map and segment usage in the older
+   checkpoint slot. Segments freed since the last checkpoint become clean */
+static int checkpoint(void) {
+    if (part_flush() != 0) return -1;
+
+    // From this checkpoint on, nothing needs the dead segments any more
+    for (uint32_t s = 0; s < nsegs; ++s) seg_pending[s] = 0;
+    if (next_seg == NO_SEG) next_seg = pick_clean();
+
+    uint8_t cp[LOG_SECTOR];
+    kmemset(cp, 0, LOG_SECTOR);
+    kmemcpy(cp, cp_magic, sizeof(cp_magic));
+    put32(cp + 4, vol_id);
+    put32(cp + 8, cp_count);
+    put32(cp + 12, log_seq);
+    put16(cp + 16, nsegs);
+    put16(cp + 18, head_seg);
+    put16(cp + 20, head_off);
+    put16(cp + 22, next_seg);
+    for (int i = 0; i < LOGFS_MAX_FILES; ++i) put16(cp + CP_IMAP + 2 * i, imap[i]);
+    for (uint32_t s = 0; s < nsegs; ++s) put16(cp + CP_LIVE + 2 * s, seg_live[s]);
+    put32(cp + CP_CRC, crc32c(0, cp, LOG_SECTOR));
+
+    disk_flush();  // Everything the checkpoint points at must be on disk first
+    int r = disk_write(cp_count & 1, 1, cp);
+    disk_flush();
+    cp_count++;
+    partials_since_cp = 0;
+    return r;
+}
+
+/* Read checkpoint slot into cp. Returns 0 if it holds a valid checkpoint for this region size */
+static int cp_load(uint32_t slot, uint8_t *cp) {
+    if (disk_read(slot, 1, cp) != 0 || !magic_ok(cp, cp_magic)) return -1;
+    uint32_t crc = get32(cp + CP_CRC);
+    put32(cp + CP_CRC, 0);
+    if (crc32c(0, cp, LOG_SECTOR) != crc || get16(cp + 16) != nsegs) return -1;
+    if (get16(cp + 18) == 0 || get16(cp + 18) >= nsegs || get16(cp + 20) >= SEG) return -1;
+    return 0;
+}
+
+/* Load the partial segment at (seg, off) into part_buf if it is the one with sequence
+   log_seq. Returns the number of sectors after its summary, or -1 */
+static int partial_load(uint32_t seg, uint32_t off) {
+    if (seg == 0 || seg >= nsegs || SEG - off < 2) return -1;
+    uint8_t *sum = part_buf;
+    if (disk_read(seg * SEG + off, 1, sum) != 0) return -1;
+    if (!magic_ok(sum, sum_magic) || get32(sum + 4) != vol_id || get32(sum + 8) != log_seq) return -1;
+
+    uint32_t count = get16(sum + 12);
+    if (count == 0 || count > SEG - off - 1) return -1;
+    if (disk_read(seg * SEG + off + 1, count, part_buf + LOG_SECTOR) != 0) return -1;
+
+    // A partial segment torn by a crash fails its checksum and ends the log
+    uint32_t crc = get32(sum + SUM_CRC);
+    put32(sum + SUM_CRC, 0);
+    return crc32c(0, part_buf, (1 + count) * LOG_SECTOR) == crc ? (int)count : -1;
+}
+
+/* Apply the partial segments written after the checkpoint to the inode map. Returns how
+   many there were */
+static uint32_t roll_forward(void) {
+    uint32_t applied = 0;
+    for (;;) {
+        int count = partial_load(head_seg, head_off);
+        if (count < 0) {
+            // The writer moves on to the reserved segment early when a partial segment does not fit
+            if (head_off == 0 || next_seg == NO_SEG || (count = partial_load(next_seg, 0)) < 0) break;
+            head_seg = next_seg;
+            head_off = 0;
+        }
+
+        for (int k = 0; k < count; ++k) {
+            uint32_t ino = get16(part_buf + SUM_ENTRIES + 4 * k);
+            if (get16(part_buf + SUM_ENTRIES + 4 * k + 2) != ENTRY_INODE || ino >= LOGFS_MAX_FILES) continue;
+            const uint8_t *sec = part_buf + (1 + k) * LOG_SECTOR;
+            imap[ino] = sec[6] ? (uint16_t)(part_base() + 1 + k) : 0;
+        }
+        next_seg = get16(part_buf + 14);
+        head_off = (uint16_t)(head_off + 1 + count);
+        log_seq++;
+        applied++;
+
+        if (SEG - head_off < 3) {
+            if (next_seg == NO_SEG || next_seg >= nsegs) break;
+            head_seg = next_seg;
+            head_off = 0;
+            next_seg = NO_SEG;  // Named by the next summary
+        }
+    }
+    return applied;
+}
+
+/* Count the live sectors of every segment from the inodes (after a replay) */
+static void usage_rebuild(void) {
+    for (uint32_t s = 0; s < nsegs; ++s) {
+        seg_live[s] = 0;
+        seg_pending[s] = 0;
+    }
+    for (int ino = 0; ino < LOGFS_MAX_FILES; ++ino) {
+        logfs_inode_t *n = inode_get(ino);
+        if (!n) {
+            imap[ino] = 0;  // Deleted, or unreadable
+            inodes[ino].live = 0;
+            inodes[ino].loaded = 1;
+            continue;
+        }
+        seg_live[seg_of(imap[ino])]++;
+        for (int i = 0; i < LOGFS_FILE_SECTORS; ++i) {
+            if (n->blocks[i]) seg_live[seg_of(n->blocks[i])]++;
+        }
+    }
+    if (next_seg != NO_SEG && (next_seg >= nsegs || seg_live[next_seg] || next_seg == head_seg)) next_seg = NO_SEG;
+    if (next_seg == NO_SEG) next_seg = pick_clean();
+}
+
+/* Check the region size and start using it */
+static int region_set(uint32_t first_sector, uint32_t sectors) {
+    nsegs = 0;
+    if (sectors / SEG < 4 || sectors / SEG > LOGFS_MAX_SEGS) return -1;
+    region_start = first_sector;
+    nsegs = sectors / SEG;
+    part_count = 0;
+    partials_since_cp = 0;
+    promised = 0;
+    pcache_invalidate(&logfs_pcache_ops, 0, -1, 0);
+    return 0;
+}
+
+int logfs_format(uint32_t first_sector, uint32_t sectors) {
+    if (region_set(first_sector, sectors) != 0) return -1;
+
+    // The whole range must exist on the disk
+    uint8_t sec[LOG_SECTOR];
+    if (disk_read(nsegs * SEG - 1, 1, sec) != 0) {
+        nsegs = 0;
+        return -1;
+    }
+
+    // A new volume id keeps partial segments of an earlier filesystem here from being replayed
+    uint32_t old_id = 0;
+    for (uint32_t slot = 0; slot < 2; ++slot) {
+        if (disk_read(slot, 1, sec) == 0 && magic_ok(sec, cp_magic) && get32(sec + 4) > old_id) old_id = get32(sec + 4);
+    }
+    vol_id = old_id + 1;
+
+    for (int i = 0; i < LOGFS_MAX_FILES; ++i) imap[i] = 0;
+    for (uint32_t s = 0; s < LOGFS_MAX_SEGS; ++s) {
+        seg_live[s] = 0;
+        seg_pending[s] = 0;
+    }
+    inodes_reset();
+    log_seq = 1;
+    cp_count = 0;
+    head_seg = 1;
+    head_off = 0;
+    next_seg = 2;
+
+    // Both slots, so an older checkpoint cannot win at the next mount
+    if (checkpoint() != 0 || checkpoint() != 0) {
+        nsegs = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int logfs_mount(uint32_t first_sector, uint32_t sectors) {
+    if (region_set(first_sector, sectors) != 0) return -1;
+
+    uint8_t a[LOG_SECTOR], b[LOG_SECTOR];
+    int a_ok = cp_load(0, a) == 0, b_ok = cp_load(1, b) == 0;
+    if (!a_ok && !b_ok) {
+        nsegs = 0;
+        return -1;
+    }
+    const uint8_t *cp = (a_ok && (!b_ok || get32(a + 8) > get32(b + 8))) ? a : b;
+
+    vol_id = get32(cp + 4);
+    cp_count = get32(cp + 8) + 1;
+    log_seq = get32(cp + 12);
+    head_seg = get16(cp + 18);
+    head_off = get16(cp + 20);
+    next_seg = get16(cp + 22);
+    for (int i = 0; i < LOGFS_MAX_FILES; ++i) imap[i] = get16(cp + CP_IMAP + 2 * i);
+    for (uint32_t s = 0; s < LOGFS_MAX_SEGS; ++s) {
+        seg_live[s] = s < nsegs ? get16(cp + CP_LIVE + 2 * s) : 0;
+        seg_pending[s] = 0;
+    }
+
+    // Anything logged after the checkpoint changes the inode map; recount usage and checkpoint it
+    if (roll_forward() > 0) {
+        inodes_reset();
+        usage_rebuild();
+        if (checkpoint() != 0) return -1;
+    }
+    inodes_reset();
+    return 0;
+}
+
+/* ============================================================================
+   CLEANER
+   ============================================================================ */
+// A segment is cleaned by reading it whole and restaging every sector that a
+// file still points at; the inodes that pointed into it are rewritten too. Once
+// the new copies are on disk and checkpointed, the segment is clean.
+
+/* Segment with the fewest live sectors (at most max_live), or NO_SEG */
+static uint16_t clean_victim(uint32_t max_live) {
+    uint16_t best = NO_SEG;
+    for (uint32_t s = 1; s < nsegs; ++s) {
+        if (s == head_seg || s == next_seg || seg_live[s] == 0 || seg_live[s] > max_live) continue;
+        if (best == NO_SEG || seg_live[s] < seg_live[best]) best = (uint16_t)s;
+    }
+    return best;
+}
+
+static int clean_segment(uint32_t s) {
+    if (disk_read(s * SEG, SEG, clean_buf) != 0) return -1;
+    for (int ino = 0; ino < LOGFS_MAX_FILES; ++ino) {
+        logfs_inode_t *n = inode_get(ino);
+        if (!n) continue;
+        for (uint32_t i = 0; i < LOGFS_FILE_SECTORS; ++i) {
+            uint32_t a = n->blocks[i];
+            if (a && a != ADDR_PROMISED && seg_of(a) == s && file_set_sector(ino, i, clean_buf + (a % SEG) * LOG_SECTOR) != 0) return -1;
+        }
+        if (seg_of(imap[ino]) == s && inode_touch(ino) != 0) return -1;
+    }
+    return 0;
+}
+
+/* Make sure the log can take 'sectors' more sectors (with their summaries and inodes) and
+   still leave the cleaner a segment to work in: checkpoint to release freed segments, then
+   clean the emptiest ones. Returns 0, or -1 if the disk is full */
+static int log_make_room(uint32_t sectors) {
+    uint32_t need = sectors + 2 * (sectors / (SEG - 3) + 1) + dirty_count() + SEG;
+    for (uint32_t tries = 0; tries <= nsegs; ++tries) {
+        uint32_t avail = (SEG - head_off - 1 - part_count) + (next_seg != NO_SEG ? SEG : 0) + clean_count() * SEG;
+        if (avail >= need) return 0;
+        if (!freeable_count()) {
+            uint16_t s = clean_victim(SEG - 3);
+            if (s == NO_SEG || clean_segment(s) != 0) return -1;
+        }
+        if (checkpoint() != 0) return -1;
+    }
+    return -1;
+}
+
+int logfs_clean_pending(void) {
+    if (!nsegs || clean_count() >= CLEAN_TARGET) return 0;
+    return freeable_count() > 0 || clean_victim(CLEAN_MAX_LIVE) != NO_SEG;
+}
+
+void logfs_clean_step(void) {
+    if (!freeable_count()) {
+        uint16_t s = clean_victim(CLEAN_MAX_LIVE);
+        if (s == NO_SEG || clean_segment(s) != 0) return;
+    }
+    checkpoint();
+}
+
+/* ============================================================================
+   FILE PAGES
+   ============================================================================ */
+
+static int logfs_page_fill(void *fs, int ino, uint32_t index, uint8_t *page) {
+    (void)fs;
+    logfs_inode_t *n = inode_get(ino);
+    if (!n) return -1;
+    kmemset(page, 0, PCACHE_PAGE_SIZE);
+
+    uint32_t start = index * PCACHE_PAGE_SIZE;
+    if (start >= n->size) return 0;
+    uint32_t bytes = n->size - start < PCACHE_PAGE_SIZE ? n->size - start : PCACHE_PAGE_SIZE;
+    if (file_read_sectors(n, start / LOG_SECTOR, (bytes + LOG_SECTOR - 1) / LOG_SECTOR, page) != 0) return -1;
+    kmemset(page + bytes, 0, PCACHE_PAGE_SIZE - bytes);  // Past end of file
+    return 0;
+}
+
+/* Stage the sectors of a page that lie inside the file and were written; they reach the
+   disk with the next partial segment */
+static int logfs_page_writeback(void *fs, int ino, uint32_t index, const uint8_t *page) {
+    (void)fs;
+    logfs_inode_t *n = inode_get(ino);
+    if (!n) return 0;  // A deleted file has nothing left to write
+
+    uint32_t start = index * PCACHE_PAGE_SIZE;
+    if (start >= n->size) return 0;
+    uint32_t bytes = n->size - start < PCACHE_PAGE_SIZE ? n->size - start : PCACHE_PAGE_SIZE;
+    uint32_t first = start / LOG_SECTOR, count = (bytes + LOG_SECTOR - 1) / LOG_SECTOR;
+    if (log_make_room(count + 1) != 0) return -1;
+    for (uint32_t i = 0; i < count; ++i) {
+        // Sectors nobody wrote stay holes
+        if (n->blocks[first + i] && file_set_sector(ino, first + i, page + i * LOG_SECTOR) != 0) return -1;
+    }
+    return 0;
+}
+
+static const pcache_ops_t logfs_pcache_ops = {
+    .fill = logfs_page_fill,
+    .writeback = logfs_page_writeback
+};
+
+size_t logfs_writeback_pending(void) {
+    if (!nsegs) return 0;
+    return pcache_dirty_count(&logfs_pcache_ops, 0) + part_count + dirty_count() +
+           (size_t)(partials_since_cp >= CP_INTERVAL);
+}
+
+void logfs_writeback_step(size_t max_pages) {
+    // Pages are only staged; the log is written once they are all in, as one partial segment
+    pcache_flush(&logfs_pcache_ops, 0, -1, max_pages);
+    if (pcache_dirty_count(&logfs_pcache_ops, 0) != 0) return;
+    part_flush();
+    if (partials_since_cp >= CP_INTERVAL) checkpoint();
+}
+
+void logfs_sync(void) {
+    if (!nsegs) return;
+    pcache_flush(&logfs_pcache_ops, 0, -1, SIZE_MAX);
+    if (part_count || dirty_count() || partials_since_cp || freeable_count()) checkpoint();
+}
+
+/* ============================================================================
+   VFS OPERATIONS
+   ============================================================================ */
+
+static int logfs_streq(const char *a, const char *b) {
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
+/* Sectors a file has on disk, staged or promised */
+static uint32_t file_sectors(const logfs_inode_t *n) {
+    uint32_t c = 0;
+    for (int i = 0; i < LOGFS_FILE_SECTORS; ++i) c += (uint32_t)(n->blocks[i] != 0);
+    return c;
+}
+
+/* Drop file sectors from index 'from' on */
+static void file_release(logfs_inode_t *n, uint32_t from) {
+    for (uint32_t i = from; i < LOGFS_FILE_SECTORS; ++i) {
+        sector_dead(n->blocks[i]);
+        n->blocks[i] = 0;
+    }
+}
+
+static int logfs_lookup(void *fs, const char *name) {
+    (void)fs;
+    for (int i = 0; i < LOGFS_MAX_FILES; ++i) {
+        logfs_inode_t *n = inode_get(i);
+        if (n && logfs_streq(n->name, name)) return i;
+    }
+    return -1;
+}
+
+static int logfs_create(void *fs, const char *name) {
+    int ino = logfs_lookup(fs, name);
+    if (ino >= 0) return ino;
+    if (!nsegs || !name[0]) return -1;
+
+    for (int i = 0; i < LOGFS_MAX_FILES; ++i) {
+        logfs_inode_t *n = &inodes[i];
+        if (n->live) continue;  // Includes inodes not read in yet
+        if (inode_touch(i) != 0) return -1;
+        size_t k = 0;
+        for (; name[k] && k < VFS_NAME_MAX - 1; ++k) n->name[k] = name[k];
+        n->name[k] = 0;
+        n->live = 1;
+        n->loaded = 1;
+        n->size = 0;
+        for (int b = 0; b < LOGFS_FILE_SECTORS; ++b) n->blocks[b] = 0;
+        return i;
+    }
+    return -1;  // No free inodes
+}
+
+static int logfs_size(void *fs, int ino) {
+    (void)fs;
+    logfs_inode_t *n = inode_get(ino);
+    return n ? (int)n->size : -1;
+}
+
+static const uint8_t *logfs_map(void *fs, int ino, uint32_t pos, size_t *len) {
+    (void)fs;
+    logfs_inode_t *n = inode_get(ino);
+    if (!n || pos >= n->size) return 0;
+
+    const uint8_t *page = pcache_get(&logfs_pcache_ops, 0, ino, pos / PCACHE_PAGE_SIZE, 0);
+    if (!page) return 0;
+
+    uint32_t off = pos % PCACHE_PAGE_SIZE;
+    uint32_t size = inodes[ino].size;
+    *len = PCACHE_PAGE_SIZE - off;
+    if (*len > size - pos) *len = size - pos;
+    return page + off;
+}
+
+static int logfs_read(void *fs, int ino, uint32_t pos, uint8_t *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        size_t avail;
+        const uint8_t *src = logfs_map(fs, ino, pos + (uint32_t)got, &avail);
+        if (!src) break;  // End of file (or not a file)
+        if (avail > len - got) avail = len - got;
+        kmemcpy(buf + got, src, avail);
+        got += avail;
+    }
+    if (got == 0 && !inode_get(ino)) return -1;
+    return (int)got;
+}
+
+static int logfs_write(void *fs, int ino, uint32_t pos, const uint8_t *data, size_t len) {
+    (void)fs;
+    logfs_inode_t *n = inode_get(ino);
+    if (!n) return -1;
+    if (len == 0) return 0;
+    if ((uint64_t)pos + len > (uint64_t)LOGFS_FILE_SECTORS * LOG_SECTOR) return -1;  // Too large
+    uint32_t end = pos + (uint32_t)len;
+
+    // New sectors must fit in the capacity; overwritten ones only leave dead space for the cleaner
+    uint32_t first = pos / LOG_SECTOR, last = (end + LOG_SECTOR - 1) / LOG_SECTOR, add = 0;
+    for (uint32_t s = first; s < last; ++s) add += (uint32_t)(n->blocks[s] == 0);
+    if (live_total() + promised + add > log_capacity()) return -1;
+
+    /* Bytes past the old end of file in its last sector (left by a truncate) must read back
+       as zeros: bring the page in while the old size still applies and mark it dirty */
+    if (end > n->size && n->size % LOG_SECTOR) {
+        uint8_t *page = pcache_get(&logfs_pcache_ops, 0, ino, n->size / PCACHE_PAGE_SIZE, PCACHE_DIRTY);
+        if (!page) return -1;
+        kmemset(page + n->size % PCACHE_PAGE_SIZE, 0, PCACHE_PAGE_SIZE - n->size % PCACHE_PAGE_SIZE);
+    }
+
+    uint32_t old_size = n->size;
+    if (end > n->size) n->size = end;
+    if (inode_touch(ino) != 0) {
+        n->size = old_size;
+        return -1;
+    }
+    for (uint32_t s = first; s < last; ++s) {
+        if (!n->blocks[s]) {
+            n->blocks[s] = ADDR_PROMISED;  // Gets an address when its page is written back
+            promised++;
+        }
+    }
+
+    /* Copy the data into cached pages; they are staged into the log on writeback */
+    size_t done = 0;
+    while (done < len) {
+        uint32_t at = pos + (uint32_t)done;
+        uint32_t skip = at % PCACHE_PAGE_SIZE;
+        size_t copy = PCACHE_PAGE_SIZE - skip;
+        if (copy > len - done) copy = len - done;
+
+        int flags = PCACHE_DIRTY | (copy == PCACHE_PAGE_SIZE ? PCACHE_NOFILL : 0);
+        uint8_t *page = pcache_get(&logfs_pcache_ops, 0, ino, at / PCACHE_PAGE_SIZE, flags);
+        if (!page) break;
+        kmemcpy(page + skip, data + done, copy);
+        done += copy;
+    }
+    return done ? (int)done : -1;
+}
+
+static int logfs_truncate(void *fs, int ino, uint32_t len) {
+    (void)fs;
+    logfs_inode_t *n = inode_get(ino);
+    if (!n || len > n->size) return -1;  // Only shrinking is supported
+    if (len == n->size) return 0;
+    if (inode_touch(ino) != 0) return -1;
+
+    pcache_truncate(&logfs_pcache_ops, 0, ino, len);
+    file_release(n, (len + LOG_SECTOR - 1) / LOG_SECTOR);
+    n->size = len;
+    return 0;
+}
+
+/* Whole-file save: the data is staged straight from the caller's buffer and written with
+   the inode as one partial segment (one per segment it spans) */
+static int logfs_replace(void *fs, const char *name, const uint8_t *data, size_t len) {
+    if (len > (size_t)LOGFS_FILE_SECTORS * LOG_SECTOR) return -1;  // Too large
+    int ino = logfs_create(fs, name);
+    if (ino < 0) return -1;
+    logfs_inode_t *n = &inodes[ino];
+
+    uint32_t count = (uint32_t)((len + LOG_SECTOR - 1) / LOG_SECTOR);
+    if (live_total() + promised - file_sectors(n) + count > log_capacity()) return -1;
+    if (log_make_room(count + 1) != 0) return -1;
+
+    pcache_invalidate(&logfs_pcache_ops, 0, ino, 0);  // Cached pages hold the old contents
+    file_release(n, 0);
+    n->size = (uint32_t)len;
+    if (inode_touch(ino) != 0) return -1;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *src = data + (size_t)i * LOG_SECTOR;
+        uint8_t last[LOG_SECTOR];
+        if (len - (size_t)i * LOG_SECTOR < LOG_SECTOR) {
+            kmemset(last, 0, LOG_SECTOR);  // Zero-pad the last sector
+            kmemcpy(last, src, len - (size_t)i * LOG_SECTOR);
+            src = last;
+        }
+        if (file_set_sector(ino, i, src) != 0) return -1;
+    }
+    return part_flush();
+}
+
+static int logfs_unlink(void *fs, const char *name) {
+    int ino = logfs_lookup(fs, name);
+    if (ino < 0 || inode_touch(ino) != 0) return -1;  // The tombstone goes out with the next partial segment
+
+    logfs_inode_t *n = &inodes[ino];
+    pcache_invalidate(&logfs_pcache_ops, 0, ino, 0);
+    file_release(n, 0);
+    sector_dead(imap[ino]);
+    imap[ino] = 0;
+    n->live = 0;
+    n->name[0] = 0;
+    n->size = 0;
+    return 0;
+}
+
+static int logfs_rename(void *fs, const char *old_name, const char *new_name) {
+    if (logfs_lookup(fs, new_name) >= 0) return -1;  // Target name already in use
+    int ino = logfs_lookup(fs, old_name);
+    if (ino < 0 || !new_name[0] || inode_touch(ino) != 0) return -1;
+
+    size_t k = 0;
+    for (; new_name[k] && k < VFS_NAME_MAX - 1; ++k) inodes[ino].name[k] = new_name[k];
+    inodes[ino].name[k] = 0;
+    return 0;
+}
+
+static int logfs_readdir(void *fs, uint32_t *cursor, char *name, uint32_t *size) {
+    (void)fs;
+    while (*cursor < LOGFS_MAX_FILES) {
+        logfs_inode_t *n = inode_get((int)(*cursor)++);
+        if (!n) continue;
+        for (size_t k = 0; k < VFS_NAME_MAX; ++k) name[k] = n->name[k];
+        *size = n->size;
+        return 0;
+    }
+    return -1;
+}
+
+static void logfs_vfs_sync(void *fs) { (void)fs; logfs_sync(); }
+
+const vfs_ops_t logfs_vfs_ops = {
+    .lookup = logfs_lookup,
+    .create = logfs_create,
+    .size = logfs_size,
+    .read = logfs_read,
+    .write = logfs_write,
+    .truncate = logfs_truncate,
+    .replace = logfs_replace,
+    .unlink = logfs_unlink,
+    .rename = logfs_rename,
+    .readdir = logfs_readdir,
+    .sync = logfs_vfs_sync,
+    .map = logfs_map
+};
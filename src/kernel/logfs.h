@@ -0,0 +1,51 @@
+/* logfs.h - Log-structured filesystem for append-friendly sequential writes */
+#ifndef LOGFS_H
+#define LOGFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vfs.h"
+
+#define LOGFS_SEG_SECTORS 32     // Sectors per segment (16KB), the unit the cleaner reclaims
+#define LOGFS_MAX_SEGS 64        // Largest region: 64 segments (1MB)
+#define LOGFS_MAX_FILES 64       // Files at once
+#define LOGFS_FILE_SECTORS 234   // Largest file: 234 sectors (117KB), what one inode sector can address
+
+/* Sector I/O callbacks the filesystem needs - must be provided by kernel (or a host harness) */
+typedef struct {
+    int (*disk_read_sectors)(uint32_t lba, uint32_t count, void *buf);         // Return 0 on success
+    int (*disk_write_sectors)(uint32_t lba, uint32_t count, const void *buf);  // Return 0 on success
+    int (*disk_flush)(void);  // Optional (may be NULL): make every completed write durable
+} logfs_callbacks_t;
+
+/* Set the callbacks that the filesystem will use */
+void logfs_set_callbacks(const logfs_callbacks_t *callbacks);
+
+/* Create an empty filesystem in the given range of disk sectors (at least 4 segments).
+   Returns 0, or -1 if the range does not fit the limits or the disk is too small */
+int logfs_format(uint32_t first_sector, uint32_t sectors);
+
+/* Use the filesystem already in the given range: loads the newest checkpoint and replays
+   anything logged after it. Returns 0, or -1 if there is no valid checkpoint */
+int logfs_mount(uint32_t first_sector, uint32_t sectors);
+
+/* Amount of buffered work: dirty file pages, sectors staged for the log and a checkpoint that is due */
+size_t logfs_writeback_pending(void);
+
+/* Stage up to max_pages dirty pages; once none are left, write the staged log and any
+   due checkpoint (called from the idle loop) */
+void logfs_writeback_step(size_t max_pages);
+
+/* Check if the cleaner should run: few clean segments left and one worth cleaning */
+int logfs_clean_pending(void);
+
+/* Clean one segment: copy its live sectors to the head of the log (called from the idle loop) */
+void logfs_clean_step(void);
+
+/* Write everything out and store a checkpoint, then flush the disk cache */
+void logfs_sync(void);
+
+/* logfs as a VFS backend (single instance, the fs pointer is unused) */
+extern const vfs_ops_t logfs_vfs_ops;
+
+#endif
@@ -0,0 +1,153 @@
+/* lz4.c - LZ4 block compression
+ *
+ * Greedy single-pass compressor with a 4096-entry hash table of earlier
+ * positions, producing standard LZ4 blocks: each sequence is a token (literal
+ * count, match length), the literals, a 16-bit back offset and the match.
+ * The block ends with at least LASTLITERALS literals, as the format requires.
+ * The decompressor checks every length and offset against both buffers, so a
+ * corrupted block fails instead of writing out of bounds. Away from the end of
+ * either buffer it copies in 8-byte steps and may write a few bytes past the
+ * current sequence, which the next sequence overwrites.
+ */
+#include "lz4.h"
+#include "kstring.h"
+
+#define MINMATCH 4        // Shortest match the format can express
+#define LASTLITERALS 5    // The last 5 bytes are always literals
+#define MFLIMIT 12        // No match may start in the last 12 bytes
+#define HASH_BITS 12
+
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32;
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+
+static uint16_t hash_table[1 << HASH_BITS];  // Position + 1 of the last 4 bytes with each hash (0: none)
+
+static uint32_t read32(const uint8_t *p) {
+    return *(const unaligned_u32 *)p;
+}
+
+/* Copy n bytes in 8-byte steps, possibly writing up to 7 bytes past dst + n. The source
+   must be at least 8 bytes behind dst or not overlap it at all */
+static void copy8(uint8_t *dst, const uint8_t *src, size_t n) {
+    for (size_t i = 0; i < n; i += 8) *(unaligned_u64 *)(dst + i) = *(const unaligned_u64 *)(src + i);
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Write a length of 15 or more as the extra bytes that follow the token */
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    for (len -= 15; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* Append one sequence (mlen = 0: final literals only). Returns NULL if dst is too small */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t litlen,
+                             size_t offset, size_t mlen) {
+    size_t m = mlen ? mlen - MINMATCH : 0;
+    size_t need = 1 + litlen + (litlen >= 15 ? (litlen - 15) / 255 + 1 : 0) +
+                  (mlen ? 2 + (m >= 15 ? (m - 15) / 255 + 1 : 0) : 0);
+    if ((size_t)(oend - op) < need) return 0;
+
+    uint8_t *token = op++;
+    *token = (uint8_t)((litlen >= 15 ? 15 : litlen) << 4);
+    if (litlen >= 15) op = put_length(op, litlen);
+    for (size_t i = 0; i < litlen; ++i) *op++ = lit[i];
+    if (!mlen) return op;
+
+    *op++ = (uint8_t)(offset & 0xFF);
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)(m >= 15 ? 15 : m);
+    if (m >= 15) op = put_length(op, m);
+    return op;
+}
+
+size_t lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    if (n > LZ4_MAX_INPUT) return 0;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + cap;
+    size_t anchor = 0;  // First byte not yet emitted
+
+    if (n > MFLIMIT) {
+        for (size_t i = 0; i < (1u << HASH_BITS); ++i) hash_table[i] = 0;
+
+        size_t ip = 0;
+        while (ip < n - MFLIMIT) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash4(seq);
+            size_t ref = hash_table[h];
+            hash_table[h] = (uint16_t)(ip + 1);
+            if (ref == 0 || read32(src + ref - 1) != seq) {
+                ip++;
+                continue;
+            }
+            ref--;
+
+            // Grow the match backwards over pending literals, then forwards
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) { ip--; ref--; }
+            size_t len = MINMATCH;
+            while (ip + len < n - LASTLITERALS && src[ip + len] == src[ref + len]) len++;
+
+            op = put_sequence(op, oend, src + anchor, ip - anchor, ip - ref, len);
+            if (!op) return 0;
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    op = put_sequence(op, oend, src + anchor, n - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+/* Read the extra bytes of a length that was 15 in the token. Returns -1 past the end of input */
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    const uint8_t *ip = src, *iend = src + n;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t litlen = token >> 4;
+        if (litlen == 15 && get_length(&ip, iend, &litlen) != 0) return -1;
+        if ((size_t)(iend - ip) < litlen || (size_t)(oend - op) < litlen) return -1;
+        if ((size_t)(iend - ip) >= litlen + 8 && (size_t)(oend - op) >= litlen + 8) copy8(op, ip, litlen);
+        else kmemcpy(op, ip, litlen);  // Near the end of either buffer: no overrun allowed
+        op += litlen;
+        ip += litlen;
+        if (ip == iend) break;  // Final literals
+
+        if (iend - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+
+        size_t mlen = token & 15;
+        if (mlen == 15 && get_length(&ip, iend, &mlen) != 0) return -1;
+        mlen += MINMATCH;
+        if ((size_t)(oend - op) < mlen) return -1;
+
+        // A match closer than 8 bytes overlaps the bytes it is producing, so it has to be
+        // copied one byte at a time
+        const uint8_t *match = op - offset;
+        if (offset >= 8 && (size_t)(oend - op) >= mlen + 8) {
+            copy8(op, match, mlen);
+            op += mlen;
+        } else {
+            for (size_t i = 0; i < mlen; ++i) *op++ = *match++;
+        }
+    }
+    return (int)(op - dst);
+}
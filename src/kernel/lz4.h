@@ -0,0 +1,19 @@
+/* lz4.h - LZ4 block compression */
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LZ4_MAX_INPUT 65535                         // Largest block lz4_compress accepts
+#define LZ4_BOUND(n) ((n) + (n) / 255 + 16)         // Worst-case compressed size of n bytes
+
+/* Compress n bytes of src into dst (at most cap bytes) in the LZ4 block format.
+   Returns the compressed size, or 0 if it does not fit in cap or n is too large */
+size_t lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+
+/* Decompress an n-byte LZ4 block into dst (at most cap bytes). Returns the number of
+   bytes produced, or -1 if the block is malformed or would overflow dst */
+int lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+
+#endif
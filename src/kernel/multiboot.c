@@ -0,0 +1,150 @@
+/* multiboot.c - Multiboot2 boot information parsing
+ *
+ * GRUB passes the physical address of the boot information in EBX, which
+ * main.asm hands to kernel_main. It is a list of 8-byte aligned tags.
+ */
+#include "multiboot.h"
+
+#define MB2_TAG_END 0
+#define MB2_TAG_CMDLINE 1
+#define MB2_TAG_MODULE 3
+#define MB2_TAG_MMAP 6
+#define MB2_TAG_ACPI_OLD 14   // RSDP of ACPI 1.0 (RSDT)
+#define MB2_TAG_ACPI_NEW 15   // RSDP of ACPI 2.0 and later (XSDT)
+#define MB2_IDENTITY_MAPPED 0x40000000ull  // main.asm identity maps the first 1GB
+
+typedef struct {
+    uint32_t total_size;   // Size of the whole structure, including this header
+    uint32_t reserved;
+} mb2_info_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;         // Size of this tag, without padding to the next one
+} mb2_tag_t;
+
+typedef struct {
+    uint32_t type;         // MB2_TAG_MODULE
+    uint32_t size;
+    uint32_t mod_start;    // Physical address of the first byte
+    uint32_t mod_end;      // Physical address just past the last byte
+    char cmdline[];        // Text after the path on the module2 line
+} mb2_module_tag_t;
+
+typedef struct {
+    uint32_t type;         // MB2_TAG_CMDLINE
+    uint32_t size;
+    char string[];         // Text after the kernel path on the multiboot2 line
+} mb2_cmdline_tag_t;
+
+typedef struct {
+    uint32_t type;         // MB2_TAG_MMAP
+    uint32_t size;
+    uint32_t entry_size;   // Bytes per entry, a multiple of 8 and at least sizeof(mb2_mmap_entry_t)
+    uint32_t entry_version;
+} mb2_mmap_tag_t;
+
+typedef struct {
+    uint64_t base;
+    uint64_t len;
+    uint32_t type;         // MULTIBOOT_MEMORY_*
+    uint32_t reserved;
+} mb2_mmap_entry_t;
+
+static int mb_streq(const char *a, const char *b) {
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
+/* First tag of the given type, or NULL */
+static const mb2_tag_t *find_tag(uint64_t info, uint32_t type, const mb2_tag_t *after) {
+    if (info == 0 || info + sizeof(mb2_info_t) > MB2_IDENTITY_MAPPED) return 0;
+
+    const mb2_info_t *mbi = (const mb2_info_t *)(uintptr_t)info;
+    if (info + mbi->total_size > MB2_IDENTITY_MAPPED) return 0;
+
+    const uint8_t *p = (const uint8_t *)mbi + sizeof(mb2_info_t);
+    const uint8_t *end = (const uint8_t *)mbi + mbi->total_size;
+    if (after) p = (const uint8_t *)after + ((after->size + 7) & ~7u);
+    while (p + sizeof(mb2_tag_t) <= end) {
+        const mb2_tag_t *tag = (const mb2_tag_t *)p;
+        if (tag->type == MB2_TAG_END || tag->size < sizeof(mb2_tag_t)) break;
+        if (tag->type == type) return tag;
+        p += (tag->size + 7) & ~7u;  // Tags start on 8-byte boundaries
+    }
+    return 0;
+}
+
+int multiboot_find_module(uint64_t info, const char *name, const uint8_t **start, size_t *len) {
+    for (const mb2_tag_t *tag = find_tag(info, MB2_TAG_MODULE, 0); tag; tag = find_tag(info, MB2_TAG_MODULE, tag)) {
+        const mb2_module_tag_t *mod = (const mb2_module_tag_t *)tag;
+        if ((!name || mb_streq(mod->cmdline, name)) &&
+            mod->mod_end >= mod->mod_start && mod->mod_end <= MB2_IDENTITY_MAPPED) {
+            *start = (const uint8_t *)(uintptr_t)mod->mod_start;
+            *len = mod->mod_end - mod->mod_start;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int multiboot_option(uint64_t info, const char *name, char *value, size_t max) {
+    const mb2_tag_t *tag = find_tag(info, MB2_TAG_CMDLINE, 0);
+    if (!tag || max == 0) return -1;
+
+    // Options are separated by spaces
+    const char *p = ((const mb2_cmdline_tag_t *)tag)->string;
+    const char *end = (const char *)tag + tag->size;
+    while (p < end && *p) {
+        while (p < end && *p == ' ') p++;
+        const char *n = name;
+        while (p < end && *n && *p == *n) { p++; n++; }
+        if (!*n && p < end && *p == '=') {
+            size_t k = 0;
+            for (p++; p < end && *p && *p != ' ' && k < max - 1; ++p) value[k++] = *p;
+            value[k] = 0;
+            return 0;
+        }
+        while (p < end && *p && *p != ' ') p++;
+    }
+    return -1;
+}
+
+int multiboot_memory_region(uint64_t info, int i, uint64_t *base, uint64_t *len, uint32_t *type) {
+    const mb2_tag_t *tag = find_tag(info, MB2_TAG_MMAP, 0);
+    if (!tag || i < 0 || tag->size < sizeof(mb2_mmap_tag_t)) return -1;
+    const mb2_mmap_tag_t *mmap = (const mb2_mmap_tag_t *)tag;
+    if (mmap->entry_size < sizeof(mb2_mmap_entry_t)) return -1;
+
+    // Entries may grow in later versions, so step by entry_size
+    uint64_t off = sizeof(mb2_mmap_tag_t) + (uint64_t)i * mmap->entry_size;
+    if (off + sizeof(mb2_mmap_entry_t) > tag->size) return -1;
+    const mb2_mmap_entry_t *e = (const mb2_mmap_entry_t *)((const uint8_t *)tag + off);
+    *base = e->base;
+    *len = e->len;
+    *type = e->type;
+    return 0;
+}
+
+int multiboot_module_region(uint64_t info, int i, uint64_t *base, uint64_t *len) {
+    for (const mb2_tag_t *tag = find_tag(info, MB2_TAG_MODULE, 0); tag; tag = find_tag(info, MB2_TAG_MODULE, tag)) {
+        const mb2_module_tag_t *mod = (const mb2_module_tag_t *)tag;
+        if (i-- > 0) continue;
+        *base = mod->mod_start;
+        *len = mod->mod_end >= mod->mod_start ? mod->mod_end - mod->mod_start : 0;
+        return 0;
+    }
+    return -1;
+}
+
+const void *multiboot_acpi_rsdp(uint64_t info) {
+    const mb2_tag_t *tag = find_tag(info, MB2_TAG_ACPI_NEW, 0);
+    if (!tag) tag = find_tag(info, MB2_TAG_ACPI_OLD, 0);
+    if (!tag || tag->size <= sizeof(mb2_tag_t)) return 0;
+    return (const uint8_t *)tag + sizeof(mb2_tag_t);  // The RSDP is copied right after the header
+}
+
+size_t multiboot_info_size(uint64_t info) {
+    if (info == 0 || info + sizeof(mb2_info_t) > MB2_IDENTITY_MAPPED) return 0;
+    return ((const mb2_info_t *)(uintptr_t)info)->total_size;
+}
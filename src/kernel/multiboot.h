@@ -0,0 +1,41 @@
+/* multiboot.h - Multiboot2 boot information parsing */
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Find a module GRUB loaded with "module2 PATH NAME" in grub.cfg. name is compared with
+   the module's command line, NULL picks the first module. The module is left where GRUB
+   put it and *start points straight at it. Returns 0 on success, -1 if there is no such module */
+int multiboot_find_module(uint64_t info, const char *name, const uint8_t **start, size_t *len);
+
+/* Find the value of option "name=value" on the kernel's command line (the text after the
+   path on the multiboot2 line in grub.cfg) and copy it to value (at most max bytes with the
+   terminating zero). Returns 0 on success, -1 if the option is not there */
+int multiboot_option(uint64_t info, const char *name, char *value, size_t max);
+
+/* Memory map entry types */
+#define MULTIBOOT_MEMORY_AVAILABLE 1  // RAM the kernel may use
+#define MULTIBOOT_MEMORY_ACPI 3       // ACPI tables, reclaimable once read
+#define MULTIBOOT_MEMORY_NVS 4        // Must be preserved across hibernation
+#define MULTIBOOT_MEMORY_BAD 5
+
+/* Entry i of the firmware's memory map (the tag header.asm asks GRUB for): physical range
+   base..base+len-1 of the given type. Returns 0, or -1 past the last entry or if there is no
+   map */
+int multiboot_memory_region(uint64_t info, int i, uint64_t *base, uint64_t *len, uint32_t *type);
+
+/* Physical range of boot module i (in the order of the module2 lines). Returns 0, or -1 past
+   the last module */
+int multiboot_module_region(uint64_t info, int i, uint64_t *base, uint64_t *len);
+
+/* GRUB's copy of the ACPI root pointer (RSDP), the ACPI 2.0 one if there is one, NULL if the
+   firmware has no ACPI or GRUB did not pass it */
+const void *multiboot_acpi_rsdp(uint64_t info);
+
+/* Size in bytes of the boot information itself, which lives in memory GRUB chose and has to
+   be kept while options are still read from it. 0 if there is none */
+size_t multiboot_info_size(uint64_t info);
+
+#endif
@@ -0,0 +1,146 @@
+/* numa.c - NUMA topology from ACPI
+ *
+ * The SRAT lists memory ranges and processors (by local APIC id) with the
+ * proximity domain each belongs to. Domains get node numbers in the order
+ * they first appear. The SLIT gives the relative cost of reaching memory in
+ * one domain from another; without it every other node counts as equally far.
+ */
+#include "numa.h"
+
+#define SRAT_ENTRIES 48          // Table header, then 12 reserved bytes
+#define SRAT_CPU 0               // Processor local APIC affinity
+#define SRAT_MEMORY 1            // Memory affinity
+#define SRAT_X2APIC 2            // Processor local x2APIC affinity
+#define SRAT_ENABLED 0x01
+#define SLIT_MATRIX 44           // Table header, then the 8-byte number of localities
+
+typedef struct {
+    uint64_t base;
+    uint64_t len;
+    int node;
+} numa_range_t;
+
+static int nnodes = 1;
+static uint32_t domains[NUMA_MAX_NODES];  // Proximity domain of each node
+static numa_range_t ranges[NUMA_MAX_RANGES];
+static int nranges = 0;
+static uint8_t apic_node[NUMA_MAX_APIC];
+static int node_cpus[NUMA_MAX_NODES];
+static uint8_t distance[NUMA_MAX_NODES][NUMA_MAX_NODES];
+
+static uint32_t read32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Node for a proximity domain, numbering new ones as they come */
+static int domain_node(uint32_t domain) {
+    for (int n = 0; n < nnodes; ++n) {
+        if (domains[n] == domain) return n;
+    }
+    if (nnodes == NUMA_MAX_NODES) return NUMA_MAX_NODES - 1;
+    domains[nnodes] = domain;
+    return nnodes++;
+}
+
+static void add_cpu(uint32_t apic_id, uint32_t domain) {
+    int node = domain_node(domain);
+    if (apic_id < NUMA_MAX_APIC) apic_node[apic_id] = (uint8_t)node;
+    node_cpus[node]++;
+}
+
+static void parse_srat(const acpi_header_t *srat) {
+    const uint8_t *p = (const uint8_t *)srat + SRAT_ENTRIES;
+    const uint8_t *end = (const uint8_t *)srat + srat->length;
+    nnodes = 0;
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        uint8_t type = p[0], len = p[1];
+        if (type == SRAT_CPU && len >= 16 && (read32(p + 4) & SRAT_ENABLED)) {
+            // Domain bits 0-7 at offset 2, bits 8-31 at offset 9
+            uint32_t domain = p[2] | ((uint32_t)p[9] << 8) | ((uint32_t)p[10] << 16) | ((uint32_t)p[11] << 24);
+            add_cpu(p[3], domain);
+        } else if (type == SRAT_X2APIC && len >= 24 && (read32(p + 12) & SRAT_ENABLED)) {
+            add_cpu(read32(p + 8), read32(p + 4));
+        } else if (type == SRAT_MEMORY && len >= 40 && (read32(p + 28) & SRAT_ENABLED) && nranges < NUMA_MAX_RANGES) {
+            uint64_t base = read32(p + 8) | ((uint64_t)read32(p + 12) << 32);
+            uint64_t size = read32(p + 16) | ((uint64_t)read32(p + 20) << 32);
+            if (size) {
+                ranges[nranges].base = base;
+                ranges[nranges].len = size;
+                ranges[nranges].node = domain_node(read32(p + 2));
+                nranges++;
+            }
+        }
+        p += len;
+    }
+    if (nnodes == 0) nnodes = 1;
+}
+
+static void parse_slit(const acpi_header_t *slit) {
+    const uint8_t *p = (const uint8_t *)slit;
+    if (slit->length < SLIT_MATRIX) return;
+    uint64_t n = read32(p + 36) | ((uint64_t)read32(p + 40) << 32);
+    if (n == 0 || n > 256 || SLIT_MATRIX + n * n > slit->length) return;
+
+    // Rows and columns are proximity domains; keep the ones that became nodes
+    for (int a = 0; a < nnodes; ++a) {
+        for (int b = 0; b < nnodes; ++b) {
+            if (domains[a] < n && domains[b] < n) distance[a][b] = p[SLIT_MATRIX + domains[a] * n + domains[b]];
+        }
+    }
+}
+
+void numa_init(const acpi_header_t *srat, const acpi_header_t *slit) {
+    nnodes = 1;
+    nranges = 0;
+    domains[0] = 0;
+    for (int i = 0; i < NUMA_MAX_APIC; ++i) apic_node[i] = 0;
+    for (int a = 0; a < NUMA_MAX_NODES; ++a) {
+        node_cpus[a] = 0;
+        for (int b = 0; b < NUMA_MAX_NODES; ++b) distance[a][b] = a == b ? NUMA_LOCAL : NUMA_REMOTE;
+    }
+    if (!srat) return;
+    parse_srat(srat);
+    if (slit) parse_slit(slit);
+}
+
+int numa_nodes(void) {
+    return nnodes;
+}
+
+int numa_range(int i, uint64_t *base, uint64_t *len, int *node) {
+    if (i < 0 || i >= nranges) return -1;
+    *base = ranges[i].base;
+    *len = ranges[i].len;
+    *node = ranges[i].node;
+    return 0;
+}
+
+int numa_node_of_cpu(uint32_t apic_id) {
+    return apic_id < NUMA_MAX_APIC ? apic_node[apic_id] : 0;
+}
+
+int numa_cpus(int node) {
+    return node >= 0 && node < nnodes ? node_cpus[node] : 0;
+}
+
+int numa_distance(int a, int b) {
+    if (a < 0 || b < 0 || a >= nnodes || b >= nnodes) return NUMA_REMOTE;
+    return distance[a][b];
+}
+
+int numa_fallback(int node, int *nodes) {
+    if (node < 0 || node >= nnodes) node = 0;
+    int n = 0;
+    for (int i = 0; i < nnodes; ++i) nodes[n++] = i;
+    // Insertion sort by distance; the node itself (NUMA_LOCAL) comes first, ties by number
+    for (int i = 1; i < n; ++i) {
+        int v = nodes[i], j = i;
+        while (j > 0 && (numa_distance(node, nodes[j - 1]) > numa_distance(node, v) ||
+                         (nodes[j - 1] != node && v == node))) {
+            nodes[j] = nodes[j - 1];
+            j--;
+        }
+        nodes[j] = v;
+    }
+    return n;
+}
@@ -0,0 +1,39 @@
+/* numa.h - Memory topology: which memory and CPUs belong to which node, from ACPI SRAT/SLIT */
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "acpi.h"
+
+#define NUMA_MAX_NODES 8      // Proximity domains told apart (more are folded onto the last)
+#define NUMA_MAX_RANGES 32    // Memory ranges with a node
+#define NUMA_MAX_APIC 256     // CPUs by local APIC id (xAPIC ids; larger x2APIC ids go to node 0)
+#define NUMA_LOCAL 10         // SLIT distance of a node to itself
+#define NUMA_REMOTE 20        // Distance between different nodes when there is no SLIT
+
+/* Read the System Resource Affinity Table and, if there is one, the System Locality
+   Information Table. With no SRAT (NULL, or nothing usable in it) there is one node holding
+   everything */
+void numa_init(const acpi_header_t *srat, const acpi_header_t *slit);
+
+/* Number of nodes, at least 1 */
+int numa_nodes(void);
+
+/* Memory range i of the SRAT and its node. Returns 0, or -1 past the last one */
+int numa_range(int i, uint64_t *base, uint64_t *len, int *node);
+
+/* Node of the CPU with the given local APIC id (0 if the SRAT does not list it) */
+int numa_node_of_cpu(uint32_t apic_id);
+
+/* Number of CPUs the SRAT puts on node */
+int numa_cpus(int node);
+
+/* Relative memory access cost from node a to node b (NUMA_LOCAL for a == b) */
+int numa_distance(int a, int b);
+
+/* Every node in order of distance from node, node itself first, into nodes (NUMA_MAX_NODES
+   entries). Returns how many */
+int numa_fallback(int node, int *nodes);
+
+#endif
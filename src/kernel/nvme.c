@@ -0,0 +1,620 @@
+/* nvme.c - NVMe driver
+ *
+ * Finds the controller on PCI (class 01, subclass 08, programming interface
+ * 02), maps its registers and brings it up with an admin queue pair. After
+ * identifying the controller and namespace 1 it asks for one I/O submission
+ * and completion queue pair per CPU. Each pair is only ever used by its own
+ * CPU, so the queues need no locks: a CPU fills in submission entries, rings
+ * the tail doorbell and reaps its own completions. Long requests are cut into
+ * commands that are all put in flight before the first one is waited for.
+ *
+ * A command's data is described with PRP entries: the first one may start
+ * anywhere in a page, the second is either the next page or the address of a
+ * list of the remaining pages. Completions are found by polling the phase tag
+ * of the next completion entry. If a command takes long, the driver unmasks
+ * the controller's (legacy, pin-based) interrupt and lets the kernel sleep
+ * until it arrives, rather than keep spinning.
+ */
+#include "nvme.h"
+#include "pci.h"
+#include "kstring.h"
+
+/* Controller registers, from BAR0 */
+#define REG_CAP       0x00    // Capabilities (64-bit)
+#define REG_INTMS     0x0C    // Interrupt mask set
+#define REG_INTMC     0x10    // Interrupt mask clear
+#define REG_CC        0x14    // Controller configuration
+#define REG_CSTS      0x1C    // Controller status
+#define REG_AQA       0x24    // Admin queue sizes
+#define REG_ASQ       0x28    // Admin submission queue address (64-bit)
+#define REG_ACQ       0x30    // Admin completion queue address (64-bit)
+#define REG_DOORBELLS 0x1000  // Tail/head doorbells, two per queue pair
+
+#define CC_EN     0x01
+#define CC_IOSQES (6u << 16)  // Submission entries are 2^6 bytes
+#define CC_IOCQES (4u << 20)  // Completion entries are 2^4 bytes
+#define CSTS_RDY  0x01
+#define CSTS_CFS  0x02        // Controller fatal status
+
+/* Admin commands */
+#define ADMIN_CREATE_SQ    0x01
+#define ADMIN_CREATE_CQ    0x05
+#define ADMIN_IDENTIFY     0x06
+#define ADMIN_SET_FEATURES 0x09
+#define FEATURE_QUEUES     0x07  // Number of queues
+#define CNS_NAMESPACE      0x00
+#define CNS_CONTROLLER     0x01
+
+/* NVM commands */
+#define CMD_FLUSH 0x00
+#define CMD_WRITE 0x01
+#define CMD_READ  0x02
+#define CMD_DSM   0x09
+#define DSM_DEALLOCATE (1u << 2)
+
+#define QUEUE_CONTIGUOUS 0x01  // Create queue: physically contiguous
+#define QUEUE_IRQ        0x02  // Create completion queue: interrupts enabled
+
+#define PAGE 4096
+#define SECTOR 512
+#define ADMIN_DEPTH 16
+#define PRP_ENTRIES 64              // Entries in a command's PRP list (512 bytes, never crosses a page)
+#define NVME_SPINS 20000            // Completion polls before sleeping on the interrupt
+#define NVME_TIMEOUT 50000000       // Polls (or wakeups) without a completion before giving up
+#define NVME_READY_TIMEOUT 50000000 // Status polls for the controller to enable or disable
+
+/* Submission queue entry */
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t cid;       // Command id, echoed in the completion
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    uint64_t prp1;      // First data page (may start at an offset)
+    uint64_t prp2;      // Second page, or the address of a PRP list
+    uint32_t cdw10, cdw11, cdw12, cdw13, cdw14, cdw15;
+} nvme_sqe_t;
+
+/* Completion queue entry */
+typedef struct {
+    uint32_t result;    // Command specific
+    uint32_t reserved;
+    uint16_t sq_head;   // How far the controller has fetched the submission queue
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;    // Bit 0: phase tag, bits 1-15: status (0 on success)
+} nvme_cqe_t;
+
+typedef struct {
+    uint16_t qid;
+    uint16_t depth;
+    uint16_t sq_tail;
+    uint16_t sq_head;
+    uint16_t cq_head;
+    uint16_t phase;        // Phase tag new completion entries carry
+    uint64_t busy;         // Bit per command id in flight
+    int inflight;
+    int errors;            // Commands that completed with an error status
+    uint32_t result;       // Result of the last completion
+    nvme_sqe_t *sq;
+    volatile nvme_cqe_t *cq;
+    volatile uint32_t *sq_doorbell;
+    volatile uint32_t *cq_doorbell;
+    uint64_t (*prp)[PRP_ENTRIES];  // PRP list per command id
+    uint8_t *bounce;       // Page for buffers that are not dword aligned
+    uint64_t *range;       // Dataset Management range
+} nvme_queue_t;
+
+static nvme_callbacks_t callbacks;
+static volatile uint8_t *regs;
+static uint32_t doorbell_stride;
+static int present = 0;
+static int failed = 0;     // Flag: a command timed out, the controller is no longer used
+static int nqueues = 0;
+static int irq_line = -1;
+static uint32_t ns_sectors = 0;
+static uint32_t max_count = NVME_MAX_COUNT;
+static int can_discard = 0;
+static int write_cache = 0;
+static char model[NVME_MODEL_MAX];
+
+static nvme_queue_t admin;
+static nvme_queue_t io[NVME_MAX_QUEUES];
+
+// Queues are page aligned and physically contiguous (the kernel is identity mapped)
+static nvme_sqe_t admin_sq[ADMIN_DEPTH] __attribute__((aligned(PAGE)));
+static nvme_cqe_t admin_cq[ADMIN_DEPTH] __attribute__((aligned(PAGE)));
+static nvme_sqe_t io_sq[NVME_MAX_QUEUES][NVME_IO_DEPTH] __attribute__((aligned(PAGE)));
+static nvme_cqe_t io_cq[NVME_MAX_QUEUES][PAGE / sizeof(nvme_cqe_t)] __attribute__((aligned(PAGE)));
+static uint64_t prp_lists[NVME_MAX_QUEUES][NVME_IO_DEPTH][PRP_ENTRIES] __attribute__((aligned(PAGE)));
+static uint8_t bounce[NVME_MAX_QUEUES][PAGE] __attribute__((aligned(PAGE)));
+static uint64_t ranges[NVME_MAX_QUEUES][2] __attribute__((aligned(16)));
+static uint8_t identify[PAGE] __attribute__((aligned(PAGE)));
+
+void nvme_set_callbacks(const nvme_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+static void report(const char *msg) {
+    if (callbacks.print_message) callbacks.print_message(msg);
+}
+
+static uint32_t reg_read32(uint32_t off) {
+    return *(volatile uint32_t *)(regs + off);
+}
+
+static void reg_write32(uint32_t off, uint32_t val) {
+    *(volatile uint32_t *)(regs + off) = val;
+}
+
+static uint64_t reg_read64(uint32_t off) {
+    return (uint64_t)reg_read32(off) | ((uint64_t)reg_read32(off + 4) << 32);
+}
+
+static void reg_write64(uint32_t off, uint64_t val) {
+    reg_write32(off, (uint32_t)val);
+    reg_write32(off + 4, (uint32_t)(val >> 32));
+}
+
+/* Bus address of kernel memory (identity mapped) */
+static uint64_t phys(const void *p) {
+    return (uint64_t)(uintptr_t)p;
+}
+
+/* Wait for CSTS.RDY to become ready (0 or CSTS_RDY). -1 on timeout or a fatal error */
+static int wait_status(uint32_t ready) {
+    for (int i = 0; i < NVME_READY_TIMEOUT; ++i) {
+        uint32_t csts = reg_read32(REG_CSTS);
+        if (csts & CSTS_CFS) break;
+        if ((csts & CSTS_RDY) == ready) return 0;
+        __asm__ volatile ("pause");
+    }
+    report("NVMe: controller did not become ready\n");
+    return -1;
+}
+
+static void queue_setup(nvme_queue_t *q, uint16_t qid, uint16_t depth, nvme_sqe_t *sq, nvme_cqe_t *cq) {
+    kmemset(q, 0, sizeof(*q));
+    kmemset(sq, 0, (size_t)depth * sizeof(nvme_sqe_t));
+    kmemset(cq, 0, (size_t)depth * sizeof(nvme_cqe_t));
+    q->qid = qid;
+    q->depth = depth;
+    q->phase = 1;  // The controller flips the tag each time round, starting from cleared entries
+    q->sq = sq;
+    q->cq = cq;
+    q->sq_doorbell = (volatile uint32_t *)(regs + REG_DOORBELLS + (2u * qid) * doorbell_stride);
+    q->cq_doorbell = (volatile uint32_t *)(regs + REG_DOORBELLS + (2u * qid + 1) * doorbell_stride);
+}
+
+/* ============================================================================
+   QUEUES
+   ============================================================================ */
+
+static int completion_ready(const nvme_queue_t *q) {
+    return (q->cq[q->cq_head].status & 1) == q->phase;
+}
+
+/* Take the next completion entry off q and tell the controller the slot is free */
+static void consume(nvme_queue_t *q) {
+    volatile nvme_cqe_t *e = &q->cq[q->cq_head];
+    if (e->status >> 1) q->errors++;
+    q->result = e->result;
+    q->sq_head = e->sq_head;
+    q->busy &= ~(1ull << (e->cid % NVME_IO_DEPTH));
+    q->inflight--;
+    if (++q->cq_head == q->depth) {
+        q->cq_head = 0;
+        q->phase ^= 1;
+    }
+    *q->cq_doorbell = q->cq_head;
+}
+
+/* Wait until q has a completion: poll the phase tag for a while, then sleep on the
+   interrupt if there is one and the kernel can wait for it. -1 on timeout */
+static int wait_completion(nvme_queue_t *q) {
+    for (uint32_t spins = 0; spins < NVME_TIMEOUT; ++spins) {
+        if (completion_ready(q)) {
+            __asm__ volatile ("" ::: "memory");  // Read the entry (and data) only after the tag
+            return 0;
+        }
+        if (spins < NVME_SPINS || irq_line < 0 || !callbacks.wait_irq) {
+            __asm__ volatile ("pause");
+            continue;
+        }
+        // Unmask and look once more, since the completion may have come in between; the
+        // interrupt handler masks it again
+        reg_write32(REG_INTMC, 1);
+        if (completion_ready(q) || callbacks.wait_irq(irq_line) != 0) reg_write32(REG_INTMS, 1);
+    }
+    report("NVMe: command timed out\n");
+    failed = 1;
+    return -1;
+}
+
+/* Wait for every command on q. -1 on timeout */
+static int drain(nvme_queue_t *q) {
+    while (q->inflight > 0) {
+        if (wait_completion(q) != 0) return -1;
+        consume(q);
+    }
+    return 0;
+}
+
+/* Free command id on q, reaping completions until one is free and the submission queue has
+   room. -1 on timeout */
+static int take_slot(nvme_queue_t *q) {
+    while (q->inflight >= q->depth - 1 || (uint16_t)((q->sq_tail + 1) % q->depth) == q->sq_head) {
+        if (wait_completion(q) != 0) return -1;
+        consume(q);
+    }
+    for (int cid = 0; cid < q->depth; ++cid) {
+        if (!(q->busy & (1ull << cid))) return cid;
+    }
+    return -1;
+}
+
+/* Copy cmd into q's next submission slot as command cid and ring the doorbell */
+static void post(nvme_queue_t *q, int cid, nvme_sqe_t *cmd) {
+    cmd->cid = (uint16_t)cid;
+    kmemcpy(&q->sq[q->sq_tail], cmd, sizeof(*cmd));
+    q->busy |= 1ull << cid;
+    q->inflight++;
+    if (++q->sq_tail == q->depth) q->sq_tail = 0;
+    __asm__ volatile ("" ::: "memory");  // Entry and PRP list before the doorbell
+    *q->sq_doorbell = q->sq_tail;
+}
+
+/* Run one admin command and wait for it. Sets *result to its result if result is not NULL */
+static int admin_command(nvme_sqe_t *cmd, uint32_t *result) {
+    if (failed) return -1;
+    int cid = take_slot(&admin);
+    if (cid < 0) return -1;
+    int errors = admin.errors;
+    post(&admin, cid, cmd);
+    if (drain(&admin) != 0) return -1;
+    if (result) *result = admin.result;
+    return admin.errors == errors ? 0 : -1;
+}
+
+/* Queue pair of the calling CPU */
+static nvme_queue_t *cpu_queue(void) {
+    int cpu = callbacks.cpu ? callbacks.cpu() : 0;
+    return &io[(cpu < 0 ? 0 : cpu) % nqueues];
+}
+
+/* Put a read or write of count (1 to max_count) sectors at lba in flight on q. buf must be
+   dword aligned: PRP entry 1 is buf, entry 2 the next page or a list of every page after
+   the first */
+static int start_rw(nvme_queue_t *q, int write, uint32_t lba, uint32_t count, uint8_t *buf) {
+    int cid = take_slot(q);
+    if (cid < 0) return -1;
+
+    nvme_sqe_t cmd;
+    kmemset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = write ? CMD_WRITE : CMD_READ;
+    cmd.nsid = 1;
+    cmd.cdw10 = lba;
+    cmd.cdw12 = count - 1;  // 0-based
+
+    uint64_t addr = phys(buf);
+    size_t len = (size_t)count * SECTOR;
+    size_t first = PAGE - (size_t)(addr & (PAGE - 1));
+    cmd.prp1 = addr;
+    if (len > first) {
+        uint64_t next = addr + first;
+        size_t left = len - first;
+        if (left <= PAGE) {
+            cmd.prp2 = next;
+        } else {
+            uint64_t *list = q->prp[cid];
+            for (int n = 0; left > 0; ++n) {
+                list[n] = next;
+                next += PAGE;
+                left -= left < PAGE ? left : PAGE;
+            }
+            cmd.prp2 = phys(list);
+        }
+    }
+    post(q, cid, &cmd);
+    return 0;
+}
+
+/* Read or write on the calling CPU's queue pair */
+static int transfer(int write, uint32_t lba, uint32_t count, uint8_t *buf) {
+    if (!present || failed || count == 0 || lba + count > ns_sectors || lba + count < lba) return -1;
+    nvme_queue_t *q = cpu_queue();
+    int errors = q->errors;
+
+    if ((uintptr_t)buf & 3) {
+        // PRP entries must be dword aligned: go through the bounce page, a page at a time
+        while (count > 0) {
+            uint32_t n = count < PAGE / SECTOR ? count : PAGE / SECTOR;
+            if (write) kmemcpy(q->bounce, buf, (size_t)n * SECTOR);
+            if (start_rw(q, write, lba, n, q->bounce) != 0 || drain(q) != 0) return -1;
+            if (!write) kmemcpy(buf, q->bounce, (size_t)n * SECTOR);
+            lba += n;
+            count -= n;
+            buf += (size_t)n * SECTOR;
+        }
+        return q->errors == errors ? 0 : -1;
+    }
+
+    while (count > 0) {
+        uint32_t n = count < max_count ? count : max_count;
+        if (start_rw(q, write, lba, n, buf) != 0) {
+            drain(q);
+            return -1;
+        }
+        lba += n;
+        count -= n;
+        buf += (size_t)n * SECTOR;
+    }
+    if (drain(q) != 0) return -1;
+    return q->errors == errors ? 0 : -1;
+}
+
+/* ============================================================================
+   CONTROLLER SETUP
+   ============================================================================ */
+
+/* Identify Controller: model, largest transfer, optional commands, write cache */
+static int identify_controller(void) {
+    nvme_sqe_t cmd;
+    kmemset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = ADMIN_IDENTIFY;
+    cmd.prp1 = phys(identify);
+    cmd.cdw10 = CNS_CONTROLLER;
+    if (admin_command(&cmd, 0) != 0) return -1;
+
+    // Bytes 24-63: model, space padded; 77: MDTS (2^n pages, 0: no limit); 520: ONCS; 525: VWC
+    int n = 0;
+    for (int i = 24; i < 64; ++i) model[n++] = (char)identify[i];
+    while (n > 0 && model[n - 1] == ' ') n--;
+    model[n] = 0;
+    uint8_t mdts = identify[77];
+    max_count = NVME_MAX_COUNT;
+    if (mdts && mdts < 16 && ((uint32_t)PAGE << mdts) / SECTOR < max_count) max_count = ((uint32_t)PAGE << mdts) / SECTOR;
+    can_discard = (identify[520] & (1u << 2)) != 0;
+    write_cache = identify[525] & 1;
+    return 0;
+}
+
+/* Identify Namespace 1: its size, and that it uses 512-byte sectors */
+static int identify_namespace(void) {
+    nvme_sqe_t cmd;
+    kmemset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = ADMIN_IDENTIFY;
+    cmd.nsid = 1;
+    cmd.prp1 = phys(identify);
+    cmd.cdw10 = CNS_NAMESPACE;
+    if (admin_command(&cmd, 0) != 0) return -1;
+
+    // Bytes 0-7: size in blocks; 26: format in use; 128 on: formats, bits 16-23 log2(block size)
+    uint64_t size = 0;
+    for (int i = 7; i >= 0; --i) size = (size << 8) | identify[i];
+    int fmt = identify[26] & 0x0F;
+    if (identify[128 + 4 * fmt + 2] != 9) {
+        report("NVMe: namespace 1 does not use 512-byte sectors\n");
+        return -1;
+    }
+    ns_sectors = size > 0xFFFFFFFFull ? 0xFFFFFFFFu : (uint32_t)size;
+    return ns_sectors ? 0 : -1;
+}
+
+/* Create I/O queue pair qid (its completion queue first) */
+static int create_queue_pair(nvme_queue_t *q, uint16_t qid, uint16_t depth, nvme_sqe_t *sq, nvme_cqe_t *cq) {
+    queue_setup(q, qid, depth, sq, cq);
+    q->prp = prp_lists[qid - 1];
+    q->bounce = bounce[qid - 1];
+    q->range = ranges[qid - 1];
+
+    nvme_sqe_t cmd;
+    kmemset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = ADMIN_CREATE_CQ;
+    cmd.prp1 = phys(cq);
+    cmd.cdw10 = ((uint32_t)(depth - 1) << 16) | qid;
+    cmd.cdw11 = QUEUE_CONTIGUOUS | (irq_line >= 0 ? QUEUE_IRQ : 0);  // Interrupt vector 0
+    if (admin_command(&cmd, 0) != 0) return -1;
+
+    kmemset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = ADMIN_CREATE_SQ;
+    cmd.prp1 = phys(sq);
+    cmd.cdw10 = ((uint32_t)(depth - 1) << 16) | qid;
+    cmd.cdw11 = ((uint32_t)qid << 16) | QUEUE_CONTIGUOUS;  // Completions go to the pair's queue
+    return admin_command(&cmd, 0);
+}
+
+int nvme_init(int cpus) {
+    present = 0;
+    failed = 0;
+    nqueues = 0;
+    irq_line = -1;
+    ns_sectors = 0;
+    model[0] = 0;
+
+    pci_addr_t ctrl;
+    int found = 0;
+    for (int i = 0; !found && pci_find_class(0x01, 0x08, i, &ctrl) == 0; ++i) {
+        found = ((pci_read32(ctrl, PCI_CLASS) >> 8) & 0xFF) == 0x02;  // Programming interface: NVM Express
+    }
+    if (!found || !callbacks.map_mmio) return -1;
+    uint64_t bar = pci_bar64(ctrl, 0);
+    regs = bar ? (volatile uint8_t *)callbacks.map_mmio(bar, REG_DOORBELLS) : 0;
+    if (!regs) return -1;
+    pci_enable(ctrl, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+
+    // CAP bits 0-15: largest queue (0-based), 32-35: doorbell stride, 37: NVM command set,
+    // 48-51: smallest page size (2^(12+n))
+    uint64_t cap = reg_read64(REG_CAP);
+    if (((cap >> 48) & 0xF) != 0 || !((cap >> 37) & 1)) {
+        report("NVMe: controller needs pages larger than 4KB or lacks the NVM command set\n");
+        return -1;
+    }
+    doorbell_stride = 4u << ((cap >> 32) & 0xF);
+    regs = (volatile uint8_t *)callbacks.map_mmio(bar, REG_DOORBELLS + 2u * (NVME_MAX_QUEUES + 1) * doorbell_stride);
+    if (!regs) return -1;
+    uint32_t entries = (uint32_t)(cap & 0xFFFF) + 1;
+
+    // Reset, give it the admin queues and enable it with interrupts masked: completions are
+    // polled, and the interrupt only unmasked to sleep on a slow one
+    reg_write32(REG_CC, reg_read32(REG_CC) & ~(uint32_t)CC_EN);
+    if (wait_status(0) != 0) return -1;
+    uint16_t depth = (uint16_t)(entries < ADMIN_DEPTH ? entries : ADMIN_DEPTH);
+    queue_setup(&admin, 0, depth, admin_sq, admin_cq);
+    reg_write32(REG_AQA, ((uint32_t)(depth - 1) << 16) | (uint32_t)(depth - 1));
+    reg_write64(REG_ASQ, phys(admin_sq));
+    reg_write64(REG_ACQ, phys(admin_cq));
+    reg_write32(REG_INTMS, 0xFFFFFFFFu);
+    reg_write32(REG_CC, CC_IOSQES | CC_IOCQES | CC_EN);  // 4KB pages, NVM command set, round robin
+    if (wait_status(CSTS_RDY) != 0) return -1;
+
+    if (identify_controller() != 0 || identify_namespace() != 0) return -1;
+
+    irq_line = pci_irq(ctrl);
+    if (irq_line >= 0) pci_disable(ctrl, PCI_COMMAND_INTX_DISABLE);
+
+    // One pair per CPU, as many as the controller grants (its answer is 0-based)
+    int want = cpus < 1 ? 1 : cpus > NVME_MAX_QUEUES ? NVME_MAX_QUEUES : cpus;
+    nvme_sqe_t cmd;
+    kmemset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = ADMIN_SET_FEATURES;
+    cmd.cdw10 = FEATURE_QUEUES;
+    cmd.cdw11 = ((uint32_t)(want - 1) << 16) | (uint32_t)(want - 1);
+    uint32_t granted;
+    if (admin_command(&cmd, &granted) != 0) return -1;
+    if ((int)(granted & 0xFFFF) + 1 < want) want = (int)(granted & 0xFFFF) + 1;
+    if ((int)(granted >> 16) + 1 < want) want = (int)(granted >> 16) + 1;
+
+    depth = (uint16_t)(entries < NVME_IO_DEPTH ? entries : NVME_IO_DEPTH);
+    for (int q = 0; q < want; ++q) {
+        if (create_queue_pair(&io[q], (uint16_t)(q + 1), depth, io_sq[q], io_cq[q]) != 0) break;
+        nqueues++;
+    }
+    if (nqueues == 0) {
+        report("NVMe: could not create an I/O queue\n");
+        return -1;
+    }
+    present = 1;
+    return 0;
+}
+
+int nvme_present(void) {
+    return present;
+}
+
+uint32_t nvme_sectors(void) {
+    return present ? ns_sectors : 0;
+}
+
+const char *nvme_model(void) {
+    return present ? model : "";
+}
+
+int nvme_queues(void) {
+    return nqueues;
+}
+
+int nvme_irq(void) {
+    return present ? irq_line : -1;
+}
+
+void nvme_interrupt(void) {
+    if (regs) reg_write32(REG_INTMS, 1);
+}
+
+/* ============================================================================
+   SECTOR I/O
+   ============================================================================ */
+
+int nvme_read_sectors(uint32_t lba, uint32_t count, void *buf) {
+    return transfer(0, lba, count, (uint8_t *)buf);
+}
+
+int nvme_write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+    // The controller only reads from buf on writes
+    return transfer(1, lba, count, (uint8_t *)(uintptr_t)buf);
+}
+
+int nvme_flush(void) {
+    if (!present || failed) return -1;
+    if (!write_cache) return 0;
+    nvme_queue_t *q = cpu_queue();
+    int cid = take_slot(q);
+    if (cid < 0) return -1;
+    int errors = q->errors;
+    nvme_sqe_t cmd;
+    kmemset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = CMD_FLUSH;
+    cmd.nsid = 1;
+    post(q, cid, &cmd);
+    if (drain(q) != 0) return -1;
+    return q->errors == errors ? 0 : -1;
+}
+
+int nvme_discard_supported(void) {
+    return present && can_discard;
+}
+
+int nvme_discard(uint32_t lba, uint32_t count) {
+    if (!present || failed || count == 0 || lba + count > ns_sectors || lba + count < lba) return -1;
+    if (!can_discard) return 0;
+    nvme_queue_t *q = cpu_queue();
+    if (drain(q) != 0) return -1;  // Nothing else in flight may be using the range buffer
+    int cid = take_slot(q);
+    if (cid < 0) return -1;
+    int errors = q->errors;
+
+    // One range: context attributes, length in sectors, starting sector
+    q->range[0] = (uint64_t)count << 32;
+    q->range[1] = lba;
+    nvme_sqe_t cmd;
+    kmemset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = CMD_DSM;
+    cmd.nsid = 1;
+    cmd.prp1 = phys(q->range);
+    cmd.cdw10 = 0;  // Number of ranges, 0-based
+    cmd.cdw11 = DSM_DEALLOCATE;
+    post(q, cid, &cmd);
+    if (drain(q) != 0) return -1;
+    return q->errors == errors ? 0 : -1;
+}
+
+/* ============================================================================
+   BLOCK DEVICE
+   ============================================================================ */
+// There is one namespace, so the device pointer is unused
+
+static int blk_read(void *dev, uint32_t lba, uint32_t count, void *buf) {
+    (void)dev;
+    return nvme_read_sectors(lba, count, buf);
+}
+
+static int blk_write(void *dev, uint32_t lba, uint32_t count, const void *buf) {
+    (void)dev;
+    return nvme_write_sectors(lba, count, buf);
+}
+
+static int blk_flush(void *dev) {
+    (void)dev;
+    return nvme_flush();
+}
+
+static int blk_discard(void *dev, uint32_t lba, uint32_t count) {
+    (void)dev;
+    return nvme_discard(lba, count);
+}
+
+const blkdev_ops_t nvme_blkdev_ops = {
+    .read_sectors = blk_read,
+    .write_sectors = blk_write,
+    .flush = blk_flush,
+    .discard = blk_discard
+};
+
+int nvme_register(const char *name) {
+    if (!present) return -1;
+    // No per-call limit: long requests become several commands in flight
+    return blkdev_register(name, model, &nvme_blkdev_ops, 0, ns_sectors, 0,
+                           can_discard ? BLKDEV_DISCARD : 0);
+}
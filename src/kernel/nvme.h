@@ -0,0 +1,74 @@
+/* nvme.h - NVMe SSD driver: admin queue plus one I/O queue pair per CPU */
+#ifndef NVME_H
+#define NVME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "blkdev.h"
+
+#define NVME_MAX_QUEUES 4    // I/O queue pairs (one per CPU, as many as the controller grants)
+#define NVME_IO_DEPTH 64     // Entries per I/O queue, one page (fewer if the controller takes fewer)
+#define NVME_MAX_COUNT 256   // Most sectors one command transfers (less if the controller says so)
+#define NVME_MODEL_MAX 41    // Model string from Identify Controller, with the terminating zero
+
+/* Callbacks - must be provided by kernel */
+typedef struct {
+    void (*print_message)(const char *msg);       // Optional (may be NULL): report driver errors
+    void *(*map_mmio)(uint64_t phys, size_t len);  // Make controller registers addressable (uncached), NULL on failure
+    int (*cpu)(void);                              // Optional (may be NULL): number of the CPU running the caller
+    int (*wait_irq)(int irq);                      // Optional (may be NULL): sleep until irq arrives, 0 if slept,
+                                                   // -1 if it cannot be waited for right now (keep polling)
+} nvme_callbacks_t;
+
+/* Set the callbacks that the driver will use */
+void nvme_set_callbacks(const nvme_callbacks_t *callbacks);
+
+/* Find the first NVMe controller on PCI, reset and enable it, identify namespace 1 (which
+   must use 512-byte sectors) and create one I/O queue pair for each of cpus CPUs (as many as
+   NVME_MAX_QUEUES and the controller allow; CPUs beyond that are mapped onto them and must
+   then not do I/O at the same time). Returns 0 on success, -1 if there is no usable
+   controller */
+int nvme_init(int cpus);
+
+/* Check if a controller was set up */
+int nvme_present(void);
+
+/* Size of namespace 1 in sectors (capped to what 32 bits address), 0 if there is none */
+uint32_t nvme_sectors(void);
+
+/* Model string reported by the controller, "" if there is none */
+const char *nvme_model(void);
+
+/* Number of I/O queue pairs created */
+int nvme_queues(void);
+
+/* Legacy IRQ the controller interrupts on when a completion is waited for, -1 if none */
+int nvme_irq(void);
+
+/* Call from the interrupt handler for nvme_irq(): masks the controller's interrupt again, so
+   the (level-triggered) line drops before the end of interrupt */
+void nvme_interrupt(void);
+
+/* Read or write count consecutive 512-byte sectors on the calling CPU's queue pair. Long
+   requests become several commands in flight at once. Buffers must be identity mapped.
+   Returns 0 on success, -1 on error */
+int nvme_read_sectors(uint32_t lba, uint32_t count, void *buf);
+int nvme_write_sectors(uint32_t lba, uint32_t count, const void *buf);
+
+/* Make completed writes durable (Flush; nothing to do without a volatile write cache) */
+int nvme_flush(void);
+
+/* Check if the controller takes Dataset Management deallocate (discard) */
+int nvme_discard_supported(void);
+
+/* Deallocate sectors lba..lba+count-1. Does nothing on controllers without it */
+int nvme_discard(uint32_t lba, uint32_t count);
+
+/* Operations to register namespace 1 with (the device pointer is unused) */
+extern const blkdev_ops_t nvme_blkdev_ops;
+
+/* Register namespace 1 as a block device under name. Returns its id, or -1 if there is no
+   controller */
+int nvme_register(const char *name);
+
+#endif
@@ -0,0 +1,352 @@
+/* paging.c - Page table manager
+ *
+ * x86-64 translates through four levels of 512-entry tables: level 4 (PML4)
+ * entries cover 512GB, level 3 1GB, level 2 2MB and level 1 4KB. An entry at
+ * level 3 or 2 can map a page of its whole size itself (the PS bit) instead of
+ * pointing at a table, which is what paging_map uses wherever both addresses
+ * are aligned for it: one TLB entry then covers 2MB or 1GB.
+ *
+ * Changing a mapping inside a larger page first splits that page into a table
+ * of the next size mapping the same memory, so the rest of it is untouched.
+ * Mapping a larger page over a table frees the tables below it. Every entry
+ * that was present and changes has its TLB entry dropped with invlpg; past
+ * FLUSH_MAX of them, or when a whole subtree goes, the TLB is flushed at once.
+ *
+ * Every address space has its own level 4 table whose first entry points at
+ * the kernel's level 3 table, so kernel mappings are shared. They are marked
+ * global, which keeps them in the TLB when CR3 changes, and each space is
+ * tagged with a PCID, so switching back to it finds its own translations still
+ * cached. Changing a shared mapping while other PCIDs may have cached it takes
+ * a full flush of every PCID.
+ *
+ * Tables are reached at their physical address, so they must come from
+ * memory that is identity mapped.
+ */
+#include "paging.h"
+#include "kstring.h"
+
+#define ENTRY_PRESENT 0x001
+#define ENTRY_LARGE   0x080                  // PS: the entry maps a 2MB or 1GB page
+#define ENTRY_ADDR    0x000FFFFFFFFFF000ull
+#define ENTRY_FLAGS   (PAGE_WRITE | PAGE_USER | PAGE_WRITETHROUGH | PAGE_NOCACHE | PAGE_GLOBAL)
+#define TABLE_FLAGS   (ENTRY_PRESENT | PAGE_WRITE | PAGE_USER)  // Tables allow everything, leaves decide
+#define VIRT_LIMIT    0x0000800000000000ull  // Lower half of the canonical address space
+#define FLUSH_MAX     32                     // Pages invalidated one by one before a full flush is cheaper
+#define CR4_PGE       (1ull << 7)
+#define CR4_PCIDE     (1ull << 17)
+#define CR3_NOFLUSH   (1ull << 63)              // With PCIDs: keep the new PCID's translations
+#define PCID_COUNT    4096
+#define KERNEL_SLOTS  (PAGING_USER_BASE >> 39)  // Level 4 entries every space shares
+
+static paging_callbacks_t callbacks;
+static paging_space_t kernel_space;
+static paging_space_t *current = &kernel_space;
+static uint64_t *l4 = 0;           // Level 4 table of the running space
+static int huge = 0;               // Flag: the CPU maps 1GB pages
+static int pcid = 0;               // Flag: CR4.PCIDE is on
+static int spaces = 0;             // Address spaces besides the kernel's
+static uint8_t pcid_used[PCID_COUNT / 8];
+
+static uint64_t stale_pages[FLUSH_MAX];
+static int nstale = 0;             // Pages to invalidate; above FLUSH_MAX, flush everything
+
+void paging_set_callbacks(const paging_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+void paging_init(void) {
+    uint64_t cr3, cr4;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+    l4 = (uint64_t *)(uintptr_t)(cr3 & ENTRY_ADDR);
+    kernel_space.l4 = l4;
+    kernel_space.pcid = 0;
+    kernel_space.flush = 0;
+    current = &kernel_space;
+    spaces = 0;
+    for (int i = 0; i < PCID_COUNT / 8; ++i) pcid_used[i] = 0;
+    pcid_used[0] = 1;  // The kernel's
+
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000000u), "c"(0));
+    huge = 0;
+    if (eax >= 0x80000001u) {
+        __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001u), "c"(0));
+        huge = (edx >> 26) & 1;  // PDPE1GB
+    }
+
+    // PCIDs only with global pages, which the full flush relies on to reach every PCID.
+    // CR3 bits 0-11 are zero here, as turning on PCIDE requires
+    __asm__ volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1u), "c"(0));
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    if ((edx >> 13) & 1) cr4 |= CR4_PGE;
+    pcid = ((edx >> 13) & 1) && ((ecx >> 17) & 1);
+    if (pcid) cr4 |= CR4_PCIDE;
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+int paging_1g_pages(void) {
+    return huge;
+}
+
+int paging_pcid(void) {
+    return pcid;
+}
+
+/* ============================================================================
+   TABLES AND TLB
+   ============================================================================ */
+
+/* Bytes one entry covers at level (1 = 4KB pages ... 4 = 512GB) */
+static uint64_t level_size(int level) {
+    return 1ull << (12 + 9 * (level - 1));
+}
+
+static unsigned level_index(uint64_t virt, int level) {
+    return (unsigned)(virt >> (12 + 9 * (level - 1))) & 511;
+}
+
+static uint64_t *table_at(uint64_t entry) {
+    return (uint64_t *)(uintptr_t)(entry & ENTRY_ADDR);
+}
+
+static uint64_t *new_table(void) {
+    uint64_t phys = callbacks.table_alloc ? callbacks.table_alloc() : 0;
+    if (!phys) return 0;
+    return (uint64_t *)(uintptr_t)phys;  // Comes zeroed: every entry not present
+}
+
+/* A present entry for virt changed: its TLB entry has to go. invlpg only reaches the running
+   PCID's paging-structure caches, so a shared mapping other spaces may have cached takes a
+   full flush */
+static void stale(uint64_t virt) {
+    if (pcid && spaces > 0 && virt < PAGING_USER_BASE) nstale = FLUSH_MAX + 1;
+    if (nstale < FLUSH_MAX) stale_pages[nstale] = virt;
+    if (nstale <= FLUSH_MAX) nstale++;
+}
+
+static void flush(void) {
+    if (nstale > FLUSH_MAX) {
+        uint64_t cr4;
+        __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+        if (cr4 & CR4_PGE) {
+            // Reloading CR3 keeps global pages; turning PGE off and on drops them too, for every PCID
+            __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+            __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4) : "memory");
+        } else {
+            uint64_t cr3;
+            __asm__ volatile ("mov %%cr3, %0" : "=r"(cr3));
+            __asm__ volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+        }
+    } else {
+        for (int i = 0; i < nstale; ++i) {
+            __asm__ volatile ("invlpg (%0)" : : "r"(stale_pages[i]) : "memory");
+        }
+    }
+    nstale = 0;
+}
+
+/* Free a table and the tables below it, whose pages a larger page now covers. level is the
+   table's own level */
+static void free_tables(uint64_t *table, int level) {
+    if (level > 1) {
+        for (int i = 0; i < 512; ++i) {
+            if ((table[i] & ENTRY_PRESENT) && !(table[i] & ENTRY_LARGE)) free_tables(table_at(table[i]), level - 1);
+        }
+    }
+    if (callbacks.table_free) callbacks.table_free((uint64_t)(uintptr_t)table);
+}
+
+/* Replace the large page in *entry (at level, mapping virt) with a table of pages of the
+   next size mapping the same memory. Returns 0, or -1 if no table could be allocated */
+static int split(uint64_t *entry, int level, uint64_t virt) {
+    uint64_t *t = new_table();
+    if (!t) return -1;
+    uint64_t child = level_size(level - 1);
+    uint64_t phys = *entry & ENTRY_ADDR & ~(level_size(level) - 1);
+    uint64_t flags = (*entry & ENTRY_FLAGS) | ENTRY_PRESENT | (level - 1 > 1 ? ENTRY_LARGE : 0);
+    for (uint64_t i = 0; i < 512; ++i) t[i] = (phys + i * child) | flags;
+    *entry = (uint64_t)(uintptr_t)t | TABLE_FLAGS;
+    stale(virt & ~(level_size(level) - 1));  // Same translations, but a different page size
+    return 0;
+}
+
+/* Entry for virt at level, creating tables and splitting larger pages on the way down. NULL
+   if a table could not be allocated */
+static uint64_t *walk_create(uint64_t virt, int level) {
+    uint64_t *table = l4;
+    for (int l = 4; l > level; --l) {
+        uint64_t *e = &table[level_index(virt, l)];
+        if (!(*e & ENTRY_PRESENT)) {
+            uint64_t *t = new_table();
+            if (!t) return 0;
+            *e = (uint64_t)(uintptr_t)t | TABLE_FLAGS;
+        } else if (*e & ENTRY_LARGE) {
+            if (split(e, l, virt) != 0) return 0;
+        }
+        table = table_at(*e);
+    }
+    return &table[level_index(virt, level)];
+}
+
+/* ============================================================================
+   MAPPING
+   ============================================================================ */
+
+int paging_map(uint64_t virt, uint64_t phys, uint64_t len, uint64_t flags) {
+    if (!l4 || ((virt | phys) & (PAGE_SIZE - 1))) return -1;
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (virt >= VIRT_LIMIT || len > VIRT_LIMIT - virt) return -1;
+
+    int r = 0;
+    while (len > 0) {
+        int level = 1;
+        if (huge && !((virt | phys) & (PAGE_SIZE_1G - 1)) && len >= PAGE_SIZE_1G) level = 3;
+        else if (!((virt | phys) & (PAGE_SIZE_2M - 1)) && len >= PAGE_SIZE_2M) level = 2;
+
+        uint64_t *e = walk_create(virt, level);
+        if (!e) {
+            r = -1;
+            break;
+        }
+        uint64_t f = flags & ENTRY_FLAGS;
+        if (virt >= PAGING_USER_BASE) f &= ~(uint64_t)PAGE_GLOBAL;  // Would show through in other spaces
+        uint64_t old = *e;
+        *e = phys | f | ENTRY_PRESENT | (level > 1 ? ENTRY_LARGE : 0);
+        if ((old & ENTRY_PRESENT) && level > 1 && !(old & ENTRY_LARGE)) {
+            free_tables(table_at(old), level - 1);
+            nstale = FLUSH_MAX + 1;  // Every small page the tables mapped may be cached
+        } else if (old & ENTRY_PRESENT) {
+            stale(virt);
+        }
+        uint64_t size = level_size(level);
+        virt += size;
+        phys += size;
+        len -= size;
+    }
+    flush();
+    return r;
+}
+
+int paging_unmap(uint64_t virt, uint64_t len) {
+    if (!l4 || (virt & (PAGE_SIZE - 1))) return -1;
+    len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (virt >= VIRT_LIMIT || len > VIRT_LIMIT - virt) return -1;
+
+    int r = 0;
+    while (len > 0 && r == 0) {
+        uint64_t *table = l4;
+        for (int l = 4; l >= 1; --l) {
+            uint64_t *e = &table[level_index(virt, l)];
+            uint64_t size = level_size(l);
+            if (!(*e & ENTRY_PRESENT)) {
+                // Nothing mapped up to the end of this entry's range
+                uint64_t skip = size - (virt & (size - 1));
+                if (skip > len) skip = len;
+                virt += skip;
+                len -= skip;
+                break;
+            }
+            if (l == 1 || (*e & ENTRY_LARGE)) {
+                if (!(virt & (size - 1)) && len >= size) {
+                    *e = 0;
+                    stale(virt);
+                    virt += size;
+                    len -= size;
+                    break;
+                }
+                // Only part of this page goes: split it and go on into the new table
+                if (split(e, l, virt) != 0) {
+                    r = -1;
+                    break;
+                }
+            }
+            table = table_at(*e);
+        }
+    }
+    flush();
+    return r;
+}
+
+int paging_translate(uint64_t virt, uint64_t *phys) {
+    if (!l4 || virt >= VIRT_LIMIT) return -1;
+    uint64_t *table = l4;
+    for (int l = 4; l >= 1; --l) {
+        uint64_t e = table[level_index(virt, l)];
+        if (!(e & ENTRY_PRESENT)) return -1;
+        if (l == 1 || (e & ENTRY_LARGE)) {
+            uint64_t size = level_size(l);
+            *phys = (e & ENTRY_ADDR & ~(size - 1)) + (virt & (size - 1));
+            return 0;
+        }
+        table = table_at(e);
+    }
+    return -1;
+}
+
+/* Add up the pages mapped through table (at level) and the tables below it */
+static void count_pages(const uint64_t *table, int level, paging_stats_t *st) {
+    st->tables++;
+    for (int i = 0; i < 512; ++i) {
+        uint64_t e = table[i];
+        if (!(e & ENTRY_PRESENT)) continue;
+        if (level > 1 && !(e & ENTRY_LARGE)) {
+            count_pages(table_at(e), level - 1, st);
+            continue;
+        }
+        if (level == 1) st->pages_4k++;
+        else if (level == 2) st->pages_2m++;
+        else st->pages_1g++;
+        if (e & PAGE_GLOBAL) st->global++;
+    }
+}
+
+void paging_stats(paging_stats_t *st) {
+    kmemset(st, 0, sizeof(*st));
+    if (l4) count_pages(l4, 4, st);
+}
+
+/* ============================================================================
+   ADDRESS SPACES
+   ============================================================================ */
+
+int paging_space_create(paging_space_t *as) {
+    uint16_t id = 0;
+    if (pcid) {
+        for (id = 1; id < PCID_COUNT && (pcid_used[id / 8] & (1u << (id % 8))); ++id) {}
+        if (id == PCID_COUNT) return -1;
+    }
+    uint64_t *t = new_table();
+    if (!t) return -1;
+    for (unsigned i = 0; i < KERNEL_SLOTS; ++i) t[i] = kernel_space.l4[i];
+    if (pcid) pcid_used[id / 8] |= (uint8_t)(1u << (id % 8));
+    as->l4 = t;
+    as->pcid = id;
+    as->flush = 1;  // A PCID given back by a destroyed space may still tag its translations
+    spaces++;
+    return 0;
+}
+
+void paging_space_switch(paging_space_t *as) {
+    if (!as) as = &kernel_space;
+    uint64_t cr3 = (uint64_t)(uintptr_t)as->l4;
+    if (pcid) {
+        cr3 |= as->pcid;
+        if (!as->flush) cr3 |= CR3_NOFLUSH;
+        as->flush = 0;
+    }
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    current = as;
+    l4 = as->l4;
+}
+
+int paging_space_destroy(paging_space_t *as) {
+    if (!as || as == current || as == &kernel_space || !as->l4) return -1;
+    for (unsigned i = KERNEL_SLOTS; i < 512; ++i) {
+        if (as->l4[i] & ENTRY_PRESENT) free_tables(table_at(as->l4[i]), 3);
+    }
+    if (callbacks.table_free) callbacks.table_free((uint64_t)(uintptr_t)as->l4);
+    if (pcid) pcid_used[as->pcid / 8] &= (uint8_t)~(1u << (as->pcid % 8));
+    as->l4 = 0;
+    spaces--;
+    return 0;
+}
@@ -0,0 +1,91 @@
+/* paging.h - Page tables: map and unmap 4KB, 2MB and 1GB pages in the 4-level hierarchy */
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PAGE_SIZE    0x1000ull      // Smallest page, and the alignment paging_map takes
+#define PAGE_SIZE_2M 0x200000ull
+#define PAGE_SIZE_1G 0x40000000ull  // Only with CPUID PDPE1GB (paging_1g_pages)
+
+/* Below this (the first level 4 entry, 512GB) are the kernel's mappings, shared by every
+   address space; from here up each space has its own */
+#define PAGING_USER_BASE 0x8000000000ull
+
+/* Mapping flags: page table entry bits (present is implied) */
+#define PAGE_WRITE        0x002
+#define PAGE_USER         0x004
+#define PAGE_WRITETHROUGH 0x008
+#define PAGE_NOCACHE      0x010
+#define PAGE_GLOBAL       0x100    // Kept in the TLB across address space switches (kernel range only)
+
+/* Callbacks - must be provided by kernel */
+typedef struct {
+    uint64_t (*table_alloc)(void);     // Physical address of a zeroed page for a table, 0 if none;
+                                       // it must be mapped at that same address
+    void (*table_free)(uint64_t phys); // Optional (may be NULL): a table paging_map made redundant
+} paging_callbacks_t;
+
+/* Pages currently mapped, by size, and the tables holding them */
+typedef struct {
+    uint64_t pages_4k;
+    uint64_t pages_2m;
+    uint64_t pages_1g;
+    uint64_t global;      // Pages of any size marked global
+    uint64_t tables;
+} paging_stats_t;
+
+/* An address space: its own level 4 table, sharing the kernel's entries, tagged with a PCID
+   so that switching to it keeps other spaces' translations in the TLB */
+typedef struct {
+    uint64_t *l4;
+    uint16_t pcid;        // 0 for the kernel's space, or when the CPU has no PCIDs
+    uint8_t flush;        // Flag: the PCID may hold another space's translations
+} paging_space_t;
+
+/* Set the callbacks that the page table manager will use */
+void paging_set_callbacks(const paging_callbacks_t *callbacks);
+
+/* Take over the tables the CPU runs on (CR3, main.asm's identity map of the first 1GB) as
+   the kernel's address space, check which page sizes the CPU has, and turn on global pages
+   (CR4.PGE) and PCIDs (CR4.PCIDE) where CPUID reports them */
+void paging_init(void);
+
+/* Check if the CPU maps 1GB pages */
+int paging_1g_pages(void);
+
+/* Check if address spaces are tagged with PCIDs */
+int paging_pcid(void);
+
+/* Make a new address space sharing the kernel's mappings. Returns 0, or -1 if no table or
+   PCID is left */
+int paging_space_create(paging_space_t *as);
+
+/* Run on address space as (NULL for the kernel's); paging_map and paging_unmap then change
+   it. Global pages, and with PCIDs every space's own translations, stay in the TLB */
+void paging_space_switch(paging_space_t *as);
+
+/* Free an address space's own tables and its PCID. Returns 0, or -1 if it is the one
+   running or the kernel's */
+int paging_space_destroy(paging_space_t *as);
+
+/* Map virt..virt+len-1 to phys..phys+len-1 with flags in the running address space,
+   replacing what was there, using the largest pages the alignment of both addresses allows
+   (PAGE_GLOBAL is dropped from PAGING_USER_BASE up). Larger pages that only partly
+   overlap are split first. virt and phys must be page aligned; len is rounded up to pages.
+   Returns 0, or -1 if a table could not be allocated (the range may be partly mapped) */
+int paging_map(uint64_t virt, uint64_t phys, uint64_t len, uint64_t flags);
+
+/* Remove the mappings of virt..virt+len-1 (page aligned; len rounded up), splitting larger
+   pages that reach outside it. Returns 0, or -1 if a table for a split could not be
+   allocated */
+int paging_unmap(uint64_t virt, uint64_t len);
+
+/* Physical address virt is mapped to. Returns 0, or -1 if it is not mapped */
+int paging_translate(uint64_t virt, uint64_t *phys);
+
+/* Count the mapped pages by walking the tables */
+void paging_stats(paging_stats_t *st);
+
+#endif
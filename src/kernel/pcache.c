@@ -0,0 +1,131 @@
+/* pcache.c - Page cache for file data
+ *
+ * Pages are keyed by file and page index rather than by disk location, so
+ * they stay valid when a file's clusters move and every reader of a file
+ * shares the same copy. Replacement is least recently used; dirty pages are
+ * written back when evicted or flushed.
+ */
+#include "pcache.h"
+#include "kstring.h"
+
+typedef struct {
+    const pcache_ops_t *ops;  // Owning filesystem (NULL when the slot is free)
+    void *fs;
+    int ino;
+    uint32_t index;           // Page index within the file
+    uint32_t last_used;       // Value of use_clock at the last access
+    int dirty;                // Flag: 1 if the page differs from storage
+} pcache_slot_t;
+
+static uint8_t pages[PCACHE_PAGES][PCACHE_PAGE_SIZE] __attribute__((aligned(PCACHE_PAGE_SIZE)));
+static pcache_slot_t slots[PCACHE_PAGES];
+static uint32_t use_clock = 0;   // Incremented on every access, orders pages by recency
+static pcache_stats_t stats;
+
+void pcache_init(void) {
+    for (int i = 0; i < PCACHE_PAGES; ++i) {
+        slots[i].ops = 0;
+        slots[i].dirty = 0;
+    }
+    use_clock = 0;
+    stats.hits = stats.misses = stats.writebacks = 0;
+}
+
+/* Does slot s belong to (ops, fs, ino)? ino < 0 matches every file */
+static int slot_matches(const pcache_slot_t *s, const pcache_ops_t *ops, void *fs, int ino) {
+    return s->ops == ops && s->fs == fs && (ino < 0 || s->ino == ino);
+}
+
+/* Write back one dirty slot */
+static int slot_writeback(int i) {
+    pcache_slot_t *s = &slots[i];
+    if (!s->dirty) return 0;
+    if (s->ops->writeback(s->fs, s->ino, s->index, pages[i]) != 0) return -1;
+    s->dirty = 0;
+    stats.writebacks++;
+    return 0;
+}
+
+/* Pick a slot for a new page: a free one, else the least recently used (written back first) */
+static int slot_claim(void) {
+    int victim = -1;
+    for (int i = 0; i < PCACHE_PAGES; ++i) {
+        if (!slots[i].ops) return i;
+        if (victim < 0 || use_clock - slots[i].last_used > use_clock - slots[victim].last_used) victim = i;
+    }
+    if (slot_writeback(victim) != 0) return -1;
+    slots[victim].ops = 0;
+    return victim;
+}
+
+uint8_t *pcache_get(const pcache_ops_t *ops, void *fs, int ino, uint32_t index, int flags) {
+    use_clock++;
+    for (int i = 0; i < PCACHE_PAGES; ++i) {
+        pcache_slot_t *s = &slots[i];
+        if (slot_matches(s, ops, fs, ino) && s->index == index) {
+            s->last_used = use_clock;
+            if (flags & PCACHE_DIRTY) s->dirty = 1;
+            stats.hits++;
+            return pages[i];
+        }
+    }
+
+    int i = slot_claim();
+    if (i < 0) return 0;
+    if (!(flags & PCACHE_NOFILL) && ops->fill(fs, ino, index, pages[i]) != 0) return 0;
+    stats.misses++;
+
+    pcache_slot_t *s = &slots[i];
+    s->ops = ops;
+    s->fs = fs;
+    s->ino = ino;
+    s->index = index;
+    s->last_used = use_clock;
+    s->dirty = (flags & PCACHE_DIRTY) ? 1 : 0;
+    return pages[i];
+}
+
+void pcache_invalidate(const pcache_ops_t *ops, void *fs, int ino, uint32_t from) {
+    for (int i = 0; i < PCACHE_PAGES; ++i) {
+        if (slot_matches(&slots[i], ops, fs, ino) && slots[i].index >= from) {
+            slots[i].ops = 0;
+            slots[i].dirty = 0;
+        }
+    }
+}
+
+void pcache_truncate(const pcache_ops_t *ops, void *fs, int ino, uint32_t size) {
+    uint32_t last = size / PCACHE_PAGE_SIZE;  // Page holding the new end of file
+    uint32_t tail = size % PCACHE_PAGE_SIZE;
+
+    // Bytes past the end of file must read back as zeros if the file grows again
+    if (tail) {
+        for (int i = 0; i < PCACHE_PAGES; ++i) {
+            if (!slot_matches(&slots[i], ops, fs, ino) || slots[i].index != last) continue;
+            kmemset(pages[i] + tail, 0, PCACHE_PAGE_SIZE - tail);
+        }
+        last++;
+    }
+    pcache_invalidate(ops, fs, ino, last);
+}
+
+int pcache_flush(const pcache_ops_t *ops, void *fs, int ino, size_t max) {
+    for (int i = 0; i < PCACHE_PAGES && max > 0; ++i) {
+        if (!slot_matches(&slots[i], ops, fs, ino) || !slots[i].dirty) continue;
+        if (slot_writeback(i) != 0) return -1;
+        max--;
+    }
+    return 0;
+}
+
+size_t pcache_dirty_count(const pcache_ops_t *ops, void *fs) {
+    size_t n = 0;
+    for (int i = 0; i < PCACHE_PAGES; ++i) {
+        if (slot_matches(&slots[i], ops, fs, -1) && slots[i].dirty) n++;
+    }
+    return n;
+}
+
+void pcache_get_stats(pcache_stats_t *out) {
+    *out = stats;
+}
@@ -0,0 +1,51 @@
+/* pcache.h - Page cache for file data */
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PCACHE_PAGE_SIZE 4096   // File data is cached in 4KB pages
+#define PCACHE_PAGES 32         // Pages in the cache (128KB)
+
+/* pcache_get flags */
+#define PCACHE_NOFILL 0x01      // Caller overwrites the whole page, don't read it in
+#define PCACHE_DIRTY 0x02       // Caller modifies the page, write it back later
+
+/* How a filesystem moves pages between the cache and its storage. A page is
+   identified by (ops, fs, inode, index) where index is the file offset / PCACHE_PAGE_SIZE */
+typedef struct {
+    int (*fill)(void *fs, int ino, uint32_t index, uint8_t *page);             // Read a page, zeros past end of file
+    int (*writeback)(void *fs, int ino, uint32_t index, const uint8_t *page);  // Write the part of a page inside the file
+} pcache_ops_t;
+
+/* Cache statistics */
+typedef struct {
+    uint64_t hits;        // pcache_get calls served from memory
+    uint64_t misses;      // pcache_get calls that had to fill a page
+    uint64_t writebacks;  // Dirty pages written back
+} pcache_stats_t;
+
+/* Drop every page */
+void pcache_init(void);
+
+/* Get a page of a file, reading it in (unless PCACHE_NOFILL) and evicting the least recently
+   used page if needed. The pointer is valid until the next pcache call. Returns NULL on failure */
+uint8_t *pcache_get(const pcache_ops_t *ops, void *fs, int ino, uint32_t index, int flags);
+
+/* Discard cached pages of a file (ino < 0: of every file on fs) from page index 'from' on,
+   dirty or not. Used when the data they hold no longer belongs to the file */
+void pcache_invalidate(const pcache_ops_t *ops, void *fs, int ino, uint32_t from);
+
+/* A file was shrunk to size bytes: zero the cached bytes past the new end and drop later pages */
+void pcache_truncate(const pcache_ops_t *ops, void *fs, int ino, uint32_t size);
+
+/* Write back up to max dirty pages of fs (ino < 0: of every file). Returns 0, or -1 if a write failed */
+int pcache_flush(const pcache_ops_t *ops, void *fs, int ino, size_t max);
+
+/* Number of dirty pages belonging to fs */
+size_t pcache_dirty_count(const pcache_ops_t *ops, void *fs);
+
+void pcache_get_stats(pcache_stats_t *stats);
+
+#endif
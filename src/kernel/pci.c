@@ -0,0 +1,78 @@
+/* pci.c - PCI configuration space access
+ *
+ * Uses configuration mechanism #1: the address of a 32-bit register (bus,
+ * slot, function, offset) goes to port 0xCF8 and the register is read or
+ * written through port 0xCFC. Enough to find a controller by class and learn
+ * where its registers are.
+ */
+#include "pci.h"
+#include "io.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+static uint32_t config_address(pci_addr_t a, uint8_t off) {
+    return 0x80000000u | ((uint32_t)a.bus << 16) | ((uint32_t)(a.slot & 0x1F) << 11) |
+           ((uint32_t)(a.func & 0x07) << 8) | (off & 0xFC);
+}
+
+uint32_t pci_read32(pci_addr_t a, uint8_t off) {
+    outl(PCI_CONFIG_ADDRESS, config_address(a, off));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write32(pci_addr_t a, uint8_t off, uint32_t val) {
+    outl(PCI_CONFIG_ADDRESS, config_address(a, off));
+    outl(PCI_CONFIG_DATA, val);
+}
+
+int pci_find_class(uint8_t cls, uint8_t subclass, int index, pci_addr_t *out) {
+    for (uint32_t bus = 0; bus < 256; ++bus) {
+        for (uint8_t slot = 0; slot < 32; ++slot) {
+            for (uint8_t func = 0; func < 8; ++func) {
+                pci_addr_t a = { (uint8_t)bus, slot, func };
+                uint32_t id = pci_read32(a, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) {
+                    if (func == 0) break;  // No device in this slot
+                    continue;
+                }
+                uint32_t class_reg = pci_read32(a, PCI_CLASS);
+                if ((class_reg >> 24) == cls && ((class_reg >> 16) & 0xFF) == subclass && index-- == 0) {
+                    *out = a;
+                    return 0;
+                }
+                // Functions 1-7 only exist on multi-function devices (header type bit 7)
+                if (func == 0 && !((pci_read32(a, 0x0C) >> 16) & 0x80)) break;
+            }
+        }
+    }
+    return -1;
+}
+
+uint32_t pci_bar(pci_addr_t a, int n) {
+    uint32_t bar = pci_read32(a, (uint8_t)(PCI_BAR0 + 4 * n));
+    return (bar & 1) ? (bar & ~0x3u) : (bar & ~0xFu);
+}
+
+uint64_t pci_bar64(pci_addr_t a, int n) {
+    uint32_t bar = pci_read32(a, (uint8_t)(PCI_BAR0 + 4 * n));
+    uint64_t addr = bar & ~0xFu;
+    if ((bar & 0x7) == 0x4) addr |= (uint64_t)pci_read32(a, (uint8_t)(PCI_BAR0 + 4 * (n + 1))) << 32;  // Type 2: 64-bit
+    return addr;
+}
+
+int pci_irq(pci_addr_t a) {
+    uint32_t reg = pci_read32(a, PCI_INTERRUPT);
+    uint8_t line = reg & 0xFF, pin = (reg >> 8) & 0xFF;
+    return pin && line < 16 ? line : -1;  // 0xFF: not connected
+}
+
+void pci_enable(pci_addr_t a, uint16_t bits) {
+    uint32_t cmd = pci_read32(a, PCI_COMMAND);
+    pci_write32(a, PCI_COMMAND, (cmd & 0xFFFF) | bits);  // Writing 0 to the status half changes nothing
+}
+
+void pci_disable(pci_addr_t a, uint16_t bits) {
+    uint32_t cmd = pci_read32(a, PCI_COMMAND);
+    pci_write32(a, PCI_COMMAND, cmd & 0xFFFF & ~(uint32_t)bits);
+}
@@ -0,0 +1,50 @@
+/* pci.h - PCI configuration space access (configuration mechanism #1) */
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+/* Location of a PCI function */
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+} pci_addr_t;
+
+/* Standard configuration header offsets */
+#define PCI_VENDOR_ID 0x00
+#define PCI_COMMAND   0x04  // Low 16 bits: command register, high 16 bits: status
+#define PCI_CLASS     0x08  // Revision, prog IF, subclass, class (low to high byte)
+#define PCI_BAR0      0x10  // Base address registers, 4 bytes apart
+#define PCI_INTERRUPT 0x3C  // Low byte: interrupt line (PIC IRQ), next byte: interrupt pin (0: none)
+
+#define PCI_COMMAND_IO     0x0001  // Respond to I/O space accesses
+#define PCI_COMMAND_MEMORY 0x0002  // Respond to memory space accesses
+#define PCI_COMMAND_MASTER 0x0004  // May act as bus master (DMA)
+#define PCI_COMMAND_INTX_DISABLE 0x0400  // Do not assert the legacy interrupt pin
+
+/* Read or write a 32-bit register (off is rounded down to a multiple of 4) */
+uint32_t pci_read32(pci_addr_t a, uint8_t off);
+void pci_write32(pci_addr_t a, uint8_t off, uint32_t val);
+
+/* Find the index-th function (counting from 0) with the given class and subclass. Returns 0
+   and sets *out if found, -1 if not */
+int pci_find_class(uint8_t cls, uint8_t subclass, int index, pci_addr_t *out);
+
+/* Base address register n with its flag bits masked off (I/O or 32-bit memory) */
+uint32_t pci_bar(pci_addr_t a, int n);
+
+/* Base address register n as a memory address, taking the next register as the high half
+   if n is a 64-bit memory BAR */
+uint64_t pci_bar64(pci_addr_t a, int n);
+
+/* Legacy interrupt (IRQ) the function raises, -1 if it has no interrupt pin */
+int pci_irq(pci_addr_t a);
+
+/* Set bits in the command register */
+void pci_enable(pci_addr_t a, uint16_t bits);
+
+/* Clear bits in the command register */
+void pci_disable(pci_addr_t a, uint16_t bits);
+
+#endif
@@ -0,0 +1,478 @@
+/* raid.c - Software RAID over several disks
+ *
+ * Presents two to four disks as one volume. RAID-0 deals the volume out in
+ * stripe units: unit k lives on member k % n, so a long transfer becomes one
+ * command per unit spread over every member. RAID-1 keeps a full copy on each
+ * member: writes go to all of them, and reads are cut into stripe-sized
+ * pieces that each go to a member with nothing in flight, the one whose head
+ * is nearest first. Commands are started with the members' overlapped I/O
+ * callbacks and only waited for when that member is needed again (or at the
+ * end of the request), so members on different channels transfer at the same
+ * time. A mirror whose command fails is dropped and a read it was serving is
+ * done again on another copy.
+ *
+ * The last sector of every RAID-1 member holds a superblock: an event count
+ * that goes up whenever the set of working mirrors changes, and which members
+ * were out of it then. It is rewritten on the surviving members as soon as a
+ * mirror is dropped, before the request that dropped it returns. At assembly
+ * the members whose superblock is behind the newest one, or that the newest
+ * one lists as failed, stay out until raid_resync copies the volume onto them,
+ * so a stale mirror never serves reads after a reboot.
+ */
+#include "raid.h"
+#include "kstring.h"
+#include "crc32c.h"
+
+#define RAID_SECTOR 512
+#define SB_MAGIC 0x31444952u  // "RID1"
+
+/* Superblock in the last sector of each RAID-1 member */
+typedef struct {
+    uint32_t magic;
+    uint32_t members;      // Members in the volume
+    uint32_t slot;         // Which one this disk is
+    uint32_t failed;       // Bit m: member m was out of sync when this was written
+    uint64_t events;       // Goes up with every change of the working set
+    uint32_t crc;          // CRC32C of the fields before it
+} __attribute__((packed)) raid_super_t;
+
+typedef struct {
+    raid_member_stats_t st;
+    int inflight;      // Flag: a command was submitted and not waited for yet
+    uint64_t started;  // When the command in flight was submitted (submission count)
+    int write;         // Command in flight, so a failed read can be done again elsewhere
+    uint32_t lba;
+    uint32_t count;
+    uint8_t *buf;
+} raid_member_t;
+
+static raid_callbacks_t callbacks;
+static int level = -1;
+static int nmembers = 0;
+static uint32_t stripe = RAID_DEFAULT_STRIPE;
+static uint32_t volume_sectors = 0;
+static uint64_t submitted = 0;
+static raid_member_t members[RAID_MAX_MEMBERS];
+static uint64_t events = 0;       // RAID-1: event count of the superblocks
+static int state_changed = 0;    // Flag: a mirror was dropped, the superblocks are behind
+static uint8_t super_buf[RAID_MAX_MEMBERS][RAID_SECTOR];
+static uint8_t resync_buf[RAID_MAX_STRIPE * RAID_SECTOR];
+
+void raid_set_callbacks(const raid_callbacks_t *cb) {
+    callbacks = *cb;
+}
+
+static int assemble(void);
+
+int raid_init(int lvl, const int *devs, const uint32_t *sizes, int n, uint32_t stripe_sectors) {
+    level = -1;
+    nmembers = 0;
+    volume_sectors = 0;
+    if ((lvl != 0 && lvl != 1) || n < 2 || n > RAID_MAX_MEMBERS || stripe_sectors == 0 ||
+        stripe_sectors > RAID_MAX_STRIPE) {
+        return -1;
+    }
+
+    // Every member contributes as much as the smallest one has
+    uint32_t smallest = sizes[0];
+    for (int i = 0; i < n; ++i) {
+        if (sizes[i] < smallest) smallest = sizes[i];
+        kmemset(&members[i], 0, sizeof(members[i]));
+        members[i].st.dev = devs[i];
+    }
+    // RAID-1 keeps the last sector of each member for its superblock
+    uint32_t size = lvl == 0 ? smallest / stripe_sectors * stripe_sectors * (uint32_t)n : smallest - 1;
+    if (smallest == 0 || size == 0) return -1;
+
+    level = lvl;
+    nmembers = n;
+    stripe = stripe_sectors;
+    volume_sectors = size;
+    return lvl == 1 ? assemble() : 0;
+}
+
+int raid_level(void) {
+    return level;
+}
+
+uint32_t raid_sectors(void) {
+    return volume_sectors;
+}
+
+uint32_t raid_stripe(void) {
+    return stripe;
+}
+
+int raid_members(void) {
+    return nmembers;
+}
+
+void raid_member_stats(int i, raid_member_stats_t *st) {
+    if (i >= 0 && i < nmembers) *st = members[i].st;
+}
+
+/* ============================================================================
+   MEMBER COMMANDS
+   ============================================================================ */
+
+static int live_members(void) {
+    int live = 0;
+    for (int m = 0; m < nmembers; ++m) live += !members[m].st.failed;
+    return live;
+}
+
+/* Member to serve a read at lba: an idle one with its head nearest, otherwise the one
+   that has been busy longest. -1 if every member failed */
+static int pick_reader(uint32_t lba) {
+    int best = -1;
+    for (int m = 0; m < nmembers; ++m) {
+        const raid_member_t *c = &members[m];
+        if (c->st.failed) continue;
+        if (best < 0) { best = m; continue; }
+        const raid_member_t *b = &members[best];
+        if (c->inflight != b->inflight) {
+            if (!c->inflight) best = m;
+        } else if (c->inflight) {
+            if (c->started < b->started) best = m;
+        } else {
+            uint32_t dc = c->st.head > lba ? c->st.head - lba : lba - c->st.head;
+            uint32_t db = b->st.head > lba ? b->st.head - lba : lba - b->st.head;
+            if (dc < db) best = m;
+        }
+    }
+    return best;
+}
+
+static int start(int m, int write, uint32_t lba, uint32_t count, uint8_t *buf);
+
+/* Wait for member m's command, if it has one. Returns its result */
+static int wait_member(int m) {
+    raid_member_t *mb = &members[m];
+    if (!mb->inflight) return 0;
+    mb->inflight = 0;
+    if (callbacks.complete(mb->st.dev) == 0) return 0;
+    if (level == 0) return -1;
+
+    // Drop the mirror; the others hold the data a write put there
+    mb->st.failed = 1;
+    state_changed = 1;
+    if (mb->write) return live_members() ? 0 : -1;
+    int other = pick_reader(mb->lba);
+    if (other < 0 || start(other, 0, mb->lba, mb->count, mb->buf) != 0) return -1;
+    return wait_member(other);
+}
+
+/* Start a command on member m once its previous one is done. Returns -1 if either fails */
+static int start(int m, int write, uint32_t lba, uint32_t count, uint8_t *buf) {
+    raid_member_t *mb = &members[m];
+    int r = wait_member(m);
+    if (callbacks.submit(mb->st.dev, write, lba, count, buf) != 0) {
+        if (level == 1) {
+            mb->st.failed = 1;
+            state_changed = 1;
+        }
+        return -1;
+    }
+    mb->inflight = 1;
+    mb->started = ++submitted;
+    mb->write = write;
+    mb->lba = lba;
+    mb->count = count;
+    mb->buf = buf;
+    if (write) {
+        mb->st.writes++;
+        mb->st.sectors_written += count;
+    } else {
+        mb->st.reads++;
+        mb->st.sectors_read += count;
+    }
+    mb->st.head = lba + count;
+    return r;
+}
+
+static int wait_all(void) {
+    int r = 0;
+    for (int m = 0; m < nmembers; ++m) {
+        if (wait_member(m) != 0) r = -1;
+    }
+    return r;
+}
+
+/* ============================================================================
+   SUPERBLOCKS (RAID-1)
+   ============================================================================ */
+
+static uint32_t super_lba(void) {
+    return volume_sectors;  // The sector after the volume
+}
+
+/* Member m's superblock from super_buf, if it belongs to this volume. Returns 0 if valid */
+static int super_valid(int m) {
+    const raid_super_t *sb = (const raid_super_t *)super_buf[m];
+    if (sb->magic != SB_MAGIC || sb->crc != crc32c(0, sb, offsetof(raid_super_t, crc))) return -1;
+    return sb->members == (uint32_t)nmembers && sb->slot == (uint32_t)m ? 0 : -1;
+}
+
+/* Record the working set under a new event count on every working member, made durable
+   before returning. A member that fails meanwhile is dropped and the round repeated.
+   Returns 0, or -1 if no member could store it */
+static int super_write(void) {
+    int r = -1;
+    for (int round = 0; round <= nmembers; ++round) {
+        state_changed = 0;
+        uint32_t failed = 0;
+        for (int m = 0; m < nmembers; ++m) failed |= (uint32_t)members[m].st.failed << m;
+        events++;
+        for (int m = 0; m < nmembers; ++m) {
+            if (members[m].st.failed) continue;
+            raid_super_t *sb = (raid_super_t *)super_buf[m];
+            kmemset(super_buf[m], 0, RAID_SECTOR);
+            sb->magic = SB_MAGIC;
+            sb->members = (uint32_t)nmembers;
+            sb->slot = (uint32_t)m;
+            sb->failed = failed;
+            sb->events = events;
+            sb->crc = crc32c(0, sb, offsetof(raid_super_t, crc));
+            start(m, 1, super_lba(), 1, super_buf[m]);
+        }
+        r = wait_all();
+        for (int m = 0; m < nmembers; ++m) {
+            if (!members[m].st.failed && callbacks.flush && callbacks.flush(members[m].st.dev) != 0) {
+                members[m].st.failed = 1;
+                state_changed = 1;
+            }
+        }
+        if (!state_changed) break;
+    }
+    return live_members() ? r : -1;
+}
+
+/* Called at the end of every request: if it dropped a mirror, say so on the others */
+static int super_update(int r) {
+    if (level == 1 && state_changed && super_write() != 0) return -1;
+    return r;
+}
+
+/* Read every member's superblock and keep the ones that are behind out of the volume. A
+   volume with no superblocks anywhere is new and in sync by definition. Returns 0, or -1
+   if no member can be used */
+static int assemble(void) {
+    uint64_t newest = 0;
+    int found = -1;
+    events = 0;
+    state_changed = 0;
+    for (int m = 0; m < nmembers; ++m) {
+        kmemset(super_buf[m], 0, RAID_SECTOR);
+        if (callbacks.submit(members[m].st.dev, 0, super_lba(), 1, super_buf[m]) != 0 ||
+            callbacks.complete(members[m].st.dev) != 0) {
+            members[m].st.failed = 1;
+            continue;
+        }
+        const raid_super_t *sb = (const raid_super_t *)super_buf[m];
+        if (super_valid(m) == 0 && (found < 0 || sb->events > newest)) {
+            newest = sb->events;
+            found = m;
+        }
+    }
+    if (found >= 0) {
+        uint32_t failed = ((const raid_super_t *)super_buf[found])->failed;
+        for (int m = 0; m < nmembers; ++m) {
+            const raid_super_t *sb = (const raid_super_t *)super_buf[m];
+            if (super_valid(m) != 0 || sb->events < newest || (failed & (1u << m))) members[m].st.failed = 1;
+        }
+        events = newest;
+    }
+    if (super_write() != 0) {
+        level = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* ============================================================================
+   VOLUME I/O
+   ============================================================================ */
+
+/* RAID-0: one command per stripe unit the request touches, on the member that holds it */
+static int striped_io(int write, uint32_t lba, uint32_t count, uint8_t *buf) {
+    int r = 0;
+    while (count > 0) {
+        uint32_t unit = lba / stripe, off = lba % stripe;
+        uint32_t run = stripe - off < count ? stripe - off : count;
+        int m = (int)(unit % (uint32_t)nmembers);
+        if (start(m, write, unit / (uint32_t)nmembers * stripe + off, run, buf) != 0) r = -1;
+        lba += run;
+        count -= run;
+        buf += (size_t)run * RAID_SECTOR;
+    }
+    if (wait_all() != 0) r = -1;
+    return r;
+}
+
+/* RAID-1 read: each stripe-sized piece from whichever copy can serve it soonest */
+static int mirrored_read(uint32_t lba, uint32_t count, uint8_t *buf) {
+    int r = 0;
+    while (count > 0) {
+        uint32_t run = stripe - lba % stripe < count ? stripe - lba % stripe : count;
+        for (;;) {
+            int m = pick_reader(lba);
+            if (m >= 0 && members[m].inflight) {
+                if (wait_member(m) != 0) r = -1;
+                if (members[m].st.failed) continue;  // Its copy is gone, pick again
+            }
+            if (m < 0) {
+                r = -1;
+                break;
+            }
+            if (start(m, 0, lba, run, buf) == 0) break;
+            // The member refused the command and is dropped now: try the next copy
+        }
+        lba += run;
+        count -= run;
+        buf += (size_t)run * RAID_SECTOR;
+    }
+    if (wait_all() != 0) r = -1;
+    return r;
+}
+
+/* RAID-1 write: the same commands on every copy that still works */
+static int mirrored_write(uint32_t lba, uint32_t count, uint8_t *buf) {
+    int r = 0;
+    while (count > 0) {
+        uint32_t run = count < RAID_MAX_STRIPE ? count : RAID_MAX_STRIPE;
+        for (int m = 0; m < nmembers; ++m) {
+            if (!members[m].st.failed) start(m, 1, lba, run, buf);
+        }
+        lba += run;
+        count -= run;
+        buf += (size_t)run * RAID_SECTOR;
+    }
+    if (wait_all() != 0) r = -1;
+    return live_members() ? r : -1;
+}
+
+int raid_read_sectors(uint32_t lba, uint32_t count, void *buf) {
+    if (level < 0 || count == 0 || lba + count > volume_sectors || lba + count < lba) return -1;
+    if (level == 0) return striped_io(0, lba, count, (uint8_t *)buf);
+    return super_update(mirrored_read(lba, count, (uint8_t *)buf));
+}
+
+int raid_write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+    if (level < 0 || count == 0 || lba + count > volume_sectors || lba + count < lba) return -1;
+    // Members only read from buf on writes
+    if (level == 0) return striped_io(1, lba, count, (uint8_t *)(uintptr_t)buf);
+    return super_update(mirrored_write(lba, count, (uint8_t *)(uintptr_t)buf));
+}
+
+int raid_discard(uint32_t lba, uint32_t count) {
+    if (level < 0 || count == 0 || lba + count > volume_sectors || lba + count < lba) return -1;
+    if (!callbacks.discard) return 0;
+    int r = 0;
+    if (level == 1) {
+        for (int m = 0; m < nmembers; ++m) {
+            if (!members[m].st.failed && callbacks.discard(members[m].st.dev, lba, count) != 0) r = -1;
+        }
+        return r;
+    }
+
+    // Consecutive units on a member are consecutive on its disk, so each member's share of
+    // the range is one run (growing as units are dealt out in turn)
+    uint32_t first[RAID_MAX_MEMBERS], len[RAID_MAX_MEMBERS];
+    for (int m = 0; m < nmembers; ++m) len[m] = 0;
+    while (count > 0) {
+        uint32_t unit = lba / stripe, off = lba % stripe;
+        uint32_t run = stripe - off < count ? stripe - off : count;
+        int m = (int)(unit % (uint32_t)nmembers);
+        uint32_t at = unit / (uint32_t)nmembers * stripe + off;
+        if (len[m] && first[m] + len[m] == at) {
+            len[m] += run;
+        } else {
+            if (len[m] && callbacks.discard(members[m].st.dev, first[m], len[m]) != 0) r = -1;
+            first[m] = at;
+            len[m] = run;
+        }
+        lba += run;
+        count -= run;
+    }
+    for (int m = 0; m < nmembers; ++m) {
+        if (len[m] && callbacks.discard(members[m].st.dev, first[m], len[m]) != 0) r = -1;
+    }
+    return r;
+}
+
+int raid_flush(void) {
+    if (level < 0) return -1;
+    int r = wait_all();
+    for (int m = 0; m < nmembers; ++m) {
+        if (members[m].st.failed || !callbacks.flush) continue;
+        if (callbacks.flush(members[m].st.dev) != 0) r = -1;
+    }
+    return super_update(r);
+}
+
+int raid_resync(void) {
+    if (level != 1 || !live_members()) return -1;
+    int r = 0;
+    for (int m = 0; m < nmembers; ++m) {
+        if (!members[m].st.failed) continue;
+        // Copy the whole volume from a working member, one largest command at a time
+        raid_member_t *mb = &members[m];
+        for (uint32_t lba = 0; lba < volume_sectors && r == 0;) {
+            uint32_t run = volume_sectors - lba < RAID_MAX_STRIPE ? volume_sectors - lba : RAID_MAX_STRIPE;
+            if (mirrored_read(lba, run, resync_buf) != 0 ||
+                callbacks.submit(mb->st.dev, 1, lba, run, resync_buf) != 0 ||
+                callbacks.complete(mb->st.dev) != 0) {
+                r = -1;
+                break;
+            }
+            mb->st.writes++;
+            mb->st.sectors_written += run;
+            lba += run;
+        }
+        if (r != 0) break;
+        if (!callbacks.flush || callbacks.flush(mb->st.dev) == 0) {
+            mb->st.failed = 0;
+            mb->st.head = volume_sectors;
+            state_changed = 1;
+        }
+    }
+    return super_update(r);
+}
+
+/* ============================================================================
+   BLOCK DEVICE
+   ============================================================================ */
+// There is one volume, so the device pointer is unused
+
+static int blk_read(void *dev, uint32_t lba, uint32_t count, void *buf) {
+    (void)dev;
+    return raid_read_sectors(lba, count, buf);
+}
+
+static int blk_write(void *dev, uint32_t lba, uint32_t count, const void *buf) {
+    (void)dev;
+    return raid_write_sectors(lba, count, buf);
+}
+
+static int blk_flush(void *dev) {
+    (void)dev;
+    return raid_flush();
+}
+
+static int blk_discard(void *dev, uint32_t lba, uint32_t count) {
+    (void)dev;
+    return raid_discard(lba, count);
+}
+
+const blkdev_ops_t raid_blkdev_ops = {
+    .read_sectors = blk_read,
+    .write_sectors = blk_write,
+    .flush = blk_flush,
+    .discard = blk_discard
+};
+
+int raid_register(const char *name) {
+    if (level < 0) return -1;
+    return blkdev_register(name, level == 0 ? "RAID-0" : "RAID-1", &raid_blkdev_ops, 0,
+                           volume_sectors, 0, callbacks.discard ? BLKDEV_DISCARD : 0);
+}
@@ -0,0 +1,79 @@
+/* raid.h - Software RAID-0 (striping) and RAID-1 (mirroring) over several disks */
+#ifndef RAID_H
+#define RAID_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "blkdev.h"
+
+#define RAID_MAX_MEMBERS 4
+#define RAID_MAX_STRIPE 256        // Sectors; a stripe unit is one disk command at most
+#define RAID_DEFAULT_STRIPE 16     // 8KB
+
+/* Overlapped I/O callbacks of the member disks - must be provided by kernel (or a host
+   harness). Members are named by the device numbers given to raid_init */
+typedef struct {
+    int (*submit)(int dev, int write, uint32_t lba, uint32_t count, void *buf);  // Start a command, return 0 if started
+    int (*complete)(int dev);  // Wait for dev's last command, return its result (0 on success)
+    int (*flush)(int dev);     // Optional (may be NULL): make every completed write durable
+    int (*discard)(int dev, uint32_t lba, uint32_t count);  // Optional (may be NULL): sectors no longer hold data
+} raid_callbacks_t;
+
+/* Per-member counters */
+typedef struct {
+    int dev;                    // Device number of the member
+    int failed;                 // Flag: a command failed or its copy is stale, the member is not
+                                // used until raid_resync (RAID-1)
+    uint64_t reads;             // Read commands
+    uint64_t writes;            // Write commands
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint32_t head;              // Sector after the last one transferred (where the head is)
+} raid_member_stats_t;
+
+/* Set the callbacks that the volume will use */
+void raid_set_callbacks(const raid_callbacks_t *callbacks);
+
+/* Build a volume out of n (2 to RAID_MAX_MEMBERS) disks: level 0 stripes it across them in
+   units of stripe sectors (1 to RAID_MAX_STRIPE), level 1 mirrors it on every one (reads are
+   split into stripe-sized pieces and each goes to an idle member, nearest head first).
+   sizes holds each disk's size in sectors. RAID-1 keeps a superblock in the last sector of
+   the smallest size, read here: members that missed writes (dropped before a reboot, or new)
+   are left out until raid_resync. Returns 0 on success, -1 on bad arguments or if no RAID-1
+   member can be used */
+int raid_init(int level, const int *devs, const uint32_t *sizes, int n, uint32_t stripe);
+
+/* Level of the volume, -1 if there is none */
+int raid_level(void);
+
+/* Size of the volume in sectors */
+uint32_t raid_sectors(void);
+
+/* Stripe unit in sectors */
+uint32_t raid_stripe(void);
+
+/* Number of members */
+int raid_members(void);
+
+/* Copy member i's counters to *st */
+void raid_member_stats(int i, raid_member_stats_t *st);
+
+/* Sector I/O on the volume, same contract as a disk's */
+int raid_read_sectors(uint32_t lba, uint32_t count, void *buf);
+int raid_write_sectors(uint32_t lba, uint32_t count, const void *buf);
+int raid_flush(void);
+
+/* RAID-1: copy the volume from a working member onto every member left out, and take them
+   back in. Returns 0, or -1 if a copy failed (that member stays out) */
+int raid_resync(void);
+
+/* Pass a discard to the members: every copy on RAID-1, one range per member on RAID-0 */
+int raid_discard(uint32_t lba, uint32_t count);
+
+/* Operations to register the volume with (the device pointer is unused) */
+extern const blkdev_ops_t raid_blkdev_ops;
+
+/* Register the volume as a block device under name. Returns its id, or -1 if there is none */
+int raid_register(const char *name);
+
+#endif
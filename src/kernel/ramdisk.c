@@ -0,0 +1,44 @@
+/* ramdisk.c - RAM disk
+ *
+ * Sectors are slices of a memory area, so reads and writes are copies and
+ * nothing has to be flushed. Discarded sectors read back as zeros, like on a
+ * disk that supports deterministic TRIM. Contents are gone at the next boot.
+ */
+#include "ramdisk.h"
+#include "kstring.h"
+
+static int ramdisk_read(void *dev, uint32_t lba, uint32_t count, void *buf) {
+    ramdisk_t *rd = (ramdisk_t *)dev;
+    kmemcpy(buf, rd->mem + (size_t)lba * BLKDEV_SECTOR, (size_t)count * BLKDEV_SECTOR);
+    return 0;
+}
+
+static int ramdisk_write(void *dev, uint32_t lba, uint32_t count, const void *buf) {
+    ramdisk_t *rd = (ramdisk_t *)dev;
+    kmemcpy(rd->mem + (size_t)lba * BLKDEV_SECTOR, buf, (size_t)count * BLKDEV_SECTOR);
+    return 0;
+}
+
+static int ramdisk_discard(void *dev, uint32_t lba, uint32_t count) {
+    ramdisk_t *rd = (ramdisk_t *)dev;
+    kmemset(rd->mem + (size_t)lba * BLKDEV_SECTOR, 0, (size_t)count * BLKDEV_SECTOR);
+    return 0;
+}
+
+const blkdev_ops_t ramdisk_blkdev_ops = {
+    .read_sectors = ramdisk_read,
+    .write_sectors = ramdisk_write,
+    .flush = 0,
+    .discard = ramdisk_discard
+};
+
+void ramdisk_init(ramdisk_t *rd, void *mem, uint32_t sectors) {
+    rd->mem = (uint8_t *)mem;
+    rd->sectors = sectors;
+    kmemset(mem, 0, (size_t)sectors * BLKDEV_SECTOR);
+}
+
+int ramdisk_create(ramdisk_t *rd, const char *name, void *mem, uint32_t sectors) {
+    ramdisk_init(rd, mem, sectors);
+    return blkdev_register(name, "RAM disk", &ramdisk_blkdev_ops, rd, sectors, 0, BLKDEV_DISCARD);
+}
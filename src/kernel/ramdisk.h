@@ -0,0 +1,24 @@
+/* ramdisk.h - Block device backed by kernel memory */
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "blkdev.h"
+
+/* A RAM disk: sectors bytes * BLKDEV_SECTOR of memory the caller owns */
+typedef struct {
+    uint8_t *mem;
+    uint32_t sectors;
+} ramdisk_t;
+
+/* Operations to register a RAM disk with (its ramdisk_t as the device pointer) */
+extern const blkdev_ops_t ramdisk_blkdev_ops;
+
+/* Set up rd over mem, which holds sectors sectors, and zero it (a blank disk) */
+void ramdisk_init(ramdisk_t *rd, void *mem, uint32_t sectors);
+
+/* Set up rd, zero it and register it as a block device under name. Returns its id, or -1 */
+int ramdisk_create(ramdisk_t *rd, const char *name, void *mem, uint32_t sectors);
+
+#endif
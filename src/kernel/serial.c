@@ -0,0 +1,61 @@
+/* serial.c - COM1 serial port
+ *
+ * Output only, polled: each byte waits for the transmit holding register to
+ * empty. Under QEMU, -serial stdio (or -serial file:log.txt) captures what is
+ * sent, which is how reports too long for the screen are taken off the
+ * machine.
+ */
+#include "serial.h"
+#include "io.h"
+
+#define COM1 0x3F8
+
+/* Register offsets from the base port */
+#define REG_DATA    0  // Transmit holding / receive buffer; divisor low byte with DLAB set
+#define REG_IER     1  // Interrupt enable; divisor high byte with DLAB set
+#define REG_FCR     2  // FIFO control
+#define REG_LCR     3  // Line control (bit 7: DLAB)
+#define REG_MCR     4  // Modem control
+#define REG_LSR     5  // Line status
+
+#define LSR_THRE 0x20  // Transmit holding register empty
+#define SERIAL_TIMEOUT 100000  // Status polls before a byte is dropped
+
+static int present = 0;
+
+int serial_init(void) {
+    outb(COM1 + REG_IER, 0x00);   // No interrupts
+    outb(COM1 + REG_LCR, 0x80);   // DLAB: set the baud rate divisor
+    outb(COM1 + REG_DATA, 0x01);  // 115200 / 1
+    outb(COM1 + REG_IER, 0x00);
+    outb(COM1 + REG_LCR, 0x03);   // 8 bits, no parity, one stop bit
+    outb(COM1 + REG_FCR, 0xC7);   // FIFOs on and cleared, 14-byte threshold
+
+    // Loopback: a byte sent must come back
+    outb(COM1 + REG_MCR, 0x1E);
+    outb(COM1 + REG_DATA, 0xAE);
+    present = inb(COM1 + REG_DATA) == 0xAE;
+    outb(COM1 + REG_MCR, 0x0F);   // Normal operation: DTR, RTS, OUT1, OUT2
+    return present ? 0 : -1;
+}
+
+int serial_present(void) {
+    return present;
+}
+
+static void serial_putc(char c) {
+    for (int i = 0; i < SERIAL_TIMEOUT; ++i) {
+        if (inb(COM1 + REG_LSR) & LSR_THRE) {
+            outb(COM1 + REG_DATA, (uint8_t)c);
+            return;
+        }
+    }
+}
+
+void serial_write(const char *s) {
+    if (!present) return;
+    while (*s) {
+        if (*s == '\n') serial_putc('\r');
+        serial_putc(*s++);
+    }
+}
@@ -0,0 +1,15 @@
+/* serial.h - COM1 serial port output (16550 UART) */
+#ifndef SERIAL_H
+#define SERIAL_H
+
+/* Set up COM1 for 115200 baud, 8 data bits, no parity, one stop bit. Returns 0, or -1 if
+   there is no UART (a loopback test fails) */
+int serial_init(void);
+
+/* Check if serial_init found a UART */
+int serial_present(void);
+
+/* Send a string, turning "\n" into "\r\n". Does nothing without a UART */
+void serial_write(const char *s);
+
+#endif
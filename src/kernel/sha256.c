@@ -0,0 +1,180 @@
+/* sha256.c - SHA-256, HMAC-SHA256 and PBKDF2-HMAC-SHA256
+ *
+ * SHA-256 as in FIPS 180-4, one 64-byte block at a time. HMAC hashes the key
+ * padded with ipad and opad as the first block of an inner and an outer hash;
+ * PBKDF2 runs thousands of HMACs under the same key, so it hashes those two
+ * blocks once and starts every HMAC from copies of the two states, which
+ * halves the work per iteration.
+ */
+#include "sha256.h"
+#include "kstring.h"
+
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t ror(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+/* Fold one 64-byte block into the chaining value */
+static void compress(uint32_t h[8], const uint8_t *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+               (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = k + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + round_constants[i] + w[i];
+        uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+/* ============================================================================
+   SHA-256
+   ============================================================================ */
+
+void sha256_init(sha256_t *s) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    kmemcpy(s->h, initial, sizeof(initial));
+    s->len = 0;
+}
+
+void sha256_update(sha256_t *s, const void *data, size_t len) {
+    const uint8_t *p = data;
+    size_t used = s->len % SHA256_BLOCK;
+    s->len += len;
+    if (used) {
+        size_t take = SHA256_BLOCK - used < len ? SHA256_BLOCK - used : len;
+        kmemcpy(s->buf + used, p, take);
+        p += take;
+        len -= take;
+        if (used + take < SHA256_BLOCK) return;
+        compress(s->h, s->buf);
+    }
+    for (; len >= SHA256_BLOCK; p += SHA256_BLOCK, len -= SHA256_BLOCK) compress(s->h, p);
+    kmemcpy(s->buf, p, len);
+}
+
+void sha256_final(sha256_t *s, uint8_t digest[SHA256_DIGEST]) {
+    // A 1 bit, zeros up to 8 bytes short of a block boundary, then the length in bits
+    uint64_t bits = s->len * 8;
+    size_t used = s->len % SHA256_BLOCK;
+    s->buf[used++] = 0x80;
+    if (used > SHA256_BLOCK - 8) {
+        kmemset(s->buf + used, 0, SHA256_BLOCK - used);
+        compress(s->h, s->buf);
+        used = 0;
+    }
+    kmemset(s->buf + used, 0, SHA256_BLOCK - 8 - used);
+    for (int i = 0; i < 8; ++i) s->buf[SHA256_BLOCK - 1 - i] = (uint8_t)(bits >> (8 * i));
+    compress(s->h, s->buf);
+
+    for (int i = 0; i < 8; ++i) {
+        digest[4 * i] = (uint8_t)(s->h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(s->h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(s->h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)s->h[i];
+    }
+    sha256_init(s);
+}
+
+/* ============================================================================
+   HMAC AND PBKDF2
+   ============================================================================ */
+
+/* Inner and outer hashes with the padded key already fed in */
+static void hmac_start(const void *key, size_t key_len, sha256_t *inner, sha256_t *outer) {
+    uint8_t pad[SHA256_BLOCK];
+    kmemset(pad, 0, sizeof(pad));
+    if (key_len > SHA256_BLOCK) {  // Long keys are hashed first
+        sha256_init(inner);
+        sha256_update(inner, key, key_len);
+        sha256_final(inner, pad);
+    } else {
+        kmemcpy(pad, key, key_len);
+    }
+    for (int i = 0; i < SHA256_BLOCK; ++i) pad[i] ^= 0x36;
+    sha256_init(inner);
+    sha256_update(inner, pad, SHA256_BLOCK);
+    for (int i = 0; i < SHA256_BLOCK; ++i) pad[i] ^= 0x36 ^ 0x5c;
+    sha256_init(outer);
+    sha256_update(outer, pad, SHA256_BLOCK);
+    kmemset(pad, 0, sizeof(pad));
+}
+
+/* Finish an HMAC whose inner hash has the whole message: mac may be the message buffer */
+static void hmac_finish(sha256_t *inner, sha256_t *outer, uint8_t mac[SHA256_DIGEST]) {
+    sha256_final(inner, mac);
+    sha256_update(outer, mac, SHA256_DIGEST);
+    sha256_final(outer, mac);
+}
+
+void hmac_sha256(const void *key, size_t key_len, const void *msg, size_t msg_len, uint8_t mac[SHA256_DIGEST]) {
+    sha256_t inner, outer;
+    hmac_start(key, key_len, &inner, &outer);
+    sha256_update(&inner, msg, msg_len);
+    hmac_finish(&inner, &outer, mac);
+    kmemset(&inner, 0, sizeof(inner));
+    kmemset(&outer, 0, sizeof(outer));
+}
+
+void pbkdf2_sha256(const void *password, size_t password_len, const void *salt, size_t salt_len,
+                   uint32_t iterations, uint8_t *out, size_t out_len) {
+    sha256_t inner, outer, s_inner, s_outer;
+    hmac_start(password, password_len, &inner, &outer);
+    for (uint32_t block = 1; out_len > 0; ++block) {
+        // T_i = U_1 ^ ... ^ U_c, U_1 = HMAC(salt || i), U_j = HMAC(U_(j-1))
+        uint8_t u[SHA256_DIGEST], t[SHA256_DIGEST];
+        uint8_t index[4] = { (uint8_t)(block >> 24), (uint8_t)(block >> 16), (uint8_t)(block >> 8), (uint8_t)block };
+        kmemcpy(&s_inner, &inner, sizeof(inner));
+        kmemcpy(&s_outer, &outer, sizeof(outer));
+        sha256_update(&s_inner, salt, salt_len);
+        sha256_update(&s_inner, index, sizeof(index));
+        hmac_finish(&s_inner, &s_outer, u);
+        kmemcpy(t, u, SHA256_DIGEST);
+        for (uint32_t j = 1; j < iterations; ++j) {
+            kmemcpy(&s_inner, &inner, sizeof(inner));
+            kmemcpy(&s_outer, &outer, sizeof(outer));
+            sha256_update(&s_inner, u, SHA256_DIGEST);
+            hmac_finish(&s_inner, &s_outer, u);
+            for (int i = 0; i < SHA256_DIGEST; ++i) t[i] ^= u[i];
+        }
+        size_t n = out_len < SHA256_DIGEST ? out_len : SHA256_DIGEST;
+        kmemcpy(out, t, n);
+        out += n;
+        out_len -= n;
+        kmemset(u, 0, sizeof(u));
+        kmemset(t, 0, sizeof(t));
+    }
+    kmemset(&inner, 0, sizeof(inner));
+    kmemset(&outer, 0, sizeof(outer));
+    kmemset(&s_inner, 0, sizeof(s_inner));
+    kmemset(&s_outer, 0, sizeof(s_outer));
+}
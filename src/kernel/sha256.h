@@ -0,0 +1,31 @@
+/* sha256.h - SHA-256, HMAC-SHA256 and PBKDF2-HMAC-SHA256 */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_BLOCK 64   // Bytes the compression function takes at a time
+#define SHA256_DIGEST 32  // Bytes of a hash
+
+/* Hash of a message fed in pieces */
+typedef struct {
+    uint32_t h[8];               // Chaining value
+    uint64_t len;                // Bytes fed so far
+    uint8_t buf[SHA256_BLOCK];   // Partial block, len % SHA256_BLOCK bytes of it used
+} sha256_t;
+
+/* Start, extend and finish a hash. sha256_final leaves s to be started again */
+void sha256_init(sha256_t *s);
+void sha256_update(sha256_t *s, const void *data, size_t len);
+void sha256_final(sha256_t *s, uint8_t digest[SHA256_DIGEST]);
+
+/* HMAC-SHA256 (RFC 2104) of msg under key */
+void hmac_sha256(const void *key, size_t key_len, const void *msg, size_t msg_len, uint8_t mac[SHA256_DIGEST]);
+
+/* PBKDF2 (RFC 8018) with HMAC-SHA256 as the PRF: out_len bytes of key from a password and salt
+   after the given number of iterations */
+void pbkdf2_sha256(const void *password, size_t password_len, const void *salt, size_t salt_len,
+                   uint32_t iterations, uint8_t *out, size_t out_len);
+
+#endif
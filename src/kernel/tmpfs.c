@@ -0,0 +1,229 @@
+/* tmpfs.c - RAM-backed filesystem for scratch files
+ *
+ * File data lives in 4KB pages taken from a fixed pool in kernel memory, so
+ * reads and writes are plain memory copies with no disk I/O. Contents are lost
+ * on reboot.
+ */
+#include "tmpfs.h"
+#include "kstring.h"
+
+/* ============================================================================
+   PAGE POOL
+   ============================================================================ */
+
+static uint8_t page_pool[TMPFS_PAGES][TMPFS_PAGE_SIZE] __attribute__((aligned(TMPFS_PAGE_SIZE)));
+static uint16_t free_pages[TMPFS_PAGES];  // Stack of free page numbers
+static size_t free_top = 0;               // Number of free pages on the stack
+
+/* Take a zeroed page from the pool, returns -1 if the pool is empty */
+static int page_alloc(void) {
+    if (free_top == 0) return -1;
+    uint16_t p = free_pages[--free_top];
+    kmemset(page_pool[p], 0, TMPFS_PAGE_SIZE);
+    return p;
+}
+
+/* Return a page to the pool */
+static void page_free(uint16_t p) {
+    free_pages[free_top++] = p;
+}
+
+/* ============================================================================
+   FILES
+   ============================================================================ */
+
+typedef struct {
+    char name[VFS_NAME_MAX];              // File name (empty when slot is unused)
+    uint32_t size;                        // File size in bytes
+    uint16_t npages;                      // Pages allocated to this file
+    uint16_t pages[TMPFS_FILE_PAGES];     // Page numbers, in file order
+} tmpfs_node_t;
+
+static tmpfs_node_t nodes[TMPFS_MAX_FILES];  // Inode number = index in this table
+
+static int tmpfs_streq(const char *a, const char *b) {
+    while (*a && *a == *b) { a++; b++; }
+    return *a == *b;
+}
+
+/* Release pages beyond the first keep pages of a file */
+static void node_release_pages(tmpfs_node_t *n, uint16_t keep) {
+    while (n->npages > keep) page_free(n->pages[--n->npages]);
+}
+
+/* Look up a live inode */
+static tmpfs_node_t *node_get(int ino) {
+    if (ino < 0 || ino >= TMPFS_MAX_FILES || !nodes[ino].name[0]) return 0;
+    return &nodes[ino];
+}
+
+void tmpfs_init(void) {
+    for (int i = 0; i < TMPFS_MAX_FILES; ++i) {
+        nodes[i].name[0] = 0;
+        nodes[i].size = 0;
+        nodes[i].npages = 0;
+    }
+    free_top = 0;
+    for (int p = TMPFS_PAGES - 1; p >= 0; --p) free_pages[free_top++] = (uint16_t)p;
+}
+
+/* ============================================================================
+   VFS OPERATIONS
+   ============================================================================ */
+
+static int tmpfs_lookup(void *fs, const char *name) {
+    (void)fs;
+    for (int i = 0; i < TMPFS_MAX_FILES; ++i) {
+        if (nodes[i].name[0] && tmpfs_streq(nodes[i].name, name)) return i;
+    }
+    return -1;
+}
+
+static int tmpfs_create(void *fs, const char *name) {
+    int ino = tmpfs_lookup(fs, name);
+    if (ino >= 0) return ino;
+
+    for (int i = 0; i < TMPFS_MAX_FILES; ++i) {
+        if (nodes[i].name[0]) continue;
+        size_t k = 0;
+        for (; name[k] && k < VFS_NAME_MAX - 1; ++k) nodes[i].name[k] = name[k];
+        nodes[i].name[k] = 0;
+        nodes[i].size = 0;
+        nodes[i].npages = 0;
+        return i;
+    }
+    return -1;  // No free inodes
+}
+
+static int tmpfs_size(void *fs, int ino) {
+    (void)fs;
+    tmpfs_node_t *n = node_get(ino);
+    return n ? (int)n->size : -1;
+}
+
+static int tmpfs_read(void *fs, int ino, uint32_t pos, uint8_t *buf, size_t len) {
+    (void)fs;
+    tmpfs_node_t *n = node_get(ino);
+    if (!n) return -1;
+    if (pos >= n->size) return 0;
+    if (len > n->size - pos) len = n->size - pos;
+
+    size_t done = 0;
+    while (done < len) {
+        uint32_t at = pos + (uint32_t)done;
+        const uint8_t *page = page_pool[n->pages[at / TMPFS_PAGE_SIZE]];
+        size_t off = at % TMPFS_PAGE_SIZE;
+        size_t copy = TMPFS_PAGE_SIZE - off;
+        if (copy > len - done) copy = len - done;
+        kmemcpy(buf + done, page + off, copy);
+        done += copy;
+    }
+    return (int)done;
+}
+
+/* Data at pos lives in one page of the pool, hand out a pointer to it */
+static const uint8_t *tmpfs_map(void *fs, int ino, uint32_t pos, size_t *len) {
+    (void)fs;
+    tmpfs_node_t *n = node_get(ino);
+    if (!n || pos >= n->size) return 0;
+    size_t off = pos % TMPFS_PAGE_SIZE;
+    *len = TMPFS_PAGE_SIZE - off;
+    if (*len > n->size - pos) *len = n->size - pos;
+    return page_pool[n->pages[pos / TMPFS_PAGE_SIZE]] + off;
+}
+
+static int tmpfs_write(void *fs, int ino, uint32_t pos, const uint8_t *data, size_t len) {
+    (void)fs;
+    tmpfs_node_t *n = node_get(ino);
+    if (!n) return -1;
+    if ((uint64_t)pos + len > (uint64_t)TMPFS_FILE_PAGES * TMPFS_PAGE_SIZE) return -1;  // Too large
+
+    // Bytes between the old end of file and pos must read back as zeros
+    if (pos > n->size && n->size % TMPFS_PAGE_SIZE) {
+        uint8_t *page = page_pool[n->pages[n->size / TMPFS_PAGE_SIZE]];
+        kmemset(page + n->size % TMPFS_PAGE_SIZE, 0, TMPFS_PAGE_SIZE - n->size % TMPFS_PAGE_SIZE);
+    }
+
+    // Allocate (zeroed) pages up to the end of the write
+    uint32_t end = pos + (uint32_t)len;
+    uint16_t need = (uint16_t)((end + TMPFS_PAGE_SIZE - 1) / TMPFS_PAGE_SIZE);
+    uint16_t had = n->npages;
+    while (n->npages < need) {
+        int p = page_alloc();
+        if (p < 0) {
+            node_release_pages(n, had);  // Pool exhausted: undo
+            return -1;
+        }
+        n->pages[n->npages++] = (uint16_t)p;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint32_t at = pos + (uint32_t)done;
+        uint8_t *page = page_pool[n->pages[at / TMPFS_PAGE_SIZE]];
+        size_t off = at % TMPFS_PAGE_SIZE;
+        size_t copy = TMPFS_PAGE_SIZE - off;
+        if (copy > len - done) copy = len - done;
+        kmemcpy(page + off, data + done, copy);
+        done += copy;
+    }
+
+    if (end > n->size) n->size = end;
+    return (int)done;
+}
+
+static int tmpfs_truncate(void *fs, int ino, uint32_t len) {
+    (void)fs;
+    tmpfs_node_t *n = node_get(ino);
+    if (!n || len > n->size) return -1;  // Only shrinking is supported
+    node_release_pages(n, (uint16_t)((len + TMPFS_PAGE_SIZE - 1) / TMPFS_PAGE_SIZE));
+    n->size = len;
+    return 0;
+}
+
+static int tmpfs_unlink(void *fs, const char *name) {
+    int ino = tmpfs_lookup(fs, name);
+    if (ino < 0) return -1;
+    node_release_pages(&nodes[ino], 0);
+    nodes[ino].name[0] = 0;
+    nodes[ino].size = 0;
+    return 0;
+}
+
+static int tmpfs_rename(void *fs, const char *old_name, const char *new_name) {
+    if (tmpfs_lookup(fs, new_name) >= 0) return -1;  // Target name already in use
+    int ino = tmpfs_lookup(fs, old_name);
+    if (ino < 0 || !new_name[0]) return -1;
+
+    size_t k = 0;
+    for (; new_name[k] && k < VFS_NAME_MAX - 1; ++k) nodes[ino].name[k] = new_name[k];
+    nodes[ino].name[k] = 0;
+    return 0;
+}
+
+static int tmpfs_readdir(void *fs, uint32_t *cursor, char *name, uint32_t *size) {
+    (void)fs;
+    while (*cursor < TMPFS_MAX_FILES) {
+        tmpfs_node_t *n = &nodes[(*cursor)++];
+        if (!n->name[0]) continue;
+        for (size_t k = 0; k < VFS_NAME_MAX; ++k) name[k] = n->name[k];
+        *size = n->size;
+        return 0;
+    }
+    return -1;
+}
+
+const vfs_ops_t tmpfs_vfs_ops = {
+    .lookup = tmpfs_lookup,
+    .create = tmpfs_create,
+    .size = tmpfs_size,
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .truncate = tmpfs_truncate,
+    .replace = 0,          // Truncate + write is already pure memory work
+    .unlink = tmpfs_unlink,
+    .rename = tmpfs_rename,
+    .readdir = tmpfs_readdir,
+    .sync = 0,             // Nothing is ever deferred
+    .map = tmpfs_map
+};
@@ -0,0 +1,20 @@
+/* tmpfs.h - RAM-backed filesystem for scratch files */
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vfs.h"
+
+#define TMPFS_PAGE_SIZE 4096    // File data is stored in 4KB pages
+#define TMPFS_PAGES 64          // Pages in the pool (256KB)
+#define TMPFS_MAX_FILES 32      // Files at once
+#define TMPFS_FILE_PAGES 16     // Largest file: 64KB
+
+/* Reset the filesystem, discarding all files */
+void tmpfs_init(void);
+
+/* tmpfs as a VFS backend (single instance, the fs pointer is unused) */
+extern const vfs_ops_t tmpfs_vfs_ops;
+
+#endif
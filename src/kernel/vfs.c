@@ -0,0 +1,292 @@
+/* vfs.c - Virtual filesystem switch: mount points, inodes and open files */
+#include "vfs.h"
+
+/* ============================================================================
+   MOUNT TABLE AND OPEN FILE TABLE
+   ============================================================================ */
+
+typedef struct {
+    char path[VFS_NAME_MAX];   // Mount point, e.g. "/" or "/tmp"
+    const vfs_ops_t *ops;      // Backend operations
+    void *fs;                  // Backend instance passed to every operation
+    int flags;                 // VFS_RDONLY
+    int in_use;                // Flag: 1 when this slot holds a mount
+} vfs_mount_t;
+
+/* An inode is a backend inode number on a particular mount */
+typedef struct {
+    vfs_mount_t *mnt;
+    int ino;
+} vfs_inode_t;
+
+typedef struct {
+    vfs_inode_t inode;   // File this descriptor refers to
+    uint32_t pos;        // Current read/write position
+    int flags;           // VFS_O_DIRECT
+    int in_use;          // Flag: 1 when this descriptor is open
+    int stale;           // Flag: 1 once the filesystem was replaced underneath it (see vfs_invalidate)
+} vfs_file_t;
+
+static vfs_mount_t mounts[VFS_MAX_MOUNTS];
+static vfs_file_t files[VFS_MAX_OPEN];
+
+/* ============================================================================
+   PATH RESOLUTION
+   ============================================================================ */
+
+static size_t vfs_strlen(const char *s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+/* Find the mount holding path (longest matching mount point) and the name within it.
+   Paths without a leading '/' are relative to the root mount */
+static vfs_mount_t *vfs_resolve(const char *path, const char **name_out) {
+    vfs_mount_t *best = 0;
+    size_t best_len = 0;
+
+    for (int i = 0; i < VFS_MAX_MOUNTS; ++i) {
+        vfs_mount_t *m = &mounts[i];
+        if (!m->in_use) continue;
+
+        size_t len = vfs_strlen(m->path);
+        if (len == 1 && m->path[0] == '/') {
+            // Root matches everything, but any other match is longer
+            if (!best) { best = m; best_len = (path[0] == '/') ? 1 : 0; }
+            continue;
+        }
+        if (path[0] != '/') continue;
+
+        size_t k = 0;
+        while (k < len && path[k] == m->path[k]) k++;
+        if (k == len && (path[len] == '/' || path[len] == 0) && len > best_len) {
+            best = m;
+            best_len = len;
+        }
+    }
+
+    if (best) {
+        const char *name = path + best_len;
+        while (*name == '/') name++;
+        *name_out = name;
+    }
+    return best;
+}
+
+/* Resolve a path that must name a file (not just a mount point) */
+static vfs_mount_t *vfs_resolve_file(const char *path, const char **name_out) {
+    vfs_mount_t *m = vfs_resolve(path, name_out);
+    if (!m || !**name_out) return 0;
+    return m;
+}
+
+/* Look up an open descriptor (stale ones can only be closed) */
+static vfs_file_t *vfs_file(int fd) {
+    if (fd < 0 || fd >= VFS_MAX_OPEN || !files[fd].in_use || files[fd].stale) return 0;
+    return &files[fd];
+}
+
+/* Number of descriptors open on inode ino of mount m. Backends reuse the inode number of a
+   deleted file for the next one created, so a file must not go away while this is non-zero */
+static int vfs_open_count(const vfs_mount_t *m, int ino) {
+    int count = 0;
+    for (int fd = 0; fd < VFS_MAX_OPEN; ++fd) {
+        if (files[fd].in_use && !files[fd].stale && files[fd].inode.mnt == m && files[fd].inode.ino == ino) count++;
+    }
+    return count;
+}
+
+/* ============================================================================
+   MOUNTING
+   ============================================================================ */
+
+int vfs_mount(const char *path, const vfs_ops_t *ops, void *fs, int flags) {
+    size_t len = vfs_strlen(path);
+    if (path[0] != '/' || len >= VFS_NAME_MAX) return -1;
+
+    for (int i = 0; i < VFS_MAX_MOUNTS; ++i) {
+        if (mounts[i].in_use) continue;
+        for (size_t k = 0; k <= len; ++k) mounts[i].path[k] = path[k];
+        mounts[i].ops = ops;
+        mounts[i].fs = fs;
+        mounts[i].flags = flags;
+        mounts[i].in_use = 1;
+        return 0;
+    }
+    return -1;  // Mount table full
+}
+
+/* ============================================================================
+   OPEN FILES
+   ============================================================================ */
+
+int vfs_open(const char *path, int flags) {
+    const char *name;
+    vfs_mount_t *m = vfs_resolve_file(path, &name);
+    if (!m) return -1;
+
+    int writing = flags & (VFS_O_CREAT | VFS_O_TRUNC);
+    if (writing && (m->flags & VFS_RDONLY)) return -1;
+
+    int ino = m->ops->lookup(m->fs, name);
+    if (ino < 0 && (flags & VFS_O_CREAT) && m->ops->create) ino = m->ops->create(m->fs, name);
+    if (ino < 0) return -1;
+
+    if (flags & VFS_O_TRUNC) {
+        if (!m->ops->truncate || m->ops->truncate(m->fs, ino, 0) != 0) return -1;
+    }
+
+    for (int fd = 0; fd < VFS_MAX_OPEN; ++fd) {
+        if (files[fd].in_use) continue;
+        files[fd].inode.mnt = m;
+        files[fd].inode.ino = ino;
+        files[fd].pos = 0;
+        files[fd].flags = flags & VFS_O_DIRECT;
+        files[fd].in_use = 1;
+        files[fd].stale = 0;
+        return fd;
+    }
+    return -1;  // Too many open files
+}
+
+int vfs_close(int fd) {
+    if (fd < 0 || fd >= VFS_MAX_OPEN || !files[fd].in_use) return -1;
+    files[fd].in_use = 0;
+    return 0;
+}
+
+int vfs_read(int fd, uint8_t *buf, size_t len) {
+    vfs_file_t *f = vfs_file(fd);
+    if (!f) return -1;
+
+    vfs_mount_t *m = f->inode.mnt;
+    int r;
+    if ((f->flags & VFS_O_DIRECT) && m->ops->read_direct) r = m->ops->read_direct(m->fs, f->inode.ino, f->pos, buf, len);
+    else r = m->ops->read(m->fs, f->inode.ino, f->pos, buf, len);
+    if (r > 0) f->pos += (uint32_t)r;
+    return r;
+}
+
+int vfs_write(int fd, const uint8_t *data, size_t len) {
+    vfs_file_t *f = vfs_file(fd);
+    if (!f) return -1;
+
+    vfs_mount_t *m = f->inode.mnt;
+    if ((m->flags & VFS_RDONLY) || !m->ops->write) return -1;
+    int r;
+    if ((f->flags & VFS_O_DIRECT) && m->ops->write_direct) r = m->ops->write_direct(m->fs, f->inode.ino, f->pos, data, len);
+    else r = m->ops->write(m->fs, f->inode.ino, f->pos, data, len);
+    if (r > 0) f->pos += (uint32_t)r;
+    return r;
+}
+
+int vfs_seek(int fd, uint32_t pos) {
+    vfs_file_t *f = vfs_file(fd);
+    if (!f) return -1;
+    f->pos = pos;
+    return 0;
+}
+
+int vfs_size(int fd) {
+    vfs_file_t *f = vfs_file(fd);
+    if (!f) return -1;
+    return f->inode.mnt->ops->size(f->inode.mnt->fs, f->inode.ino);
+}
+
+const uint8_t *vfs_map(int fd, size_t *len) {
+    vfs_file_t *f = vfs_file(fd);
+    if (!f || !f->inode.mnt->ops->map) return 0;
+
+    vfs_mount_t *m = f->inode.mnt;
+    const uint8_t *p = m->ops->map(m->fs, f->inode.ino, f->pos, len);
+    if (p) f->pos += (uint32_t)*len;
+    return p;
+}
+
+/* ============================================================================
+   WHOLE-FILE HELPERS
+   ============================================================================ */
+
+int vfs_read_file(const char *path, uint8_t *buf, size_t maxlen) {
+    int fd = vfs_open(path, 0);
+    if (fd < 0) return -1;
+    int r = vfs_read(fd, buf, maxlen);
+    vfs_close(fd);
+    return r;
+}
+
+int vfs_write_file(const char *path, const uint8_t *data, size_t len) {
+    const char *name;
+    vfs_mount_t *m = vfs_resolve_file(path, &name);
+    if (!m || (m->flags & VFS_RDONLY)) return -1;
+
+    // Backends that can swap in new contents in one step do it themselves
+    if (m->ops->replace) return m->ops->replace(m->fs, name, data, len);
+
+    int fd = vfs_open(path, VFS_O_CREAT | VFS_O_TRUNC);
+    if (fd < 0) return -1;
+    int r = vfs_write(fd, data, len);
+    vfs_close(fd);
+    return r == (int)len ? 0 : -1;
+}
+
+/* ============================================================================
+   PATH OPERATIONS
+   ============================================================================ */
+
+int vfs_unlink(const char *path) {
+    const char *name;
+    vfs_mount_t *m = vfs_resolve_file(path, &name);
+    if (!m || (m->flags & VFS_RDONLY) || !m->ops->unlink) return -1;
+
+    int ino = m->ops->lookup(m->fs, name);
+    if (ino >= 0 && vfs_open_count(m, ino) > 0) return -1;  // Still open: its inode must not be reused
+    return m->ops->unlink(m->fs, name);
+}
+
+int vfs_rename(const char *old_path, const char *new_path) {
+    const char *old_name, *new_name;
+    vfs_mount_t *m = vfs_resolve_file(old_path, &old_name);
+    vfs_mount_t *m2 = vfs_resolve_file(new_path, &new_name);
+    if (!m || m != m2) return -1;  // Renaming across filesystems is not supported
+    if ((m->flags & VFS_RDONLY) || !m->ops->rename) return -1;
+    return m->ops->rename(m->fs, old_name, new_name);
+}
+
+int vfs_truncate(const char *path, uint32_t len) {
+    const char *name;
+    vfs_mount_t *m = vfs_resolve_file(path, &name);
+    if (!m || (m->flags & VFS_RDONLY) || !m->ops->truncate) return -1;
+
+    int ino = m->ops->lookup(m->fs, name);
+    if (ino < 0) return -1;
+    return m->ops->truncate(m->fs, ino, len);
+}
+
+int vfs_list(const char *path, vfs_list_fn fn) {
+    const char *name;
+    vfs_mount_t *m = vfs_resolve(path, &name);
+    if (!m || !m->ops->readdir) return -1;
+
+    char entry[VFS_NAME_MAX];
+    uint32_t size, cursor = 0;
+    while (m->ops->readdir(m->fs, &cursor, entry, &size) == 0) {
+        fn(entry, size);
+    }
+    return 0;
+}
+
+void vfs_invalidate(const char *path) {
+    const char *name;
+    vfs_mount_t *m = vfs_resolve(path, &name);
+    for (int fd = 0; fd < VFS_MAX_OPEN; ++fd) {
+        if (files[fd].in_use && files[fd].inode.mnt == m) files[fd].stale = 1;
+    }
+}
+
+void vfs_sync(void) {
+    for (int i = 0; i < VFS_MAX_MOUNTS; ++i) {
+        if (mounts[i].in_use && mounts[i].ops->sync) mounts[i].ops->sync(mounts[i].fs);
+    }
+}
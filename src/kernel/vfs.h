@@ -0,0 +1,77 @@
+/* vfs.h - Virtual filesystem switch: mount points, inodes and open files */
+#ifndef VFS_H
+#define VFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define VFS_NAME_MAX 32     // Longest path or file name, including terminator
+#define VFS_MAX_MOUNTS 8    // Mounted filesystems
+#define VFS_MAX_OPEN 16     // Files open at once
+
+/* Mount flags */
+#define VFS_RDONLY 0x01     // Refuse anything that modifies the filesystem
+
+/* Open flags */
+#define VFS_O_CREAT 0x01    // Create the file if it does not exist
+#define VFS_O_TRUNC 0x02    // Discard existing contents
+#define VFS_O_DIRECT 0x04   // Bypass the backend's cache (if it has read_direct/write_direct)
+
+/* Operations a filesystem backend provides. 'fs' is the pointer passed to vfs_mount,
+   names are relative to the mount point and inodes are backend-defined numbers.
+   Calls return -1 on failure. Entries a backend does not support may be NULL */
+typedef struct {
+    int (*lookup)(void *fs, const char *name);                                      // Inode of a file
+    int (*create)(void *fs, const char *name);                                      // Inode of a new (or existing) file
+    int (*size)(void *fs, int ino);                                                 // File size in bytes
+    int (*read)(void *fs, int ino, uint32_t pos, uint8_t *buf, size_t len);          // Bytes read
+    int (*write)(void *fs, int ino, uint32_t pos, const uint8_t *data, size_t len);  // Bytes written, grows the file
+    int (*truncate)(void *fs, int ino, uint32_t len);                               // Shrink a file
+    int (*replace)(void *fs, const char *name, const uint8_t *data, size_t len);    // Whole-file write (optional)
+    int (*unlink)(void *fs, const char *name);
+    int (*rename)(void *fs, const char *old_name, const char *new_name);
+    int (*readdir)(void *fs, uint32_t *cursor, char *name, uint32_t *size);         // Next file, -1 at end
+    void (*sync)(void *fs);                                                         // Write back deferred work
+    const uint8_t *(*map)(void *fs, int ino, uint32_t pos, size_t *len);            // File data in place (optional)
+    int (*read_direct)(void *fs, int ino, uint32_t pos, uint8_t *buf, size_t len);   // Uncached read (optional)
+    int (*write_direct)(void *fs, int ino, uint32_t pos, const uint8_t *data, size_t len);  // Uncached write (optional)
+} vfs_ops_t;
+
+/* Called once per file by vfs_list */
+typedef void (*vfs_list_fn)(const char *name, uint32_t size);
+
+/* Mount a filesystem at path ("/" for the root). Returns 0 on success, -1 on failure */
+int vfs_mount(const char *path, const vfs_ops_t *ops, void *fs, int flags);
+
+/* Open files: return a descriptor >= 0, or -1 on failure */
+int vfs_open(const char *path, int flags);
+int vfs_close(int fd);
+int vfs_read(int fd, uint8_t *buf, size_t len);          // Bytes read from the current position
+int vfs_write(int fd, const uint8_t *data, size_t len);  // Bytes written at the current position
+int vfs_seek(int fd, uint32_t pos);                      // Set the current position
+int vfs_size(int fd);                                    // Current file size
+
+/* Read without copying: returns a pointer to the file data at the current position and sets
+   *len to the bytes available there, then advances the position past them. The data stays
+   valid until the next filesystem call. Returns NULL at end of file, on failure, or if the
+   backend cannot map (use vfs_read then) */
+const uint8_t *vfs_map(int fd, size_t *len);
+
+/* Whole-file helpers used by the editor and console */
+int vfs_read_file(const char *path, uint8_t *buf, size_t maxlen);       // Bytes read, -1 if not found
+int vfs_write_file(const char *path, const uint8_t *data, size_t len);  // 0 on success, -1 on failure
+
+/* Path operations */
+int vfs_unlink(const char *path);                            // Fails while the file is open
+int vfs_rename(const char *old_path, const char *new_path);  // Both paths must be on the same mount
+int vfs_truncate(const char *path, uint32_t len);
+int vfs_list(const char *path, vfs_list_fn fn);              // List the files of the mount holding path
+
+/* The filesystem mounted at path was replaced underneath the VFS (rolled back or reformatted):
+   every descriptor open on it fails from now on, except vfs_close */
+void vfs_invalidate(const char *path);
+
+/* Write back deferred work on every mounted filesystem */
+void vfs_sync(void);
+
+#endif
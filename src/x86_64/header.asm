@@ -5,6 +5,13 @@ header_start:
     dd header_end - header_start ; header length
     dd 0x100000000 - (0xe85250d6 + 0 + (header_end - header_start)) ; checksum
 
+    ; information request tag: GRUB must pass the memory map (tag 6), which the frame allocator is built from
+    dw 1 ; tag type
+    dw 0 ; flags: required
+    dd 12 ; size of tag
+    dd 6 ; memory map
+    dd 0 ; padding, tags are 8-byte aligned
+
     ; end tag
     dw 0
     dw 0
@@ -1,10 +1,23 @@
 bits 64
 global keyboard_isr64
+global disk_isr64
 extern handle_scancode
+extern handle_disk_irq
 
 section .text
 
 keyboard_isr64: ; Save registers that must be preserved across function calls
+    ; Save "caller-saved" registers, because the kernel idle loop may be in the middle of work when the interrupt arrives
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
     ; Save "callee-saved" registers
     push rbp
     push rbx
@@ -17,17 +30,14 @@ keyboard_isr64: ; Save registers that must be preserved across function calls
     in al, 0x60 ; Read one byte from I/O port 0x60 (keyboard data port)
     movzx rdi, al        ; Zero-extend AL to RDI (first argument for function call)
 
-    ; Align stack to 16-bytes before a call instruction
-    sub rsp, 8 ; Adjust stack pointer down by 8 bytes for alignment
-
+    ; Stack is already 16-byte aligned here: the CPU pushed 5 qwords onto an aligned stack and 15 registers were saved above
     call handle_scancode ; Call C function: void handle_scancode(uint8_t scancode). The scancode is already in RDI (first argument)
-    add rsp, 8 ; If remainder is 8, skip
 
     ; Send End-Of-Interrupt (EOI) signal to PIC
     mov al, 0x20 ; 0x20 is the EOI command
     out 0x20, al ; Send EOI to master PIC command port (0x20)
 
-    ; Restore the callee-saved registers saved at the beginning. Restore in reverse order (last in first out)
+    ; Restore the registers saved at the beginning. Restore in reverse order (last in first out)
     pop r15
     pop r14
     pop r13
@@ -35,4 +45,42 @@ keyboard_isr64: ; Save registers that must be preserved across function calls
     pop rbx
     pop rbp
 
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+
+    iretq ; Interrupt return (64-bit)
+
+disk_isr64: ; Disk controller interrupt (installed by the kernel on the controller's IRQ vector)
+    ; Save "caller-saved" registers; the interrupt only arrives while the kernel sleeps on a command
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
+    ; Stack is 16-byte aligned: the CPU pushed 5 qwords onto an aligned stack and 9 registers were saved above.
+    ; The C function preserves the "callee-saved" registers itself
+    call handle_disk_irq ; Call C function: void handle_disk_irq(void). Masks the controller's interrupt and sends EOI
+
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+
     iretq ; Interrupt return (64-bit)
@@ -6,6 +6,13 @@ header_start:
     dd header_end - header_start ; header length
     dd -(0xe85250d6 + 0 + (header_end - header_start)) ; checksum
 
+    ; information request tag: the boot loader must pass the memory map (tag 6)
+    dw 1 ; tag type
+    dw 0 ; flags: required
+    dd 12 ; size of tag
+    dd 6 ; memory map
+    dd 0 ; padding, tags are 8-byte aligned
+
     ; end tag
     dd 0 ; tag type
     dd 8 ;size of tag
@@ -18,6 +25,7 @@ extern long_mode_start ;jump to 64-bit assembly code
 
 start:
 	mov esp, stack_top ; address of the top of the stack
+	mov edi, ebx ; keep the multiboot2 information address (cpuid below overwrites ebx), it becomes kernel_main's argument
 
 	call check_multiboot ; check that loaded by multiboot bootloader
 	call check_cpuid
@@ -87,7 +95,7 @@ setup_page_tables: ;identity mapping (mapping physical address to virtual addres
 .loop:
 	mov eax, 0x200000 ; for each iteration of the loop, map a 2MB page
 	mul ecx ; multiply the value in eax by the counter (ecx) to give correct address for next page
-	or eax, 0b10000011 ; put in present and writable bits, huge page flag
+	or eax, 0b110000011 ; put in present and writable bits, huge page flag, global flag (takes effect once the kernel sets CR4.PGE)
 	mov [page_table_l2 + ecx * 8], eax ; put above entry into level 2 table
 
 	inc ecx ; increment counter
@@ -11,6 +11,6 @@ long_mode_start: ; set all segment registers to null
     mov fs, ax
     mov gs, ax
 
-
+    mov edi, edi ; multiboot2 information address from main.asm, clear the upper half
     call kernel_main
 	hlt